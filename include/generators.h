@@ -1,11 +1,108 @@
 #ifndef _GENERATORS_H
 #define _GENERATORS_H
 
+#include <string>
+
+/** The most levels of detail a mesh can have, including the full-detail one. */
+#define MAX_LODS 5
+
+/** The longest material or texture name kept, including the terminator. */
+#define MESH_NAME_LENGTH 64
+
+/** A material from the OBJ file's material library. Fixed size, so that it can
+ * be stored in the mesh cache as is. */
+struct MeshMaterial {
+	char name[MESH_NAME_LENGTH];
+	char texture[MESH_NAME_LENGTH];  ///< file name (without directory) of the diffuse map, or empty
+};
+
+/** A range of a mesh's indices which is drawn with a single material. */
+struct MeshSubset {
+	GLuint material;  ///< index into the mesh's materials
+	GLuint firstIndex;
+	GLuint numIndices;
+
+	GLuint firstMeshlet;  ///< the meshlets which split this range up, if any
+	GLuint numMeshlets;
+};
+
+/** A small cluster of neighbouring triangles, with bounds to cull it by (see
+ * meshlets.h). */
+struct Meshlet {
+	GLuint firstIndex;
+	GLuint numIndices;
+	float center[3];    ///< bounding sphere, in model space
+	float radius;
+	float coneAxis[3];  ///< average direction the triangles face
+	float coneCutoff;   ///< sine of the widest angle between a triangle's normal and the axis, or 1 if over 90 degrees
+};
+
+/** A range of a mesh's indices which draws it at some level of detail. */
+struct MeshLOD {
+	GLuint firstIndex;
+	GLuint numIndices;
+	float error;  ///< how far the surface may be from the full-detail one, in model space units
+
+	GLuint firstSubset;  ///< the subsets which split this range up by material, if any
+	GLuint numSubsets;
+};
+
 struct Mesh {
 	std::vector<glm::vec3> vertices;
 	std::vector<glm::vec3> normals;
 	std::vector<glm::vec2> texCoords;
 	std::vector<GLuint> indices;
+
+	std::vector<MeshLOD> lods;  ///< empty if all the indices form a single level
+
+	std::string materialLibrary;  ///< file name of the OBJ's material library, relative to the OBJ, or empty
+	std::vector<MeshMaterial> materials;
+	std::vector<MeshSubset> subsets;  ///< empty if the mesh has a single material
+	std::vector<Meshlet> meshlets;    ///< of the full-detail level only
+};
+
+/** A read-only view of mesh data which may live outside a Mesh (e.g. in a
+ * memory-mapped cache file). */
+struct MeshView {
+	const glm::vec3* vertices;
+	const glm::vec3* normals;
+	const glm::vec2* texCoords;
+	const GLuint*    indices;
+	GLuint numVertices;
+	GLuint numIndices;
+
+	const MeshLOD* lods;
+	GLuint numLODs;
+
+	const MeshMaterial* materials;
+	GLuint numMaterials;
+	const MeshSubset* subsets;
+	GLuint numSubsets;
+	const Meshlet* meshlets;
+	GLuint numMeshlets;
+};
+
+MeshView viewOf(const Mesh &mesh);
+
+/** Identifies a unique combination of position, normal and texture coordinate
+ * indices, as referenced by the corner of a GLMtriangle. */
+struct VertexKey {
+	GLuint v, n, t;
+
+	bool operator==(const VertexKey &other) const {
+		return v == other.v && n == other.n && t == other.t;
+	}
+};
+
+struct VertexKeyHash {
+	size_t operator()(const VertexKey &key) const {
+		// FNV-1a style mixing of the three indices
+		size_t hash = 2166136261u;
+		hash = (hash ^ key.v) * 16777619u;
+		hash = (hash ^ key.n) * 16777619u;
+		hash = (hash ^ key.t) * 16777619u;
+		return hash;
+	}
 };
 
 
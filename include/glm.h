@@ -22,6 +22,7 @@
 
 #include <SDL_opengl.h>
 */
+#include <stddef.h>
 #include <GL/glfw.h>
 
 
@@ -37,6 +38,21 @@
 #define GLM_MATERIAL (1 << 4)       /* render with materials */
 
 
+/* GLMarena: A bump allocator for everything read from one file, so
+ * that it can all be freed at once (see glmReadOBJArena).  Zero it,
+ * or call glmArenaInit, before use.
+ */
+typedef struct _GLMarenablock GLMarenablock;
+typedef struct _GLMarena {
+  GLMarenablock* blocks;        /* blocks taken from malloc, newest first */
+  size_t  allocated;            /* bytes handed out so far */
+  size_t  held;                 /* bytes held in blocks */
+  size_t  peak;                 /* most bytes held at once, counting temporary arenas */
+  const char* name;             /* name to report the usage under */
+  GLvoid (*report)(const char* name, size_t allocated, size_t peak);
+                                /* called as the arena is released, or NULL */
+} GLMarena;
+
 /* GLMmaterial: Structure that defines a material in a model.
  */
 typedef struct _GLMmaterial
@@ -47,6 +63,7 @@ typedef struct _GLMmaterial
   GLfloat specular[4];          /* specular component */
   GLfloat emmissive[4];         /* emmissive component */
   GLfloat shininess;            /* specular exponent */
+  char*   texture;              /* diffuse texture map (map_Kd), or NULL */
 } GLMmaterial;
 
 /* GLMtriangle: Structure that defines a triangle in a model.
@@ -56,6 +73,7 @@ typedef struct _GLMtriangle {
   GLuint nindices[3];           /* array of triangle normal indices */
   GLuint tindices[3];           /* array of triangle texcoord indices*/
   GLuint findex;                /* index of triangle facet normal */
+  GLuint material;              /* index to material for triangle */
 } GLMtriangle;
 
 /* GLMgroup: Structure that defines a group in a model.
@@ -95,11 +113,61 @@ typedef struct _GLMmodel {
   GLuint       numgroups;       /* number of groups in model */
   GLMgroup*    groups;          /* linked list of groups */
 
+  GLuint       grouptablesize;  /* size of the group hash table */
+  GLMgroup**   grouptable;      /* groups hashed by name (NULL = empty) */
+  GLuint       materialtablesize; /* size of the material hash table */
+  GLuint*      materialtable;   /* material indices + 1 hashed by name (0 = empty) */
+
   GLfloat position[3];          /* position of the model */
 
+  GLMarena*    arena;           /* arena the model is in, or NULL if malloc'd */
+
 } GLMmodel;
 
 
+/* glmArenaInit: Prepares an arena for use.
+ *
+ * arena - arena to initialize
+ */
+GLvoid
+glmArenaInit(GLMarena* arena);
+
+/* glmArenaAlloc: Allocates memory from an arena, aligned to 16 bytes.
+ * It is only freed when the arena is released.
+ *
+ * arena - initialized GLMarena structure
+ * size  - number of bytes to allocate
+ */
+GLvoid*
+glmArenaAlloc(GLMarena* arena, size_t size);
+
+/* glmArenaRelease: Reports the usage of an arena (if it has a report
+ * hook) and frees all of its memory at once.  The arena may then be
+ * used again.
+ *
+ * arena - initialized GLMarena structure
+ */
+GLvoid
+glmArenaRelease(GLMarena* arena);
+
+
+/* glmSIMD: Picks the kernels used by glmUnitize, glmDimensions,
+ * glmScale, glmReverseWinding and glmFacetNormals.  GLM_SIMD_NONE
+ * runs the scalar reference kernels; a wider level runs the widest
+ * kernels the CPU supports up to that level.  Until this is called
+ * the widest supported kernels are used.  Not safe to call while
+ * models are being loaded.  Returns the level picked.
+ *
+ * level - GLM_SIMD_NONE, GLM_SIMD_SSE, GLM_SIMD_AVX2 or GLM_SIMD_BEST
+ */
+#define GLM_SIMD_NONE  (0)
+#define GLM_SIMD_SSE   (1)
+#define GLM_SIMD_AVX2  (2)
+#define GLM_SIMD_BEST  (3)
+
+GLuint
+glmSIMD(GLuint level);
+
 /* glmUnitize: "unitize" a model by translating it to the origin and
  * scaling it to fit in a unit cube around the origin.  Returns the
  * scalefactor used.
@@ -186,7 +254,8 @@ glmLinearTexture(GLMmodel* model);
 GLvoid
 glmSpheremapTexture(GLMmodel* model);
 
-/* glmDelete: Deletes a GLMmodel structure.
+/* glmDelete: Deletes a GLMmodel structure.  Does nothing for a model
+ * read into an arena, which is freed with the arena.
  *
  * model - initialized GLMmodel structure
  */
@@ -202,6 +271,17 @@ glmDelete(GLMmodel* model);
 GLMmodel*
 glmReadOBJ(char* filename);
 
+/* glmReadOBJArena: Reads a model description from a Wavefront .OBJ
+ * file, as glmReadOBJ, but allocates the model, and everything used
+ * while reading it, from the given arena.  The model is freed by
+ * releasing the arena.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.
+ * arena    - initialized GLMarena structure, or NULL to use malloc
+ */
+GLMmodel*
+glmReadOBJArena(char* filename, GLMarena* arena);
+
 /* glmWriteOBJ: Writes a model description in Wavefront .OBJ format to
  * a file.
  *
@@ -256,6 +336,26 @@ glmList(GLMmodel* model, GLuint mode);
 GLvoid
 glmWeld(GLMmodel* model, GLfloat epsilon);
 
+/* glmWeldVectors: eliminate (weld) vectors that are within an
+ * epsilon of each other, as glmWeld does for a model's vertices.
+ * Returns the unique vectors (1-based, like the input), and sets the
+ * first component of each input vector to the index of its copy.
+ *
+ * vectors    - array of GLfloat[3]'s to be welded, from index 1
+ * numvectors - number of GLfloat[3]'s in vectors; set to the number
+ *              of copies
+ * epsilon    - maximum difference between vectors
+ */
+GLfloat*
+glmWeldVectors(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon);
+
+/* glmWeldVectorsReference: as glmWeldVectors, by comparing each vector
+ * with every copy so far.  Slow, and only for checking glmWeldVectors
+ * against.
+ */
+GLfloat*
+glmWeldVectorsReference(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon);
+
 /* glmReadPPM: read a PPM raw (type P6) file.  The PPM file has a header
  * that should look something like:
  *
@@ -286,3 +386,26 @@ glmWeld(GLMmodel* model, GLfloat epsilon);
  */
 GLubyte*
 glmReadPPM(char* filename, int* width, int* height);
+
+/* glmParseInt: parse a (possibly negative) decimal integer from text
+ * which need not be NUL-terminated.  Returns GL_FALSE, without moving
+ * p, if there is no integer at p.
+ *
+ * p     - pointer to the text to parse, advanced past the integer
+ * end   - end of the text
+ * value - will contain the parsed integer on return
+ */
+GLboolean
+glmParseInt(const char** p, const char* end, int* value);
+
+/* glmParseFloat: parse a decimal floating point number, with optional
+ * fraction and exponent, from text which need not be NUL-terminated.
+ * Unlike strtod this ignores the locale.  Returns GL_FALSE, without
+ * moving p, if there is no number at p.
+ *
+ * p     - pointer to the text to parse, advanced past the number
+ * end   - end of the text
+ * value - will contain the parsed number on return
+ */
+GLboolean
+glmParseFloat(const char** p, const char* end, GLfloat* value);
@@ -0,0 +1,76 @@
+#ifndef _MESHCACHE_H
+#define _MESHCACHE_H
+
+#include <stdint.h>
+
+/** @file meshcache.h
+ * A binary cache for meshes loaded from OBJ files, so that they only have to
+ * be parsed (and optimised) once. The cache for `models/foo.obj` lives at
+ * `models/foo.obj.cache`, and is rebuilt whenever the size or modification time
+ * of the OBJ file, or of the material library it names, changes. Caches may
+ * also be shipped in the asset pack (see pack.h), under the same name, in
+ * which case they are used as they are.
+ *
+ * All values are little-endian. The file is laid out as:
+ *
+ *     MeshCacheHeader
+ *     glm::vec3    vertices [numVertices]
+ *     glm::vec3    normals  [numVertices]
+ *     glm::vec2    texCoords[numVertices]
+ *     GLuint       indices  [numIndices]
+ *     MeshLOD      lods     [numLODs]
+ *     MeshSubset   subsets  [numSubsets]
+ *     MeshMaterial materials[numMaterials]
+ *     Meshlet      meshlets [numMeshlets]
+ */
+
+#define MESH_CACHE_MAGIC   "MSHC"
+#define MESH_CACHE_EXTENSION ".cache"
+#define MESH_CACHE_VERSION 6  ///< 2: meshes are stored optimised (see meshopt.h); 3: levels of detail; 4: materials; 5: meshlets; 6: keyed on the material library too
+
+/** OBJ files larger than this (in bytes) are streamed into their cache by
+ * `writeStreamedMeshCache`, rather than being loaded whole. */
+#ifndef MESH_CACHE_STREAM_THRESHOLD
+#define MESH_CACHE_STREAM_THRESHOLD (512ull << 20)
+#endif
+
+struct MeshCacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint64_t sourceKey;    ///< hash of the size and modification time of the OBJ and its material library
+	uint32_t numVertices;
+	uint32_t numIndices;
+	float    boundsMin[3];
+	float    boundsMax[3];
+	uint32_t numLODs;      ///< 0 if all the indices form a single level
+	uint32_t numSubsets;   ///< 0 if the mesh has a single material
+	uint32_t numMaterials;
+	uint32_t numMeshlets;
+	char     materialLibrary[MESH_NAME_LENGTH];  ///< as in the Mesh, so the key can be checked without parsing the OBJ
+};
+
+/** A mesh whose data is memory-mapped from a cache file. The pointers in
+ * `view` remain valid until the mesh is passed to `closeMeshCache`. */
+struct MappedMesh {
+	void*  mapping;
+	size_t mappingLength;
+	const MeshCacheHeader* header;
+
+	void* packBuffer;  ///< the decompressed copy, if the cache came compressed from the asset pack
+	Mesh* parsed;  ///< set instead of `mapping` if the cache couldn't be used
+
+	MeshView view;
+};
+
+bool openMeshCache(const char* objPath, MappedMesh &mesh);
+void closeMeshCache(MappedMesh &mesh);
+
+bool writeMeshCache(const char* objPath, const Mesh &mesh);
+bool writeStreamedMeshCache(const char* objPath, size_t memoryLimit);
+
+void loadCachedOBJ(const char* objPath, MappedMesh &mesh);
+
+bool isLittleEndian(void);
+bool sourceKeyOf(const char* path, uint64_t &key);
+
+#endif
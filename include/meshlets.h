@@ -0,0 +1,28 @@
+#ifndef _MESHLETS_H
+#define _MESHLETS_H
+
+/** @file meshlets.h
+ * Splits the full-detail level of a Mesh into meshlets: small clusters of
+ * neighbouring triangles, each with a bounding sphere and a cone bounding the
+ * directions its triangles face. Before drawing a mesh up close, the meshlets
+ * outside the view frustum, and those whose triangles all face away from the
+ * camera, can then be skipped, and the rest drawn with `glMultiDrawElements`.
+ *
+ * Meshlets are grown greedily from the first triangle not yet used, adding
+ * whichever neighbouring triangle brings in the fewest new vertices (and then
+ * faces closest to the meshlet's average direction), so they stay compact and
+ * flat. They never cross from one MeshSubset into another. The triangles of
+ * each meshlet are then reordered for the post-transform vertex cache, as
+ * `optimizeVertexCache` would a whole mesh.
+ */
+
+/** The most triangles and distinct vertices in a meshlet. */
+#define MESHLET_MAX_TRIANGLES 128
+#define MESHLET_MAX_VERTICES  96
+
+void buildMeshlets(Mesh &mesh, const char* name);
+
+void frustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6]);
+bool isMeshletVisible(const Meshlet &meshlet, const glm::vec4 planes[6], const glm::vec3 &eye);
+
+#endif
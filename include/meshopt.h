@@ -0,0 +1,31 @@
+#ifndef _MESHOPT_H
+#define _MESHOPT_H
+
+/** @file meshopt.h
+ * Reorders the triangles and vertices of a Mesh so that it draws faster,
+ * without changing what it looks like:
+ *
+ *  1. triangles are ordered for the post-transform vertex cache (Tipsify,
+ *     from Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+ *     Locality and Reduced Overdraw", 2007);
+ *  2. the resulting clusters of triangles are sorted so that those facing out
+ *     from the middle of the mesh, which tend to hide the rest, come first;
+ *  3. vertices are renumbered in the order they are first used, so that they
+ *     are fetched from memory in order.
+ */
+
+/** The number of entries in the vertex cache that meshes are optimised for,
+ * and that ACMR/ATVR are measured with. */
+#define VERTEX_CACHE_SIZE 16
+
+void optimizeVertexCache(std::vector<GLuint> &indices, GLuint numVertices, std::vector<GLuint> &clusters);
+void optimizeOverdraw(std::vector<GLuint> &indices, const std::vector<glm::vec3> &vertices, const std::vector<GLuint> &clusters);
+void optimizeVertexFetch(Mesh &mesh);
+void weldPositions(const std::vector<glm::vec3> &vertices, std::vector<GLuint> &positionOf);
+
+float averageCacheMissRatio(const std::vector<GLuint> &indices, int cacheSize);
+float averageTransformToVertexRatio(const std::vector<GLuint> &indices, GLuint numVertices, int cacheSize);
+
+void optimizeMesh(Mesh &mesh, const char* name);
+
+#endif
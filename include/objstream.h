@@ -0,0 +1,20 @@
+#ifndef _OBJSTREAM_H
+#define _OBJSTREAM_H
+
+/** @file objstream.h
+ * Imports OBJ files which are too large to load in one go. The file is read
+ * through a fixed-size window and its faces are handed out as a series of
+ * self-contained, indexed Mesh chunks, so that memory use stays under a given
+ * limit however large the file is.
+ */
+
+#define OBJ_STREAM_DEFAULT_MEMORY_LIMIT (256 << 20)
+
+/** Receives each chunk of a streamed OBJ file. The chunk is only valid for the
+ * duration of the call, and may be changed in place (to optimise it, say)
+ * rather than copied. */
+typedef void (*MeshChunkCallback)(Mesh &chunk, void* data);
+
+bool streamOBJ(const char* path, size_t memoryLimit, MeshChunkCallback callback, void* data);
+
+#endif
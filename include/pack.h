@@ -0,0 +1,76 @@
+#ifndef _PACK_H
+#define _PACK_H
+
+#include <stdint.h>
+
+/** @file pack.h
+ * An asset pack: one archive holding many asset files, so that loading them
+ * doesn't cost an open and a seek each. It is built by the `pack` tool (see
+ * packtool.cpp), and memory-mapped whole by `openPack`. Entries stored as they
+ * are are handed out as views straight into the mapping; compressed entries
+ * are decompressed into a buffer, their blocks shared between the worker
+ * threads.
+ *
+ * Entries are named by the paths the asset macros in paths.h give, and the
+ * loaders look in the pack before the file system, so an asset missing from
+ * the pack is still loaded from its own file.
+ *
+ * All values are little-endian. The file is laid out as:
+ *
+ *     PackHeader
+ *     PackEntry entries[numEntries]  (sorted by name)
+ *     the data of each entry, starting on a PACK_ALIGNMENT boundary
+ *
+ * A compressed entry is split into blocks of PACK_BLOCK_SIZE bytes (but the
+ * last), each compressed separately in the LZ4 block format. Its data is the
+ * compressed size of each block (uint32_t[numBlocks]), then the blocks. A
+ * block which didn't compress has PACK_BLOCK_RAW set in its size, and is
+ * stored as it is.
+ */
+
+#define PACK_MAGIC     "APAK"
+#define PACK_VERSION   1
+#define PACK_ALIGNMENT 4096
+
+#define PACK_BLOCK_SIZE (256 << 10)
+#define PACK_BLOCK_RAW  0x80000000u
+
+/** The longest entry name, including the terminator. */
+#define PACK_NAME_LENGTH 112
+
+/** PackEntry flags */
+#define PACK_COMPRESSED 1
+
+struct PackHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t numEntries;
+	uint32_t reserved;
+};
+
+struct PackEntry {
+	char     name[PACK_NAME_LENGTH];
+	uint64_t offset;      ///< from the start of the pack
+	uint64_t storedSize;  ///< bytes in the pack
+	uint64_t size;        ///< bytes once decompressed
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+/** The contents of an entry. */
+struct PackView {
+	const void* data;
+	size_t size;
+	void* buffer;  ///< the decompressed copy, if the entry was compressed
+};
+
+bool openPack(const char* path);
+void closePack(void);
+
+bool isInPack(const char* name);
+bool readFromPack(const char* name, PackView &view);
+void releasePackView(PackView &view);
+
+bool decompressBlock(const unsigned char* in, size_t inLength, unsigned char* out, size_t outLength);
+
+#endif
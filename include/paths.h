@@ -7,18 +7,27 @@
  *
  * To compile the paths using a directory structure, define `ASSET_DIRECTORIES`
  * at compile time.
+ *
+ * Assets are looked up by these paths in the asset pack (see pack.h) first, so
+ * the pack must be built with the same directory structure.
  */
 
+#define ASSET_PACK ("assets.pak")
+
 #ifdef ASSET_DIRECTORIES 
 	#define SEPARATOR "/"
 
 	#define SHADER(name)  ("shaders"  SEPARATOR name)
 	#define TEXTURE(name) ("textures" SEPARATOR name)
 	#define MODEL(name)   ("models"   SEPARATOR name)
+
+	#define TEXTURE_PREFIX ("textures" SEPARATOR)  ///< for texture names only known at run time
 #else
 	#define SHADER(name)  (name)
 	#define TEXTURE(name) (name)
 	#define MODEL(name)   (name)
+
+	#define TEXTURE_PREFIX ("")
 #endif
 
 
@@ -0,0 +1,42 @@
+#ifndef _PROGCACHE_H
+#define _PROGCACHE_H
+
+#include <stdint.h>
+
+/** @file progcache.h
+ * A cache of linked shader programs, as the binaries the driver gives for them
+ * (`glGetProgramBinary`), so that they only have to be compiled and linked
+ * once. The cache for a program lives next to its fragment shader: that of
+ * `shaders/fragment.glsl` at `shaders/fragment.glsl.program`. It is keyed by a
+ * hash of the program's shader sources, the locations bound to its attributes
+ * and outputs, and the GL vendor, renderer and version, so that it is rebuilt
+ * when any of those change. A binary which the driver rejects is rebuilt from
+ * source too.
+ *
+ * Binaries only work with the driver which made them, so the caches are never
+ * shipped in the asset pack. Values are in the machine's own byte order. The
+ * file is laid out as:
+ *
+ *     ProgramCacheHeader
+ *     the binary, `binaryLength` bytes
+ */
+
+#define PROGRAM_CACHE_MAGIC     "PRGC"
+#define PROGRAM_CACHE_EXTENSION ".program"
+#define PROGRAM_CACHE_VERSION   1
+
+struct ProgramCacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint64_t key;           ///< from `programCacheKey`
+	uint32_t binaryFormat;  ///< as `glGetProgramBinary` gives it
+	uint32_t binaryLength;
+};
+
+bool programCacheSupported(void);
+uint64_t programCacheKey(const char* const strings[], int numStrings);
+
+bool loadProgramCache(const char* fragmentPath, uint64_t key, GLuint program);
+bool writeProgramCache(const char* fragmentPath, uint64_t key, GLuint program);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _QUANTIZE_H
+#define _QUANTIZE_H
+
+/** @file quantize.h
+ * Compresses vertex attributes for upload to the GPU:
+ *
+ *  - positions become 3 x 16-bit unsigned normalised integers within the
+ *    mesh's bounding box, which the vertex shader maps back with the
+ *    `dequantize` matrix;
+ *  - normals are octahedral-encoded into 2 x NORMAL_BITS signed integers,
+ *    and decoded in the vertex shader;
+ *  - texture coordinates become half floats;
+ *  - indices become 16-bit if the mesh has few enough vertices.
+ *
+ * With 16-bit normals this takes a vertex from 32 bytes to 14.
+ */
+
+/** Bits per component of an octahedral-encoded normal: 16 or 8. */
+#ifndef NORMAL_BITS
+#define NORMAL_BITS 16
+#endif
+
+#if NORMAL_BITS == 16
+	typedef GLshort EncodedNormalComponent;
+	#define ENCODED_NORMAL_TYPE GL_SHORT
+	#define ENCODED_NORMAL_MAX  32767
+#elif NORMAL_BITS == 8
+	typedef GLbyte EncodedNormalComponent;
+	#define ENCODED_NORMAL_TYPE GL_BYTE
+	#define ENCODED_NORMAL_MAX  127
+#else
+	#error NORMAL_BITS must be 16 or 8
+#endif
+
+struct QuantizedMesh {
+	std::vector<GLushort> positions;                ///< 3 per vertex
+	std::vector<EncodedNormalComponent> normals;    ///< 2 per vertex
+	std::vector<GLhalf> texCoords;                  ///< 2 per vertex
+	std::vector<GLushort> shortIndices;             ///< empty if the indices need 32 bits
+
+	glm::mat4 dequantize;  ///< maps quantised positions back into model space
+
+	float maxPositionError;     ///< in model space units
+	float maxNormalError;       ///< in degrees
+	float maxTexCoordError;
+};
+
+GLhalf floatToHalf(float value);
+float halfToFloat(GLhalf value);
+
+void encodeOctahedral(const glm::vec3 &normal, EncodedNormalComponent encoded[2]);
+glm::vec3 decodeOctahedral(const EncodedNormalComponent encoded[2]);
+
+void quantizeMesh(const MeshView &mesh, QuantizedMesh &quantized);
+void printQuantizationReport(const char* name, const MeshView &mesh, const QuantizedMesh &quantized);
+
+#endif
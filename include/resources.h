@@ -0,0 +1,100 @@
+#ifndef _RESOURCES_H
+#define _RESOURCES_H
+
+/** @file resources.h
+ * A registry of the meshes and textures on the GPU, keyed by asset path, so
+ * that objects drawn from the same files share one VAO and one texture rather
+ * than each uploading their own copy. Resources are reference counted, and
+ * deleted when the last object using them releases them.
+ *
+ * Assets are loaded in the background: OBJ files are parsed, and TGA files
+ * cooked into compressed mip chains (see texcache.h), on the worker threads,
+ * which then also copy them into buffers that `processLoadedResources` maps
+ * for them on the GL thread. The GL thread only unmaps the buffers and fences
+ * the uploads, and swaps each asset in once its fence has signalled. Until
+ * then, meshes and textures stand in as a small sphere and a plain grey
+ * texture.
+ *
+ * Textures are packed into texture arrays (see texarrays.h), so that objects
+ * whose textures are the same size and format are drawn with the same one
+ * bound, and only the layer changing.
+ *
+ * Given a budget (see `setResidencyBudget`), the registry also decides which
+ * assets stay on the GPU: objects report each frame how far away they are and
+ * whether they may be in view, and `updateResidency` evicts the assets of
+ * those out of sight back to their placeholders, and loads them again as they
+ * come near. An evicted texture's layer goes to the next texture of its size
+ * and format, but its memory is only freed with the rest of its array.
+ */
+
+/** How the vertex attributes of a mesh are arranged in VBOs. */
+enum VertexLayout {
+	LAYOUT_SEPARATE,         ///< one VBO per attribute
+	LAYOUT_INTERLEAVED,      ///< all attributes interleaved in one VBO
+	LAYOUT_SPLIT_POSITIONS   ///< positions alone (e.g. for depth-only passes), the rest interleaved
+};
+
+#define DEFAULT_VERTEX_LAYOUT LAYOUT_INTERLEAVED
+
+/** The material of the subsets of meshes which don't have any materials. */
+#define NO_MATERIAL 0xffffffffu
+
+struct GPUTexture;
+struct TextureArray;
+
+/** A mesh on the GPU, ready to be drawn with `glDrawElements`. */
+struct GPUMesh {
+	GLuint vao;
+	GLuint vboAttributes[3];    ///< as many as the layout needs; the rest are 0
+	GLuint vboIndices;
+	VertexLayout layout;
+	GLuint numVertices;
+	GLuint numIndices;
+	GLenum indexType;           ///< GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+
+	MeshLOD lods[MAX_LODS];     ///< ranges of the indices, from most to least detailed
+	GLuint numLODs;
+	std::vector<MeshSubset> subsets;  ///< the subsets of every level, which each have at least one
+	std::vector<const GPUTexture*> materialTextures;  ///< each material's diffuse map, or NULL for the object's own
+	std::vector<Meshlet> meshlets;    ///< for culling the full-detail level (see meshlets.h)
+
+	glm::mat4 dequantize;       ///< maps positions into model space (see quantize.h)
+	GLfloat octahedralScale;    ///< scale for octahedral-encoded normals, or 0 if not encoded
+	GLfloat radius;             ///< of a sphere around the origin bounding the mesh, in model space
+
+	size_t numBytes;  ///< GPU memory used by the buffers
+	bool loaded;      ///< false while this is still the placeholder
+};
+
+/** A texture on the GPU: a layer of a texture array (see texarrays.h), which
+ * it shares with other textures of the same size and format. */
+struct GPUTexture {
+	TextureArray* array;
+	GLint layer;
+
+	size_t numBytes;
+	bool loaded;
+};
+
+const GPUMesh* acquireMesh(const char* objPath, VertexLayout layout = DEFAULT_VERTEX_LAYOUT);
+void releaseMesh(const char* objPath);
+
+const GPUTexture* acquireTexture(const char* tgaPath);
+void releaseTexture(const char* tgaPath);
+
+GPUMesh createGPUMesh(const MeshView &mesh, VertexLayout layout, bool compress);
+void deleteGPUMesh(GPUMesh &mesh);
+
+int processLoadedResources(void);
+int numLoadingResources(void);
+
+void setVertexCompression(bool compress);
+void setTextureCompression(bool compress);
+
+void setResidencyBudget(size_t budget, float loadDistance);
+void useResources(const GPUMesh* mesh, const GPUTexture* texture, float distance, bool visible);
+void updateResidency(void);
+
+void printResourceUsage(void);
+
+#endif
@@ -2,6 +2,8 @@
 #define _ANIMATION_H
 
 #include "generators.h"
+#include "resources.h"
+#include "vtex.h"
 
 #define CAMERA_START_POSITION glm::vec3(115, 30, 11.6)
 #define CAMERA_START_YAW 23.1
@@ -12,11 +14,10 @@
 #define SCREENSHOT_PITCH    CAMERA_START_PITCH
 
 struct DisplayObject {
-    int numVertices;
-    int numIndices;
-    GLuint vao;
-
-    GLuint tex;
+    const GPUMesh* mesh;
+    const GPUTexture* texture;
+    VirtualTexture* virtualTexture;  ///< drawn with in place of the texture, if set
+    GLuint lod;  ///< the level of detail of the mesh to draw
 
     glm::vec3 location;
     glm::vec3 rotation;
@@ -26,6 +27,7 @@ struct DisplayObject {
 };
 
 void updateModelMatrix(DisplayObject &object);
+void updateLOD(DisplayObject &object, const glm::vec3 &cameraLocation, float pixelsPerUnit);
 
 void setupScene(std::vector<DisplayObject*> &objects, DisplayObject &camera);
 
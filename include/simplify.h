@@ -0,0 +1,21 @@
+#ifndef _SIMPLIFY_H
+#define _SIMPLIFY_H
+
+/** @file simplify.h
+ * Builds levels of detail for meshes, by collapsing edges in order of their
+ * quadric error (Garland and Heckbert, "Surface Simplification Using Quadric
+ * Error Metrics", 1997). Vertices only ever move onto their neighbours, so the
+ * vertex buffer is shared between all levels and only the indices differ.
+ *
+ * Borders (edges with a triangle on one side only) and seams (edges either
+ * side of which the normals or texture coordinates differ) are kept: their
+ * vertices only collapse along them, and extra planes through them add to
+ * the cost of moving them.
+ */
+
+float simplifyIndices(const Mesh &mesh, const std::vector<GLuint> &indices, size_t targetIndexCount,
+                      float maxError, std::vector<GLuint> &result, std::vector<GLuint>* sources = NULL);
+
+void buildLODs(Mesh &mesh, const char* name);
+
+#endif
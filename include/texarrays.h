@@ -0,0 +1,39 @@
+#ifndef _TEXARRAYS_H
+#define _TEXARRAYS_H
+
+/** @file texarrays.h
+ * Packs textures into texture arrays (`GL_TEXTURE_2D_ARRAY`), one texture to a
+ * layer, so that objects with different textures can be drawn without binding
+ * another texture between them: only the layer, which the shader takes as a
+ * uniform, changes.
+ *
+ * The layers of an array share their size, format, number of mip levels and
+ * swizzle, so textures are grouped by those, with one array for each group.
+ * An array starts with one layer, and doubles as it fills, its layers being
+ * copied across on the GPU. Freed layers are reused by the next texture of the
+ * group, and an array is deleted once all of its layers are free; until then,
+ * the memory of its free layers stays allocated.
+ */
+
+/** A texture array, holding the textures of one size and format. */
+struct TextureArray {
+	GLuint tex;             ///< the GL_TEXTURE_2D_ARRAY, which is replaced as the array grows
+	GLuint width;
+	GLuint height;
+	GLenum internalFormat;
+	GLuint numLevels;
+	GLint  swizzle[4];      ///< for GL_TEXTURE_SWIZZLE_RGBA
+	size_t layerBytes;      ///< GPU memory taken by each layer
+
+	GLuint numLayers;       ///< allocated
+	std::vector<GLint> freeLayers;
+};
+
+TextureArray* allocateTextureLayer(GLuint width, GLuint height, GLenum internalFormat, GLuint numLevels,
+                                   const GLint swizzle[4], GLint &layer);
+void freeTextureLayer(TextureArray* array, GLint layer);
+void copyTextureToLayer(GLuint source, const TextureArray* array, GLint layer);
+
+void textureArrayUsage(int &numArrays, int &numLayers, size_t &numBytes);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _TEXCACHE_H
+#define _TEXCACHE_H
+
+#include <stdint.h>
+
+/** @file texcache.h
+ * A binary cache for textures loaded from TGA files, cooked so that loading
+ * one is only a copy: every mip level is filtered on the CPU, and compressed
+ * into blocks which the GPU samples as they are, so that they are uploaded
+ * with `glCompressedTexImage2D` and take a quarter to an eighth of the memory.
+ * Images with one channel become RGTC1 (BC4), opaque images S3TC DXT1 (BC1),
+ * and images with any transparency S3TC DXT5 (BC3).
+ *
+ * Like the mesh cache (see meshcache.h), the cache for `textures/foo.tga`
+ * lives at `textures/foo.tga.cache`, and is rebuilt whenever the size or
+ * modification time of the TGA file changes. Caches may also be shipped in the
+ * asset pack (see pack.h), under the same name, in which case they are used as
+ * they are.
+ *
+ * All values are little-endian. The file is laid out as:
+ *
+ *     TextureCacheHeader
+ *     the 4x4 blocks of each mip level, from the full size down to 1x1, in
+ *     rows as `glCompressedTexImage2D` takes them
+ */
+
+#define TEXTURE_CACHE_MAGIC     "TEXC"
+#define TEXTURE_CACHE_EXTENSION ".cache"
+#define TEXTURE_CACHE_VERSION   1
+
+/** Enough levels for a 65536-pixel image. */
+#define TEXTURE_CACHE_MAX_LEVELS 17
+
+struct TextureCacheHeader {
+	char     magic[4];
+	uint32_t version;
+	uint64_t sourceKey;       ///< hash of the size and modification time of the TGA
+	uint32_t width;
+	uint32_t height;
+	uint32_t internalFormat;  ///< the GL_COMPRESSED_* format of the blocks
+	uint32_t numLevels;
+	uint32_t swizzle[4];      ///< where the shader's RGBA come from (GL_RED...GL_ONE), for GL_TEXTURE_SWIZZLE_RGBA
+};
+
+/** A cooked texture whose data is memory-mapped from a cache file. The
+ * pointers remain valid until the texture is passed to `closeTextureCache`. */
+struct MappedTexture {
+	void*  mapping;
+	size_t mappingLength;
+	const TextureCacheHeader* header;
+
+	void* packBuffer;  ///< the decompressed copy, if the cache came compressed from the asset pack
+	std::vector<unsigned char>* cooked;  ///< set instead of `mapping` if the cache couldn't be written
+
+	const unsigned char* levels[TEXTURE_CACHE_MAX_LEVELS];
+	size_t levelSizes[TEXTURE_CACHE_MAX_LEVELS];
+	size_t dataSize;   ///< of every level together, which follow one another from `levels[0]`
+};
+
+size_t compressedLevelSize(GLenum internalFormat, GLuint width, GLuint height);
+void compressImage(const unsigned char* rgba, GLuint width, GLuint height, GLenum internalFormat, unsigned char* out);
+void downsampleImage(const unsigned char* in, GLuint width, GLuint height, unsigned char* out);
+
+bool openTextureCache(const char* tgaPath, MappedTexture &texture);
+void closeTextureCache(MappedTexture &texture);
+
+void cookTexture(const TGAImage &image, const unsigned char* pixels, uint64_t sourceKey,
+                 std::vector<unsigned char> &cooked);
+bool writeTextureCache(const char* tgaPath, const std::vector<unsigned char> &cooked);
+
+bool loadCachedTGA(const char* tgaPath, MappedTexture &texture);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _TGA_H
+#define _TGA_H
+
+/** @file tga.h
+ * Reads TGA images, uncompressed or run-length encoded: 24 and 32-bit colour,
+ * and 8-bit greyscale. Colour images are decoded to RGBA, with the BGR(A)
+ * pixels TGA stores swizzled by SSSE3 or AVX2 kernels where the CPU has them
+ * (see `tgaSIMD`), and the rows put in the order OpenGL takes them, from the
+ * bottom of the image up, whichever order the file has them in.
+ *
+ * The file is opened (from the asset pack, or memory-mapped) and its header
+ * read first, so that the caller knows how big the image is, and can decode it
+ * straight into where it is going, such as a mapped pixel buffer object.
+ */
+
+/** SIMD levels for `tgaSIMD`. */
+#define TGA_SIMD_NONE  0
+#define TGA_SIMD_SSSE3 1
+#define TGA_SIMD_AVX2  2
+#define TGA_SIMD_BEST  3
+
+/** A TGA file which has been opened, and whose header has been read. */
+struct TGAImage {
+	GLuint width;
+	GLuint height;
+	int    bytesPerPixel;  ///< once decoded: 4 for colour, or 1 for greyscale
+	GLenum format;         ///< once decoded: GL_RGBA, or GL_RED for greyscale
+
+	const unsigned char* file;
+	size_t fileLength;
+	void*  mapping;      ///< if the file was memory-mapped
+	void*  packBuffer;   ///< the decompressed copy, if the file came compressed from the asset pack
+	size_t pixelsOffset; ///< where the pixel data starts in the file
+	int    fileBytesPerPixel;
+	bool   rle;
+	bool   topToBottom;
+};
+
+bool openTGA(const char* path, TGAImage &image);
+bool openTGAMemory(const void* data, size_t length, const char* name, TGAImage &image);
+void closeTGA(TGAImage &image);
+
+size_t decodedTGASize(const TGAImage &image);
+bool decodeTGA(const TGAImage &image, unsigned char* out);
+
+GLuint tgaSIMD(GLuint level);
+
+#endif
@@ -5,6 +5,4 @@ void checkForError(const char* where);
 
 char* fileToBuffer(const char* path);
 
-GLuint loadTGA(const char *imagePath);
-
 #endif
@@ -0,0 +1,76 @@
+#ifndef _VTEX_H
+#define _VTEX_H
+
+#include <stdint.h>
+
+/** @file vtex.h
+ * Virtual texturing, for textures far larger than fit on the GPU, such as the
+ * terrain's. The texture is cut into pages, which are cooked ahead of time
+ * into a page file by the `vtex` tool (see vtextool.cpp). Only the pages in
+ * view, at the mip levels they are seen at, are kept on the GPU, in a page
+ * cache texture of a fixed size.
+ *
+ * Each frame, the objects using a virtual texture are drawn small into a
+ * feedback buffer, each pixel of which records the page it needs. That is read
+ * back a frame later, so that nothing waits for the GPU. Pages which aren't in
+ * the cache are read on the worker threads, and uploaded in place of the
+ * pages used least recently. The shader finds pages through the page table, a
+ * texture with a texel for each page at each mip level, saying where in the
+ * cache that page is, or else the nearest coarser page which is. The coarsest
+ * level is a single page, which is always in the cache.
+ *
+ * The virtual texture is square, and a power of two pages across. The image
+ * takes the corner of it at the origin of the texture coordinates, and the
+ * pages beyond the image are left out of the file. Each page has a border of
+ * texels from its neighbours, so that bilinear filtering doesn't bleed in from
+ * whichever page is next to it in the cache.
+ *
+ * All values are little-endian. The file is laid out as:
+ *
+ *     VirtualTextureHeader
+ *     uint64_t pageOffsets[]  for each level from level 0, each page in rows
+ *                             from the origin: where it is in the file, or 0
+ *                             if it is beyond the image
+ *     the pages, each `pageBytes` long, in rows as `glCompressedTexImage2D`
+ *     (or `glTexImage2D`) takes them
+ */
+
+#define VIRTUAL_TEXTURE_MAGIC   "VTEX"
+#define VIRTUAL_TEXTURE_VERSION 1
+
+/** Texels across a page, including its border on each side. */
+#define VIRTUAL_PAGE_SIZE    128
+#define VIRTUAL_PAGE_BORDER  4
+#define VIRTUAL_PAGE_PAYLOAD (VIRTUAL_PAGE_SIZE - 2 * VIRTUAL_PAGE_BORDER)
+
+/** Enough levels for 4096 pages across, which the feedback buffer can name. */
+#define VIRTUAL_TEXTURE_MAX_LEVELS 13
+
+/** The texture units the page table and page cache are bound to. */
+#define VIRTUAL_PAGE_TABLE_UNIT 1
+#define VIRTUAL_PAGE_CACHE_UNIT 2
+
+struct VirtualTextureHeader {
+	char     magic[4];
+	uint32_t version;
+	uint32_t width;           ///< of the image
+	uint32_t height;
+	uint32_t numLevels;       ///< the last of which is one page
+	uint32_t internalFormat;  ///< of the pages: GL_COMPRESSED_RGB_S3TC_DXT1_EXT, or GL_RGBA8
+	uint32_t pageBytes;
+	uint32_t reserved;
+};
+
+struct VirtualTexture;
+
+VirtualTexture* openVirtualTexture(const char* path, GLuint cachePages);
+void closeVirtualTexture(VirtualTexture* texture);
+
+void bindVirtualTexture(const VirtualTexture* texture, GLuint program);
+void beginVirtualTextureFeedback(VirtualTexture* texture, GLuint program);
+void endVirtualTextureFeedback(VirtualTexture* texture, GLuint program);
+void updateVirtualTexture(VirtualTexture* texture);
+
+void printVirtualTextureUsage(const VirtualTexture* texture);
+
+#endif
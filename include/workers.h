@@ -0,0 +1,18 @@
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+/** @file workers.h
+ * A pool of worker threads, built on GLFW's threading functions, for running
+ * jobs in the background and splitting loops across processors.
+ */
+
+typedef void (*WorkerJob)(void* data);
+typedef void (*ParallelTask)(void* data, int index);
+
+void startWorkers(void);
+int numWorkers(void);
+
+void submitJob(WorkerJob job, void* data);
+void runParallel(ParallelTask task, void* data, int count);
+
+#endif
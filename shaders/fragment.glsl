@@ -3,17 +3,65 @@ in vec3 csNormal;
 in vec3 csLightDirection;
 in vec3 csEyeDirection;
 in vec2 uvTexCoord;
-out vec3 color;
+out vec4 color;
 
-uniform sampler2D diffuseTexture;
+uniform sampler2DArray diffuseTextures;
+uniform int diffuseLayer;  // of diffuseTextures
+
+// Virtual texturing (see vtex.h), in place of the diffuse texture
+uniform bool virtualTextured;
+uniform bool virtualFeedback;  // write the page each pixel needs, rather than its colour
+uniform sampler2D pageTable;
+uniform sampler2D pageCache;
+uniform vec4 virtualTexture;   // xy: the image's share of the texture; z: texels across level 0; w: the coarsest level
+uniform vec3 pageCacheLayout;  // x: pages across the cache; y, z: a page's border and payload, as fractions of it
+uniform float virtualBias;     // added to the mip level, for the smaller feedback buffer
 
 uniform vec3 specularColor;
 uniform vec3 lightColor;
 //uniform vec3 lightVector;
 
+/** The mip level of the virtual texture seen at this pixel, found from how
+ * fast the texture coordinates change across the screen. */
+int virtualLevel(vec2 vuv) {
+	vec2 dx = dFdx(vuv) * virtualTexture.z, dy = dFdy(vuv) * virtualTexture.z;
+	float level = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + virtualBias;
+	return int(clamp(floor(level), 0, virtualTexture.w));
+}
+
+/** The page of a level of the virtual texture which the coordinates fall in. */
+ivec2 virtualPage(vec2 vuv, int level) {
+	int pagesAcross = 1 << (int(virtualTexture.w) - level);
+	return min(ivec2(vuv * pagesAcross), pagesAcross - 1);
+}
+
+/** Samples the virtual texture, from the finest page over the coordinates
+ * which is in the cache. */
+vec3 sampleVirtual(vec2 vuv, int level) {
+	vec3 entry = texelFetch(pageTable, virtualPage(vuv, level), level).rgb * 255;
+	int mappedLevel = int(entry.b);
+	vec2 inPage = vuv * (1 << (int(virtualTexture.w) - mappedLevel)) - virtualPage(vuv, mappedLevel);
+	vec2 cacheUV = (entry.rg + pageCacheLayout.y + inPage * pageCacheLayout.z) / pageCacheLayout.x;
+	return textureLod(pageCache, cacheUV, 0).rgb;
+}
+
 void main() {
 	// Code adapted from http://opengl-tutorial.org/beginners-tutorials/
-	vec3 diffuseColor = texture2D(diffuseTexture, uvTexCoord).rgb;
+	vec3 diffuseColor;
+	if (virtualTextured) {
+		// The level is found before wrapping, whose jumps would throw it
+		vec2 vuv = uvTexCoord * virtualTexture.xy;
+		int level = virtualLevel(vuv);
+		vuv = fract(uvTexCoord) * virtualTexture.xy;
+		if (virtualFeedback) {
+			ivec2 page = virtualPage(vuv, level);
+			color = vec4(ivec4(page & 255, (page.x >> 8) | (page.y >> 8) << 4, level + 1)) / 255;
+			return;
+		}
+		diffuseColor = sampleVirtual(vuv, level);
+	} else {
+		diffuseColor = texture(diffuseTextures, vec3(uvTexCoord, diffuseLayer)).rgb;
+	}
 
 	vec3 n = normalize(csNormal);
 	vec3 l = normalize(csLightDirection);
@@ -29,8 +77,8 @@ void main() {
 
 	float cosAlpha = clamp(dot(E, R), 0, 1);
 
-	color = ambientColor +
-	        diffuseColor * lightColor * cosTheta +
-	        vec3(0.5, 0.5, 0.5) * specularColor * lightColor * pow(cosAlpha, 3);  // Increase 5 for a thinner lobe
+	color = vec4(ambientColor +
+	             diffuseColor * lightColor * cosTheta +
+	             vec3(0.5, 0.5, 0.5) * specularColor * lightColor * pow(cosAlpha, 3), 1);  // Increase 5 for a thinner lobe
 	// TODO: make the light fade by distance to the source?
 }
@@ -10,22 +10,36 @@ out vec2 uvTexCoord;
 uniform mat4 MVP;
 uniform mat4 M;
 uniform mat4 V;
+uniform mat4 D;                 // maps quantised positions into model space
+uniform float octahedralScale;  // 0 if msNormal is a plain normal
 
 uniform vec3 wsLightPosition;
 
+/** Decodes an octahedral-encoded normal (see quantize.cpp). */
+vec3 decodeNormal(vec2 encoded) {
+	vec2 e = encoded * octahedralScale;
+	vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+	if (n.z < 0) {
+		n.xy = (1 - abs(n.yx)) * vec2(e.x >= 0 ? 1 : -1, e.y >= 0 ? 1 : -1);
+	}
+	return normalize(n);
+}
+
 void main() {
 	// Code adapted from http://opengl-tutorial.org/beginners-tutorials/
-	gl_Position = MVP * vec4(msPosition, 1);
+	vec4 msPoint = D * vec4(msPosition, 1);
+	gl_Position = MVP * msPoint;
 
 	//wsPosition = (M * vec4(msPosition, 1)).xyz;
 
-	vec3 csPosition = (V * M * vec4(msPosition, 1)).xyz;
+	vec3 csPosition = (V * M * msPoint).xyz;
 	csEyeDirection = vec3(0,0,0) - csPosition;
 
 	vec3 csLightPosition = (V * vec4(wsLightPosition, 1)).xyz;
 	csLightDirection = csLightPosition + csEyeDirection;
 
-	csNormal = (V * M * vec4(msNormal, 0)).xyz;
+	vec3 normal = octahedralScale != 0 ? decodeNormal(msNormal.xy) : msNormal;
+	csNormal = (V * M * vec4(normal, 0)).xyz;
 		// Only correct if ModelMatrix does not scale the model! Use its inverse transpose if not.
 
 	uvTexCoord = uv;
@@ -1,6 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <vector>
+#include <unordered_map>
 
 #include <GL/glfw.h>
 #include <glm/glm.hpp>
@@ -115,39 +117,96 @@ Mesh generateCone(void) {
 	return m;
 }
 
-/** Turns pairs of GLfloats into glm::vec2s and adds them to the given std::vector. */
+MeshView viewOf(const Mesh &mesh) {
+	MeshView view;
+	view.vertices    = mesh.vertices.data();
+	view.normals     = mesh.normals.data();
+	view.texCoords   = mesh.texCoords.data();
+	view.indices     = mesh.indices.data();
+	view.numVertices = mesh.vertices.size();
+	view.numIndices  = mesh.indices.size();
+	view.lods        = mesh.lods.data();
+	view.numLODs     = mesh.lods.size();
+	view.materials    = mesh.materials.data();
+	view.numMaterials = mesh.materials.size();
+	view.subsets      = mesh.subsets.data();
+	view.numSubsets   = mesh.subsets.size();
+	view.meshlets     = mesh.meshlets.data();
+	view.numMeshlets  = mesh.meshlets.size();
+	return view;
+}
+
+static_assert(sizeof(glm::vec2) == 2 * sizeof(GLfloat), "glm::vec2 must be two packed GLfloats");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(GLfloat), "glm::vec3 must be three packed GLfloats");
+
+/** Turns pairs of GLfloats into glm::vec2s and adds them to the given std::vector.
+ * They are laid out the same, so this is one block copy. */
 static void pairsToVec2s(GLfloat* data, GLuint start, GLuint numPairs, std::vector<glm::vec2> &vector) {
-	for (GLuint i = start; i < numPairs * 2 + start; i += 2) {
-		vector.push_back(glm::vec2(data[i], data[i+1]));
-	}
+	if (numPairs == 0) return;
+	const glm::vec2* pairs = (const glm::vec2*)(data + start);
+	vector.insert(vector.end(), pairs, pairs + numPairs);
 }
 
-/** Turns sets of three GLfloats into glm::vec3s and adds them to the given std::vector. */
+/** Turns sets of three GLfloats into glm::vec3s and adds them to the given std::vector.
+ * They are laid out the same, so this is one block copy. */
 static void tripletsToVec3s(GLfloat* data, GLuint start, GLuint numTriplets, std::vector<glm::vec3> &vector) {
-	for (GLuint i = start; i < numTriplets * 3 + start; i += 3) {
-		vector.push_back(glm::vec3(data[i], data[i+1], data[i+2]));
-	}
+	if (numTriplets == 0) return;
+	const glm::vec3* triplets = (const glm::vec3*)(data + start);
+	vector.insert(vector.end(), triplets, triplets + numTriplets);
+}
+
+/** Reports how much memory reading an OBJ file took (see GLMarena). */
+static void printArenaUsage(const char* name, size_t allocated, size_t peak) {
+	printf("Parsing %s allocated %.2f MB, %.2f MB at peak.\n", name, allocated / 1048576.0, peak / 1048576.0);
 }
 
 Mesh loadOBJ(const char* path) {
-	GLMmodel* model = glmReadOBJ((char*)path);
+	// Everything GLM allocates goes in the arena, to be freed at once
+	GLMarena arena;
+	glmArenaInit(&arena);
+	arena.report = printArenaUsage;
+	GLMmodel* model = glmReadOBJArena((char*)path, &arena);
 	Mesh m;
 
 	// glmReadOBJ returns 1-based indices, hence the offsets
 	std::vector<glm::vec3> vertices;
+	vertices.reserve(model->numvertices);
 	tripletsToVec3s(model->vertices, 3, model->numvertices, vertices);
 
 	std::vector<glm::vec3> normals;
+	normals.reserve(model->numnormals);
 	tripletsToVec3s(model->normals, 3, model->numnormals, normals);
 
 	std::vector<glm::vec2> texCoords;
+	texCoords.reserve(model->numtexcoords);
 	pairsToVec2s(model->texcoords, 2, model->numtexcoords, texCoords);
 
 	GLuint numVertices  = model->numvertices;
 	GLuint numTriangles = model->numtriangles;
 	GLMtriangle* triangles = model->triangles;
-	for (GLuint i = 0; i < numTriangles; i++) {
-		GLMtriangle tri = triangles[i];
+	// Index arrays for attributes the file doesn't have are left uninitialised
+	bool hasNormals   = model->numnormals   > 0;
+	bool hasTexCoords = model->numtexcoords > 0;
+
+	// Visit the triangles grouped by material (keeping their order within each
+	// material), so that each material's triangles form one range of indices
+	GLuint numMaterials = model->nummaterials > 0 ? model->nummaterials : 1;
+	std::vector<GLuint> materialStart(numMaterials + 1, 0);
+	for (GLuint i = 0; i < numTriangles; i++) materialStart[triangles[i].material + 1]++;
+	for (GLuint i = 0; i < numMaterials; i++) materialStart[i + 1] += materialStart[i];
+	std::vector<GLuint> order(numTriangles);
+	std::vector<GLuint> next(materialStart.begin(), materialStart.end() - 1);
+	for (GLuint i = 0; i < numTriangles; i++) order[next[triangles[i].material]++] = i;
+
+	// First pass: give each distinct (vertex, normal, texcoord) tuple an index
+	std::unordered_map<VertexKey, GLuint, VertexKeyHash> indexOf;
+	indexOf.reserve(numTriangles * 3);
+	m.indices.reserve(numTriangles * 3);
+	std::vector<GLuint> cornerTriangles;  // the triangle each index came from
+	cornerTriangles.reserve(numTriangles);
+	for (GLuint k = 0; k < numTriangles; k++) {
+		GLuint i = order[k];
+		GLMtriangle &tri = triangles[i];
 
 		// > not >=, because of 1-based
 		if (tri.vindices[0] > numVertices || tri.vindices[1] > numVertices || tri.vindices[2] > numVertices) {
@@ -158,13 +217,58 @@ Mesh loadOBJ(const char* path) {
 		}
 
 		for (unsigned int j = 0; j < 3; j++) {
-			// Subtract 1 from each index to make them zero-based
-			m.vertices .push_back(vertices [tri.vindices[j] - 1]);
-			m.normals  .push_back(normals  [tri.nindices[j] - 1]);
-			m.texCoords.push_back(texCoords[tri.tindices[j] - 1]);
-			m.indices.push_back(m.indices.size());
-			// TODO: make this more efficient or replace with a binary format solution
+			VertexKey key = { tri.vindices[j],
+			                  hasNormals   ? tri.nindices[j] : 0,
+			                  hasTexCoords ? tri.tindices[j] : 0 };
+			GLuint newIndex = indexOf.size();
+			m.indices.push_back(indexOf.insert(std::make_pair(key, newIndex)).first->second);
 		}
+		cornerTriangles.push_back(i);
+
+		// Start a new subset whenever the material changes
+		if (m.subsets.empty() || m.subsets.back().material != tri.material) {
+			MeshSubset subset = { tri.material, (GLuint)m.indices.size() - 3, 0, 0, 0 };
+			m.subsets.push_back(subset);
+		}
+		m.subsets.back().numIndices += 3;
+	}
+
+	// Keep the material library, for the subsets to refer to
+	if (model->mtllibname) m.materialLibrary = model->mtllibname;
+	for (GLuint i = 0; i < model->nummaterials; i++) {
+		MeshMaterial material;
+		memset(&material, 0, sizeof(material));
+		strncpy(material.name, model->materials[i].name, MESH_NAME_LENGTH - 1);
+		if (model->materials[i].texture) {
+			// Exporters tend to write absolute paths from the artist's machine
+			const char* texture = model->materials[i].texture;
+			const char* slash = strrchr(texture, '/');
+			if (!slash) slash = strrchr(texture, '\\');
+			strncpy(material.texture, slash ? slash + 1 : texture, MESH_NAME_LENGTH - 1);
+		}
+		m.materials.push_back(material);
 	}
+	if (m.materials.empty()) m.subsets.clear();  // no library, so nothing to tell apart
+
+	// Second pass: copy the attributes of each tuple the first time it is seen
+	GLuint numUnique = indexOf.size();
+	m.vertices .reserve(numUnique);
+	m.normals  .reserve(numUnique);
+	m.texCoords.reserve(numUnique);
+	for (size_t c = 0; c < m.indices.size(); c++) {
+		if (m.indices[c] != m.vertices.size()) continue;  // already copied
+
+		GLMtriangle &tri = triangles[cornerTriangles[c / 3]];
+		unsigned int j = c % 3;
+		// Subtract 1 from each index to make them zero-based
+		m.vertices.push_back(vertices[tri.vindices[j] - 1]);
+		m.normals  .push_back(hasNormals   ? normals  [tri.nindices[j] - 1] : glm::vec3(0, 0, 0));
+		m.texCoords.push_back(hasTexCoords ? texCoords[tri.tindices[j] - 1] : glm::vec2(0, 0));
+	}
+
+	printf("Loaded %s: %lu triangles, %lu vertices (%lu before indexing), %lu materials.\n", path,
+	       (unsigned long)(m.indices.size() / 3), (unsigned long)m.vertices.size(),
+	       (unsigned long)m.indices.size(), (unsigned long)m.materials.size());
+	glmArenaRelease(&arena);
 	return m;
 }
@@ -13,24 +13,22 @@
 
 
 #include <math.h>
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "glm.h"
+#include "workers.h"
 
 
 #define T(x) (model->triangles[(x)])
 
 
-/* _GLMnode: general purpose node */
-typedef struct _GLMnode {
-    GLuint index;
-    GLboolean averaged;
-    struct _GLMnode* next;
-} GLMnode;
-
-
 /* glmMax: returns the maximum of two floats */
 static GLfloat
 glmMax(GLfloat a, GLfloat b)
@@ -114,8 +112,180 @@ glmEqual(GLfloat* u, GLfloat* v, GLfloat epsilon)
     return GL_FALSE;
 }
 
+/* GLM_ARENA_BLOCK_SIZE: smallest block an arena takes from malloc */
+#ifndef GLM_ARENA_BLOCK_SIZE
+#define GLM_ARENA_BLOCK_SIZE (64 << 10)
+#endif
+
+/* GLM_ARENA_ALIGN: round a size up to the arena's alignment */
+#define GLM_ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+/* _GLMarenablock: a block of memory taken from malloc by an arena,
+ * which hands it out front to back */
+struct _GLMarenablock {
+    GLMarenablock* next;        /* next (older) block */
+    size_t size;                /* bytes after the header */
+    size_t used;                /* bytes handed out */
+    size_t last;                /* offset of the last allocation */
+};
+
+/* GLM_ARENA_HEADER: bytes before the memory of a block, keeping it
+ * aligned */
+#define GLM_ARENA_HEADER GLM_ARENA_ALIGN(sizeof(GLMarenablock))
+
+/* glmArenaResize: resize an allocation from an arena, in place if it
+ * is the last one in its block and there is room, and otherwise by
+ * copying it.  Returns the (possibly moved) allocation.
+ *
+ * arena   - initialized GLMarena structure
+ * array   - the allocation to resize (may be NULL)
+ * oldsize - size of the allocation in bytes
+ * newsize - size it needs to be in bytes
+ */
+static GLvoid*
+glmArenaResize(GLMarena* arena, GLvoid* array, size_t oldsize, size_t newsize)
+{
+    GLMarenablock* block = arena->blocks;
+    GLvoid* moved;
+
+    newsize = GLM_ARENA_ALIGN(newsize);
+    if (array && block && (char*)array == (char*)block + GLM_ARENA_HEADER + block->last &&
+        newsize <= block->size - block->last) {
+        arena->allocated = arena->allocated - (block->used - block->last) + newsize;
+        block->used = block->last + newsize;
+        return array;
+    }
+
+    moved = glmArenaAlloc(arena, newsize);
+    if (array)
+        memcpy(moved, array, oldsize < newsize ? oldsize : newsize);
+    return moved;
+}
+
+/* glmArenaMerge: move the blocks of one arena into another, which
+ * then frees them
+ *
+ * arena - initialized GLMarena structure to take the blocks
+ * from  - initialized GLMarena structure, left empty
+ */
+static GLvoid
+glmArenaMerge(GLMarena* arena, GLMarena* from)
+{
+    GLMarenablock** tail;
+
+    /* put them after the newest block, which is still in use */
+    for (tail = &arena->blocks; *tail; tail = &(*tail)->next)
+        ;
+    *tail = from->blocks;
+    arena->allocated += from->allocated;
+    arena->held += from->held;
+    if (arena->held > arena->peak)
+        arena->peak = arena->held;
+
+    from->blocks = NULL;
+    from->allocated = 0;
+    from->held = 0;
+    from->peak = 0;
+}
+
+/* glmAlloc: allocate memory for a model, from its arena if it has one */
+static GLvoid*
+glmAlloc(GLMmodel* model, size_t size)
+{
+    GLvoid* memory;
+
+    if (model->arena)
+        return glmArenaAlloc(model->arena, size);
+
+    memory = malloc(size);
+    if (!memory) {
+        fprintf(stderr, "glmAlloc() failed: out of memory.\n");
+        exit(1);
+    }
+    return memory;
+}
+
+/* glmCalloc: allocate zeroed memory for a model */
+static GLvoid*
+glmCalloc(GLMmodel* model, size_t count, size_t size)
+{
+    GLvoid* memory = glmAlloc(model, count * size);
+
+    memset(memory, 0, count * size);
+    return memory;
+}
+
+/* glmStrdup: copy a string into memory for a model */
+static char*
+glmStrdup(GLMmodel* model, const char* string)
+{
+    return strcpy((char*)glmAlloc(model, strlen(string) + 1), string);
+}
+
+/* glmFree: free memory allocated by glmAlloc (memory in an arena is
+ * only freed with the arena) */
+static GLvoid
+glmFree(GLMmodel* model, GLvoid* memory)
+{
+    if (!model->arena)
+        free(memory);
+}
+
+/* _GLMcell: a cell of the grid used by glmWeldVectors, holding the
+ * list of copied vectors that fall in it */
+typedef struct _GLMcell {
+    long long x, y, z;          /* coordinates of the cell in the grid */
+    GLuint head;                /* first copy in this cell (0 = empty) */
+} GLMcell;
+
+/* glmCellHash: hash the coordinates of a grid cell */
+static GLuint
+glmCellHash(long long x, long long y, long long z)
+{
+    unsigned long long h;
+
+    h = (unsigned long long)x * 73856093ull ^
+        (unsigned long long)y * 19349663ull ^
+        (unsigned long long)z * 83492791ull;
+    return (GLuint)(h ^ (h >> 32));
+}
+
+/* glmFindCell: find the slot for a grid cell in an open-addressed
+ * table (mask + 1 slots); the slot is empty if the cell has no copies */
+static GLMcell*
+glmFindCell(GLMcell* cells, GLuint mask, long long x, long long y, long long z)
+{
+    GLuint slot = glmCellHash(x, y, z) & mask;
+
+    while (cells[slot].head &&
+           (cells[slot].x != x || cells[slot].y != y || cells[slot].z != z))
+        slot = (slot + 1) & mask;
+    return &cells[slot];
+}
+
+/* GLM_MAX_CELLS: most grid cells glmWeldVectors puts along each axis
+ * either side of the origin, so that cell coordinates stay exact */
+#define GLM_MAX_CELLS ((double)(1ll << 40))
+
+/* glmCellCoord: the grid cell coordinate of one component, or 0 for
+ * an infinite or NaN component (which cannot equal anything anyway) */
+static long long
+glmCellCoord(GLfloat v, double size)
+{
+    double q = floor(v / size);
+
+    if (!(glmAbs(v) <= FLT_MAX) || !(fabs(q) <= GLM_MAX_CELLS))
+        return 0;
+    return (long long)q;
+}
+
 /* glmWeldVectors: eliminate (weld) vectors that are within an
- * epsilon of each other.
+ * epsilon of each other.  The vectors are bucketed into a grid of
+ * epsilon-sized cells, so a match can only be in the same cell or one
+ * of its neighbours, making this O(n) rather than comparing each
+ * vector with every copy so far.  As before, a vector is welded to
+ * the first copy it is equal to, and nothing is welded if epsilon is
+ * not positive.
  *
  * vectors     - array of GLfloat[3]'s to be welded
  * numvectors - number of GLfloat[3]'s in vectors
@@ -124,17 +294,119 @@ glmEqual(GLfloat* u, GLfloat* v, GLfloat epsilon)
  */
 GLfloat*
 glmWeldVectors(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
+{
+    GLfloat* copies;
+    GLuint* next;              /* next copy in the same cell */
+    GLMcell* cells;
+    GLMcell* cell;
+    GLuint mask, copied, match;
+    GLuint i, j;
+    long long x, y, z;
+    int dx, dy, dz;
+    double size, largest;
+
+    copies = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (*numvectors + 1));
+
+    /* glmEqual is strict, so nothing is within an epsilon of zero */
+    if (!(epsilon > 0)) {
+        memcpy(&copies[3], &vectors[3], sizeof(GLfloat) * 3 * *numvectors);
+        for (i = 1; i <= *numvectors; i++)
+            vectors[3 * i + 0] = (GLfloat)i;
+        return copies;
+    }
+
+    next = (GLuint*)malloc(sizeof(GLuint) * (*numvectors + 1));
+
+    /* at least twice as many cells as vectors keeps probes short */
+    for (mask = 63; mask < 2 * *numvectors; mask = 2 * mask + 1)
+        ;
+    cells = (GLMcell*)calloc(mask + 1, sizeof(GLMcell));
+
+    /* vectors can only be equal if each component differs by less
+       than epsilon, so they must be in the same or adjacent cells.
+       Cells may be wider than epsilon (it only costs comparisons), so
+       for a tiny epsilon they are widened to keep the coordinates of
+       the largest component within GLM_MAX_CELLS */
+    largest = 0;
+    for (i = 3; i < 3 * (*numvectors + 1); i++) {
+        if (glmAbs(vectors[i]) > largest && glmAbs(vectors[i]) <= FLT_MAX)
+            largest = glmAbs(vectors[i]);
+    }
+    size = epsilon;
+    if (size < largest / GLM_MAX_CELLS)
+        size = largest / GLM_MAX_CELLS;
+
+    copied = 1;
+    for (i = 1; i <= *numvectors; i++) {
+        x = glmCellCoord(vectors[3 * i + 0], size);
+        y = glmCellCoord(vectors[3 * i + 1], size);
+        z = glmCellCoord(vectors[3 * i + 2], size);
+
+        /* find the earliest copy in the neighbourhood that matches */
+        match = 0;
+        for (dx = -1; dx <= 1; dx++) {
+            for (dy = -1; dy <= 1; dy++) {
+                for (dz = -1; dz <= 1; dz++) {
+                    cell = glmFindCell(cells, mask, x + dx, y + dy, z + dz);
+                    for (j = cell->head; j; j = next[j]) {
+                        if ((!match || j < match) &&
+                            glmEqual(&vectors[3 * i], &copies[3 * j], epsilon))
+                            match = j;
+                    }
+                }
+            }
+        }
+
+        if (!match) {
+            /* must not be any duplicates -- add to the copies array */
+            match = copied++;
+            copies[3 * match + 0] = vectors[3 * i + 0];
+            copies[3 * match + 1] = vectors[3 * i + 1];
+            copies[3 * match + 2] = vectors[3 * i + 2];
+
+            cell = glmFindCell(cells, mask, x, y, z);
+            cell->x = x;
+            cell->y = y;
+            cell->z = z;
+            next[match] = cell->head;
+            cell->head = match;
+        }
+
+        /* set the first component of this vector to point at the correct
+        index into the new copies array */
+        vectors[3 * i + 0] = (GLfloat)match;
+    }
+
+    free(cells);
+    free(next);
+
+    *numvectors = copied-1;
+    return copies;
+}
+
+/* glmWeldVectorsReference: the original quadratic glmWeldVectors,
+ * comparing each vector with every copy so far.  Kept to check the
+ * grid version against (see glmbench -w); it welds exactly the same
+ * vectors, in the same order.
+ *
+ * vectors     - array of GLfloat[3]'s to be welded
+ * numvectors - number of GLfloat[3]'s in vectors
+ * epsilon     - maximum difference between vectors
+ *
+ */
+GLfloat*
+glmWeldVectorsReference(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
 {
     GLfloat* copies;
     GLuint copied;
     GLuint i, j;
 
     copies = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (*numvectors + 1));
-    memcpy(copies, vectors, (sizeof(GLfloat) * 3 * (*numvectors + 1)));
 
     copied = 1;
     for (i = 1; i <= *numvectors; i++) {
-        for (j = 1; j <= copied; j++) {
+        /* only the copies made so far: slot copied is not filled yet */
+        for (j = 1; j < copied; j++) {
             if (glmEqual(&vectors[3 * i], &copies[3 * j], epsilon)) {
                 goto duplicate;
             }
@@ -157,19 +429,48 @@ duplicate:
     return copies;
 }
 
+/* glmHashName: FNV-1a hash of a group or material name */
+static GLuint
+glmHashName(char* name)
+{
+    GLuint hash = 2166136261u;
+
+    while (*name)
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+
+    return hash;
+}
+
+/* glmInsertGroup: put a group in the group hash table, which must have
+ * room for it */
+static GLvoid
+glmInsertGroup(GLMmodel* model, GLMgroup* group)
+{
+    GLuint mask = model->grouptablesize - 1;
+    GLuint i = glmHashName(group->name) & mask;
+
+    while (model->grouptable[i])
+        i = (i + 1) & mask;
+    model->grouptable[i] = group;
+}
+
 /* glmFindGroup: Find a group in the model */
 GLMgroup*
 glmFindGroup(GLMmodel* model, char* name)
 {
     GLMgroup* group;
+    GLuint mask, i;
 
     assert(model);
 
-    group = model->groups;
-    while(group) {
+    if (!model->grouptable)
+        return NULL;
+
+    /* linear probing; the table is never more than half full */
+    mask = model->grouptablesize - 1;
+    for (i = glmHashName(name) & mask; (group = model->grouptable[i]); i = (i + 1) & mask) {
         if (!strcmp(name, group->name))
             break;
-        group = group->next;
     }
 
     return group;
@@ -183,55 +484,88 @@ glmAddGroup(GLMmodel* model, char* name)
 
     group = glmFindGroup(model, name);
     if (!group) {
-        group = (GLMgroup*)malloc(sizeof(GLMgroup));
-        group->name = strdup(name);
+        group = (GLMgroup*)glmAlloc(model, sizeof(GLMgroup));
+        group->name = glmStrdup(model, name);
         group->material = 0;
         group->numtriangles = 0;
         group->triangles = NULL;
         group->next = model->groups;
         model->groups = group;
         model->numgroups++;
+
+        /* keep the hash table at most half full */
+        if (model->numgroups * 2 > model->grouptablesize) {
+            GLMgroup* g;
+
+            glmFree(model, model->grouptable);
+            model->grouptablesize = model->grouptablesize ? model->grouptablesize * 2 : 16;
+            model->grouptable = (GLMgroup**)glmCalloc(model, model->grouptablesize, sizeof(GLMgroup*));
+            for (g = model->groups; g; g = g->next)
+                glmInsertGroup(model, g);
+        } else {
+            glmInsertGroup(model, group);
+        }
     }
 
     return group;
 }
 
-/* glmFindGroup: Find a material in the model */
-GLuint
-glmFindMaterial(GLMmodel* model, char* name)
+/* glmHashMaterials: build the hash table used by glmFindMaterial */
+static GLvoid
+glmHashMaterials(GLMmodel* model)
 {
-    GLuint i;
+    GLuint mask, i, j;
+
+    glmFree(model, model->materialtable);
+    model->materialtablesize = 16;
+    while (model->materialtablesize < model->nummaterials * 2)
+        model->materialtablesize *= 2;
+    model->materialtable = (GLuint*)glmCalloc(model, model->materialtablesize, sizeof(GLuint));
 
-    /* XXX doing a linear search on a string key'd list is pretty lame,
-    but it works and is fast enough for now. */
+    mask = model->materialtablesize - 1;
     for (i = 0; i < model->nummaterials; i++) {
-        if (!strcmp(model->materials[i].name, name))
-            goto found;
+        for (j = glmHashName(model->materials[i].name) & mask; model->materialtable[j]; j = (j + 1) & mask)
+            ;
+        model->materialtable[j] = i + 1;
+    }
+}
+
+/* glmFindMaterial: Find a material in the model */
+GLuint
+glmFindMaterial(GLMmodel* model, char* name)
+{
+    GLuint mask, i, j;
+
+    /* linear probing; the table is never more than half full */
+    if (model->materialtable) {
+        mask = model->materialtablesize - 1;
+        for (j = glmHashName(name) & mask; (i = model->materialtable[j]); j = (j + 1) & mask) {
+            if (!strcmp(model->materials[i - 1].name, name))
+                return i - 1;
+        }
     }
 
     /* didn't find the name, so print a warning and return the default
     material (0). */
     printf("glmFindMaterial():  can't find material \"%s\".\n", name);
-    i = 0;
-
-found:
-    return i;
+    return 0;
 }
 
 
 /* glmDirName: return the directory given a path
  *
- * path - filesystem path
+ * model - model the path belongs to
+ * path  - filesystem path
  *
- * NOTE: the return value should be free'd.
+ * NOTE: the return value should be free'd with glmFree.
  */
 static char*
-glmDirName(char* path)
+glmDirName(GLMmodel* model, char* path)
 {
     char* dir;
     char* s;
 
-    dir = strdup(path);
+    dir = glmStrdup(model, path);
 
     s = strrchr(dir, '/');
     if (s)
@@ -255,13 +589,15 @@ glmReadMTL(GLMmodel* model, char* name)
     char* dir;
     char* filename;
     char buf[128];
+    char line[1024];
+    char* start;
     GLuint nummaterials, i;
 
-    dir = glmDirName(model->pathname);
-    filename = (char*)malloc(sizeof(char) * (strlen(dir) + strlen(name) + 1));
+    dir = glmDirName(model, model->pathname);
+    filename = (char*)glmAlloc(model, sizeof(char) * (strlen(dir) + strlen(name) + 1));
     strcpy(filename, dir);
     strcat(filename, name);
-    free(dir);
+    glmFree(model, dir);
 
     file = fopen(filename, "r");
     if (!file) {
@@ -269,7 +605,7 @@ glmReadMTL(GLMmodel* model, char* name)
             filename);
         exit(1);
     }
-    free(filename);
+    glmFree(model, filename);
 
     /* count the number of materials in the file */
     nummaterials = 1;
@@ -293,12 +629,13 @@ glmReadMTL(GLMmodel* model, char* name)
 
     rewind(file);
 
-    model->materials = (GLMmaterial*)malloc(sizeof(GLMmaterial) * nummaterials);
+    model->materials = (GLMmaterial*)glmAlloc(model, sizeof(GLMmaterial) * nummaterials);
     model->nummaterials = nummaterials;
 
     /* set the default material */
     for (i = 0; i < nummaterials; i++) {
         model->materials[i].name = NULL;
+        model->materials[i].texture = NULL;
         model->materials[i].shininess = 65.0;
         model->materials[i].diffuse[0] = 0.8;
         model->materials[i].diffuse[1] = 0.8;
@@ -313,7 +650,7 @@ glmReadMTL(GLMmodel* model, char* name)
         model->materials[i].specular[2] = 0.0;
         model->materials[i].specular[3] = 1.0;
     }
-    model->materials[0].name = strdup("default");
+    model->materials[0].name = glmStrdup(model, "default");
 
     /* now, read in the data */
     nummaterials = 0;
@@ -327,7 +664,7 @@ glmReadMTL(GLMmodel* model, char* name)
             fgets(buf, sizeof(buf), file);
             sscanf(buf, "%s %s", buf, buf);
             nummaterials++;
-            model->materials[nummaterials].name = strdup(buf);
+            model->materials[nummaterials].name = glmStrdup(model, buf);
             break;
         case 'N':
             fscanf(file, "%f", &model->materials[nummaterials].shininess);
@@ -361,6 +698,17 @@ glmReadMTL(GLMmodel* model, char* name)
                 break;
             }
             break;
+        case 'm':               /* map_Kd */
+            if (!strcmp(buf, "map_Kd") && fgets(line, sizeof(line), file)) {
+                /* the file name may contain spaces, so take the whole line */
+                start = line + strspn(line, " \t");
+                start[strcspn(start, "\r\n")] = '\0';
+                glmFree(model, model->materials[nummaterials].texture);
+                model->materials[nummaterials].texture = glmStrdup(model, start);
+            } else {
+                fgets(buf, sizeof(buf), file);
+            }
+            break;
             default:
                 /* eat up rest of line */
                 fgets(buf, sizeof(buf), file);
@@ -369,6 +717,8 @@ glmReadMTL(GLMmodel* model, char* name)
     }
 
     fclose(file);
+
+    glmHashMaterials(model);
 }
 
 /* glmWriteMTL: write a wavefront material library file
@@ -386,11 +736,11 @@ glmWriteMTL(GLMmodel* model, char* modelpath, char* mtllibname)
     GLMmaterial* material;
     GLuint i;
 
-    dir = glmDirName(modelpath);
-    filename = (char*)malloc(sizeof(char) * (strlen(dir)+strlen(mtllibname)));
+    dir = glmDirName(model, modelpath);
+    filename = (char*)glmAlloc(model, sizeof(char) * (strlen(dir)+strlen(mtllibname)+1));
     strcpy(filename, dir);
     strcat(filename, mtllibname);
-    free(dir);
+    glmFree(model, dir);
 
     /* open the file */
     file = fopen(filename, "w");
@@ -399,369 +749,1238 @@ glmWriteMTL(GLMmodel* model, char* modelpath, char* mtllibname)
             filename);
         exit(1);
     }
-    free(filename);
+    glmFree(model, filename);
+
+    /* spit out a header */
+    fprintf(file, "#  \n");
+    fprintf(file, "#  Wavefront MTL generated by GLM library\n");
+    fprintf(file, "#  \n");
+    fprintf(file, "#  GLM library\n");
+    fprintf(file, "#  Nate Robins\n");
+    fprintf(file, "#  ndr@pobox.com\n");
+    fprintf(file, "#  http://www.pobox.com/~ndr\n");
+    fprintf(file, "#  \n\n");
+
+    for (i = 0; i < model->nummaterials; i++) {
+        material = &model->materials[i];
+        fprintf(file, "newmtl %s\n", material->name);
+        fprintf(file, "Ka %f %f %f\n",
+            material->ambient[0], material->ambient[1], material->ambient[2]);
+        fprintf(file, "Kd %f %f %f\n",
+            material->diffuse[0], material->diffuse[1], material->diffuse[2]);
+        fprintf(file, "Ks %f %f %f\n",
+            material->specular[0],material->specular[1],material->specular[2]);
+        fprintf(file, "Ns %f\n", material->shininess / 128.0 * 1000.0);
+        if (material->texture)
+            fprintf(file, "map_Kd %s\n", material->texture);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+}
+
+
+/* glmIsSpace: returns true for the whitespace that separates tokens on
+ * a line (but not the newline that ends it) */
+#define glmIsSpace(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+/* glmSkipSpace: advance past spaces and tabs on the current line */
+static const char*
+glmSkipSpace(const char* p, const char* end)
+{
+    while (p < end && glmIsSpace(*p))
+        p++;
+    return p;
+}
+
+/* glmSkipLine: advance to the start of the next line */
+static const char*
+glmSkipLine(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+/* glmParseInt: parse a (possibly negative) decimal integer.  Returns
+ * GL_FALSE, without moving p, if there is no integer at p.
+ *
+ * p     - pointer to the text to parse, advanced past the integer
+ * end   - end of the text
+ * value - the parsed integer
+ */
+GLboolean
+glmParseInt(const char** p, const char* end, int* value)
+{
+    const char* s = *p;
+    int negative = 0;
+    int n = 0;
+
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        s++;
+    }
+    if (s >= end || *s < '0' || *s > '9')
+        return GL_FALSE;
+    while (s < end && *s >= '0' && *s <= '9')
+        n = 10 * n + (*s++ - '0');
+
+    *value = negative ? -n : n;
+    *p = s;
+    return GL_TRUE;
+}
+
+/* glmParseFloat: parse a decimal floating point number, with optional
+ * fraction and exponent.  Unlike strtod this ignores the locale.
+ * Returns GL_FALSE, without moving p, if there is no number at p.
+ *
+ * p     - pointer to the text to parse, advanced past the number
+ * end   - end of the text
+ * value - the parsed number
+ */
+GLboolean
+glmParseFloat(const char** p, const char* end, GLfloat* value)
+{
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* s = *p;
+    unsigned long long mantissa = 0;
+    int digits = 0, significant = 0, exponent = 0, e;
+    int negative = 0;
+    double d;
+
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        s++;
+    }
+
+    /* integer part; digits beyond what fits in the mantissa only
+       scale it */
+    for (; s < end && *s >= '0' && *s <= '9'; s++, digits++) {
+        if (significant < 19) {
+            mantissa = 10 * mantissa + (*s - '0');
+            if (mantissa) significant++;
+        } else {
+            exponent++;
+        }
+    }
+
+    /* fractional part */
+    if (s < end && *s == '.') {
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++, digits++) {
+            if (significant < 19) {
+                mantissa = 10 * mantissa + (*s - '0');
+                if (mantissa) significant++;
+                exponent--;
+            }
+        }
+    }
+    if (!digits)
+        return GL_FALSE;
+
+    /* exponent */
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char* t = s + 1;
+        if (glmParseInt(&t, end, &e)) {
+            exponent += e;
+            s = t;
+        }
+    }
+
+    d = (double)mantissa;
+    if (exponent < 0 && exponent >= -22)
+        d /= powers[-exponent];
+    else if (exponent > 0 && exponent <= 22)
+        d *= powers[exponent];
+    else if (exponent)
+        d *= pow(10.0, exponent);
+
+    *value = (GLfloat)(negative ? -d : d);
+    *p = s;
+    return GL_TRUE;
+}
+
+/* glmParseFloats: parse count whitespace-separated floats from the
+ * current line into values (unparseable values are set to 0) */
+static const char*
+glmParseFloats(const char* p, const char* end, GLfloat* values, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        p = glmSkipSpace(p, end);
+        if (!glmParseFloat(&p, end, &values[i]))
+            values[i] = 0.0;
+    }
+    return p;
+}
+
+/* glmParseWord: find the first whitespace-delimited word on the
+ * current line and copy it into buf (truncating it to size - 1
+ * characters) */
+static const char*
+glmParseWord(const char* p, const char* end, char* buf, size_t size)
+{
+    size_t length = 0;
+
+    p = glmSkipSpace(p, end);
+    while (p < end && *p != '\n' && !glmIsSpace(*p)) {
+        if (length + 1 < size)
+            buf[length++] = *p;
+        p++;
+    }
+    buf[length] = '\0';
+    return p;
+}
+
+/* glmGrow: make sure an array in an arena has room for at least
+ * needed elements, doubling its capacity as required.  Returns the
+ * (possibly moved) array.
+ *
+ * arena    - arena the array is in, or NULL if it is from malloc
+ * array    - the array to grow (may be NULL)
+ * capacity - current capacity of the array in elements, updated
+ * needed   - number of elements that must fit
+ * size     - size of each element in bytes
+ */
+static GLvoid*
+glmGrow(GLMarena* arena, GLvoid* array, GLuint* capacity, GLuint needed, size_t size)
+{
+    GLuint oldcapacity = *capacity;
+
+    if (needed <= *capacity)
+        return array;
+
+    if (*capacity == 0)
+        *capacity = 64;
+    while (*capacity < needed)
+        *capacity *= 2;
+
+    if (!arena) {
+        array = realloc(array, size * *capacity);
+        if (!array) {
+            fprintf(stderr, "glmGrow() failed: out of memory.\n");
+            exit(1);
+        }
+        return array;
+    }
+    return glmArenaResize(arena, array, size * oldcapacity, size * *capacity);
+}
+
+/* glmParseIndex: resolve a (1-based, possibly negative i.e. relative)
+ * OBJ index against the number of elements read so far */
+#define glmParseIndex(i, count) ((i) < 0 ? (GLuint)((i) + (int)(count) + 1) : (GLuint)(i))
+
+/* GLM_CHUNK_SIZE: files are split into chunks of at least this many
+ * bytes to be parsed in parallel */
+#ifndef GLM_CHUNK_SIZE
+#define GLM_CHUNK_SIZE (4 << 20)
+#endif
+
+/* GLM_RELATIVE: bit of GLMtriangle::findex that marks index attr
+ * (0 = vertex, 1 = texcoord, 2 = normal) of a corner as being
+ * relative to the start of its chunk, while parsing */
+#define GLM_RELATIVE(corner, attr) (1 << (3 * (corner) + (attr)))
+
+/* _GLMevent: a change of group or material, or a material library,
+ * recorded while parsing a chunk so that it can be applied in file
+ * order once all of the chunks have been parsed */
+typedef struct _GLMevent {
+    char   type;                /* 'g', 'u' or 'm' */
+    GLuint triangle;            /* index of the next triangle in the chunk */
+    char*  name;                /* group, material or library name */
+} GLMevent;
+
+/* _GLMchunk: the elements parsed from part of an OBJ file, in an
+ * arena of its own so that chunks can be parsed concurrently.  The
+ * arrays are 1-based like the ones in GLMmodel.  Negative (relative)
+ * indices can refer to elements in earlier chunks, so they are
+ * resolved against the counts within the chunk and flagged with
+ * GLM_RELATIVE until the offsets of the chunks are known. */
+typedef struct _GLMchunk {
+    const char*  start;         /* text of this chunk */
+    const char*  end;
+
+    GLuint       numvertices, vcapacity;
+    GLfloat*     vertices;
+    GLuint       numnormals, ncapacity;
+    GLfloat*     normals;
+    GLuint       numtexcoords, tcapacity;
+    GLfloat*     texcoords;
+    GLuint       numtriangles, fcapacity;
+    GLMtriangle* triangles;
+    GLuint       numevents, ecapacity;
+    GLMevent*    events;
+    GLMarena     arena;         /* holds the arrays and event names */
+    GLboolean    malloced;      /* the arrays are from malloc instead, for
+                                   a model without an arena to take over */
+
+    /* number of each element in earlier chunks */
+    GLuint       vbase, nbase, tbase, fbase;
+} GLMchunk;
+
+/* _GLMrange: a run of consecutive triangles in the same group */
+typedef struct _GLMrange {
+    GLMgroup* group;
+    GLuint    material;
+    GLuint    start, end;
+} GLMrange;
+
+/* glmAddEvent: record a group/material event at the current triangle */
+static GLvoid
+glmAddEvent(GLMchunk* chunk, char type, char* name)
+{
+    chunk->events = (GLMevent*)glmGrow(&chunk->arena, chunk->events, &chunk->ecapacity,
+        chunk->numevents + 1, sizeof(GLMevent));
+    chunk->events[chunk->numevents].type = type;
+    chunk->events[chunk->numevents].triangle = chunk->numtriangles;
+    chunk->events[chunk->numevents].name =
+        strcpy((char*)glmArenaAlloc(&chunk->arena, strlen(name) + 1), name);
+    chunk->numevents++;
+}
+
+/* glmParseChunk: read the elements from one chunk of a Wavefront OBJ
+ * file, growing the chunk's arrays as elements are found.  Only
+ * touches the chunk, so chunks can be parsed concurrently.
+ *
+ * chunk - chunk with start and end set, and everything else zeroed
+ */
+static GLvoid
+glmParseChunk(GLMchunk* chunk)
+{
+    const char* p = chunk->start;
+    const char* end = chunk->end;
+    const char* t;
+    GLMtriangle* triangle;
+    GLuint corner[3][3];       /* v/t/n indices of the face's fan corners */
+    GLuint relative[3];        /* GLM_RELATIVE flags of the fan corners */
+    GLuint counts[3];
+    GLuint numcorners;
+    GLuint i, j, k;
+    size_t namelength;
+    int index[3];
+    char buf[128];
+    GLMarena* arrays = chunk->malloced ? NULL : &chunk->arena;
+
+    while (p < end) {
+        p = glmSkipSpace(p, end);
+        if (p >= end)
+            break;
+
+        switch (*p) {
+        case 'v':               /* v, vn, vt */
+            t = p + 1;
+            if (t < end && glmIsSpace(*t)) {
+                chunk->numvertices++;
+                chunk->vertices = (GLfloat*)glmGrow(arrays, chunk->vertices,
+                    &chunk->vcapacity, 3 * (chunk->numvertices + 1), sizeof(GLfloat));
+                p = glmParseFloats(t, end, &chunk->vertices[3 * chunk->numvertices], 3);
+            } else if (t < end && *t == 'n') {
+                chunk->numnormals++;
+                chunk->normals = (GLfloat*)glmGrow(arrays, chunk->normals,
+                    &chunk->ncapacity, 3 * (chunk->numnormals + 1), sizeof(GLfloat));
+                p = glmParseFloats(t + 1, end, &chunk->normals[3 * chunk->numnormals], 3);
+            } else if (t < end && *t == 't') {
+                chunk->numtexcoords++;
+                chunk->texcoords = (GLfloat*)glmGrow(arrays, chunk->texcoords,
+                    &chunk->tcapacity, 2 * (chunk->numtexcoords + 1), sizeof(GLfloat));
+                p = glmParseFloats(t + 1, end, &chunk->texcoords[2 * chunk->numtexcoords], 2);
+            } else {
+                glmParseWord(p, end, buf, sizeof(buf));
+                printf("glmParseChunk(): Unknown token \"%s\".\n", buf);
+                exit(1);
+            }
+            break;
+
+        case 'f':               /* face */
+            /* each corner can be one of %d, %d//%d, %d/%d, %d/%d/%d;
+               polygons are split into a fan of triangles */
+            p++;
+            numcorners = 0;
+            counts[0] = chunk->numvertices;
+            counts[1] = chunk->numtexcoords;
+            counts[2] = chunk->numnormals;
+            for (;;) {
+                p = glmSkipSpace(p, end);
+                if (!glmParseInt(&p, end, &index[0]))
+                    break;
+                index[1] = index[2] = 0;
+                if (p < end && *p == '/') {
+                    p++;
+                    glmParseInt(&p, end, &index[1]);
+                    if (p < end && *p == '/') {
+                        p++;
+                        glmParseInt(&p, end, &index[2]);
+                    }
+                }
+
+                j = numcorners < 3 ? numcorners : 2;
+                relative[j] = 0;
+                for (k = 0; k < 3; k++) {
+                    corner[j][k] = glmParseIndex(index[k], counts[k]);
+                    if (index[k] < 0)
+                        relative[j] |= GLM_RELATIVE(0, k);
+                }
+                numcorners++;
+                if (numcorners < 3)
+                    continue;
+
+                chunk->triangles = (GLMtriangle*)glmGrow(arrays, chunk->triangles,
+                    &chunk->fcapacity, chunk->numtriangles + 1, sizeof(GLMtriangle));
+                triangle = &chunk->triangles[chunk->numtriangles++];
+                triangle->findex = 0;
+                triangle->material = 0;
+                for (i = 0; i < 3; i++) {
+                    triangle->vindices[i] = corner[i][0];
+                    triangle->tindices[i] = corner[i][1];
+                    triangle->nindices[i] = corner[i][2];
+                    triangle->findex |= relative[i] << (3 * i);
+                }
+
+                /* the next triangle of the fan shares the first and
+                   last corners of this one */
+                for (i = 0; i < 3; i++)
+                    corner[1][i] = corner[2][i];
+                relative[1] = relative[2];
+            }
+            break;
+
+        case 'm':               /* mtllib */
+            t = glmParseWord(p, end, buf, sizeof(buf));
+            glmParseWord(t, end, buf, sizeof(buf));
+            glmAddEvent(chunk, 'm', buf);
+            break;
+
+        case 'u':               /* usemtl */
+            t = glmParseWord(p, end, buf, sizeof(buf));
+            glmParseWord(t, end, buf, sizeof(buf));
+            glmAddEvent(chunk, 'u', buf);
+            break;
+
+        case 'g':               /* group */
+            /* the name is the rest of the line, including the space
+               after the 'g' (as the fscanf/fgets reader produced) */
+            t = ++p;
+            while (p < end && *p != '\n')
+                p++;
+            namelength = p - t;
+            if (namelength > sizeof(buf) - 1)
+                namelength = sizeof(buf) - 1;
+            memcpy(buf, t, namelength);
+            buf[namelength] = '\0';
+#if SINGLE_STRING_GROUP_NAMES
+            glmParseWord(buf, buf + namelength, buf, sizeof(buf));
+#endif
+            glmAddEvent(chunk, 'g', buf);
+            break;
+        }
+
+        /* anything else (including comments) is ignored, as is any
+           extra data at the end of a line */
+        p = glmSkipLine(p, end);
+    }
+}
+
+/* glmParseChunkTask: runParallel task to parse chunk index */
+static GLvoid
+glmParseChunkTask(GLvoid* chunks, int index)
+{
+    glmParseChunk(&((GLMchunk*)chunks)[index]);
+}
+
+/* _GLMstitch: arguments to glmStitchChunkTask */
+typedef struct _GLMstitch {
+    GLMmodel* model;
+    GLMchunk* chunks;
+} GLMstitch;
+
+/* glmStitchChunkTask: runParallel task to copy chunk index into place
+ * in the model, offsetting its relative indices */
+static GLvoid
+glmStitchChunkTask(GLvoid* data, int index)
+{
+    GLMmodel* model = ((GLMstitch*)data)->model;
+    GLMchunk* chunk = &((GLMstitch*)data)->chunks[index];
+    GLMtriangle* triangle;
+    GLuint i, j;
+
+    if (chunk->numvertices)
+        memcpy(&model->vertices[3 * (chunk->vbase + 1)], &chunk->vertices[3],
+            sizeof(GLfloat) * 3 * chunk->numvertices);
+    if (chunk->numnormals)
+        memcpy(&model->normals[3 * (chunk->nbase + 1)], &chunk->normals[3],
+            sizeof(GLfloat) * 3 * chunk->numnormals);
+    if (chunk->numtexcoords)
+        memcpy(&model->texcoords[2 * (chunk->tbase + 1)], &chunk->texcoords[2],
+            sizeof(GLfloat) * 2 * chunk->numtexcoords);
+
+    for (i = 0; i < chunk->numtriangles; i++) {
+        triangle = &model->triangles[chunk->fbase + i];
+        *triangle = chunk->triangles[i];
+        if (!triangle->findex)
+            continue;
+        for (j = 0; j < 3; j++) {
+            if (triangle->findex & GLM_RELATIVE(j, 0))
+                triangle->vindices[j] += chunk->vbase;
+            if (triangle->findex & GLM_RELATIVE(j, 1))
+                triangle->tindices[j] += chunk->tbase;
+            if (triangle->findex & GLM_RELATIVE(j, 2))
+                triangle->nindices[j] += chunk->nbase;
+        }
+        triangle->findex = 0;
+    }
+}
+
+/* glmStitchChunks: combine parsed chunks into the model, then apply
+ * their group and material events in file order, and free them (or,
+ * if the model is in an arena and the arrays of a single chunk were
+ * taken over, move them into it).
+ *
+ * model     - properly initialized GLMmodel structure
+ * chunks    - parsed chunks, in file order
+ * numchunks - number of chunks
+ */
+static GLvoid
+glmStitchChunks(GLMmodel* model, GLMchunk* chunks, int numchunks)
+{
+    GLMstitch stitch;
+    GLMrange* ranges;
+    GLMevent* event;
+    GLMgroup* group;           /* current group */
+    GLuint material;           /* current material */
+    GLuint numranges, start;
+    GLuint i, j;
+    size_t held;
+    int c;
+
+    /* work out where each chunk's elements go */
+    for (c = 0; c < numchunks; c++) {
+        chunks[c].vbase = model->numvertices;
+        chunks[c].nbase = model->numnormals;
+        chunks[c].tbase = model->numtexcoords;
+        chunks[c].fbase = model->numtriangles;
+        model->numvertices  += chunks[c].numvertices;
+        model->numnormals   += chunks[c].numnormals;
+        model->numtexcoords += chunks[c].numtexcoords;
+        model->numtriangles += chunks[c].numtriangles;
+    }
+
+    if (numchunks == 1 && chunks[0].malloced) {
+        /* nothing to move, so just take over (and trim) the arrays */
+        model->vertices = (GLfloat*)realloc(chunks[0].vertices,
+            sizeof(GLfloat) * 3 * (model->numvertices + 1));
+        model->triangles = (GLMtriangle*)realloc(chunks[0].triangles,
+            sizeof(GLMtriangle) * (model->numtriangles ? model->numtriangles : 1));
+        if (model->numnormals) {
+            model->normals = (GLfloat*)realloc(chunks[0].normals,
+                sizeof(GLfloat) * 3 * (model->numnormals + 1));
+            chunks[0].normals = NULL;
+        }
+        if (model->numtexcoords) {
+            model->texcoords = (GLfloat*)realloc(chunks[0].texcoords,
+                sizeof(GLfloat) * 2 * (model->numtexcoords + 1));
+            chunks[0].texcoords = NULL;
+        }
+        chunks[0].vertices = NULL;
+        chunks[0].triangles = NULL;
+
+        /* relative indices are already relative to the start */
+        for (i = 0; i < model->numtriangles; i++)
+            model->triangles[i].findex = 0;
+    } else if (numchunks == 1 && model->arena && model->numvertices && model->numtriangles) {
+        /* likewise, leaving the arrays where they are in the arena */
+        model->vertices = chunks[0].vertices;
+        model->triangles = chunks[0].triangles;
+        if (model->numnormals)
+            model->normals = chunks[0].normals;
+        if (model->numtexcoords)
+            model->texcoords = chunks[0].texcoords;
+
+        /* relative indices are already relative to the start */
+        for (i = 0; i < model->numtriangles; i++)
+            model->triangles[i].findex = 0;
+    } else {
+        model->vertices = (GLfloat*)glmAlloc(model, sizeof(GLfloat) *
+            3 * (model->numvertices + 1));
+        model->triangles = (GLMtriangle*)glmAlloc(model, sizeof(GLMtriangle) *
+            (model->numtriangles ? model->numtriangles : 1));
+        if (model->numnormals) {
+            model->normals = (GLfloat*)glmAlloc(model, sizeof(GLfloat) *
+                3 * (model->numnormals + 1));
+        }
+        if (model->numtexcoords) {
+            model->texcoords = (GLfloat*)glmAlloc(model, sizeof(GLfloat) *
+                2 * (model->numtexcoords + 1));
+        }
+
+        stitch.model = model;
+        stitch.chunks = chunks;
+        runParallel(glmStitchChunkTask, &stitch, numchunks);
+    }
+
+    /* replay the events to find which group each run of triangles is
+       in (this has to be in order, as groups and materials carry on
+       from one chunk to the next) */
+    numranges = numchunks;
+    for (c = 0; c < numchunks; c++)
+        numranges += chunks[c].numevents;
+    ranges = (GLMrange*)glmAlloc(model, sizeof(GLMrange) * numranges);
+
+    group = glmAddGroup(model, (char*)"default");
+    material = 0;
+    numranges = 0;
+    for (c = 0; c < numchunks; c++) {
+        start = 0;
+        for (i = 0; i <= chunks[c].numevents; i++) {
+            event = i < chunks[c].numevents ? &chunks[c].events[i] : NULL;
+            ranges[numranges].group = group;
+            ranges[numranges].material = material;
+            ranges[numranges].start = chunks[c].fbase + start;
+            ranges[numranges].end   = chunks[c].fbase +
+                (event ? event->triangle : chunks[c].numtriangles);
+            group->numtriangles += ranges[numranges].end - ranges[numranges].start;
+            numranges++;
+            if (!event)
+                break;
+
+            start = event->triangle;
+            switch (event->type) {
+            case 'm':
+                model->mtllibname = glmStrdup(model, event->name);
+                glmReadMTL(model, event->name);
+                break;
+            case 'u':
+                group->material = material = glmFindMaterial(model, event->name);
+                break;
+            case 'g':
+                group = glmAddGroup(model, event->name);
+                group->material = material;
+                break;
+            }
+        }
+    }
+
+    /* now that the group sizes are known, fill in their triangles */
+    for (group = model->groups; group; group = group->next) {
+        group->triangles = (GLuint*)glmAlloc(model, sizeof(GLuint) * group->numtriangles);
+        group->numtriangles = 0;
+    }
+    for (i = 0; i < numranges; i++) {
+        group = ranges[i].group;
+        for (j = ranges[i].start; j < ranges[i].end; j++) {
+            group->triangles[group->numtriangles++] = j;
+            model->triangles[j].material = ranges[i].material;
+        }
+    }
+    glmFree(model, ranges);
+
+    /* free the chunks, counting what they held towards the model's
+       arena, as it all had to fit at once */
+    if (model->arena) {
+        held = model->arena->held;
+        for (c = 0; c < numchunks; c++)
+            held += chunks[c].arena.held;
+        if (held > model->arena->peak)
+            model->arena->peak = held;
+    }
+    for (c = 0; c < numchunks; c++) {
+        if (chunks[c].malloced) {
+            free(chunks[c].vertices);
+            free(chunks[c].normals);
+            free(chunks[c].texcoords);
+            free(chunks[c].triangles);
+        }
+        if (model->arena && model->vertices == chunks[c].vertices) {
+            glmArenaMerge(model->arena, &chunks[c].arena);
+        } else {
+            if (model->arena)
+                model->arena->allocated += chunks[c].arena.allocated;
+            glmArenaRelease(&chunks[c].arena);
+        }
+    }
+}
+
+/* glmParseOBJ: read a Wavefront OBJ file from memory in a single pass.
+ * Large files are split at line boundaries into chunks which are
+ * parsed in parallel on the worker threads and then stitched
+ * together.
+ *
+ * model  - properly initialized GLMmodel structure
+ * data   - contents of the file
+ * length - length of data in bytes
+ */
+static GLvoid
+glmParseOBJ(GLMmodel* model, const char* data, size_t length)
+{
+    GLMchunk* chunks;
+    const char* end = data + length;
+    const char* p;
+    size_t numchunks;
+    size_t c;
+
+    numchunks = length / GLM_CHUNK_SIZE;
+    if (numchunks > (size_t)(4 * numWorkers()))
+        numchunks = 4 * numWorkers();
+    if (numchunks < 1)
+        numchunks = 1;
+
+    chunks = (GLMchunk*)glmCalloc(model, numchunks, sizeof(GLMchunk));
+    p = data;
+    for (c = 0; c < numchunks; c++) {
+        chunks[c].start = p;
+        if (c + 1 < numchunks && data + (c + 1) * (length / numchunks) > p)
+            p = glmSkipLine(data + (c + 1) * (length / numchunks), end);
+        else if (c + 1 == numchunks)
+            p = end;
+        chunks[c].end = p;
+    }
+
+    /* without an arena, a single chunk's arrays can be handed straight
+       to the model (see glmStitchChunks) */
+    if (numchunks == 1 && !model->arena)
+        chunks[0].malloced = GL_TRUE;
+
+    runParallel(glmParseChunkTask, chunks, numchunks);
+    glmStitchChunks(model, chunks, numchunks);
+    glmFree(model, chunks);
+}
+
+
+/* public functions */
+
+
+/* glmArenaInit: Prepares an arena for use.
+ *
+ * arena - arena to initialize
+ */
+GLvoid
+glmArenaInit(GLMarena* arena)
+{
+    memset(arena, 0, sizeof(GLMarena));
+}
+
+/* glmArenaAlloc: Allocates memory from an arena, aligned to 16 bytes.
+ * Blocks grow with the arena, so that there are only ever a few of
+ * them.
+ *
+ * arena - initialized GLMarena structure
+ * size  - number of bytes to allocate
+ */
+GLvoid*
+glmArenaAlloc(GLMarena* arena, size_t size)
+{
+    GLMarenablock* block = arena->blocks;
+    size_t blocksize;
+
+    size = GLM_ARENA_ALIGN(size);
+    if (!block || block->size - block->used < size) {
+        blocksize = arena->held > GLM_ARENA_BLOCK_SIZE ? arena->held : GLM_ARENA_BLOCK_SIZE;
+        if (blocksize < size)
+            blocksize = size;
+        block = (GLMarenablock*)malloc(GLM_ARENA_HEADER + blocksize);
+        if (!block) {
+            fprintf(stderr, "glmArenaAlloc() failed: out of memory.\n");
+            exit(1);
+        }
+        block->next = arena->blocks;
+        block->size = blocksize;
+        block->used = 0;
+        block->last = 0;
+        arena->blocks = block;
+        arena->held += GLM_ARENA_HEADER + blocksize;
+        if (arena->held > arena->peak)
+            arena->peak = arena->held;
+    }
+
+    block->last = block->used;
+    block->used += size;
+    arena->allocated += size;
+    return (char*)block + GLM_ARENA_HEADER + block->last;
+}
+
+/* glmArenaRelease: Reports the usage of an arena (if it has a report
+ * hook) and frees all of its memory at once.  The arena may then be
+ * used again.
+ *
+ * arena - initialized GLMarena structure
+ */
+GLvoid
+glmArenaRelease(GLMarena* arena)
+{
+    GLMarenablock* block;
+
+    if (arena->report)
+        arena->report(arena->name ? arena->name : "arena", arena->allocated, arena->peak);
+
+    while ((block = arena->blocks)) {
+        arena->blocks = block->next;
+        free(block);
+    }
+    arena->allocated = 0;
+    arena->held = 0;
+    arena->peak = 0;
+    arena->name = NULL;
+}
+
+
+/* The geometry kernels below come in a scalar reference version and,
+ * on x86, SSE and AVX2 versions picked at run time (see glmSIMD).
+ * Vertices are stored as x, y, z triplets, so 4 vertices fill 3 SSE
+ * registers and 8 vertices fill 3 AVX registers, with the components
+ * in the same lanes of every such block.  Per-component constants are
+ * laid out the same way (see glmPattern).  The facet normal kernels
+ * load the corners of 4 or 8 triangles and transpose them into one
+ * register per component, to work on those blocks.  The SIMD versions
+ * do the same operations as the scalar ones, in the same order (and
+ * without fused multiply-adds), so they give the same results.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GLM_X86 1
+#include <immintrin.h>
+#define GLM_SSE    __attribute__((target("sse2")))
+#define GLM_AVX2   __attribute__((target("avx2")))
+/* for helpers shared by the SSE and AVX2 kernels, which must be built
+ * into each so as not to mix SSE and AVX code */
+#define GLM_INLINE __inline__ __attribute__((always_inline))
+#endif
+
+/* _GLMkernels: one implementation of each geometry kernel */
+typedef struct _GLMkernels {
+    /* grow min and max to bound n vertices */
+    GLvoid (*bounds)(const GLfloat* vertices, GLuint n, GLfloat* min, GLfloat* max);
+    /* (vertex - center) * scale for n vertices */
+    GLvoid (*transform)(GLfloat* vertices, GLuint n, const GLfloat* center, GLfloat scale);
+    /* negate n floats */
+    GLvoid (*negate)(GLfloat* values, GLuint n);
+    /* facet normals of triangles first up to numtriangles */
+    GLvoid (*facetnorms)(GLMmodel* model, GLuint first);
+} GLMkernels;
+
+/* glmPattern: fill pattern with count floats repeating the three
+ * components of v, to line up with a block of vertices */
+static GLvoid
+glmPattern(const GLfloat* v, GLfloat* pattern, GLuint count)
+{
+    GLuint i;
+
+    for (i = 0; i < count; i++)
+        pattern[i] = v[i % 3];
+}
+
+static GLvoid
+glmBoundsScalar(const GLfloat* vertices, GLuint n, GLfloat* min, GLfloat* max)
+{
+    GLuint i, k;
+
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 3; k++) {
+            if (max[k] < vertices[3 * i + k])
+                max[k] = vertices[3 * i + k];
+            if (min[k] > vertices[3 * i + k])
+                min[k] = vertices[3 * i + k];
+        }
+    }
+}
+
+static GLvoid
+glmTransformScalar(GLfloat* vertices, GLuint n, const GLfloat* center, GLfloat scale)
+{
+    GLuint i, k;
+
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 3; k++) {
+            vertices[3 * i + k] -= center[k];
+            vertices[3 * i + k] *= scale;
+        }
+    }
+}
+
+static GLvoid
+glmNegateScalar(GLfloat* values, GLuint n)
+{
+    GLuint i;
+
+    for (i = 0; i < n; i++)
+        values[i] = -values[i];
+}
+
+static GLvoid
+glmFacetNormalsScalar(GLMmodel* model, GLuint first)
+{
+    GLuint  i;
+    GLfloat u[3];
+    GLfloat v[3];
+
+    for (i = first; i < model->numtriangles; i++) {
+        model->triangles[i].findex = i+1;
+
+        u[0] = model->vertices[3 * T(i).vindices[1] + 0] -
+            model->vertices[3 * T(i).vindices[0] + 0];
+        u[1] = model->vertices[3 * T(i).vindices[1] + 1] -
+            model->vertices[3 * T(i).vindices[0] + 1];
+        u[2] = model->vertices[3 * T(i).vindices[1] + 2] -
+            model->vertices[3 * T(i).vindices[0] + 2];
+
+        v[0] = model->vertices[3 * T(i).vindices[2] + 0] -
+            model->vertices[3 * T(i).vindices[0] + 0];
+        v[1] = model->vertices[3 * T(i).vindices[2] + 1] -
+            model->vertices[3 * T(i).vindices[0] + 1];
+        v[2] = model->vertices[3 * T(i).vindices[2] + 2] -
+            model->vertices[3 * T(i).vindices[0] + 2];
+
+        glmCross(u, v, &model->facetnorms[3 * (i+1)]);
+        glmNormalize(&model->facetnorms[3 * (i+1)]);
+    }
+}
+
+static const GLMkernels glmScalarKernels = {
+    glmBoundsScalar, glmTransformScalar, glmNegateScalar, glmFacetNormalsScalar
+};
+
+#ifdef GLM_X86
+
+/* glmBoundsReduce: fold the bounds kept in each lane of a block of
+ * count floats into min and max */
+static GLvoid
+glmBoundsReduce(const GLfloat* lanemin, const GLfloat* lanemax, GLuint count,
+                GLfloat* min, GLfloat* max)
+{
+    GLuint i;
+
+    for (i = 0; i < count; i++) {
+        if (max[i % 3] < lanemax[i])
+            max[i % 3] = lanemax[i];
+        if (min[i % 3] > lanemin[i])
+            min[i % 3] = lanemin[i];
+    }
+}
+
+GLM_SSE static GLvoid
+glmBoundsSSE(const GLfloat* vertices, GLuint n, GLfloat* min, GLfloat* max)
+{
+    GLfloat lanemin[12], lanemax[12];
+    __m128 min0, min1, min2, max0, max1, max2, a, b, c;
+    GLuint i, blocks = n / 4;
+
+    glmPattern(min, lanemin, 12);
+    glmPattern(max, lanemax, 12);
+    min0 = _mm_loadu_ps(lanemin + 0); max0 = _mm_loadu_ps(lanemax + 0);
+    min1 = _mm_loadu_ps(lanemin + 4); max1 = _mm_loadu_ps(lanemax + 4);
+    min2 = _mm_loadu_ps(lanemin + 8); max2 = _mm_loadu_ps(lanemax + 8);
+    for (i = 0; i < blocks; i++) {
+        a = _mm_loadu_ps(vertices + 12 * i + 0);
+        b = _mm_loadu_ps(vertices + 12 * i + 4);
+        c = _mm_loadu_ps(vertices + 12 * i + 8);
+        min0 = _mm_min_ps(min0, a); max0 = _mm_max_ps(max0, a);
+        min1 = _mm_min_ps(min1, b); max1 = _mm_max_ps(max1, b);
+        min2 = _mm_min_ps(min2, c); max2 = _mm_max_ps(max2, c);
+    }
+    _mm_storeu_ps(lanemin + 0, min0); _mm_storeu_ps(lanemax + 0, max0);
+    _mm_storeu_ps(lanemin + 4, min1); _mm_storeu_ps(lanemax + 4, max1);
+    _mm_storeu_ps(lanemin + 8, min2); _mm_storeu_ps(lanemax + 8, max2);
+
+    glmBoundsScalar(vertices + 12 * blocks, n - 4 * blocks, min, max);
+    glmBoundsReduce(lanemin, lanemax, 12, min, max);
+}
+
+GLM_SSE static GLvoid
+glmTransformSSE(GLfloat* vertices, GLuint n, const GLfloat* center, GLfloat scale)
+{
+    GLfloat pattern[12];
+    __m128 c0, c1, c2, s;
+    GLuint i, blocks = n / 4;
+
+    glmPattern(center, pattern, 12);
+    c0 = _mm_loadu_ps(pattern + 0);
+    c1 = _mm_loadu_ps(pattern + 4);
+    c2 = _mm_loadu_ps(pattern + 8);
+    s = _mm_set1_ps(scale);
+    for (i = 0; i < blocks; i++) {
+        GLfloat* v = vertices + 12 * i;
+        _mm_storeu_ps(v + 0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v + 0), c0), s));
+        _mm_storeu_ps(v + 4, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v + 4), c1), s));
+        _mm_storeu_ps(v + 8, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v + 8), c2), s));
+    }
+    glmTransformScalar(vertices + 12 * blocks, n - 4 * blocks, center, scale);
+}
+
+GLM_SSE static GLvoid
+glmNegateSSE(GLfloat* values, GLuint n)
+{
+    __m128 sign = _mm_set1_ps(-0.0f);
+    GLuint i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(values + i, _mm_xor_ps(_mm_loadu_ps(values + i), sign));
+    glmNegateScalar(values + i, n - i);
+}
+
+/* glmLoadVertex: load vertex i as (x, y, z, anything), without reading
+ * past the last vertex */
+GLM_SSE static GLM_INLINE __m128
+glmLoadVertex(const GLfloat* vertices, GLuint numvertices, GLuint i)
+{
+    const GLfloat* v = &vertices[3 * i];
+
+    if (i < numvertices)
+        return _mm_loadu_ps(v);
+    return _mm_setr_ps(v[0], v[1], v[2], 0.0f);
+}
+
+/* glmLoadCorners: load one corner of 4 triangles, a component per
+ * register */
+GLM_SSE static GLM_INLINE GLvoid
+glmLoadCorners(const GLfloat* vertices, GLuint numvertices, const GLMtriangle* triangles,
+               GLuint corner, __m128* p)
+{
+    __m128 a = glmLoadVertex(vertices, numvertices, triangles[0].vindices[corner]);
+    __m128 b = glmLoadVertex(vertices, numvertices, triangles[1].vindices[corner]);
+    __m128 c = glmLoadVertex(vertices, numvertices, triangles[2].vindices[corner]);
+    __m128 d = glmLoadVertex(vertices, numvertices, triangles[3].vindices[corner]);
 
-    /* spit out a header */
-    fprintf(file, "#  \n");
-    fprintf(file, "#  Wavefront MTL generated by GLM library\n");
-    fprintf(file, "#  \n");
-    fprintf(file, "#  GLM library\n");
-    fprintf(file, "#  Nate Robins\n");
-    fprintf(file, "#  ndr@pobox.com\n");
-    fprintf(file, "#  http://www.pobox.com/~ndr\n");
-    fprintf(file, "#  \n\n");
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    p[0] = a; p[1] = b; p[2] = c;
+}
 
-    for (i = 0; i < model->nummaterials; i++) {
-        material = &model->materials[i];
-        fprintf(file, "newmtl %s\n", material->name);
-        fprintf(file, "Ka %f %f %f\n",
-            material->ambient[0], material->ambient[1], material->ambient[2]);
-        fprintf(file, "Kd %f %f %f\n",
-            material->diffuse[0], material->diffuse[1], material->diffuse[2]);
-        fprintf(file, "Ks %f %f %f\n",
-            material->specular[0],material->specular[1],material->specular[2]);
-        fprintf(file, "Ns %f\n", material->shininess / 128.0 * 1000.0);
-        fprintf(file, "\n");
-    }
+/* glmStoreFacetNorms: store 4 facet normals, given a component per
+ * register.  Each store spills into the next normal, so the normal
+ * after these must be stored afterwards. */
+GLM_SSE static GLM_INLINE GLvoid
+glmStoreFacetNorms(GLfloat* facetnorms, __m128 x, __m128 y, __m128 z)
+{
+    __m128 w = _mm_setzero_ps();
 
-    fclose(file);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(facetnorms + 0, x);
+    _mm_storeu_ps(facetnorms + 3, y);
+    _mm_storeu_ps(facetnorms + 6, z);
+    _mm_storeu_ps(facetnorms + 9, w);
 }
 
+GLM_SSE static GLvoid
+glmFacetNormalsSSE(GLMmodel* model, GLuint first)
+{
+    const GLfloat* vertices = model->vertices;
+    GLuint numvertices = model->numvertices;
+    GLMtriangle* triangles = model->triangles;
+    GLfloat* facetnorms = model->facetnorms;
+    __m128 p0[3], p1[3], p2[3];
+    __m128 ux, uy, uz, vx, vy, vz, nx, ny, nz, l;
+    GLuint i, j, end;
+
+    /* the last triangle is left to the scalar kernel, as the stores
+     * spill past its normal */
+    end = first;
+    if (model->numtriangles > first)
+        end += (model->numtriangles - first - 1) / 4 * 4;
+
+    for (i = first; i < end; i += 4) {
+        glmLoadCorners(vertices, numvertices, &triangles[i], 0, p0);
+        glmLoadCorners(vertices, numvertices, &triangles[i], 1, p1);
+        glmLoadCorners(vertices, numvertices, &triangles[i], 2, p2);
+
+        ux = _mm_sub_ps(p1[0], p0[0]);
+        uy = _mm_sub_ps(p1[1], p0[1]);
+        uz = _mm_sub_ps(p1[2], p0[2]);
+        vx = _mm_sub_ps(p2[0], p0[0]);
+        vy = _mm_sub_ps(p2[1], p0[1]);
+        vz = _mm_sub_ps(p2[2], p0[2]);
+
+        nx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+        ny = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+        nz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+        l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)),
+                                   _mm_mul_ps(nz, nz)));
+
+        glmStoreFacetNorms(&facetnorms[3 * (i + 1)], _mm_div_ps(nx, l), _mm_div_ps(ny, l), _mm_div_ps(nz, l));
+        for (j = 0; j < 4; j++)
+            triangles[i + j].findex = i + j + 1;
+    }
+    glmFacetNormalsScalar(model, end);
+}
 
-/* glmFirstPass: first pass at a Wavefront OBJ file that gets all the
- * statistics of the model (such as #vertices, #normals, etc)
- *
- * model - properly initialized GLMmodel structure
- * file  - (fopen'd) file descriptor
- */
-static GLvoid
-glmFirstPass(GLMmodel* model, FILE* file)
+static const GLMkernels glmSSEKernels = {
+    glmBoundsSSE, glmTransformSSE, glmNegateSSE, glmFacetNormalsSSE
+};
+
+GLM_AVX2 static GLvoid
+glmBoundsAVX2(const GLfloat* vertices, GLuint n, GLfloat* min, GLfloat* max)
 {
-    GLuint numvertices;        /* number of vertices in model */
-    GLuint numnormals;         /* number of normals in model */
-    GLuint numtexcoords;       /* number of texcoords in model */
-    GLuint numtriangles;       /* number of triangles in model */
-    GLMgroup* group;           /* current group */
-    int v, n, t;
-    char buf[128];
+    GLfloat lanemin[24], lanemax[24];
+    __m256 min0, min1, min2, max0, max1, max2, a, b, c;
+    GLuint i, blocks = n / 8;
+
+    glmPattern(min, lanemin, 24);
+    glmPattern(max, lanemax, 24);
+    min0 = _mm256_loadu_ps(lanemin + 0);  max0 = _mm256_loadu_ps(lanemax + 0);
+    min1 = _mm256_loadu_ps(lanemin + 8);  max1 = _mm256_loadu_ps(lanemax + 8);
+    min2 = _mm256_loadu_ps(lanemin + 16); max2 = _mm256_loadu_ps(lanemax + 16);
+    for (i = 0; i < blocks; i++) {
+        a = _mm256_loadu_ps(vertices + 24 * i + 0);
+        b = _mm256_loadu_ps(vertices + 24 * i + 8);
+        c = _mm256_loadu_ps(vertices + 24 * i + 16);
+        min0 = _mm256_min_ps(min0, a); max0 = _mm256_max_ps(max0, a);
+        min1 = _mm256_min_ps(min1, b); max1 = _mm256_max_ps(max1, b);
+        min2 = _mm256_min_ps(min2, c); max2 = _mm256_max_ps(max2, c);
+    }
+    _mm256_storeu_ps(lanemin + 0, min0);  _mm256_storeu_ps(lanemax + 0, max0);
+    _mm256_storeu_ps(lanemin + 8, min1);  _mm256_storeu_ps(lanemax + 8, max1);
+    _mm256_storeu_ps(lanemin + 16, min2); _mm256_storeu_ps(lanemax + 16, max2);
+
+    glmBoundsScalar(vertices + 24 * blocks, n - 8 * blocks, min, max);
+    glmBoundsReduce(lanemin, lanemax, 24, min, max);
+}
 
-    /* make a default group */
-    group = glmAddGroup(model, (char*)"default");
+GLM_AVX2 static GLvoid
+glmTransformAVX2(GLfloat* vertices, GLuint n, const GLfloat* center, GLfloat scale)
+{
+    GLfloat pattern[24];
+    __m256 c0, c1, c2, s;
+    GLuint i, blocks = n / 8;
+
+    glmPattern(center, pattern, 24);
+    c0 = _mm256_loadu_ps(pattern + 0);
+    c1 = _mm256_loadu_ps(pattern + 8);
+    c2 = _mm256_loadu_ps(pattern + 16);
+    s = _mm256_set1_ps(scale);
+    for (i = 0; i < blocks; i++) {
+        GLfloat* v = vertices + 24 * i;
+        _mm256_storeu_ps(v + 0,  _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(v + 0),  c0), s));
+        _mm256_storeu_ps(v + 8,  _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(v + 8),  c1), s));
+        _mm256_storeu_ps(v + 16, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(v + 16), c2), s));
+    }
+    glmTransformScalar(vertices + 24 * blocks, n - 8 * blocks, center, scale);
+}
 
-    numvertices = numnormals = numtexcoords = numtriangles = 0;
-    while(fscanf(file, "%s", buf) != EOF) {
-        switch(buf[0]) {
-        case '#':               /* comment */
-            /* eat up rest of line */
-            fgets(buf, sizeof(buf), file);
-            break;
-        case 'v':               /* v, vn, vt */
-            switch(buf[1]) {
-            case '\0':          /* vertex */
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                numvertices++;
-                break;
-            case 'n':           /* normal */
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                numnormals++;
-                break;
-            case 't':           /* texcoord */
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                numtexcoords++;
-                break;
-            default:
-                printf("glmFirstPass(): Unknown token \"%s\".\n", buf);
-                exit(1);
-                break;
-            }
-            break;
-            case 'm':
-                fgets(buf, sizeof(buf), file);
-                sscanf(buf, "%s %s", buf, buf);
-                model->mtllibname = strdup(buf);
-                glmReadMTL(model, buf);
-                break;
-            case 'u':
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                break;
-            case 'g':               /* group */
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-#if SINGLE_STRING_GROUP_NAMES
-                sscanf(buf, "%s", buf);
-#else
-                buf[strlen(buf)-1] = '\0';  /* nuke '\n' */
-#endif
-                group = glmAddGroup(model, buf);
-                break;
-            case 'f':               /* face */
-                v = n = t = 0;
-                fscanf(file, "%s", buf);
-                /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-                if (strstr(buf, "//")) {
-                    /* v//n */
-                    sscanf(buf, "%d//%d", &v, &n);
-                    fscanf(file, "%d//%d", &v, &n);
-                    fscanf(file, "%d//%d", &v, &n);
-                    numtriangles++;
-                    group->numtriangles++;
-                    while(fscanf(file, "%d//%d", &v, &n) > 0) {
-                        numtriangles++;
-                        group->numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d/%d", &v, &t, &n) == 3) {
-                    /* v/t/n */
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    numtriangles++;
-                    group->numtriangles++;
-                    while(fscanf(file, "%d/%d/%d", &v, &t, &n) > 0) {
-                        numtriangles++;
-                        group->numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d", &v, &t) == 2) {
-                    /* v/t */
-                    fscanf(file, "%d/%d", &v, &t);
-                    fscanf(file, "%d/%d", &v, &t);
-                    numtriangles++;
-                    group->numtriangles++;
-                    while(fscanf(file, "%d/%d", &v, &t) > 0) {
-                        numtriangles++;
-                        group->numtriangles++;
-                    }
-                } else {
-                    /* v */
-                    fscanf(file, "%d", &v);
-                    fscanf(file, "%d", &v);
-                    numtriangles++;
-                    group->numtriangles++;
-                    while(fscanf(file, "%d", &v) > 0) {
-                        numtriangles++;
-                        group->numtriangles++;
-                    }
-                }
-                break;
+GLM_AVX2 static GLvoid
+glmNegateAVX2(GLfloat* values, GLuint n)
+{
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    GLuint i;
 
-            default:
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                break;
-        }
-  }
+    for (i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(values + i, _mm256_xor_ps(_mm256_loadu_ps(values + i), sign));
+    glmNegateScalar(values + i, n - i);
+}
 
-  /* set the stats in the model structure */
-  model->numvertices  = numvertices;
-  model->numnormals   = numnormals;
-  model->numtexcoords = numtexcoords;
-  model->numtriangles = numtriangles;
+/* glmLoadCorners8: load one corner of 8 triangles, a component per
+ * register */
+GLM_AVX2 static GLM_INLINE GLvoid
+glmLoadCorners8(const GLfloat* vertices, GLuint numvertices, const GLMtriangle* triangles,
+                GLuint corner, __m256* p)
+{
+    __m128 low[3], high[3];
+    GLuint k;
 
-  /* allocate memory for the triangles in each group */
-  group = model->groups;
-  while(group) {
-      group->triangles = (GLuint*)malloc(sizeof(GLuint) * group->numtriangles);
-      group->numtriangles = 0;
-      group = group->next;
-  }
+    glmLoadCorners(vertices, numvertices, triangles, corner, low);
+    glmLoadCorners(vertices, numvertices, triangles + 4, corner, high);
+    for (k = 0; k < 3; k++)
+        p[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(low[k]), high[k], 1);
 }
 
-/* glmSecondPass: second pass at a Wavefront OBJ file that gets all
- * the data.
- *
- * model - properly initialized GLMmodel structure
- * file  - (fopen'd) file descriptor
- */
-static GLvoid
-glmSecondPass(GLMmodel* model, FILE* file)
-{
-    GLuint numvertices;        /* number of vertices in model */
-    GLuint numnormals;         /* number of normals in model */
-    GLuint numtexcoords;       /* number of texcoords in model */
-    GLuint numtriangles;       /* number of triangles in model */
-    GLfloat* vertices;         /* array of vertices  */
-    GLfloat* normals;          /* array of normals */
-    GLfloat* texcoords;        /* array of texture coordinates */
-    GLMgroup* group;           /* current group pointer */
-    GLuint material;           /* current material */
-    int v, n, t;
-    char buf[128];
+GLM_AVX2 static GLvoid
+glmFacetNormalsAVX2(GLMmodel* model, GLuint first)
+{
+    const GLfloat* vertices = model->vertices;
+    GLuint numvertices = model->numvertices;
+    GLMtriangle* triangles = model->triangles;
+    GLfloat* facetnorms = model->facetnorms;
+    __m256 p0[3], p1[3], p2[3];
+    __m256 ux, uy, uz, vx, vy, vz, nx, ny, nz, l;
+    GLuint i, j, end;
+
+    /* the last triangle is left to the scalar kernel, as the stores
+     * spill past its normal */
+    end = first;
+    if (model->numtriangles > first)
+        end += (model->numtriangles - first - 1) / 8 * 8;
+
+    for (i = first; i < end; i += 8) {
+        glmLoadCorners8(vertices, numvertices, &triangles[i], 0, p0);
+        glmLoadCorners8(vertices, numvertices, &triangles[i], 1, p1);
+        glmLoadCorners8(vertices, numvertices, &triangles[i], 2, p2);
+
+        ux = _mm256_sub_ps(p1[0], p0[0]);
+        uy = _mm256_sub_ps(p1[1], p0[1]);
+        uz = _mm256_sub_ps(p1[2], p0[2]);
+        vx = _mm256_sub_ps(p2[0], p0[0]);
+        vy = _mm256_sub_ps(p2[1], p0[1]);
+        vz = _mm256_sub_ps(p2[2], p0[2]);
+
+        nx = _mm256_sub_ps(_mm256_mul_ps(uy, vz), _mm256_mul_ps(uz, vy));
+        ny = _mm256_sub_ps(_mm256_mul_ps(uz, vx), _mm256_mul_ps(ux, vz));
+        nz = _mm256_sub_ps(_mm256_mul_ps(ux, vy), _mm256_mul_ps(uy, vx));
+        l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)),
+                                         _mm256_mul_ps(nz, nz)));
+        nx = _mm256_div_ps(nx, l);
+        ny = _mm256_div_ps(ny, l);
+        nz = _mm256_div_ps(nz, l);
+
+        glmStoreFacetNorms(&facetnorms[3 * (i + 1)], _mm256_castps256_ps128(nx),
+                           _mm256_castps256_ps128(ny), _mm256_castps256_ps128(nz));
+        glmStoreFacetNorms(&facetnorms[3 * (i + 5)], _mm256_extractf128_ps(nx, 1),
+                           _mm256_extractf128_ps(ny, 1), _mm256_extractf128_ps(nz, 1));
+        for (j = 0; j < 8; j++)
+            triangles[i + j].findex = i + j + 1;
+    }
+    glmFacetNormalsScalar(model, end);
+}
 
-    /* set the pointer shortcuts */
-    vertices       = model->vertices;
-    normals    = model->normals;
-    texcoords    = model->texcoords;
-    group      = model->groups;
+static const GLMkernels glmAVX2Kernels = {
+    glmBoundsAVX2, glmTransformAVX2, glmNegateAVX2, glmFacetNormalsAVX2
+};
 
-    /* on the second pass through the file, read all the data into the
-    allocated arrays */
-    numvertices = numnormals = numtexcoords = 1;
-    numtriangles = 0;
-    material = 0;
-    while(fscanf(file, "%s", buf) != EOF) {
-        switch(buf[0]) {
-        case '#':               /* comment */
-            /* eat up rest of line */
-            fgets(buf, sizeof(buf), file);
-            break;
-        case 'v':               /* v, vn, vt */
-            switch(buf[1]) {
-            case '\0':          /* vertex */
-                fscanf(file, "%f %f %f",
-                    &vertices[3 * numvertices + 0],
-                    &vertices[3 * numvertices + 1],
-                    &vertices[3 * numvertices + 2]);
-                numvertices++;
-                break;
-            case 'n':           /* normal */
-                fscanf(file, "%f %f %f",
-                    &normals[3 * numnormals + 0],
-                    &normals[3 * numnormals + 1],
-                    &normals[3 * numnormals + 2]);
-                numnormals++;
-                break;
-            case 't':           /* texcoord */
-                fscanf(file, "%f %f",
-                    &texcoords[2 * numtexcoords + 0],
-                    &texcoords[2 * numtexcoords + 1]);
-                numtexcoords++;
-                break;
-            }
-            break;
-            case 'u':
-                fgets(buf, sizeof(buf), file);
-                sscanf(buf, "%s %s", buf, buf);
-                group->material = material = glmFindMaterial(model, buf);
-                break;
-            case 'g':               /* group */
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-#if SINGLE_STRING_GROUP_NAMES
-                sscanf(buf, "%s", buf);
-#else
-                buf[strlen(buf)-1] = '\0';  /* nuke '\n' */
-#endif
-                group = glmFindGroup(model, buf);
-                group->material = material;
-                break;
-            case 'f':               /* face */
-                v = n = t = 0;
-                fscanf(file, "%s", buf);
-                /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-                if (strstr(buf, "//")) {
-                    /* v//n */
-                    sscanf(buf, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[0] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[1] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d//%d", &v, &n);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d//%d", &v, &n) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d/%d", &v, &t, &n) == 3) {
-                    /* v/t/n */
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[0] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[0] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[1] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[1] = n < 0 ? n + numnormals : n;
-                    fscanf(file, "%d/%d/%d", &v, &t, &n);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                    T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d/%d/%d", &v, &t, &n) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-                        T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-                        T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                        T(numtriangles).nindices[2] = n < 0 ? n + numnormals : n;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else if (sscanf(buf, "%d/%d", &v, &t) == 2) {
-                    /* v/t */
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[0] = t < 0 ? t + numtexcoords : t;
-                    fscanf(file, "%d/%d", &v, &t);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[1] = t < 0 ? t + numtexcoords : t;
-                    fscanf(file, "%d/%d", &v, &t);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d/%d", &v, &t) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        T(numtriangles).tindices[2] = t < 0 ? t + numtexcoords : t;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                } else {
-                    /* v */
-                    sscanf(buf, "%d", &v);
-                    T(numtriangles).vindices[0] = v < 0 ? v + numvertices : v;
-                    fscanf(file, "%d", &v);
-                    T(numtriangles).vindices[1] = v < 0 ? v + numvertices : v;
-                    fscanf(file, "%d", &v);
-                    T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                    group->triangles[group->numtriangles++] = numtriangles;
-                    numtriangles++;
-                    while(fscanf(file, "%d", &v) > 0) {
-                        T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-                        T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-                        T(numtriangles).vindices[2] = v < 0 ? v + numvertices : v;
-                        group->triangles[group->numtriangles++] = numtriangles;
-                        numtriangles++;
-                    }
-                }
-                break;
+#endif /* GLM_X86 */
 
-            default:
-                /* eat up rest of line */
-                fgets(buf, sizeof(buf), file);
-                break;
-    }
-  }
+/* the kernels in use; glmPickKernels sets the widest supported ones
+   before main runs, so threads loading models only ever read this */
+static const GLMkernels* glmKernelsInUse = &glmScalarKernels;
 
-#if 0
-  /* announce the memory requirements */
-  printf(" Memory: %d bytes\n",
-      numvertices  * 3*sizeof(GLfloat) +
-      numnormals   * 3*sizeof(GLfloat) * (numnormals ? 1 : 0) +
-      numtexcoords * 3*sizeof(GLfloat) * (numtexcoords ? 1 : 0) +
-      numtriangles * sizeof(GLMtriangle));
+/* glmSupportedSIMD: the widest kernels this CPU can run */
+static GLuint
+glmSupportedSIMD(GLvoid)
+{
+#ifdef GLM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return GLM_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return GLM_SIMD_SSE;
+#endif
+    return GLM_SIMD_NONE;
+}
+
+GLuint
+glmSIMD(GLuint level)
+{
+    GLuint supported = glmSupportedSIMD();
+
+    if (level > supported)
+        level = supported;
+    switch (level) {
+#ifdef GLM_X86
+    case GLM_SIMD_AVX2: glmKernelsInUse = &glmAVX2Kernels; break;
+    case GLM_SIMD_SSE:  glmKernelsInUse = &glmSSEKernels;  break;
 #endif
+    default:            glmKernelsInUse = &glmScalarKernels; level = GLM_SIMD_NONE; break;
+    }
+    return level;
 }
 
+/* glmPickKernels: pick the widest supported kernels at startup */
+static GLvoid __attribute__((constructor))
+glmPickKernels(GLvoid)
+{
+    glmSIMD(GLM_SIMD_BEST);
+}
 
-/* public functions */
+static const GLMkernels*
+glmKernels(GLvoid)
+{
+    return glmKernelsInUse;
+}
 
 
 /* glmUnitize: "unitize" a model by translating it to the origin and
@@ -773,57 +1992,34 @@ glmSecondPass(GLMmodel* model, FILE* file)
 GLfloat
 glmUnitize(GLMmodel* model)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
-    GLfloat cx, cy, cz, w, h, d;
+    GLfloat max[3], min[3], center[3];
+    GLfloat w, h, d;
     GLfloat scale;
 
     assert(model);
     assert(model->vertices);
 
     /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
-    }
+    max[0] = min[0] = model->vertices[3 + 0];
+    max[1] = min[1] = model->vertices[3 + 1];
+    max[2] = min[2] = model->vertices[3 + 2];
+    glmKernels()->bounds(&model->vertices[3], model->numvertices, min, max);
 
     /* calculate model width, height, and depth */
-    w = glmAbs(maxx) + glmAbs(minx);
-    h = glmAbs(maxy) + glmAbs(miny);
-    d = glmAbs(maxz) + glmAbs(minz);
+    w = glmAbs(max[0]) + glmAbs(min[0]);
+    h = glmAbs(max[1]) + glmAbs(min[1]);
+    d = glmAbs(max[2]) + glmAbs(min[2]);
 
     /* calculate center of the model */
-    cx = (maxx + minx) / 2.0;
-    cy = (maxy + miny) / 2.0;
-    cz = (maxz + minz) / 2.0;
+    center[0] = (max[0] + min[0]) / 2.0;
+    center[1] = (max[1] + min[1]) / 2.0;
+    center[2] = (max[2] + min[2]) / 2.0;
 
     /* calculate unitizing scale factor */
     scale = 2.0 / glmMax(glmMax(w, h), d);
 
     /* translate around center then scale */
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] -= cx;
-        model->vertices[3 * i + 1] -= cy;
-        model->vertices[3 * i + 2] -= cz;
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
-    }
+    glmKernels()->transform(&model->vertices[3], model->numvertices, center, scale);
 
     return scale;
 }
@@ -837,38 +2033,22 @@ glmUnitize(GLMmodel* model)
 GLvoid
 glmDimensions(GLMmodel* model, GLfloat* dimensions)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
+    GLfloat max[3], min[3];
 
     assert(model);
     assert(model->vertices);
     assert(dimensions);
 
     /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
-    }
+    max[0] = min[0] = model->vertices[3 + 0];
+    max[1] = min[1] = model->vertices[3 + 1];
+    max[2] = min[2] = model->vertices[3 + 2];
+    glmKernels()->bounds(&model->vertices[3], model->numvertices, min, max);
 
     /* calculate model width, height, and depth */
-    dimensions[0] = glmAbs(maxx) + glmAbs(minx);
-    dimensions[1] = glmAbs(maxy) + glmAbs(miny);
-    dimensions[2] = glmAbs(maxz) + glmAbs(minz);
+    dimensions[0] = glmAbs(max[0]) + glmAbs(min[0]);
+    dimensions[1] = glmAbs(max[1]) + glmAbs(min[1]);
+    dimensions[2] = glmAbs(max[2]) + glmAbs(min[2]);
 }
 
 /* glmScale: Scales a model by a given amount.
@@ -879,13 +2059,9 @@ glmDimensions(GLMmodel* model, GLfloat* dimensions)
 GLvoid
 glmScale(GLMmodel* model, GLfloat scale)
 {
-    GLuint i;
+    static const GLfloat origin[3] = { 0.0, 0.0, 0.0 };
 
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
-    }
+    glmKernels()->transform(&model->vertices[3], model->numvertices, origin, scale);
 }
 
 /* glmReverseWinding: Reverse the polygon winding for all polygons in
@@ -920,18 +2096,12 @@ glmReverseWinding(GLMmodel* model)
     }
 
     /* reverse facet normals */
-    for (i = 1; i <= model->numfacetnorms; i++) {
-        model->facetnorms[3 * i + 0] = -model->facetnorms[3 * i + 0];
-        model->facetnorms[3 * i + 1] = -model->facetnorms[3 * i + 1];
-        model->facetnorms[3 * i + 2] = -model->facetnorms[3 * i + 2];
-    }
+    if (model->numfacetnorms)
+        glmKernels()->negate(&model->facetnorms[3], 3 * model->numfacetnorms);
 
     /* reverse vertex normals */
-    for (i = 1; i <= model->numnormals; i++) {
-        model->normals[3 * i + 0] = -model->normals[3 * i + 0];
-        model->normals[3 * i + 1] = -model->normals[3 * i + 1];
-        model->normals[3 * i + 2] = -model->normals[3 * i + 2];
-    }
+    if (model->numnormals)
+        glmKernels()->negate(&model->normals[3], 3 * model->numnormals);
 }
 
 /* glmFacetNormals: Generates facet normals for a model (by taking the
@@ -943,42 +2113,145 @@ glmReverseWinding(GLMmodel* model)
 GLvoid
 glmFacetNormals(GLMmodel* model)
 {
-    GLuint  i;
-    GLfloat u[3];
-    GLfloat v[3];
-
     assert(model);
     assert(model->vertices);
 
-    /* clobber any old facetnormals */
-    if (model->facetnorms)
-        free(model->facetnorms);
+    /* clobber any old facetnormals, keeping their memory if it fits */
+    if (model->facetnorms && model->numfacetnorms != model->numtriangles) {
+        glmFree(model, model->facetnorms);
+        model->facetnorms = NULL;
+    }
 
     /* allocate memory for the new facet normals */
     model->numfacetnorms = model->numtriangles;
-    model->facetnorms = (GLfloat*)malloc(sizeof(GLfloat) *
-                       3 * (model->numfacetnorms + 1));
-
-    for (i = 0; i < model->numtriangles; i++) {
-        model->triangles[i].findex = i+1;
+    if (!model->facetnorms)
+        model->facetnorms = (GLfloat*)glmAlloc(model, sizeof(GLfloat) *
+                           3 * (model->numfacetnorms + 1));
 
-        u[0] = model->vertices[3 * T(i).vindices[1] + 0] -
-            model->vertices[3 * T(i).vindices[0] + 0];
-        u[1] = model->vertices[3 * T(i).vindices[1] + 1] -
-            model->vertices[3 * T(i).vindices[0] + 1];
-        u[2] = model->vertices[3 * T(i).vindices[1] + 2] -
-            model->vertices[3 * T(i).vindices[0] + 2];
+    glmKernels()->facetnorms(model, 0);
+}
 
-        v[0] = model->vertices[3 * T(i).vindices[2] + 0] -
-            model->vertices[3 * T(i).vindices[0] + 0];
-        v[1] = model->vertices[3 * T(i).vindices[2] + 1] -
-            model->vertices[3 * T(i).vindices[0] + 1];
-        v[2] = model->vertices[3 * T(i).vindices[2] + 2] -
-            model->vertices[3 * T(i).vindices[0] + 2];
+/* _GLMsmooth: shared state for the glmVertexNormals tasks.  The
+ * triangles that vertex i is in are members[start[i]] up to (but not
+ * including) members[start[i+1]], most recent triangle first. */
+typedef struct _GLMsmooth {
+    GLMmodel* model;
+    GLuint*   start;
+    GLuint*   members;
+    GLuint*   first;            /* first new normal of each vertex */
+    GLfloat   cos_angle;
+    GLuint    blocksize;        /* vertices per task */
+} GLMsmooth;
+
+/* glmSmoothVertex: calculate an average normal for vertex i by
+ * averaging the facet normal of every triangle it is in, and return
+ * how many normals the vertex needs.  If normals is not NULL, also
+ * store them there and set the normal indices of the vertex's
+ * triangles, starting from index first.
+ */
+static GLuint
+glmSmoothVertex(GLMsmooth* smooth, GLuint i, GLfloat* normals, GLuint first)
+{
+    GLMmodel* model = smooth->model;
+    GLfloat* reference;
+    GLfloat* facetnorm;
+    GLfloat average[3];
+    GLuint m, tri, numnormals, normal;
+    GLboolean avg;
 
-        glmCross(u, v, &model->facetnorms[3 * (i+1)]);
-        glmNormalize(&model->facetnorms[3 * (i+1)]);
+    if (smooth->start[i] == smooth->start[i + 1]) {
+        if (!normals)
+            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
+        return 0;
+    }
+
+    /* only average if the dot product of the angle between the two
+    facet normals is greater than the cosine of the threshold
+    angle -- or, said another way, the angle between the two
+    facet normals is less than (or equal to) the threshold angle */
+    reference = &model->facetnorms[3 * T(smooth->members[smooth->start[i]]).findex];
+    average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
+    avg = GL_FALSE;
+    numnormals = 0;
+    for (m = smooth->start[i]; m < smooth->start[i + 1]; m++) {
+        facetnorm = &model->facetnorms[3 * T(smooth->members[m]).findex];
+        if (glmDot(facetnorm, reference) > smooth->cos_angle) {
+            average[0] += facetnorm[0];
+            average[1] += facetnorm[1];
+            average[2] += facetnorm[2];
+            avg = GL_TRUE;      /* we averaged at least one normal! */
+        } else {
+            numnormals++;       /* this one keeps its facet normal */
+        }
     }
+    if (avg)
+        numnormals++;
+    if (!normals)
+        return numnormals;
+
+    if (avg) {
+        /* normalize the averaged normal, and add it to the list */
+        glmNormalize(average);
+        normals[3 * first + 0] = average[0];
+        normals[3 * first + 1] = average[1];
+        normals[3 * first + 2] = average[2];
+    }
+
+    /* set the normal of this vertex in each triangle it is in */
+    numnormals = avg ? first + 1 : first;
+    for (m = smooth->start[i]; m < smooth->start[i + 1]; m++) {
+        tri = smooth->members[m];
+        facetnorm = &model->facetnorms[3 * T(tri).findex];
+        if (glmDot(facetnorm, reference) > smooth->cos_angle) {
+            /* if this triangle was averaged, use the average normal */
+            normal = first;
+        } else {
+            /* if this triangle wasn't averaged, use the facet normal */
+            normals[3 * numnormals + 0] = facetnorm[0];
+            normals[3 * numnormals + 1] = facetnorm[1];
+            normals[3 * numnormals + 2] = facetnorm[2];
+            normal = numnormals++;
+        }
+        if (T(tri).vindices[0] == i)
+            T(tri).nindices[0] = normal;
+        else if (T(tri).vindices[1] == i)
+            T(tri).nindices[1] = normal;
+        else if (T(tri).vindices[2] == i)
+            T(tri).nindices[2] = normal;
+    }
+    return numnormals - first;
+}
+
+/* glmCountNormalsTask: runParallel task counting the normals needed
+ * by each vertex in block index */
+static GLvoid
+glmCountNormalsTask(GLvoid* data, int index)
+{
+    GLMsmooth* smooth = (GLMsmooth*)data;
+    GLuint i, last;
+
+    i = 1 + index * smooth->blocksize;
+    last = i + smooth->blocksize;
+    if (last > smooth->model->numvertices + 1)
+        last = smooth->model->numvertices + 1;
+    for (; i < last; i++)
+        smooth->first[i] = glmSmoothVertex(smooth, i, NULL, 0);
+}
+
+/* glmStoreNormalsTask: runParallel task storing the normals of each
+ * vertex in block index */
+static GLvoid
+glmStoreNormalsTask(GLvoid* data, int index)
+{
+    GLMsmooth* smooth = (GLMsmooth*)data;
+    GLuint i, last;
+
+    i = 1 + index * smooth->blocksize;
+    last = i + smooth->blocksize;
+    if (last > smooth->model->numvertices + 1)
+        last = smooth->model->numvertices + 1;
+    for (; i < last; i++)
+        glmSmoothVertex(smooth, i, smooth->model->normals, smooth->first[i]);
 }
 
 /* glmVertexNormals: Generates smooth vertex normals for a model.
@@ -994,156 +2267,81 @@ glmFacetNormals(GLMmodel* model)
  * the facet normal.  This tends to preserve hard edges.  The angle to
  * use depends on the model, but 90 degrees is usually a good start.
  *
+ * The lists are stored in compressed sparse row form (one array of
+ * triangle indices, and the offset of each vertex's list in it), and
+ * the vertices are processed in parallel: once to count the normals
+ * each vertex needs, and again (after a prefix sum gives each vertex
+ * its place in the normals array) to store them.
+ *
  * model - initialized GLMmodel structure
  * angle - maximum angle (in degrees) to smooth across
  */
 GLvoid
 glmVertexNormals(GLMmodel* model, GLfloat angle)
 {
-    GLMnode* node;
-    GLMnode* tail;
-    GLMnode** members;
-    GLfloat* normals;
-    GLuint numnormals;
-    GLfloat average[3];
-    GLfloat dot, cos_angle;
-    GLuint i, avg;
+    GLMsmooth smooth;
+    GLuint* cursor;
+    GLuint numblocks;
+    GLuint numnormals, count;
+    GLuint i, j, v;
 
     assert(model);
     assert(model->facetnorms);
 
     /* calculate the cosine of the angle (in degrees) */
-    cos_angle = cos(angle * M_PI / 180.0);
-
-    /* nuke any previous normals */
-    if (model->normals)
-        free(model->normals);
-
-    /* allocate space for new normals */
-    model->numnormals = model->numtriangles * 3; /* 3 normals per triangle */
-    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
-
-    /* allocate a structure that will hold a linked list of triangle
-    indices for each vertex */
-    members = (GLMnode**)malloc(sizeof(GLMnode*) * (model->numvertices + 1));
-    for (i = 1; i <= model->numvertices; i++)
-        members[i] = NULL;
-
-    /* for every triangle, create a node for each vertex in it */
-    for (i = 0; i < model->numtriangles; i++) {
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[0]];
-        members[T(i).vindices[0]] = node;
-
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[1]];
-        members[T(i).vindices[1]] = node;
-
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[2]];
-        members[T(i).vindices[2]] = node;
-    }
-
-    /* calculate the average normal for each vertex */
+    smooth.cos_angle = cos(angle * M_PI / 180.0);
+    smooth.model = model;
+
+    /* count the triangles each vertex is in, and turn the counts into
+    the offsets of each vertex's list */
+    smooth.start = (GLuint*)glmCalloc(model, model->numvertices + 2, sizeof(GLuint));
+    for (i = 0; i < model->numtriangles; i++)
+        for (j = 0; j < 3; j++)
+            if (T(i).vindices[j] <= model->numvertices)
+                smooth.start[T(i).vindices[j] + 1]++;
+    for (v = 1; v <= model->numvertices + 1; v++)
+        smooth.start[v] += smooth.start[v - 1];
+
+    /* fill the lists back to front, so that (as with the linked lists
+    this replaced) the most recent triangle comes first */
+    smooth.members = (GLuint*)glmAlloc(model, sizeof(GLuint) * (3 * model->numtriangles + 1));
+    cursor = (GLuint*)glmAlloc(model, sizeof(GLuint) * (model->numvertices + 1));
+    memcpy(cursor, &smooth.start[1], sizeof(GLuint) * (model->numvertices + 1));
+    for (i = 0; i < model->numtriangles; i++)
+        for (j = 0; j < 3; j++)
+            if (T(i).vindices[j] <= model->numvertices)
+                smooth.members[--cursor[T(i).vindices[j]]] = i;
+    glmFree(model, cursor);
+
+    /* count the normals each vertex needs */
+    smooth.first = (GLuint*)glmAlloc(model, sizeof(GLuint) * (model->numvertices + 1));
+    numblocks = 4 * numWorkers();
+    smooth.blocksize = (model->numvertices + numblocks - 1) / numblocks;
+    if (smooth.blocksize < 256)
+        smooth.blocksize = 256;
+    numblocks = (model->numvertices + smooth.blocksize - 1) / smooth.blocksize;
+    runParallel(glmCountNormalsTask, &smooth, numblocks);
+
+    /* give each vertex its range of normals */
     numnormals = 1;
-    for (i = 1; i <= model->numvertices; i++) {
-    /* calculate an average normal for this vertex by averaging the
-        facet normal of every triangle this vertex is in */
-        node = members[i];
-        if (!node)
-            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
-        average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
-        avg = 0;
-        while (node) {
-        /* only average if the dot product of the angle between the two
-        facet normals is greater than the cosine of the threshold
-        angle -- or, said another way, the angle between the two
-            facet normals is less than (or equal to) the threshold angle */
-            dot = glmDot(&model->facetnorms[3 * T(node->index).findex],
-                &model->facetnorms[3 * T(members[i]->index).findex]);
-            if (dot > cos_angle) {
-                node->averaged = GL_TRUE;
-                average[0] += model->facetnorms[3 * T(node->index).findex + 0];
-                average[1] += model->facetnorms[3 * T(node->index).findex + 1];
-                average[2] += model->facetnorms[3 * T(node->index).findex + 2];
-                avg = 1;            /* we averaged at least one normal! */
-            } else {
-                node->averaged = GL_FALSE;
-            }
-            node = node->next;
-        }
-
-        if (avg) {
-            /* normalize the averaged normal */
-            glmNormalize(average);
-
-            /* add the normal to the vertex normals list */
-            model->normals[3 * numnormals + 0] = average[0];
-            model->normals[3 * numnormals + 1] = average[1];
-            model->normals[3 * numnormals + 2] = average[2];
-            avg = numnormals;
-            numnormals++;
-        }
-
-        /* set the normal of this vertex in each triangle it is in */
-        node = members[i];
-        while (node) {
-            if (node->averaged) {
-                /* if this node was averaged, use the average normal */
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = avg;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = avg;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = avg;
-            } else {
-                /* if this node wasn't averaged, use the facet normal */
-                model->normals[3 * numnormals + 0] =
-                    model->facetnorms[3 * T(node->index).findex + 0];
-                model->normals[3 * numnormals + 1] =
-                    model->facetnorms[3 * T(node->index).findex + 1];
-                model->normals[3 * numnormals + 2] =
-                    model->facetnorms[3 * T(node->index).findex + 2];
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = numnormals;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = numnormals;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = numnormals;
-                numnormals++;
-            }
-            node = node->next;
-        }
+    for (v = 1; v <= model->numvertices; v++) {
+        count = smooth.first[v];
+        smooth.first[v] = numnormals;
+        numnormals += count;
     }
 
+    /* nuke any previous normals, and allocate space for new ones */
+    if (model->normals)
+        glmFree(model, model->normals);
     model->numnormals = numnormals - 1;
+    model->normals = (GLfloat*)glmAlloc(model, sizeof(GLfloat)* 3* (model->numnormals+1));
 
-    /* free the member information */
-    for (i = 1; i <= model->numvertices; i++) {
-        node = members[i];
-        while (node) {
-            tail = node;
-            node = node->next;
-            free(tail);
-        }
-    }
-    free(members);
+    /* calculate the normals */
+    runParallel(glmStoreNormalsTask, &smooth, numblocks);
 
-    /* pack the normals array (we previously allocated the maximum
-    number of normals that could possibly be created (numtriangles *
-    3), so get rid of some of them (usually alot unless none of the
-    facet normals were averaged)) */
-    normals = model->normals;
-    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
-    for (i = 1; i <= model->numnormals; i++) {
-        model->normals[3 * i + 0] = normals[3 * i + 0];
-        model->normals[3 * i + 1] = normals[3 * i + 1];
-        model->normals[3 * i + 2] = normals[3 * i + 2];
-    }
-    free(normals);
+    glmFree(model, smooth.first);
+    glmFree(model, smooth.members);
+    glmFree(model, smooth.start);
 }
 
 
@@ -1164,9 +2362,9 @@ glmLinearTexture(GLMmodel* model)
     assert(model);
 
     if (model->texcoords)
-        free(model->texcoords);
+        glmFree(model, model->texcoords);
     model->numtexcoords = model->numvertices;
-    model->texcoords=(GLfloat*)malloc(sizeof(GLfloat)*2*(model->numtexcoords+1));
+    model->texcoords=(GLfloat*)glmAlloc(model, sizeof(GLfloat)*2*(model->numtexcoords+1));
 
     glmDimensions(model, dimensions);
     scalefactor = 2.0 /
@@ -1219,9 +2417,9 @@ glmSpheremapTexture(GLMmodel* model)
     assert(model->normals);
 
     if (model->texcoords)
-        free(model->texcoords);
+        glmFree(model, model->texcoords);
     model->numtexcoords = model->numnormals;
-    model->texcoords=(GLfloat*)malloc(sizeof(GLfloat)*2*(model->numtexcoords+1));
+    model->texcoords=(GLfloat*)glmAlloc(model, sizeof(GLfloat)*2*(model->numtexcoords+1));
 
     for (i = 1; i <= model->numnormals; i++) {
         z = model->normals[3 * i + 0];  /* re-arrange for pole distortion */
@@ -1273,6 +2471,10 @@ glmDelete(GLMmodel* model)
 
     assert(model);
 
+    /* everything in an arena is freed with it */
+    if (model->arena)
+        return;
+
     if (model->pathname)     free(model->pathname);
     if (model->mtllibname) free(model->mtllibname);
     if (model->vertices)     free(model->vertices);
@@ -1281,10 +2483,14 @@ glmDelete(GLMmodel* model)
     if (model->facetnorms) free(model->facetnorms);
     if (model->triangles)  free(model->triangles);
     if (model->materials) {
-        for (i = 0; i < model->nummaterials; i++)
+        for (i = 0; i < model->nummaterials; i++) {
             free(model->materials[i].name);
+            free(model->materials[i].texture);
+        }
     }
     free(model->materials);
+    free(model->materialtable);
+    free(model->grouptable);
     while(model->groups) {
         group = model->groups;
         model->groups = model->groups->next;
@@ -1304,21 +2510,52 @@ glmDelete(GLMmodel* model)
  */
 GLMmodel*
 glmReadOBJ(char* filename)
+{
+    return glmReadOBJArena(filename, NULL);
+}
+
+/* glmReadOBJArena: Reads a model description from a Wavefront .OBJ
+ * file, as glmReadOBJ, but allocates the model, and everything used
+ * while reading it, from the given arena.  The model is freed by
+ * releasing the arena.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.
+ * arena    - initialized GLMarena structure, or NULL to use malloc
+ */
+GLMmodel*
+glmReadOBJArena(char* filename, GLMarena* arena)
 {
     GLMmodel* model;
-    FILE* file;
+    struct stat st;
+    char* data;
+    int fd;
 
-    /* open the file */
-    file = fopen(filename, "r");
-    if (!file) {
+    /* open and map the file */
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
         fprintf(stderr, "glmReadOBJ() failed: can't open data file \"%s\".\n",
             filename);
         exit(1);
     }
+    data = NULL;
+    if (st.st_size > 0) {
+        data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "glmReadOBJ() failed: can't map data file \"%s\".\n",
+                filename);
+            exit(1);
+        }
+    }
+    close(fd);
 
     /* allocate a new model */
-    model = (GLMmodel*)malloc(sizeof(GLMmodel));
-    model->pathname    = strdup(filename);
+    if (arena) {
+        model = (GLMmodel*)glmArenaAlloc(arena, sizeof(GLMmodel));
+    } else {
+        model = (GLMmodel*)malloc(sizeof(GLMmodel));
+    }
+    model->arena       = arena;
+    model->pathname    = glmStrdup(model, filename);
     model->mtllibname    = NULL;
     model->numvertices   = 0;
     model->vertices    = NULL;
@@ -1334,35 +2571,23 @@ glmReadOBJ(char* filename)
     model->materials       = NULL;
     model->numgroups       = 0;
     model->groups      = NULL;
+    model->grouptablesize = 0;
+    model->grouptable    = NULL;
+    model->materialtablesize = 0;
+    model->materialtable = NULL;
     model->position[0]   = 0.0;
     model->position[1]   = 0.0;
     model->position[2]   = 0.0;
 
-    /* make a first pass through the file to get a count of the number
-    of vertices, normals, texcoords & triangles */
-    glmFirstPass(model, file);
+    if (arena && !arena->name)
+        arena->name = model->pathname;
 
-    /* allocate memory */
-    model->vertices = (GLfloat*)malloc(sizeof(GLfloat) *
-        3 * (model->numvertices + 1));
-    model->triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) *
-        model->numtriangles);
-    if (model->numnormals) {
-        model->normals = (GLfloat*)malloc(sizeof(GLfloat) *
-            3 * (model->numnormals + 1));
-    }
-    if (model->numtexcoords) {
-        model->texcoords = (GLfloat*)malloc(sizeof(GLfloat) *
-            2 * (model->numtexcoords + 1));
-    }
-
-    /* rewind to beginning of file and read in the data this pass */
-    rewind(file);
-
-    glmSecondPass(model, file);
+    /* read in the data in a single pass over the mapped file */
+    glmParseOBJ(model, data, st.st_size);
 
-    /* close the file */
-    fclose(file);
+    /* unmap the file */
+    if (data)
+        munmap(data, st.st_size);
 
     return model;
 }
@@ -1739,11 +2964,11 @@ glmWeld(GLMmodel* model, GLfloat epsilon)
     }
 
     /* free space for old vertices */
-    free(vectors);
+    glmFree(model, vectors);
 
     /* allocate space for the new vertices */
     model->numvertices = numvectors;
-    model->vertices = (GLfloat*)malloc(sizeof(GLfloat) *
+    model->vertices = (GLfloat*)glmAlloc(model, sizeof(GLfloat) *
         3 * (model->numvertices + 1));
 
     /* copy the optimized vertices into the actual vertex list */
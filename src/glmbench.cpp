@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glfw.h>
+
+#include "workers.h"
+#include "glm.h"
+#include "paths.h"
+
+/** @file glmbench.cpp
+ * Times GLM's geometry kernels (see glmSIMD) on a model, at each SIMD level
+ * the CPU supports:
+ *
+ *     glmbench [model.obj]
+ *
+ * The landscape is used if no model is given. Before timing, checks that each
+ * level gives exactly the same results as the scalar kernels.
+ *
+ * With `-w`, checks the grid-based glmWeldVectors against the quadratic
+ * reference instead, on the vertices and normals of every model (or those
+ * given) at each of a range of epsilons:
+ *
+ *     glmbench -w [model.obj...]
+ *
+ * The copies and the index each vector is welded to must be identical, or it
+ * fails.
+ */
+
+#define BENCH_CALLS  200
+#define BENCH_ROUNDS 5
+
+static const char* levelNames[] = { "scalar", "SSE", "AVX2" };
+
+/** From no welding at all to welding across whole features. */
+static const GLfloat weldEpsilons[] = { 0, 1e-30f, 1e-5f, 1e-3f, 0.05f, 0.3f };
+
+static void runDimensions(GLMmodel* model) {
+	GLfloat dimensions[3];
+	glmDimensions(model, dimensions);
+}
+
+static void runUnitize(GLMmodel* model) {
+	glmUnitize(model);
+}
+
+static void runScale(GLMmodel* model) {
+	glmScale(model, 1.0f);
+}
+
+static void runFacetNormals(GLMmodel* model) {
+	glmFacetNormals(model);
+}
+
+static void runReverseWinding(GLMmodel* model) {
+	glmReverseWinding(model);
+}
+
+struct Kernel {
+	const char* name;
+	void (*run)(GLMmodel* model);
+};
+
+static const Kernel kernels[] = {
+	{ "glmDimensions",     runDimensions },
+	{ "glmUnitize",        runUnitize },
+	{ "glmScale",          runScale },
+	{ "glmFacetNormals",   runFacetNormals },
+	{ "glmReverseWinding", runReverseWinding },
+};
+
+/** What the kernels make of a model, to compare between levels. */
+struct KernelResults {
+	GLfloat dimensions[3];
+	GLfloat scale;
+	std::vector<GLfloat> vertices, facetNorms, normals;
+	std::vector<GLMtriangle> triangles;
+};
+
+/** A copy of the arrays the kernels change, to run each level from. */
+struct ModelState {
+	std::vector<GLfloat> vertices, normals;
+	std::vector<GLMtriangle> triangles;
+
+	void save(const GLMmodel* model) {
+		vertices.assign(model->vertices, model->vertices + 3 * (model->numvertices + 1));
+		normals.assign(model->normals, model->normals + (model->normals ? 3 * (model->numnormals + 1) : 0));
+		triangles.assign(model->triangles, model->triangles + model->numtriangles);
+	}
+
+	void restore(GLMmodel* model) const {
+		memcpy(model->vertices, vertices.data(), vertices.size() * sizeof(GLfloat));
+		if (!normals.empty()) memcpy(model->normals, normals.data(), normals.size() * sizeof(GLfloat));
+		memcpy(model->triangles, triangles.data(), triangles.size() * sizeof(GLMtriangle));
+	}
+};
+
+static void runAll(GLMmodel* model, const ModelState &state, KernelResults &results) {
+	state.restore(model);
+	glmDimensions(model, results.dimensions);
+	results.scale = glmUnitize(model);
+	glmScale(model, 0.5f);
+	glmFacetNormals(model);
+	glmReverseWinding(model);
+
+	results.vertices.assign(model->vertices + 3, model->vertices + 3 * (model->numvertices + 1));
+	results.facetNorms.assign(model->facetnorms + 3, model->facetnorms + 3 * (model->numfacetnorms + 1));
+	results.normals.assign(state.normals.size() ? model->normals + 3 : NULL,
+	                       state.normals.size() ? model->normals + 3 * (model->numnormals + 1) : NULL);
+	results.triangles.assign(model->triangles, model->triangles + model->numtriangles);
+}
+
+static bool sameResults(const KernelResults &a, const KernelResults &b) {
+	return memcmp(a.dimensions, b.dimensions, sizeof(a.dimensions)) == 0 && a.scale == b.scale
+	    && a.vertices == b.vertices && a.facetNorms == b.facetNorms && a.normals == b.normals
+	    && memcmp(a.triangles.data(), b.triangles.data(), a.triangles.size() * sizeof(GLMtriangle)) == 0;
+}
+
+/** @return the best time of BENCH_ROUNDS rounds of BENCH_CALLS calls, in
+ *          seconds per call. */
+static double timeKernel(const Kernel &kernel, GLMmodel* model) {
+	kernel.run(model);  // warm up
+	double best = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		double start = glfwGetTime();
+		for (int i = 0; i < BENCH_CALLS; i++) kernel.run(model);
+		double elapsed = glfwGetTime() - start;
+		if (round == 0 || elapsed < best) best = elapsed;
+	}
+	return best / BENCH_CALLS;
+}
+
+/** Welds a copy of some vectors with glmWeldVectors, and another with the
+ * quadratic reference, and compares them.
+ * @return false, having said how, if they differ. */
+static bool checkWeld(const char* path, const char* name, const GLfloat* vectors, GLuint numVectors, GLfloat epsilon) {
+	std::vector<GLfloat> grid(vectors, vectors + 3 * (numVectors + 1)), quadratic(grid);
+	GLuint numGrid = numVectors, numQuadratic = numVectors;
+	double start = glfwGetTime();
+	GLfloat* gridCopies = glmWeldVectors(grid.data(), &numGrid, epsilon);
+	double gridTime = glfwGetTime() - start;
+	start = glfwGetTime();
+	GLfloat* quadraticCopies = glmWeldVectorsReference(quadratic.data(), &numQuadratic, epsilon);
+	double quadraticTime = glfwGetTime() - start;
+
+	bool same = true;
+	if (numGrid != numQuadratic) {
+		fprintf(stderr, "MISMATCH in %s, %s at epsilon %g: %u copies, but the reference makes %u.\n",
+		        path, name, epsilon, numGrid, numQuadratic);
+		same = false;
+	}
+	for (GLuint i = 1; i <= numGrid && same; i++) {
+		if (memcmp(gridCopies + 3 * i, quadraticCopies + 3 * i, 3 * sizeof(GLfloat)) != 0) {
+			fprintf(stderr, "MISMATCH in %s, %s at epsilon %g: copy %u differs from the reference's.\n",
+			        path, name, epsilon, i);
+			same = false;
+		}
+	}
+	for (GLuint i = 1; i <= numVectors && same; i++) {
+		if (memcmp(&grid[3 * i], &quadratic[3 * i], 3 * sizeof(GLfloat)) != 0) {
+			fprintf(stderr, "MISMATCH in %s, %s at epsilon %g: vector %u is welded to copy %g, but to %g by the reference.\n",
+			        path, name, epsilon, i, grid[3 * i], quadratic[3 * i]);
+			same = false;
+		}
+	}
+	free(gridCopies);
+	free(quadraticCopies);
+
+	if (same) {
+		printf("  %-8s epsilon %-6g %6u -> %6u, grid %.3f ms, quadratic %.3f ms\n", name, epsilon, numVectors,
+		       numGrid, gridTime * 1e3, quadraticTime * 1e3);
+	}
+	return same;
+}
+
+/** Checks glmWeldVectors against the reference on each model's vertices and
+ * normals, at every epsilon.
+ * @return false if any weld differs. */
+static bool checkWelds(int numPaths, const char* const* paths) {
+	for (int i = 0; i < numPaths; i++) {
+		GLMmodel* model = glmReadOBJ((char*)paths[i]);
+		if (!model) return false;
+		printf("Checking welds of %s:\n", paths[i]);
+		for (size_t e = 0; e < sizeof(weldEpsilons) / sizeof(weldEpsilons[0]); e++) {
+			if (!checkWeld(paths[i], "vertices", model->vertices, model->numvertices, weldEpsilons[e])) return false;
+			if (model->normals && !checkWeld(paths[i], "normals", model->normals, model->numnormals, weldEpsilons[e])) {
+				return false;
+			}
+		}
+		glmDelete(model);
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	bool weld = argc > 1 && strcmp(argv[1], "-w") == 0;
+	const char* path = argc > 1 && !weld ? argv[1] : MODEL("landscape.obj");
+	if (!glfwInit()) {
+		fprintf(stderr, "Could not initialise GLFW. Terminating.\n");
+		return EXIT_FAILURE;
+	}
+	startWorkers();
+
+	if (weld) {
+		static const char* modelPaths[] = { MODEL("landscape.obj"), MODEL("spaceship.obj"), MODEL("clanger.obj"),
+		                                    MODEL("music-tree.obj") };
+		bool passed = argc > 2 ? checkWelds(argc - 2, (const char**)argv + 2)
+		                       : checkWelds(sizeof(modelPaths) / sizeof(modelPaths[0]), modelPaths);
+		if (!passed) {
+			fprintf(stderr, "glmWeldVectors does not match the reference weld.\n");
+			return EXIT_FAILURE;
+		}
+		printf("glmWeldVectors matches the reference weld.\n");
+		glfwTerminate();
+		return EXIT_SUCCESS;
+	}
+
+	GLMmodel* model = glmReadOBJ((char*)path);
+	if (!model) return EXIT_FAILURE;
+	if (model->numvertices == 0 || model->numtriangles == 0) {
+		fprintf(stderr, "%s has no triangles to benchmark with.\n", path);
+		return EXIT_FAILURE;
+	}
+	glmFacetNormals(model);  // so that glmReverseWinding has some to reverse
+	ModelState state;
+	state.save(model);
+
+	GLuint numLevels = glmSIMD(GLM_SIMD_BEST) + 1;
+	KernelResults reference, results;
+	glmSIMD(GLM_SIMD_NONE);
+	runAll(model, state, reference);
+	for (GLuint level = 1; level < numLevels; level++) {
+		glmSIMD(level);
+		runAll(model, state, results);
+		if (!sameResults(reference, results)) {
+			fprintf(stderr, "The %s kernels give different results from the scalar ones.\n", levelNames[level]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("Benchmarking GLM kernels on %s (%u vertices, %u triangles), best of %d rounds of %d calls:\n",
+	       path, model->numvertices, model->numtriangles, BENCH_ROUNDS, BENCH_CALLS);
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		printf("  %-18s", kernels[k].name);
+		double scalarTime = 0;
+		for (GLuint level = 0; level < numLevels; level++) {
+			glmSIMD(level);
+			state.restore(model);
+			double time = timeKernel(kernels[k], model);
+			if (level == 0) {
+				scalarTime = time;
+				printf(" %s %.4f ms", levelNames[level], time * 1e3);
+			} else {
+				printf(", %s %.4f ms (%.1fx)", levelNames[level], time * 1e3, scalarTime / time);
+			}
+		}
+		printf("\n");
+	}
+
+	glmDelete(model);
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}
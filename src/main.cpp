@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <math.h>
 #include <vector>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <GL/glfw.h>
@@ -13,7 +14,14 @@
 
 #include "paths.h"
 #include "utils.h"
+#include "workers.h"
+#include "pack.h"
 #include "generators.h"
+#include "meshcache.h"
+#include "meshlets.h"
+#include "resources.h"
+#include "texarrays.h"
+#include "progcache.h"
 #include "scene.hpp"
 
 #define PI 3.14159265
@@ -24,11 +32,20 @@
 
 #define LIGHT_POSITION 310.f, 150.f, 150.f
 
+#define FIELD_OF_VIEW 45.0f
+
+/** The most GPU memory the scene's meshes and textures may take, and how near
+ * an object must come for them to be loaded if it isn't in view (about the
+ * far plane). */
+#define GPU_MEMORY_BUDGET       (256 << 20)
+#define RESIDENCY_LOAD_DISTANCE 1000.0f
+
 #define CAMERA_ACCELERATION 6
 #define CAMERA_ROTATION_SPEED 0.4
 
 static GLuint prgNormals;
 static GLuint prgShaded;
+static GLint uniDiffuseLayer;  ///< of prgShaded
 
 static DisplayObject camera;
 static std::vector<DisplayObject*> objects;
@@ -37,10 +54,18 @@ static GLfloat cameraSpeed = 0;
 static glm::mat4 VP, V, P;
 
 static bool showNormals = false;
+static bool cullMeshlets = true;
+
+static int numMeshletsDrawn, numMeshletsTested;  ///< in the last frame
 
-GLuint createShader(GLenum type, const char* path) {
+/** The attributes bound to locations 0, 1 and 2 of each program, and its
+ * output, which are part of the key of its cache (see progcache.h). */
+static const char* attributeNames[] = { "msPosition", "msNormal", "uv" };
+static const char* outputName = "color";
+#define NUM_ATTRIBUTES (sizeof(attributeNames) / sizeof(attributeNames[0]))
+
+GLuint createShader(GLenum type, const char* path, const char* source) {
 	GLuint shdShader = glCreateShader(type);
-	char* source = fileToBuffer(path);
 	glShaderSource(shdShader, 1, (const GLchar**)&source, NULL);
 	glCompileShader(shdShader);
 
@@ -64,10 +89,9 @@ GLuint createProgram(GLuint shdVertex, GLuint shdGeometry, GLuint shdFragment) {
 	if (shdVertex)   glAttachShader(prgProgram, shdVertex);
 	if (shdGeometry) glAttachShader(prgProgram, shdGeometry);
 	if (shdFragment) glAttachShader(prgProgram, shdFragment);
-	glBindAttribLocation(prgProgram, 0, "msPosition");
-	glBindAttribLocation(prgProgram, 1, "msNormal");
-	glBindAttribLocation(prgProgram, 2, "uv");
-	glBindFragDataLocation(prgProgram, 0, "color");
+	for (GLuint i = 0; i < NUM_ATTRIBUTES; i++) glBindAttribLocation(prgProgram, i, attributeNames[i]);
+	glBindFragDataLocation(prgProgram, 0, outputName);
+	if (programCacheSupported()) glProgramParameteri(prgProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(prgProgram);
 
 	// Check for errors
@@ -85,41 +109,67 @@ GLuint createProgram(GLuint shdVertex, GLuint shdGeometry, GLuint shdFragment) {
 	return prgProgram;
 }
 
-// Setup methods //
+/** Builds a program from its shader files: from its cache (see progcache.h) if
+ * that was built from the same sources by the same driver, or else by
+ * compiling and linking them, and caching the result.
+ * @param geometryPath NULL if the program has no geometry shader. */
+GLuint loadProgram(const char* vertexPath, const char* geometryPath, const char* fragmentPath) {
+	const char* paths[3] = { vertexPath, geometryPath, fragmentPath };
+	const GLenum types[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+	char* sources[3] = { NULL, NULL, NULL };
+	const char* keyStrings[3 + NUM_ATTRIBUTES + 1];
+	for (int i = 0; i < 3; i++) {
+		if (paths[i]) sources[i] = fileToBuffer(paths[i]);
+		keyStrings[i] = sources[i];
+	}
+	for (GLuint i = 0; i < NUM_ATTRIBUTES; i++) keyStrings[3 + i] = attributeNames[i];
+	keyStrings[3 + NUM_ATTRIBUTES] = outputName;
+	uint64_t key = programCacheKey(keyStrings, sizeof(keyStrings) / sizeof(keyStrings[0]));
 
-void setupShaders(void) {
-	// Normals program
-	GLuint shdNormalVertex   = createShader(GL_VERTEX_SHADER,   SHADER("normals-vertex.glsl"));
-	GLuint shdNormalGeometry = createShader(GL_GEOMETRY_SHADER, SHADER("normals-geometry.glsl"));
-	GLuint shdNormalFragment = createShader(GL_FRAGMENT_SHADER, SHADER("normals-fragment.glsl"));
+	GLuint prgProgram = glCreateProgram();
+	if (loadProgramCache(fragmentPath, key, prgProgram)) {
+		printf("Loaded the program for %s from its cache.\n", fragmentPath);
+	} else {
+		glDeleteProgram(prgProgram);
+		GLuint shaders[3] = { 0, 0, 0 };
+		for (int i = 0; i < 3; i++) {
+			if (sources[i]) shaders[i] = createShader(types[i], paths[i], sources[i]);
+		}
+		prgProgram = createProgram(shaders[0], shaders[1], shaders[2]);
+		for (int i = 0; i < 3; i++) {
+			if (shaders[i]) glDeleteShader(shaders[i]);
+		}
 
-	prgNormals = createProgram(shdNormalVertex, shdNormalGeometry, shdNormalFragment);
+		GLint linked;
+		glGetProgramiv(prgProgram, GL_LINK_STATUS, &linked);
+		if (linked == GL_TRUE) writeProgramCache(fragmentPath, key, prgProgram);
+	}
 
-	glDeleteShader(shdNormalGeometry);
-	glDeleteShader(shdNormalVertex);
-	glDeleteShader(shdNormalFragment);
+	for (int i = 0; i < 3; i++) free(sources[i]);
+	return prgProgram;
+}
 
-	// Shaded program
-	GLuint shdShadedVertex   = createShader(GL_VERTEX_SHADER,   SHADER("vertex.glsl"));
-	GLuint shdShadedFragment = createShader(GL_FRAGMENT_SHADER, SHADER("fragment.glsl"));
+// Setup methods //
 
-	prgShaded = createProgram(shdShadedVertex, 0, shdShadedFragment);
+void setupShaders(void) {
+	prgNormals = loadProgram(SHADER("normals-vertex.glsl"), SHADER("normals-geometry.glsl"), SHADER("normals-fragment.glsl"));
+	prgShaded  = loadProgram(SHADER("vertex.glsl"), NULL, SHADER("fragment.glsl"));
 
 	GLuint uni_diffuseColor    = glGetUniformLocation(prgShaded, "diffuseColor"),
 	       uni_specularColor   = glGetUniformLocation(prgShaded, "specularColor"),
 	       uni_lightColor      = glGetUniformLocation(prgShaded, "lightColor"),
 	       uni_wsLightPosition = glGetUniformLocation(prgShaded, "wsLightPosition"),
-	       uni_diffuseTexture  = glGetUniformLocation(prgShaded, "diffuseTexture");
+	       uni_diffuseTextures = glGetUniformLocation(prgShaded, "diffuseTextures");
 	glProgramUniform3f(prgShaded, uni_diffuseColor,  0.2f, 0.5f, 0.2f);
 	glProgramUniform3f(prgShaded, uni_specularColor, 0.5f, 0.5f, 0.5f);
 	glProgramUniform3f(prgShaded, uni_lightColor,    1.0f, 1.0f, 1.0f);
 	glProgramUniform3f(prgShaded, uni_wsLightPosition, LIGHT_POSITION);
 	// TODO: put these values in a common location
 
-	glProgramUniform1i(prgShaded, uni_diffuseTexture, 0);
-
-	glDeleteShader(shdShadedVertex);
-	glDeleteShader(shdShadedFragment);
+	glProgramUniform1i(prgShaded, uni_diffuseTextures, 0);
+	uniDiffuseLayer = glGetUniformLocation(prgShaded, "diffuseLayer");
+	glProgramUniform1i(prgShaded, glGetUniformLocation(prgShaded, "pageTable"), VIRTUAL_PAGE_TABLE_UNIT);
+	glProgramUniform1i(prgShaded, glGetUniformLocation(prgShaded, "pageCache"), VIRTUAL_PAGE_CACHE_UNIT);
 
 	glUseProgram(prgShaded);
 }
@@ -142,15 +192,22 @@ void moveCamera(float timePassed) {
 
 	glm::vec3 target = camera.location + direction;
 	V = glm::lookAt(camera.location, target, up);
-	P = glm::perspective(45.0f, (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f);
+	P = glm::perspective(FIELD_OF_VIEW, (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f);
 
 	VP = P * V;
 }
 
 // Main loop methods //
 
-void drawObject(DisplayObject* obj) {
-	glBindVertexArray(obj->vao);
+/** Binds the texture array holding a texture, and selects its layer. */
+static void bindTexture(const GPUTexture* texture) {
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture->array->tex);
+	glUniform1i(uniDiffuseLayer, texture->layer);
+}
+
+/** Binds an object's mesh and sets the uniforms which place it in the scene. */
+static void setObjectState(const DisplayObject* obj) {
+	glBindVertexArray(obj->mesh->vao);
 	checkForError("after VAO bind");
 
 	// Set the MVP
@@ -159,21 +216,271 @@ void drawObject(DisplayObject* obj) {
 	GLuint uniMVP = glGetUniformLocation(prgShaded, "MVP"),
 	       uniM   = glGetUniformLocation(prgShaded, "M"),
 	       uniV   = glGetUniformLocation(prgShaded, "V"),
-	       uniP   = glGetUniformLocation(prgShaded, "P");
+	       uniP   = glGetUniformLocation(prgShaded, "P"),
+	       uniD   = glGetUniformLocation(prgShaded, "D"),
+	       uniOctahedralScale = glGetUniformLocation(prgShaded, "octahedralScale");
 	glUniformMatrix4fv(uniMVP, 1, GL_FALSE, &MVP[0][0]);
 	glUniformMatrix4fv(uniM,   1, GL_FALSE, &(obj->modelMatrix[0][0]));
 	glUniformMatrix4fv(uniV,   1, GL_FALSE, &V[0][0]);
 	glUniformMatrix4fv(uniP,   1, GL_FALSE, &P[0][0]);
 
-	// Set the texture
-	glBindTexture(GL_TEXTURE_2D, obj->tex);
-	checkForError("after texture bind");
+	// Set how to unpack the vertex attributes
+	glUniformMatrix4fv(uniD,   1, GL_FALSE, &(obj->mesh->dequantize[0][0]));
+	glUniform1f(uniOctahedralScale, obj->mesh->octahedralScale);
+}
+
+/** @return the level of detail to draw an object at, within its mesh's levels. */
+static const MeshLOD &currentLOD(const DisplayObject* obj) {
+	return obj->mesh->lods[obj->lod < obj->mesh->numLODs ? obj->lod : obj->mesh->numLODs - 1];
+}
+
+/** @return the texture to draw a subset of an object's mesh with: its
+ * material's diffuse map if it has one, or else the object's texture. */
+static const GPUTexture* textureFor(const DisplayObject* obj, const MeshSubset &subset) {
+	const std::vector<const GPUTexture*> &textures = obj->mesh->materialTextures;
+	if (subset.material < textures.size() && textures[subset.material]) return textures[subset.material];
+	return obj->texture;
+}
+
+/** @return the virtual texture to draw a subset of an object's mesh with, which
+ * takes the place of the object's texture, or NULL. */
+static VirtualTexture* virtualTextureFor(const DisplayObject* obj, const MeshSubset &subset) {
+	return textureFor(obj, subset) == obj->texture ? obj->virtualTexture : NULL;
+}
+
+/** Draws a subset of an object's mesh. If it is split into meshlets, those
+ * which can't be seen are skipped, and the rest drawn in as few ranges as
+ * possible with one call. */
+static void drawSubset(const DisplayObject* obj, const MeshSubset &subset) {
+	const GPUMesh* mesh = obj->mesh;
+	size_t indexSize = mesh->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	if (subset.numMeshlets == 0 || !cullMeshlets) {
+		glDrawElements(GL_TRIANGLES, subset.numIndices, mesh->indexType, (const void*)(subset.firstIndex * indexSize));
+		return;
+	}
 
-	glDrawElements(GL_TRIANGLES, obj->numIndices, GL_UNSIGNED_INT, NULL);
+	// Cull in model space
+	glm::vec4 planes[6];
+	frustumPlanes(VP * obj->modelMatrix, planes);
+	glm::vec3 eye = glm::vec3(glm::inverse(obj->modelMatrix) * glm::vec4(camera.location, 1));
+
+	static std::vector<GLsizei> counts;
+	static std::vector<const GLvoid*> offsets;
+	counts.clear();
+	offsets.clear();
+	GLuint end = 0;
+	for (GLuint i = subset.firstMeshlet; i < subset.firstMeshlet + subset.numMeshlets; i++) {
+		const Meshlet &meshlet = mesh->meshlets[i];
+		if (!isMeshletVisible(meshlet, planes, eye)) continue;
+
+		if (!counts.empty() && meshlet.firstIndex == end) {
+			counts.back() += meshlet.numIndices;
+		} else {
+			counts.push_back(meshlet.numIndices);
+			offsets.push_back((const GLvoid*)(meshlet.firstIndex * indexSize));
+		}
+		end = meshlet.firstIndex + meshlet.numIndices;
+		numMeshletsDrawn++;
+	}
+	numMeshletsTested += subset.numMeshlets;
+
+	if (!counts.empty()) {
+		glMultiDrawElements(GL_TRIANGLES, counts.data(), mesh->indexType, (const GLvoid**)offsets.data(), counts.size());
+	}
+}
+
+void drawObject(DisplayObject* obj) {
+	setObjectState(obj);
+
+	const MeshLOD &lod = currentLOD(obj);
+	for (GLuint i = lod.firstSubset; i < lod.firstSubset + lod.numSubsets; i++) {
+		const MeshSubset &subset = obj->mesh->subsets[i];
+		bindTexture(textureFor(obj, subset));
+		bindVirtualTexture(virtualTextureFor(obj, subset), prgShaded);
+		drawSubset(obj, subset);
+	}
 	checkForError("after object draw");
 }
 
-static bool nPressed = false, hPressed = false, dPressed = false, pPressed = false;
+/** @return whether any of an object may be in view, testing the sphere
+ * bounding its mesh against the planes of the view frustum. */
+static bool isObjectInView(const DisplayObject* obj, const glm::vec4 planes[6]) {
+	float radius = obj->mesh->radius * obj->scale;
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(planes[i]), obj->location) + planes[i].w < -radius) return false;
+	}
+	return true;
+}
+
+/** Tells the resource registry how near each object is, and whether it is in
+ * view, so that it can keep the assets which matter on the GPU. */
+static void useObjectResources(const std::vector<DisplayObject*> &objects) {
+	glm::vec4 planes[6];
+	frustumPlanes(VP, planes);
+	for (size_t i = 0; i < objects.size(); i++) {
+		const DisplayObject* obj = objects[i];
+		float distance = glm::length(obj->location - camera.location) - obj->mesh->radius * obj->scale;
+		// A virtual texture is paged in by its own feedback instead
+		useResources(obj->mesh, obj->virtualTexture ? NULL : obj->texture, distance > 0 ? distance : 0,
+		             isObjectInView(obj, planes));
+	}
+	updateResidency();
+}
+
+/** One subset of an object's mesh to draw. */
+struct Draw {
+	const VirtualTexture* virtualTexture;
+	GLuint textureArray;
+	GLint layer;
+	const DisplayObject* object;
+	const MeshSubset* subset;
+};
+
+/** Orders draws by virtual texture, texture array, and then by mesh and object,
+ * so that as few textures, VAOs and sets of uniforms as possible have to be
+ * switched. Objects with different textures in the same array only need the
+ * layer changed. */
+static bool byMaterial(const Draw &a, const Draw &b) {
+	if (a.virtualTexture != b.virtualTexture) return a.virtualTexture < b.virtualTexture;
+	if (a.textureArray != b.textureArray) return a.textureArray < b.textureArray;
+	if (a.object->mesh->vao != b.object->mesh->vao) return a.object->mesh->vao < b.object->mesh->vao;
+	return a.object < b.object;
+}
+
+/** Draws every subset of the objects at their current levels of detail, sorted
+ * by material rather than by object. */
+void drawObjects(const std::vector<DisplayObject*> &objects) {
+	static std::vector<Draw> draws;
+	draws.clear();
+	numMeshletsDrawn = numMeshletsTested = 0;
+	for (size_t i = 0; i < objects.size(); i++) {
+		const MeshLOD &lod = currentLOD(objects[i]);
+		for (GLuint j = lod.firstSubset; j < lod.firstSubset + lod.numSubsets; j++) {
+			const MeshSubset &subset = objects[i]->mesh->subsets[j];
+			const GPUTexture* texture = textureFor(objects[i], subset);
+			Draw draw = { virtualTextureFor(objects[i], subset), texture->array->tex, texture->layer, objects[i], &subset };
+			draws.push_back(draw);
+		}
+	}
+	std::sort(draws.begin(), draws.end(), byMaterial);
+
+	const VirtualTexture* virtualTexture = NULL;
+	GLuint textureArray = 0;
+	GLint layer = -1;
+	const DisplayObject* object = NULL;
+	for (size_t i = 0; i < draws.size(); i++) {
+		if (i == 0 || draws[i].virtualTexture != virtualTexture) {
+			virtualTexture = draws[i].virtualTexture;
+			bindVirtualTexture(virtualTexture, prgShaded);
+		}
+		if (i == 0 || draws[i].textureArray != textureArray) {
+			textureArray = draws[i].textureArray;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+		}
+		if (draws[i].layer != layer) {
+			layer = draws[i].layer;
+			glUniform1i(uniDiffuseLayer, layer);
+		}
+		if (draws[i].object != object) {
+			object = draws[i].object;
+			setObjectState(object);
+		}
+		drawSubset(object, *draws[i].subset);
+	}
+	checkForError("after drawing objects");
+}
+
+/** Draws the objects with virtual textures into the textures' feedback
+ * buffers, and updates each texture from the feedback of the frame before. */
+void updateVirtualTextures(const std::vector<DisplayObject*> &objects) {
+	for (size_t i = 0; i < objects.size(); i++) {
+		VirtualTexture* texture = objects[i]->virtualTexture;
+		bool seen = false;
+		for (size_t j = 0; j < i && !seen; j++) seen = objects[j]->virtualTexture == texture;
+		if (!texture || seen) continue;
+
+		// Every subset drawn with the texture, of every object using it
+		beginVirtualTextureFeedback(texture, prgShaded);
+		for (size_t j = i; j < objects.size(); j++) {
+			if (objects[j]->virtualTexture != texture) continue;
+			setObjectState(objects[j]);
+			const MeshLOD &lod = currentLOD(objects[j]);
+			for (GLuint k = lod.firstSubset; k < lod.firstSubset + lod.numSubsets; k++) {
+				const MeshSubset &subset = objects[j]->mesh->subsets[k];
+				if (virtualTextureFor(objects[j], subset)) drawSubset(objects[j], subset);
+			}
+		}
+		endVirtualTextureFeedback(texture, prgShaded);
+		updateVirtualTexture(texture);
+	}
+	checkForError("after virtual texture feedback");
+}
+
+#define BENCHMARK_DRAWS  200
+#define BENCHMARK_ROUNDS 5
+
+/** Times drawing the landscape with each vertex layout, with and without
+ * compressed attributes, and prints the best time per draw of each. The
+ * landscape is found in the scene by its mesh, so it is drawn with its own
+ * texture and transform wherever it is in `objects`. */
+void benchmarkVertexLayouts(void) {
+	static const char* layoutNames[] = { "separate", "interleaved", "split positions" };
+	static const char* landscapePath = MODEL("landscape.obj");
+
+	const GPUMesh* sceneMesh = acquireMesh(landscapePath);
+	const DisplayObject* sceneObject = NULL;
+	for (size_t i = 0; i < objects.size() && !sceneObject; i++) {
+		if (objects[i]->mesh == sceneMesh) sceneObject = objects[i];
+	}
+	releaseMesh(landscapePath);
+	if (!sceneObject) {
+		fprintf(stderr, "The landscape isn't in the scene, so there is nothing to benchmark.\n");
+		return;
+	}
+
+	MappedMesh landscapeMesh;
+	loadCachedOBJ(landscapePath, landscapeMesh);
+	DisplayObject landscape = *sceneObject;
+	landscape.lod = 0;
+	bool wasCulling = cullMeshlets;
+	cullMeshlets = false;  // draw the whole mesh every time
+
+	GLuint query;
+	glGenQueries(1, &query);
+	printf("Benchmarking vertex layouts (%d draws of %u vertices, %u indices):\n", BENCHMARK_DRAWS,
+	       landscapeMesh.view.numVertices, landscapeMesh.view.numIndices);
+	for (int compress = 0; compress < 2; compress++) {
+		for (int layout = LAYOUT_SEPARATE; layout <= LAYOUT_SPLIT_POSITIONS; layout++) {
+			GPUMesh mesh = createGPUMesh(landscapeMesh.view, (VertexLayout)layout, compress);
+			landscape.mesh = &mesh;
+			drawObject(&landscape);  // warm up
+
+			GLuint64 best = 0;
+			for (int round = 0; round < BENCHMARK_ROUNDS; round++) {
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				for (int i = 0; i < BENCHMARK_DRAWS; i++) {
+					drawObject(&landscape);
+				}
+				glEndQuery(GL_TIME_ELAPSED);
+
+				GLuint64 elapsed;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+				if (round == 0 || elapsed < best) best = elapsed;
+			}
+			printf("  %-16s %-11s %7.1f KB: %.3f ms per draw\n", layoutNames[layout],
+			       compress ? "compressed" : "float", mesh.numBytes / 1024.0,
+			       best / 1e6 / BENCHMARK_DRAWS);
+			deleteGPUMesh(mesh);
+		}
+	}
+	glDeleteQueries(1, &query);
+	closeMeshCache(landscapeMesh);
+	cullMeshlets = wasCulling;
+	checkForError("after benchmark");
+}
+
+static bool nPressed = false, hPressed = false, dPressed = false, pPressed = false, bPressed = false,
+            cPressed = false;
 
 bool processInput(float timePassed) {
 	bool n = glfwGetKey(static_cast<int>('N'));
@@ -201,9 +508,26 @@ bool processInput(float timePassed) {
 	if (d && !dPressed) {
 		printf("Camera position: (%f, %f, %f)\n", camera.location[0], camera.location[1], camera.location[2]);
 		printf("Camera angle: %f horizontal, %f vertical\n", camera.rotation[1], camera.rotation[0]);
+		printf("Meshlets drawn: %d of %d\n", numMeshletsDrawn, numMeshletsTested);
+		for (size_t i = 0; i < objects.size(); i++) {
+			if (objects[i]->virtualTexture) printVirtualTextureUsage(objects[i]->virtualTexture);
+		}
 	}
 	dPressed = d;
 
+	bool c = glfwGetKey(static_cast<int>('C'));
+	if (c && !cPressed) {
+		cullMeshlets = !cullMeshlets;
+		printf("Meshlet culling %s.\n", cullMeshlets ? "on" : "off");
+	}
+	cPressed = c;
+
+	bool b = glfwGetKey(static_cast<int>('B'));
+	if (b && !bPressed && numLoadingResources() == 0) {
+		benchmarkVertexLayouts();
+	}
+	bPressed = b;
+
 	bool t = glfwGetKey(static_cast<int>('T'));
 	if (t && !isTourRunning()) {
 		printf("Starting the tour.\n");
@@ -247,6 +571,8 @@ int main(void) {
 		fprintf(stderr, "Could not initialise GLFW. Terminating.\n");
 		exit(EXIT_FAILURE);
 	}
+	startWorkers();
+	openPack(ASSET_PACK);
 
 	// Set up
 	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
@@ -275,26 +601,33 @@ int main(void) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthMask(GL_TRUE);
 
+	setResidencyBudget(GPU_MEMORY_BUDGET, RESIDENCY_LOAD_DISTANCE);
 	setupScene(objects, camera);
 	moveCamera(0);
 	checkForError("After scene setup");
 
 	// Main loop
+	float pixelsPerUnit = WINDOW_HEIGHT / (2 * tan(FIELD_OF_VIEW / 2 * PI / 180));
 	printf("Entering main loop.\n");
 	double lastTime = glfwGetTime();
 	bool shouldExit = false;
 	do {
+		processLoadedResources();
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		for (unsigned int i = 0; i < objects.size(); i++) {
-			drawObject(objects[i]);
+			updateLOD(*objects[i], camera.location, pixelsPerUnit);
 		}
+		useObjectResources(objects);
+		updateVirtualTextures(objects);
+		drawObjects(objects);
 
 		/*if (showNormals) {
 			glUseProgram(prgNormals);
 			GLuint uniMVP = glGetUniformLocation(prgNormals, "MVP");
 			for (unsigned int i = 0; i < objects.size(); i++) {
 				glUniformMatrix4fv(uniMVP, 1, GL_FALSE, &(objects[i]->mvpSet.mvp[0][0]));
-				glDrawArrays(GL_POINTS, 0, objects[i]->numVertices);
+				glDrawArrays(GL_POINTS, 0, objects[i]->mesh->numVertices);
 			}
 			glUseProgram(prgShaded);
 		}*/
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "generators.h"
+#include "meshcache.h"
+#include "objstream.h"
+#include "pack.h"
+#include "meshopt.h"
+#include "meshlets.h"
+#include "simplify.h"
+
+static_assert(sizeof(MeshCacheHeader) == 128, "MeshCacheHeader must not contain padding");
+static_assert(sizeof(MeshLOD) == 20, "MeshLOD must not contain padding");
+static_assert(sizeof(MeshSubset) == 20, "MeshSubset must not contain padding");
+static_assert(sizeof(Meshlet) == 40, "Meshlet must not contain padding");
+
+static std::string cachePathFor(const char* objPath) {
+	return std::string(objPath) + MESH_CACHE_EXTENSION;
+}
+
+/** The caches store raw in-memory floats and integers, so they are only usable
+ * on little-endian machines. */
+bool isLittleEndian(void) {
+	const uint16_t one = 1;
+	return *(const uint8_t*)&one == 1;
+}
+
+/** Hashes the size and modification time of a file (FNV-1a), to detect when a
+ * cache is stale.
+ * @return false if the file could not be stat'd. */
+bool sourceKeyOf(const char* path, uint64_t &key) {
+	struct stat st;
+	if (stat(path, &st) != 0) return false;
+
+	uint64_t values[3] = { (uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec };
+	const unsigned char* bytes = (const unsigned char*)values;
+	key = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(values); i++) {
+		key = (key ^ bytes[i]) * 1099511628211ull;
+	}
+	return true;
+}
+
+/** Hashes the size and modification time of an OBJ file and, if it names one,
+ * of its material library, which is found next to it as `glmReadMTL` does. A
+ * missing library hashes as 0, so the cache is rebuilt when it turns up.
+ * @return false if the OBJ file could not be stat'd. */
+static bool meshSourceKeyOf(const char* objPath, const char* materialLibrary, uint64_t &key) {
+	if (!sourceKeyOf(objPath, key)) return false;
+	if (!materialLibrary[0]) return true;
+
+	std::string path(objPath);
+	size_t slash = path.rfind('/');
+	path = path.substr(0, slash == std::string::npos ? 0 : slash + 1) + materialLibrary;
+	uint64_t libraryKey = 0;
+	sourceKeyOf(path.c_str(), libraryKey);
+	key = (key ^ libraryKey) * 1099511628211ull;
+	return true;
+}
+
+static size_t cacheLength(const MeshCacheHeader &header) {
+	return sizeof(MeshCacheHeader)
+	     + header.numVertices  * (2 * sizeof(glm::vec3) + sizeof(glm::vec2))
+	     + header.numIndices   * sizeof(GLuint)
+	     + header.numLODs      * sizeof(MeshLOD)
+	     + header.numSubsets   * sizeof(MeshSubset)
+	     + header.numMaterials * sizeof(MeshMaterial)
+	     + header.numMeshlets  * sizeof(Meshlet);
+}
+
+/** Checks that a cache's blocks add up to its length, and points `mesh.view`
+ * at them.
+ * @return false if the cache isn't in the current format. */
+static bool viewMeshCache(const void* data, size_t length, MappedMesh &mesh) {
+	const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+	if (length < sizeof(MeshCacheHeader) || memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0
+			|| header->version != MESH_CACHE_VERSION || cacheLength(*header) != length
+			|| header->materialLibrary[MESH_NAME_LENGTH - 1] != 0) {
+		return false;
+	}
+
+	mesh.header = header;
+	mesh.view.numVertices = header->numVertices;
+	mesh.view.numIndices  = header->numIndices;
+	mesh.view.vertices  = (const glm::vec3*)(header + 1);
+	mesh.view.normals   = mesh.view.vertices + header->numVertices;
+	mesh.view.texCoords = (const glm::vec2*)(mesh.view.normals + header->numVertices);
+	mesh.view.indices   = (const GLuint*)(mesh.view.texCoords + header->numVertices);
+	mesh.view.lods      = (const MeshLOD*)(mesh.view.indices + header->numIndices);
+	mesh.view.numLODs   = header->numLODs;
+	mesh.view.subsets   = (const MeshSubset*)(mesh.view.lods + header->numLODs);
+	mesh.view.numSubsets = header->numSubsets;
+	mesh.view.materials = (const MeshMaterial*)(mesh.view.subsets + header->numSubsets);
+	mesh.view.numMaterials = header->numMaterials;
+	mesh.view.meshlets  = (const Meshlet*)(mesh.view.materials + header->numMaterials);
+	mesh.view.numMeshlets = header->numMeshlets;
+	return true;
+}
+
+/** Maps the cache for the given OBJ file into memory, if it exists and is up
+ * to date.
+ * @return true on success, in which case `mesh` must later be passed to
+ *         `closeMeshCache`. */
+bool openMeshCache(const char* objPath, MappedMesh &mesh) {
+	if (!isLittleEndian() || access(objPath, F_OK) != 0) return false;
+
+	std::string path = cachePathFor(objPath);
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MeshCacheHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+
+	uint64_t key;
+	if (!viewMeshCache(mapping, st.st_size, mesh) || !meshSourceKeyOf(objPath, mesh.header->materialLibrary, key)
+			|| mesh.header->sourceKey != key) {
+		fprintf(stderr, "Mesh cache %s is stale, ignoring it.\n", path.c_str());
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	mesh.mapping       = mapping;
+	mesh.mappingLength = st.st_size;
+	mesh.packBuffer    = NULL;
+	mesh.parsed        = NULL;
+	printf("Mapped %s: %u vertices, %u indices.\n", path.c_str(), mesh.header->numVertices, mesh.header->numIndices);
+	return true;
+}
+
+/** Finds the cache for the given OBJ file in the asset pack (see pack.h). The
+ * pack is built from up-to-date caches, so the OBJ itself isn't checked, and
+ * needn't exist.
+ * @return true on success, in which case `mesh` must later be passed to
+ *         `closeMeshCache`. */
+static bool openPackedMeshCache(const char* objPath, MappedMesh &mesh) {
+	PackView packed;
+	std::string name = cachePathFor(objPath);
+	if (!isLittleEndian() || !readFromPack(name.c_str(), packed)) return false;
+
+	if (!viewMeshCache(packed.data, packed.size, mesh)) {
+		fprintf(stderr, "Mesh cache %s in the asset pack is stale, ignoring it.\n", name.c_str());
+		releasePackView(packed);
+		return false;
+	}
+
+	mesh.mapping       = NULL;
+	mesh.mappingLength = 0;
+	mesh.packBuffer    = packed.buffer;
+	mesh.parsed        = NULL;
+	printf("Found %s in the asset pack: %u vertices, %u indices.\n", name.c_str(),
+	       mesh.header->numVertices, mesh.header->numIndices);
+	return true;
+}
+
+void closeMeshCache(MappedMesh &mesh) {
+	if (mesh.mapping) munmap(mesh.mapping, mesh.mappingLength);
+	free(mesh.packBuffer);
+	delete mesh.parsed;
+	mesh.mapping    = NULL;
+	mesh.header     = NULL;
+	mesh.packBuffer = NULL;
+	mesh.parsed     = NULL;
+}
+
+/** Writes the cache for the given OBJ file. The file is written under a
+ * temporary name and renamed into place, so a partially written cache is never
+ * picked up.
+ * @return true if the cache was written. */
+bool writeMeshCache(const char* objPath, const Mesh &mesh) {
+	if (!isLittleEndian()) return false;
+	if (mesh.normals.size() != mesh.vertices.size() || mesh.texCoords.size() != mesh.vertices.size()) return false;
+	if (mesh.materialLibrary.size() >= MESH_NAME_LENGTH) {
+		fprintf(stderr, "The material library name of %s is too long for its mesh cache.\n", objPath);
+		return false;
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.materialLibrary, mesh.materialLibrary.c_str());
+	uint64_t key;
+	if (!meshSourceKeyOf(objPath, header.materialLibrary, key)) return false;
+	memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+	header.version     = MESH_CACHE_VERSION;
+	header.sourceKey   = key;
+	header.numVertices = mesh.vertices.size();
+	header.numIndices  = mesh.indices.size();
+	header.numLODs     = mesh.lods.size();
+	header.numSubsets  = mesh.subsets.size();
+	header.numMaterials = mesh.materials.size();
+	header.numMeshlets  = mesh.meshlets.size();
+
+	glm::vec3 boundsMin(0, 0, 0), boundsMax(0, 0, 0);
+	if (!mesh.vertices.empty()) boundsMin = boundsMax = mesh.vertices[0];
+	for (size_t i = 1; i < mesh.vertices.size(); i++) {
+		boundsMin = glm::min(boundsMin, mesh.vertices[i]);
+		boundsMax = glm::max(boundsMax, mesh.vertices[i]);
+	}
+	for (int i = 0; i < 3; i++) {
+		header.boundsMin[i] = boundsMin[i];
+		header.boundsMax[i] = boundsMax[i];
+	}
+
+	std::string path = cachePathFor(objPath);
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Could not write mesh cache %s.\n", path.c_str());
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(mesh.vertices.data(),  sizeof(glm::vec3), mesh.vertices.size(),  file) == mesh.vertices.size();
+	ok = ok && fwrite(mesh.normals.data(),   sizeof(glm::vec3), mesh.normals.size(),   file) == mesh.normals.size();
+	ok = ok && fwrite(mesh.texCoords.data(), sizeof(glm::vec2), mesh.texCoords.size(), file) == mesh.texCoords.size();
+	ok = ok && fwrite(mesh.indices.data(),   sizeof(GLuint),    mesh.indices.size(),   file) == mesh.indices.size();
+	ok = ok && fwrite(mesh.lods.data(),      sizeof(MeshLOD),   mesh.lods.size(),      file) == mesh.lods.size();
+	ok = ok && fwrite(mesh.subsets.data(),   sizeof(MeshSubset), mesh.subsets.size(),  file) == mesh.subsets.size();
+	ok = ok && fwrite(mesh.materials.data(), sizeof(MeshMaterial), mesh.materials.size(), file) == mesh.materials.size();
+	ok = ok && fwrite(mesh.meshlets.data(),  sizeof(Meshlet),   mesh.meshlets.size(),  file) == mesh.meshlets.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Could not write mesh cache %s.\n", path.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Where the chunks of a streamed OBJ go while its cache is being built. The
+ * vertices are written straight after the header, and the other blocks to
+ * temporary files which are appended once the number of vertices is known. */
+struct StreamedCache {
+	FILE* file;
+	FILE* normals;
+	FILE* texCoords;
+	FILE* indices;
+	MeshCacheHeader header;
+	glm::vec3 boundsMin, boundsMax;
+	bool ok;
+};
+
+static void appendChunk(Mesh &optimized, void* data) {
+	StreamedCache &cache = *(StreamedCache*)data;
+	if (!cache.ok) return;
+
+	optimizeMesh(optimized, NULL);  // in place, so the chunk isn't held twice
+
+	// Indices are relative to the chunk, so offset them past the earlier ones
+	GLuint offset = cache.header.numVertices;
+	std::vector<GLuint> &indices = optimized.indices;
+	for (size_t i = 0; i < indices.size(); i++) indices[i] += offset;
+
+	if (offset == 0 && !optimized.vertices.empty()) cache.boundsMin = cache.boundsMax = optimized.vertices[0];
+	for (size_t i = 0; i < optimized.vertices.size(); i++) {
+		cache.boundsMin = glm::min(cache.boundsMin, optimized.vertices[i]);
+		cache.boundsMax = glm::max(cache.boundsMax, optimized.vertices[i]);
+	}
+
+	size_t n = optimized.vertices.size();
+	cache.ok = fwrite(optimized.vertices.data(),  sizeof(glm::vec3), n, cache.file)      == n
+	        && fwrite(optimized.normals.data(),   sizeof(glm::vec3), n, cache.normals)   == n
+	        && fwrite(optimized.texCoords.data(), sizeof(glm::vec2), n, cache.texCoords) == n
+	        && fwrite(indices.data(), sizeof(GLuint), indices.size(), cache.indices) == indices.size();
+	cache.header.numVertices += n;
+	cache.header.numIndices  += indices.size();
+}
+
+/** Copies the whole of `from` onto the end of `to`. */
+static bool appendFile(FILE* to, FILE* from) {
+	if (fflush(from) != 0 || fseek(from, 0, SEEK_SET) != 0) return false;
+	char buffer[1 << 16];
+	size_t got;
+	while ((got = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+		if (fwrite(buffer, 1, got, to) != got) return false;
+	}
+	return !ferror(from);
+}
+
+/** Writes the cache for an OBJ file without ever holding the whole mesh in
+ * memory, using `streamOBJ`. Each chunk is optimised separately. Vertices on
+ * the boundary between two chunks are stored once per chunk, so the cache can
+ * be slightly larger than the one `writeMeshCache` would write. Streamed
+ * meshes only have their full-detail level, a single material and no
+ * meshlets.
+ * @return true if the cache was written. */
+bool writeStreamedMeshCache(const char* objPath, size_t memoryLimit) {
+	StreamedCache cache;
+	memset(&cache.header, 0, sizeof(cache.header));
+	memcpy(cache.header.magic, MESH_CACHE_MAGIC, 4);
+	cache.header.version = MESH_CACHE_VERSION;
+	if (!isLittleEndian() || !sourceKeyOf(objPath, cache.header.sourceKey)) return false;
+	cache.boundsMin = cache.boundsMax = glm::vec3(0, 0, 0);
+
+	std::string path = cachePathFor(objPath);
+	std::string tempPath = path + ".tmp";
+	cache.file      = fopen(tempPath.c_str(), "w+b");
+	cache.normals   = tmpfile();
+	cache.texCoords = tmpfile();
+	cache.indices   = tmpfile();
+	cache.ok = cache.file && cache.normals && cache.texCoords && cache.indices;
+
+	// Leave room for the header, which is filled in at the end
+	cache.ok = cache.ok && fwrite(&cache.header, sizeof(cache.header), 1, cache.file) == 1;
+	cache.ok = cache.ok && streamOBJ(objPath, memoryLimit, appendChunk, &cache);
+	cache.ok = cache.ok && appendFile(cache.file, cache.normals)
+	                    && appendFile(cache.file, cache.texCoords)
+	                    && appendFile(cache.file, cache.indices);
+
+	for (int i = 0; i < 3; i++) {
+		cache.header.boundsMin[i] = cache.boundsMin[i];
+		cache.header.boundsMax[i] = cache.boundsMax[i];
+	}
+	cache.ok = cache.ok && fseek(cache.file, 0, SEEK_SET) == 0
+	                    && fwrite(&cache.header, sizeof(cache.header), 1, cache.file) == 1;
+
+	if (cache.normals)   fclose(cache.normals);
+	if (cache.texCoords) fclose(cache.texCoords);
+	if (cache.indices)   fclose(cache.indices);
+	if (cache.file) cache.ok = (fclose(cache.file) == 0) && cache.ok;
+
+	if (!cache.ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Could not write mesh cache %s.\n", path.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** @return true if the given OBJ file is big enough that it should be
+ * streamed into its cache rather than loaded in one go. */
+static bool shouldStream(const char* objPath) {
+	struct stat st;
+	return stat(objPath, &st) == 0 && (uint64_t)st.st_size > MESH_CACHE_STREAM_THRESHOLD;
+}
+
+/** Loads the mesh for an OBJ file, from its cache if there is an up-to-date
+ * one, or otherwise by parsing and optimising the OBJ, building its levels of
+ * detail, and writing the cache for next time.
+ * OBJ files over MESH_CACHE_STREAM_THRESHOLD bytes are streamed into the cache
+ * in chunks instead, so that they never have to fit in memory.
+ * The mesh must later be passed to `closeMeshCache`. */
+void loadCachedOBJ(const char* objPath, MappedMesh &mesh) {
+	if (openPackedMeshCache(objPath, mesh) || openMeshCache(objPath, mesh)) return;
+
+	if (shouldStream(objPath)) {
+		if (writeStreamedMeshCache(objPath, OBJ_STREAM_DEFAULT_MEMORY_LIMIT) && openMeshCache(objPath, mesh)) return;
+		fprintf(stderr, "Could not stream %s into its cache, loading it directly.\n", objPath);
+	}
+
+	Mesh parsed = loadOBJ(objPath);
+	optimizeMesh(parsed, objPath);
+	buildMeshlets(parsed, objPath);
+	buildLODs(parsed, objPath);
+	if (writeMeshCache(objPath, parsed) && openMeshCache(objPath, mesh)) return;
+
+	// Couldn't use the cache, so hold on to the parsed mesh instead
+	mesh.mapping = NULL;
+	mesh.mappingLength = 0;
+	mesh.header = NULL;
+	mesh.packBuffer = NULL;
+	mesh.parsed = new Mesh(parsed);
+	mesh.view   = viewOf(*mesh.parsed);
+}
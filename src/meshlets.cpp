@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "generators.h"
+#include "meshopt.h"
+#include "meshlets.h"
+
+/** Sets the size and facing of a meshlet from its triangles. */
+static void computeBounds(Meshlet &meshlet, const Mesh &mesh, const GLuint* indices,
+                          const std::vector<glm::vec3> &faceNormals, const std::vector<GLuint> &triangles) {
+	// Bounding sphere around the middle of the bounding box
+	glm::vec3 boundsMin = mesh.vertices[indices[3 * triangles[0]]], boundsMax = boundsMin;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int k = 0; k < 3; k++) {
+			const glm::vec3 &v = mesh.vertices[indices[3 * triangles[i] + k]];
+			boundsMin = glm::min(boundsMin, v);
+			boundsMax = glm::max(boundsMax, v);
+		}
+	}
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = 0;
+	for (size_t i = 0; i < triangles.size(); i++) {
+		for (int k = 0; k < 3; k++) {
+			radius = fmaxf(radius, glm::length(mesh.vertices[indices[3 * triangles[i] + k]] - center));
+		}
+	}
+
+	// Normal cone around the area-weighted average normal
+	glm::vec3 axis(0, 0, 0);
+	for (size_t i = 0; i < triangles.size(); i++) axis += faceNormals[triangles[i]];
+	float axisLength = glm::length(axis);
+	float minDot = -1;
+	if (axisLength > 0) {
+		axis /= axisLength;
+		minDot = 1;
+		for (size_t i = 0; i < triangles.size(); i++) {
+			float area = glm::length(faceNormals[triangles[i]]);
+			if (area > 0) minDot = fminf(minDot, glm::dot(faceNormals[triangles[i]] / area, axis));
+		}
+	}
+
+	for (int k = 0; k < 3; k++) {
+		meshlet.center[k]   = center[k];
+		meshlet.coneAxis[k] = axis[k];
+	}
+	meshlet.radius = radius;
+	// A cone wider than a hemisphere can always be seen from somewhere
+	meshlet.coneCutoff = minDot > 0 ? sqrtf(1 - minDot * minDot) : 1;
+}
+
+/** Splits one range of a mesh's indices into meshlets.
+ * @param positionOf The first vertex with the same position as each vertex.
+ * @param reordered  The triangles of the meshlets are appended to this, which
+ *                   must hold all the indices before the range.
+ * @param meshlets   The meshlets are appended to this. */
+static void buildRange(const Mesh &mesh, const std::vector<GLuint> &positionOf, GLuint firstIndex, GLuint numIndices,
+                       std::vector<GLuint> &reordered, std::vector<Meshlet> &meshlets) {
+	const GLuint* indices = &mesh.indices[firstIndex];
+	GLuint numTriangles = numIndices / 3;
+	GLuint numVertices = mesh.vertices.size();
+
+	// Triangles are neighbours if they share a position, so that meshlets can
+	// grow across seams
+	std::vector<GLuint> start(numVertices + 1, 0);
+	for (GLuint i = 0; i < numIndices; i++) start[positionOf[indices[i]] + 1]++;
+	for (GLuint p = 0; p < numVertices; p++) start[p + 1] += start[p];
+	std::vector<GLuint> adjacent(numIndices), next(start.begin(), start.end() - 1);
+	for (GLuint i = 0; i < numIndices; i++) adjacent[next[positionOf[indices[i]]]++] = i / 3;
+
+	std::vector<glm::vec3> faceNormals(numTriangles);  // with length proportional to area
+	for (GLuint t = 0; t < numTriangles; t++) {
+		const glm::vec3 &a = mesh.vertices[indices[3 * t]];
+		const glm::vec3 &b = mesh.vertices[indices[3 * t + 1]];
+		const glm::vec3 &c = mesh.vertices[indices[3 * t + 2]];
+		faceNormals[t] = glm::cross(b - a, c - a);
+	}
+
+	std::vector<char> used(numTriangles, 0);
+	std::vector<GLuint> inMeshlet(numVertices, ~0u);  // the last meshlet each vertex was in
+	std::vector<GLuint> triangles, candidates;
+	std::vector<GLuint> localOf(numVertices, ~0u), meshletVertices, local, clusters;
+	for (GLuint seed = 0; seed < numTriangles; seed++) {
+		if (used[seed]) continue;
+
+		GLuint id = meshlets.size();
+		int numMeshletVertices = 0;
+		glm::vec3 normalSum(0, 0, 0);
+		triangles.clear();
+		candidates.clear();
+		for (GLuint t = seed; ; ) {
+			used[t] = 1;
+			triangles.push_back(t);
+			normalSum += faceNormals[t];
+			for (int k = 0; k < 3; k++) {
+				GLuint v = indices[3 * t + k];
+				if (inMeshlet[v] != id) {
+					inMeshlet[v] = id;
+					numMeshletVertices++;
+				}
+				GLuint p = positionOf[v];
+				for (GLuint j = start[p]; j < start[p + 1]; j++) {
+					if (!used[adjacent[j]]) candidates.push_back(adjacent[j]);
+				}
+			}
+			if (triangles.size() == MESHLET_MAX_TRIANGLES) break;
+
+			// Pick the neighbour which adds the fewest vertices, and then
+			// faces most nearly the same way as the meshlet
+			float normalLength = glm::length(normalSum);
+			glm::vec3 direction = normalLength > 0 ? normalSum / normalLength : normalSum;
+			GLuint best = ~0u;
+			int bestNew = 4;
+			float bestDot = -2;
+			size_t kept = 0;
+			for (size_t i = 0; i < candidates.size(); i++) {
+				GLuint c = candidates[i];
+				if (used[c]) continue;
+				candidates[kept++] = c;
+
+				int numNew = 0;
+				for (int k = 0; k < 3; k++) numNew += inMeshlet[indices[3 * c + k]] != id;
+				if (numMeshletVertices + numNew > MESHLET_MAX_VERTICES) continue;
+
+				float area = glm::length(faceNormals[c]);
+				float dot = area > 0 ? glm::dot(faceNormals[c] / area, direction) : -1;
+				if (numNew < bestNew || (numNew == bestNew && dot > bestDot)) {
+					best = c;
+					bestNew = numNew;
+					bestDot = dot;
+				}
+			}
+			candidates.resize(kept);
+			if (best == ~0u) break;
+			t = best;
+		}
+
+		Meshlet meshlet;
+		meshlet.firstIndex = reordered.size();  // the ranges are built in order
+		meshlet.numIndices = 3 * triangles.size();
+		computeBounds(meshlet, mesh, indices, faceNormals, triangles);
+		meshlets.push_back(meshlet);
+
+		// The triangles were added in the order the meshlet grew, so reorder
+		// them for the vertex cache, numbering the vertices from 0 within the
+		// meshlet to keep that cheap
+		local.clear();
+		meshletVertices.clear();
+		for (size_t i = 0; i < triangles.size(); i++) {
+			for (int k = 0; k < 3; k++) {
+				GLuint v = indices[3 * triangles[i] + k];
+				if (localOf[v] == ~0u) {
+					localOf[v] = meshletVertices.size();
+					meshletVertices.push_back(v);
+				}
+				local.push_back(localOf[v]);
+			}
+		}
+		optimizeVertexCache(local, meshletVertices.size(), clusters);
+		for (size_t i = 0; i < local.size(); i++) reordered.push_back(meshletVertices[local[i]]);
+		for (size_t i = 0; i < meshletVertices.size(); i++) localOf[meshletVertices[i]] = ~0u;
+	}
+}
+
+/** Splits the triangles of a mesh into meshlets, reordering them so that each
+ * meshlet's triangles are consecutive, and then reordering the triangles
+ * within each meshlet for the vertex cache. This should be run after
+ * `optimizeMesh`, whose vertex order it starts from, but before `buildLODs`.
+ * If `name` is not NULL, prints how it went. */
+void buildMeshlets(Mesh &mesh, const char* name) {
+	mesh.meshlets.clear();
+	if (mesh.indices.empty()) return;
+
+	// Weld vertices by position
+	std::vector<GLuint> positionOf;
+	weldPositions(mesh.vertices, positionOf);
+
+	std::vector<GLuint> reordered;
+	reordered.reserve(mesh.indices.size());
+	if (mesh.subsets.empty()) {
+		buildRange(mesh, positionOf, 0, mesh.indices.size(), reordered, mesh.meshlets);
+	} else {
+		for (size_t i = 0; i < mesh.subsets.size(); i++) {
+			MeshSubset &subset = mesh.subsets[i];
+			subset.firstMeshlet = mesh.meshlets.size();
+			buildRange(mesh, positionOf, subset.firstIndex, subset.numIndices, reordered, mesh.meshlets);
+			subset.numMeshlets = mesh.meshlets.size() - subset.firstMeshlet;
+		}
+	}
+	mesh.indices.swap(reordered);
+	optimizeVertexFetch(mesh);
+
+	if (name) {
+		int numCones = 0;
+		for (size_t i = 0; i < mesh.meshlets.size(); i++) numCones += mesh.meshlets[i].coneCutoff < 1;
+		printf("Built %lu meshlets for %s: %.1f triangles each, %d cullable by facing, ACMR %.3f.\n",
+		       (unsigned long)mesh.meshlets.size(), name, mesh.indices.size() / 3.0 / mesh.meshlets.size(), numCones,
+		       averageCacheMissRatio(mesh.indices, VERTEX_CACHE_SIZE));
+	}
+}
+
+/** Finds the planes of the view frustum in the space that `mvp` transforms
+ * from (Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from
+ * the World-View-Projection Matrix", 2001). Points inside the frustum are on
+ * the positive side of all six, and the planes are normalised so that this
+ * gives their distance. */
+void frustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6]) {
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) rows[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+	for (int i = 0; i < 3; i++) {
+		planes[2 * i]     = rows[3] + rows[i];
+		planes[2 * i + 1] = rows[3] - rows[i];
+	}
+	for (int i = 0; i < 6; i++) planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+/** @return whether any of a meshlet may be seen, given the planes of the view
+ * frustum and the position of the camera in model space. */
+bool isMeshletVisible(const Meshlet &meshlet, const glm::vec4 planes[6], const glm::vec3 &eye) {
+	glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -meshlet.radius) return false;
+	}
+
+	// Every triangle faces away if the direction to every point of the sphere
+	// is within 90 degrees of every normal in the cone
+	glm::vec3 axis(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+	glm::vec3 toCenter = center - eye;
+	return glm::dot(toCenter, axis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
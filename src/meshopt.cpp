@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "generators.h"
+#include "meshopt.h"
+
+/** Simulates a FIFO post-transform vertex cache of the given size.
+ * @return the number of vertices transformed to draw the indices. */
+static size_t countCacheMisses(const std::vector<GLuint> &indices, int cacheSize) {
+	// A vertex is in the cache if fewer than cacheSize misses have happened since
+	// it was last added
+	std::vector<size_t> addedAt;
+	size_t misses = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		GLuint v = indices[i];
+		if (v >= addedAt.size()) addedAt.resize(v + 1, 0);
+		if (addedAt[v] == 0 || misses - addedAt[v] >= (size_t)cacheSize) {
+			misses++;
+			addedAt[v] = misses;
+		}
+	}
+	return misses;
+}
+
+/** @return the Average Cache Miss Ratio: vertices transformed per triangle
+ * (between 0.5 and 3; lower is better). */
+float averageCacheMissRatio(const std::vector<GLuint> &indices, int cacheSize) {
+	if (indices.empty()) return 0;
+	return countCacheMisses(indices, cacheSize) / (indices.size() / 3.0f);
+}
+
+/** @return the Average Transform to Vertex Ratio: the number of times each
+ * vertex is transformed, on average (1 is ideal). */
+float averageTransformToVertexRatio(const std::vector<GLuint> &indices, GLuint numVertices, int cacheSize) {
+	if (numVertices == 0) return 0;
+	return countCacheMisses(indices, cacheSize) / (float)numVertices;
+}
+
+/** Reorders triangles so that the vertices they share are likely to still be
+ * in the post-transform cache (Tipsify). Triangles are emitted in fans around
+ * one vertex at a time, and the next vertex is the one most likely to still be
+ * cached after its own fan.
+ * @param indices     The triangles to reorder.
+ * @param numVertices The number of vertices the indices refer to.
+ * @param clusters    Set to the first triangle of each run emitted without
+ *                    losing the contents of the cache, for `optimizeOverdraw`.
+ */
+void optimizeVertexCache(std::vector<GLuint> &indices, GLuint numVertices, std::vector<GLuint> &clusters) {
+	GLuint numTriangles = indices.size() / 3;
+	clusters.clear();
+	if (numTriangles == 0) return;
+
+	// The triangles using each vertex (in CSR form), and how many are left to emit
+	std::vector<GLuint> liveTriangles(numVertices, 0);
+	for (size_t i = 0; i < indices.size(); i++) liveTriangles[indices[i]]++;
+	std::vector<GLuint> start(numVertices + 1, 0);
+	for (GLuint v = 0; v < numVertices; v++) start[v + 1] = start[v] + liveTriangles[v];
+	std::vector<GLuint> adjacent(indices.size());
+	std::vector<GLuint> filled(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++) adjacent[filled[indices[i]]++] = i / 3;
+
+	std::vector<size_t> cachedAt(numVertices, 0);  // time each vertex entered the cache
+	std::vector<bool> emitted(numTriangles, false);
+	std::vector<GLuint> deadEnds;   // recently used vertices, to fall back on
+	std::vector<GLuint> candidates;
+	std::vector<GLuint> output;
+	output.reserve(indices.size());
+
+	size_t time = VERTEX_CACHE_SIZE + 1;
+	GLuint nextInOrder = 0;
+	long fanning = 0;
+	clusters.push_back(0);
+	while (fanning >= 0) {
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (GLuint a = start[fanning]; a < start[fanning + 1]; a++) {
+			GLuint t = adjacent[a];
+			if (emitted[t]) continue;
+			for (int j = 0; j < 3; j++) {
+				GLuint v = indices[3 * t + j];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - cachedAt[v] > VERTEX_CACHE_SIZE) {
+					cachedAt[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Pick the candidate which will still be in the cache after its fan, and
+		// which has been in the cache longest
+		long best = -1;
+		long bestPriority = -1;
+		for (size_t c = 0; c < candidates.size(); c++) {
+			GLuint v = candidates[c];
+			if (liveTriangles[v] == 0) continue;
+			long priority = 0;
+			if (time - cachedAt[v] + 2 * liveTriangles[v] <= VERTEX_CACHE_SIZE) {
+				priority = time - cachedAt[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+		if (best >= 0) {
+			fanning = best;
+			continue;
+		}
+
+		// Dead end: back up to a recent vertex, or carry on in input order
+		fanning = -1;
+		while (!deadEnds.empty()) {
+			GLuint v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[v] > 0) {
+				fanning = v;
+				break;
+			}
+		}
+		while (fanning < 0 && nextInOrder < numVertices) {
+			if (liveTriangles[nextInOrder] > 0) fanning = nextInOrder;
+			nextInOrder++;
+		}
+		if (fanning >= 0 && output.size() / 3 > clusters.back()) {
+			clusters.push_back(output.size() / 3);
+		}
+	}
+
+	indices.swap(output);
+}
+
+struct Cluster {
+	GLuint first, count;
+	float sortKey;
+};
+
+static bool outermostFirst(const Cluster &a, const Cluster &b) {
+	return a.sortKey > b.sortKey;
+}
+
+/** Sorts clusters of triangles (as found by `optimizeVertexCache`) so that
+ * those which face out from the centre of the mesh are drawn first. These are
+ * the ones most likely to cover the others, whatever direction the mesh is
+ * seen from, so more of the others fail the depth test. The order of the
+ * triangles within each cluster is kept, so cache efficiency is barely
+ * affected. */
+void optimizeOverdraw(std::vector<GLuint> &indices, const std::vector<glm::vec3> &vertices, const std::vector<GLuint> &clusters) {
+	GLuint numTriangles = indices.size() / 3;
+	if (clusters.size() < 2) return;
+
+	// The centroid of the mesh, weighted by area
+	glm::vec3 meshCentroid(0, 0, 0);
+	float meshArea = 0;
+	for (GLuint t = 0; t < numTriangles; t++) {
+		const glm::vec3 &a = vertices[indices[3*t]], &b = vertices[indices[3*t+1]], &c = vertices[indices[3*t+2]];
+		float area = glm::length(glm::cross(b - a, c - a));
+		meshCentroid += area * (a + b + c) / 3.0f;
+		meshArea += area;
+	}
+	if (meshArea > 0) meshCentroid /= meshArea;
+
+	// Score each cluster by how far its centroid lies out along its average normal
+	std::vector<Cluster> sorted(clusters.size());
+	for (size_t i = 0; i < clusters.size(); i++) {
+		Cluster &cluster = sorted[i];
+		cluster.first = clusters[i];
+		cluster.count = (i + 1 < clusters.size() ? clusters[i + 1] : numTriangles) - cluster.first;
+
+		glm::vec3 centroid(0, 0, 0), normal(0, 0, 0);
+		float area = 0;
+		for (GLuint t = cluster.first; t < cluster.first + cluster.count; t++) {
+			const glm::vec3 &a = vertices[indices[3*t]], &b = vertices[indices[3*t+1]], &c = vertices[indices[3*t+2]];
+			glm::vec3 n = glm::cross(b - a, c - a);  // length is twice the area
+			float triangleArea = glm::length(n);
+			centroid += triangleArea * (a + b + c) / 3.0f;
+			normal += n;
+			area += triangleArea;
+		}
+		float normalLength = glm::length(normal);
+		cluster.sortKey = (area > 0 && normalLength > 0)
+			? glm::dot(centroid / area - meshCentroid, normal / normalLength)
+			: 0;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), outermostFirst);
+
+	std::vector<GLuint> output;
+	output.reserve(indices.size());
+	for (size_t i = 0; i < sorted.size(); i++) {
+		output.insert(output.end(), indices.begin() + 3 * sorted[i].first,
+		              indices.begin() + 3 * (sorted[i].first + sorted[i].count));
+	}
+	indices.swap(output);
+}
+
+/** Renumbers the vertices of a mesh in the order its indices first use them,
+ * so that vertex data is read from memory sequentially. Vertices which aren't
+ * used are dropped. */
+void optimizeVertexFetch(Mesh &mesh) {
+	const GLuint unused = (GLuint)-1;
+	std::vector<GLuint> remap(mesh.vertices.size(), unused);
+	GLuint numUsed = 0;
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		GLuint &index = mesh.indices[i];
+		if (remap[index] == unused) remap[index] = numUsed++;
+		index = remap[index];
+	}
+
+	bool hasNormals   = mesh.normals.size()   == mesh.vertices.size();
+	bool hasTexCoords = mesh.texCoords.size() == mesh.vertices.size();
+	std::vector<glm::vec3> vertices(numUsed), normals(hasNormals ? numUsed : 0);
+	std::vector<glm::vec2> texCoords(hasTexCoords ? numUsed : 0);
+	for (size_t v = 0; v < remap.size(); v++) {
+		if (remap[v] == unused) continue;
+		vertices[remap[v]] = mesh.vertices[v];
+		if (hasNormals)   normals  [remap[v]] = mesh.normals[v];
+		if (hasTexCoords) texCoords[remap[v]] = mesh.texCoords[v];
+	}
+	mesh.vertices.swap(vertices);
+	if (hasNormals)   mesh.normals.swap(normals);
+	if (hasTexCoords) mesh.texCoords.swap(texCoords);
+}
+
+struct PositionHash {
+	size_t operator()(const glm::vec3 &v) const {
+		uint32_t bits[3];
+		memcpy(bits, &v, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+/** Welds vertices by position, ignoring their other attributes.
+ * @param positionOf Set to the first vertex with the same position as each
+ *                   vertex. */
+void weldPositions(const std::vector<glm::vec3> &vertices, std::vector<GLuint> &positionOf) {
+	std::unordered_map<glm::vec3, GLuint, PositionHash> firstWith;
+	positionOf.resize(vertices.size());
+	for (GLuint v = 0; v < vertices.size(); v++) {
+		positionOf[v] = firstWith.insert(std::make_pair(vertices[v], v)).first->second;
+	}
+}
+
+/** Runs all three optimisations on a mesh. Triangles are only reordered within
+ * their material's subset, so the subsets stay intact. If `name` is not NULL,
+ * prints the ACMR and ATVR before and after. */
+void optimizeMesh(Mesh &mesh, const char* name) {
+	float acmrBefore = averageCacheMissRatio(mesh.indices, VERTEX_CACHE_SIZE);
+	float atvrBefore = averageTransformToVertexRatio(mesh.indices, mesh.vertices.size(), VERTEX_CACHE_SIZE);
+
+	size_t numClusters = 0;
+	std::vector<GLuint> clusters;
+	if (mesh.subsets.empty()) {
+		optimizeVertexCache(mesh.indices, mesh.vertices.size(), clusters);
+		optimizeOverdraw(mesh.indices, mesh.vertices, clusters);
+		numClusters = clusters.size();
+	} else {
+		std::vector<GLuint> indices;
+		for (size_t i = 0; i < mesh.subsets.size(); i++) {
+			std::vector<GLuint>::iterator first = mesh.indices.begin() + mesh.subsets[i].firstIndex;
+			indices.assign(first, first + mesh.subsets[i].numIndices);
+			optimizeVertexCache(indices, mesh.vertices.size(), clusters);
+			optimizeOverdraw(indices, mesh.vertices, clusters);
+			std::copy(indices.begin(), indices.end(), first);
+			numClusters += clusters.size();
+		}
+	}
+	optimizeVertexFetch(mesh);
+
+	if (name) {
+		printf("Optimised %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%lu clusters).\n", name,
+		       acmrBefore, averageCacheMissRatio(mesh.indices, VERTEX_CACHE_SIZE),
+		       atvrBefore, averageTransformToVertexRatio(mesh.indices, mesh.vertices.size(), VERTEX_CACHE_SIZE),
+		       (unsigned long)numClusters);
+	}
+}
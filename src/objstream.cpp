@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+#include "glm.h" // Nate Robins' GLM, NOT the maths library
+
+#include "generators.h"
+#include "objstream.h"
+
+/** Rough number of bytes needed per vertex in a chunk: its attributes, its
+ * share of the index buffer and its entry in the deduplication table. */
+#define BYTES_PER_CHUNK_VERTEX 160
+
+/** A pool of position, normal or texture coordinate values, written to a
+ * temporary file in the first pass and mapped back in for the second. */
+struct AttributePool {
+	FILE* file;
+	GLuint count;
+	int numComponents;
+	bool writeFailed;  ///< if the temporary file could not be written, say for lack of space
+
+	const GLfloat* values;
+	size_t mappingLength;
+};
+
+/** Calls `process(line, end, state)` for each line of the file, reading it
+ * through a buffer of `windowSize` bytes.
+ * @return false if the file could not be read, or has a line longer than the
+ *         window. */
+template <class State>
+static bool forEachLine(const char* path, size_t windowSize, void (*process)(const char*, const char*, State&), State &state) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s.\n", path);
+		return false;
+	}
+
+	char* window = (char*)malloc(windowSize);
+	size_t filled = 0;
+	bool ok = true, atEnd = false;
+	while (!atEnd) {
+		ssize_t got = read(fd, window + filled, windowSize - filled);
+		if (got < 0) {
+			fprintf(stderr, "Could not read %s.\n", path);
+			ok = false;
+			break;
+		}
+		filled += got;
+		atEnd = (got == 0);
+
+		// Process the complete lines, and keep the partial one for next time
+		const char* p = window;
+		const char* end = window + filled;
+		for (;;) {
+			const char* newline = (const char*)memchr(p, '\n', end - p);
+			if (!newline) break;
+			process(p, newline, state);
+			p = newline + 1;
+		}
+		if (atEnd && p < end) {
+			process(p, end, state);
+			p = end;
+		}
+
+		size_t remaining = end - p;
+		if (remaining == windowSize) {
+			fprintf(stderr, "%s has a line longer than %lu bytes.\n", path, (unsigned long)windowSize);
+			ok = false;
+			break;
+		}
+		memmove(window, p, remaining);
+		filled = remaining;
+	}
+
+	free(window);
+	close(fd);
+	return ok;
+}
+
+static const char* skipSpace(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+/** Identifies the attribute pool a `v`, `vn` or `vt` line belongs to.
+ * @return 0, 1 or 2 respectively, or -1 for any other line. */
+static int attributeType(const char* &p, const char* end) {
+	p = skipSpace(p, end);
+	if (end - p < 2 || p[0] != 'v') return -1;
+	if (p[1] == ' ' || p[1] == '\t') { p += 1; return 0; }
+	if (p[1] == 'n') { p += 2; return 1; }
+	if (p[1] == 't') { p += 2; return 2; }
+	return -1;
+}
+
+// First pass: copy the attributes out to the pools //
+
+static void poolAttributes(const char* p, const char* end, AttributePool* &pools) {
+	int type = attributeType(p, end);
+	if (type < 0) return;
+
+	AttributePool &pool = pools[type];
+	GLfloat values[3];
+	for (int i = 0; i < pool.numComponents; i++) {
+		p = skipSpace(p, end);
+		if (!glmParseFloat(&p, end, &values[i])) values[i] = 0;
+	}
+	if (pool.writeFailed) return;
+	if (fwrite(values, sizeof(GLfloat), pool.numComponents, pool.file) != (size_t)pool.numComponents) {
+		pool.writeFailed = true;
+		return;
+	}
+	pool.count++;
+}
+
+/** Maps a pool back in, once it has all been written.
+ * @return false if the pool's temporary file is not all there, as mapping
+ *         past its end would fault on the first read. */
+static bool mapPool(AttributePool &pool) {
+	pool.values = NULL;
+	pool.mappingLength = 0;
+	if (pool.writeFailed || fflush(pool.file) != 0) return false;
+	if (pool.count == 0) return true;
+
+	pool.mappingLength = sizeof(GLfloat) * pool.numComponents * pool.count;
+	struct stat st;
+	if (fstat(fileno(pool.file), &st) != 0 || (size_t)st.st_size < pool.mappingLength) return false;
+	void* mapping = mmap(NULL, pool.mappingLength, PROT_READ, MAP_SHARED, fileno(pool.file), 0);
+	if (mapping == MAP_FAILED) return false;
+	pool.values = (const GLfloat*)mapping;
+	return true;
+}
+
+/** Drops the pages of a pool from this process's resident set. They come back
+ * from the page cache (or disk) when they are next needed. */
+static void evictPool(AttributePool &pool) {
+	if (pool.values) madvise((void*)pool.values, pool.mappingLength, MADV_DONTNEED);
+}
+
+// Second pass: build the chunks from the faces //
+
+struct ChunkState {
+	AttributePool* pools;
+	GLuint counts[3];  ///< attributes seen so far, for resolving relative indices
+
+	size_t maxChunkVertices;
+	Mesh chunk;
+	std::unordered_map<VertexKey, GLuint, VertexKeyHash> indexOf;
+
+	MeshChunkCallback callback;
+	void* data;
+	unsigned long numTriangles, numChunks, numSkipped;
+};
+
+static void emitChunk(ChunkState &state) {
+	if (state.chunk.indices.empty()) return;
+
+	state.callback(state.chunk, state.data);
+	state.numChunks++;
+
+	state.chunk.vertices.clear();
+	state.chunk.normals.clear();
+	state.chunk.texCoords.clear();
+	state.chunk.indices.clear();
+	state.indexOf.clear();
+	for (int i = 0; i < 3; i++) evictPool(state.pools[i]);
+
+	// The callback may have swapped in smaller arrays
+	state.chunk.vertices .reserve(state.maxChunkVertices);
+	state.chunk.normals  .reserve(state.maxChunkVertices);
+	state.chunk.texCoords.reserve(state.maxChunkVertices);
+}
+
+/** @return the index of the given corner in the current chunk, adding its
+ * attributes to the chunk if they aren't there yet. */
+static GLuint chunkIndexOf(ChunkState &state, const VertexKey &key) {
+	std::pair<std::unordered_map<VertexKey, GLuint, VertexKeyHash>::iterator, bool> inserted =
+		state.indexOf.insert(std::make_pair(key, (GLuint)state.chunk.vertices.size()));
+	if (!inserted.second) return inserted.first->second;
+
+	// Keys are 1-based (0 = not given)
+	const GLfloat* v = &state.pools[0].values[3 * (key.v - 1)];
+	state.chunk.vertices.push_back(glm::vec3(v[0], v[1], v[2]));
+	if (key.n) {
+		const GLfloat* n = &state.pools[1].values[3 * (key.n - 1)];
+		state.chunk.normals.push_back(glm::vec3(n[0], n[1], n[2]));
+	} else {
+		state.chunk.normals.push_back(glm::vec3(0, 0, 0));
+	}
+	if (key.t) {
+		const GLfloat* t = &state.pools[2].values[2 * (key.t - 1)];
+		state.chunk.texCoords.push_back(glm::vec2(t[0], t[1]));
+	} else {
+		state.chunk.texCoords.push_back(glm::vec2(0, 0));
+	}
+	return inserted.first->second;
+}
+
+static void buildChunks(const char* p, const char* end, ChunkState &state) {
+	const char* start = p;
+	int type = attributeType(p, end);
+	if (type >= 0) {
+		state.counts[type]++;
+		return;
+	}
+
+	p = skipSpace(start, end);
+	if (p >= end || *p != 'f') return;
+	p++;
+
+	// Each corner can be v, v/t, v/t/n or v//n; polygons become triangle fans
+	VertexKey corners[3];
+	int numCorners = 0;
+	for (;;) {
+		int index[3] = { 0, 0, 0 };
+		p = skipSpace(p, end);
+		if (!glmParseInt(&p, end, &index[0])) break;
+		if (p < end && *p == '/') {
+			p++;
+			glmParseInt(&p, end, &index[1]);
+			if (p < end && *p == '/') {
+				p++;
+				glmParseInt(&p, end, &index[2]);
+			}
+		}
+
+		// Resolve relative indices, and check they refer to something
+		GLuint resolved[3];
+		static const int pool[3] = { 0, 2, 1 };  // v, t, n
+		bool valid = true;
+		for (int i = 0; i < 3; i++) {
+			long value = index[i] < 0 ? index[i] + (long)state.counts[pool[i]] + 1 : index[i];
+			if (value < 0 || value > (long)state.counts[pool[i]] || (i == 0 && value == 0)) {
+				valid = false;
+			}
+			resolved[i] = valid ? (GLuint)value : 0;
+		}
+		if (!valid) {
+			state.numSkipped++;
+			return;
+		}
+
+		VertexKey key = { resolved[0], resolved[2], resolved[1] };
+		corners[numCorners < 3 ? numCorners : 2] = key;
+		numCorners++;
+		if (numCorners < 3) continue;
+
+		// Start a new chunk if this triangle might not fit in the current one
+		if (state.chunk.vertices.size() + 3 > state.maxChunkVertices) emitChunk(state);
+		for (int i = 0; i < 3; i++) {
+			state.chunk.indices.push_back(chunkIndexOf(state, corners[i]));
+		}
+		state.numTriangles++;
+
+		corners[1] = corners[2];
+	}
+}
+
+/** Imports an OBJ file in chunks, keeping memory use roughly within the given
+ * limit. A quarter of the limit is used to read the file, and the rest for the
+ * chunk being built. The positions, normals and texture coordinates are first
+ * copied out to temporary files, which are then mapped back in (and evicted
+ * from memory after each chunk) while the faces are read.
+ *
+ * Each chunk has its own vertices and indices, and a vertex shared between two
+ * chunks appears in both. Groups and materials are ignored, as in `loadOBJ`.
+ * @return false if the file could not be imported. */
+bool streamOBJ(const char* path, size_t memoryLimit, MeshChunkCallback callback, void* data) {
+	size_t windowSize = memoryLimit / 4;
+
+	AttributePool pools[3] = {
+		{ tmpfile(), 0, 3, false, NULL, 0 },
+		{ tmpfile(), 0, 3, false, NULL, 0 },
+		{ tmpfile(), 0, 2, false, NULL, 0 }
+	};
+	bool ok = pools[0].file && pools[1].file && pools[2].file;
+
+	AttributePool* poolsPointer = pools;
+	ok = ok && forEachLine<AttributePool*>(path, windowSize, poolAttributes, poolsPointer);
+	for (int i = 0; i < 3; i++) {
+		ok = ok && mapPool(pools[i]);
+	}
+
+	ChunkState state;
+	state.pools = pools;
+	state.counts[0] = state.counts[1] = state.counts[2] = 0;
+	state.maxChunkVertices = (memoryLimit - windowSize) / BYTES_PER_CHUNK_VERTEX;
+	state.chunk.vertices .reserve(state.maxChunkVertices);
+	state.chunk.normals  .reserve(state.maxChunkVertices);
+	state.chunk.texCoords.reserve(state.maxChunkVertices);
+	state.indexOf.reserve(state.maxChunkVertices);
+	state.callback = callback;
+	state.data = data;
+	state.numTriangles = state.numChunks = state.numSkipped = 0;
+
+	ok = ok && forEachLine<ChunkState>(path, windowSize, buildChunks, state);
+	if (ok) emitChunk(state);
+
+	for (int i = 0; i < 3; i++) {
+		if (pools[i].values) munmap((void*)pools[i].values, pools[i].mappingLength);
+		if (pools[i].file) fclose(pools[i].file);
+	}
+	if (!ok) {
+		fprintf(stderr, "Could not stream %s.\n", path);
+		return false;
+	}
+
+	if (state.numSkipped) {
+		fprintf(stderr, "WARNING: skipped %lu faces in %s which refer to non-existent vertices.\n",
+		        state.numSkipped, path);
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Streamed %s: %lu triangles in %lu chunks, process peak RSS so far %.1f MB.\n",
+	       path, state.numTriangles, state.numChunks, usage.ru_maxrss / 1024.0);
+	return true;
+}
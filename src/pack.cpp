@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GL/glfw.h>
+
+#include "workers.h"
+#include "pack.h"
+
+static_assert(sizeof(PackHeader) == 16, "PackHeader must not contain padding");
+static_assert(sizeof(PackEntry) == 144, "PackEntry must not contain padding");
+
+static const unsigned char* packData = NULL;
+static size_t packLength = 0;
+static const PackEntry* entries = NULL;
+static uint32_t numEntries = 0;
+
+/** Maps the asset pack at the given path into memory, replacing any pack
+ * already open. Must be called before any assets are loaded from it.
+ * @return true if the pack was opened; if not, assets are loaded from their
+ *         own files. */
+bool openPack(const char* path) {
+	closePack();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+
+	// Check that the table of contents, and everything it points to, is in the file
+	const PackHeader* header = (const PackHeader*)mapping;
+	size_t length = st.st_size;
+	bool valid = memcmp(header->magic, PACK_MAGIC, 4) == 0 && header->version == PACK_VERSION
+	          && header->numEntries <= (length - sizeof(PackHeader)) / sizeof(PackEntry);
+	const PackEntry* toc = (const PackEntry*)(header + 1);
+	for (uint32_t i = 0; valid && i < header->numEntries; i++) {
+		valid = toc[i].offset <= length && toc[i].storedSize <= length - toc[i].offset
+		     && memchr(toc[i].name, '\0', PACK_NAME_LENGTH) != NULL;
+	}
+	if (!valid) {
+		fprintf(stderr, "Asset pack %s is invalid, ignoring it.\n", path);
+		munmap(mapping, length);
+		return false;
+	}
+
+	packData   = (const unsigned char*)mapping;
+	packLength = length;
+	entries    = toc;
+	numEntries = header->numEntries;
+	printf("Opened asset pack %s: %u entries.\n", path, numEntries);
+	return true;
+}
+
+void closePack(void) {
+	if (packData) munmap((void*)packData, packLength);
+	packData = NULL;
+	packLength = 0;
+	entries = NULL;
+	numEntries = 0;
+}
+
+/** @return the entry with the given name, or NULL if there isn't one. */
+static const PackEntry* findEntry(const char* name) {
+	uint32_t low = 0, high = numEntries;
+	while (low < high) {
+		uint32_t middle = (low + high) / 2;
+		int order = strcmp(entries[middle].name, name);
+		if (order == 0) return &entries[middle];
+		if (order < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return NULL;
+}
+
+/** @return whether the asset pack has an entry with the given name. */
+bool isInPack(const char* name) {
+	return packData && findEntry(name);
+}
+
+/** Decompresses one block in the LZ4 block format.
+ * @return true if the block was valid and filled exactly `outLength` bytes. */
+bool decompressBlock(const unsigned char* in, size_t inLength, unsigned char* out, size_t outLength) {
+	const unsigned char* inEnd = in + inLength;
+	unsigned char* op = out;
+	unsigned char* outEnd = out + outLength;
+	while (in < inEnd) {
+		unsigned token = *in++;
+
+		// Literals
+		size_t length = token >> 4;
+		if (length == 15) {
+			unsigned char extra;
+			do {
+				if (in >= inEnd) return false;
+				extra = *in++;
+				length += extra;
+			} while (extra == 255);
+		}
+		if (length > (size_t)(inEnd - in) || length > (size_t)(outEnd - op)) return false;
+		memcpy(op, in, length);
+		op += length;
+		in += length;
+		if (in == inEnd) break;  // the last sequence has no match
+
+		// Match
+		if (inEnd - in < 2) return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if (offset == 0 || offset > (size_t)(op - out)) return false;
+		length = token & 15;
+		if (length == 15) {
+			unsigned char extra;
+			do {
+				if (in >= inEnd) return false;
+				extra = *in++;
+				length += extra;
+			} while (extra == 255);
+		}
+		length += 4;
+		if (length > (size_t)(outEnd - op)) return false;
+		const unsigned char* match = op - offset;
+		for (size_t i = 0; i < length; i++) op[i] = match[i];  // may overlap
+		op += length;
+	}
+	return op == outEnd;
+}
+
+/** A compressed entry being decompressed by `runParallel`, a block per task. */
+struct Decompression {
+	const unsigned char* blocks;  ///< where each block starts
+	const uint32_t* blockSizes;
+	const size_t* blockOffsets;
+	unsigned char* out;
+	size_t size;
+	std::atomic<bool> ok;
+};
+
+static void decompressBlockTask(void* data, int index) {
+	Decompression* d = (Decompression*)data;
+	const unsigned char* in = d->blocks + d->blockOffsets[index];
+	uint32_t storedSize = d->blockSizes[index] & ~PACK_BLOCK_RAW;
+	size_t start = (size_t)index * PACK_BLOCK_SIZE;
+	size_t length = d->size - start < PACK_BLOCK_SIZE ? d->size - start : PACK_BLOCK_SIZE;
+
+	bool ok;
+	if (d->blockSizes[index] & PACK_BLOCK_RAW) {
+		ok = storedSize == length;
+		if (ok) memcpy(d->out + start, in, length);
+	} else {
+		ok = decompressBlock(in, storedSize, d->out + start, length);
+	}
+	if (!ok) d->ok = false;
+}
+
+/** Finds an entry in the asset pack. Safe to call from any thread.
+ * @return true if the pack has the entry, in which case `view` must later be
+ *         passed to `releasePackView`. */
+bool readFromPack(const char* name, PackView &view) {
+	const PackEntry* entry = packData ? findEntry(name) : NULL;
+	if (!entry) return false;
+
+	const unsigned char* stored = packData + entry->offset;
+	if (!(entry->flags & PACK_COMPRESSED)) {
+		if (entry->storedSize != entry->size) {
+			fprintf(stderr, "Asset pack entry %s is corrupt.\n", name);
+			return false;
+		}
+		view.data   = stored;
+		view.size   = entry->size;
+		view.buffer = NULL;
+		return true;
+	}
+
+	size_t numBlocks = (entry->size + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+	Decompression d;
+	d.blockSizes = (const uint32_t*)stored;
+	d.blocks = stored + numBlocks * sizeof(uint32_t);
+	d.size = entry->size;
+	d.ok = numBlocks * sizeof(uint32_t) <= entry->storedSize;
+
+	std::vector<size_t> offsets(numBlocks);
+	size_t offset = 0;
+	for (size_t i = 0; d.ok && i < numBlocks; i++) {
+		offsets[i] = offset;
+		offset += d.blockSizes[i] & ~PACK_BLOCK_RAW;
+	}
+	d.ok = d.ok && numBlocks * sizeof(uint32_t) + offset <= entry->storedSize;
+	d.blockOffsets = offsets.data();
+	d.out = (unsigned char*)malloc(d.size ? d.size : 1);
+	if (d.ok) runParallel(decompressBlockTask, &d, numBlocks);
+
+	if (!d.ok) {
+		fprintf(stderr, "Asset pack entry %s is corrupt.\n", name);
+		free(d.out);
+		return false;
+	}
+	view.data   = d.out;
+	view.size   = d.size;
+	view.buffer = d.out;
+	return true;
+}
+
+void releasePackView(PackView &view) {
+	free(view.buffer);
+	view.data   = NULL;
+	view.size   = 0;
+	view.buffer = NULL;
+}
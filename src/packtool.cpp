@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "workers.h"
+#include "generators.h"
+#include "meshcache.h"
+#include "tga.h"
+#include "texcache.h"
+#include "pack.h"
+
+/** @file packtool.cpp
+ * Builds an asset pack (see pack.h) from the files named on the command line:
+ *
+ *     pack <archive> [-c | -s] files...
+ *
+ * Files after `-c` are compressed, and those after `-s` (or before either) are
+ * stored as they are, so that they can be used straight from the mapping. Each
+ * entry is named by the path it was given as. OBJ and TGA files are cooked into
+ * their mesh and texture caches first (see meshcache.h and texcache.h), and the
+ * cache is packed in their place, named as it would be next to the file.
+ */
+
+/** The shortest match, and the furthest back one can be. */
+#define LZ4_MIN_MATCH   4
+#define LZ4_MAX_OFFSET  65535
+#define LZ4_HASH_BITS   16
+
+/** The end of a block which must be literals: a match must not start in the
+ * last LZ4_MATCH_LIMIT bytes, nor reach into the last LZ4_LAST_LITERALS. */
+#define LZ4_MATCH_LIMIT   12
+#define LZ4_LAST_LITERALS 5
+
+struct PackInput {
+	std::string name;
+	bool compress;
+	std::vector<unsigned char> contents;
+	std::vector<unsigned char> stored;
+};
+
+static uint32_t read32(const unsigned char* p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/** Writes an LZ4 length beyond what fits in the token. */
+static unsigned char* writeLength(unsigned char* out, size_t length) {
+	for (; length >= 255; length -= 255) *out++ = 255;
+	*out++ = (unsigned char)length;
+	return out;
+}
+
+/** Writes one sequence: some literals, and then a match unless `matchLength`
+ * is 0 (which only the last sequence may be). */
+static unsigned char* writeSequence(unsigned char* out, const unsigned char* literals, size_t numLiterals,
+                                    size_t offset, size_t matchLength) {
+	size_t matchCode = matchLength ? matchLength - LZ4_MIN_MATCH : 0;
+	*out++ = (unsigned char)(((numLiterals < 15 ? numLiterals : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+	if (numLiterals >= 15) out = writeLength(out, numLiterals - 15);
+	memcpy(out, literals, numLiterals);
+	out += numLiterals;
+	if (matchLength == 0) return out;
+
+	*out++ = offset & 0xff;
+	*out++ = offset >> 8;
+	if (matchCode >= 15) out = writeLength(out, matchCode - 15);
+	return out;
+}
+
+/** The most bytes compressing `length` bytes can take. */
+static size_t compressBound(size_t length) {
+	return length + length / 255 + 16;
+}
+
+/** Compresses one block in the LZ4 block format, greedily taking the match
+ * found through a hash of the next four bytes.
+ * @param out Must have room for `compressBound(length)` bytes.
+ * @return the compressed size. */
+static size_t compressBlock(const unsigned char* in, size_t length, unsigned char* out) {
+	unsigned char* op = out;
+	size_t anchor = 0;
+	if (length > LZ4_MATCH_LIMIT) {
+		std::vector<uint32_t> table(1 << LZ4_HASH_BITS, ~0u);  // where each hash was last seen
+		size_t matchLimit = length - LZ4_MATCH_LIMIT;
+		size_t matchEnd = length - LZ4_LAST_LITERALS;
+		size_t i = 0;
+		while (i < matchLimit) {
+			uint32_t sequence = read32(in + i);
+			uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+			uint32_t candidate = table[hash];
+			table[hash] = i;
+			if (candidate == ~0u || i - candidate > LZ4_MAX_OFFSET || read32(in + candidate) != sequence) {
+				i++;
+				continue;
+			}
+
+			size_t matchLength = LZ4_MIN_MATCH;
+			while (i + matchLength < matchEnd && in[candidate + matchLength] == in[i + matchLength]) matchLength++;
+			op = writeSequence(op, in + anchor, i - anchor, i - candidate, matchLength);
+			i += matchLength;
+			anchor = i;
+		}
+	}
+	op = writeSequence(op, in + anchor, length - anchor, 0, 0);
+	return op - out;
+}
+
+/** Compressed blocks of one file, filled in by `runParallel`, a block per task. */
+struct Compression {
+	const unsigned char* in;
+	size_t size;
+	std::vector<std::vector<unsigned char> > blocks;
+	std::vector<uint32_t> blockSizes;
+};
+
+static void compressBlockTask(void* data, int index) {
+	Compression* c = (Compression*)data;
+	size_t start = (size_t)index * PACK_BLOCK_SIZE;
+	size_t length = c->size - start < PACK_BLOCK_SIZE ? c->size - start : PACK_BLOCK_SIZE;
+
+	std::vector<unsigned char> &block = c->blocks[index];
+	block.resize(compressBound(length));
+	size_t compressed = compressBlock(c->in + start, length, block.data());
+	if (compressed < length) {
+		block.resize(compressed);
+		c->blockSizes[index] = compressed;
+	} else {
+		// Didn't shrink, so store it as it is
+		block.assign(c->in + start, c->in + start + length);
+		c->blockSizes[index] = length | PACK_BLOCK_RAW;
+	}
+}
+
+/** Sets the data to be stored for an input: its contents, or their blocks
+ * compressed (see pack.h). */
+static void storeInput(PackInput &input) {
+	if (!input.compress) {
+		input.stored = input.contents;
+		return;
+	}
+
+	size_t numBlocks = (input.contents.size() + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+	Compression c;
+	c.in = input.contents.data();
+	c.size = input.contents.size();
+	c.blocks.resize(numBlocks);
+	c.blockSizes.resize(numBlocks);
+	runParallel(compressBlockTask, &c, numBlocks);
+
+	input.stored.assign((const unsigned char*)c.blockSizes.data(),
+	                    (const unsigned char*)(c.blockSizes.data() + numBlocks));
+	for (size_t i = 0; i < numBlocks; i++) input.stored.insert(input.stored.end(), c.blocks[i].begin(), c.blocks[i].end());
+}
+
+/** Reads the contents of a file to be packed, cooking OBJ and TGA files into
+ * their caches.
+ * @return false if the file couldn't be read. */
+static bool readInput(const char* path, PackInput &input) {
+	size_t pathLength = strlen(path);
+	if (pathLength > 4 && strcmp(path + pathLength - 4, ".obj") == 0) {
+		MappedMesh mesh;
+		loadCachedOBJ(path, mesh);
+		if (!mesh.mapping) {
+			fprintf(stderr, "Could not build the mesh cache for %s.\n", path);
+			closeMeshCache(mesh);
+			return false;
+		}
+		input.name = std::string(path) + MESH_CACHE_EXTENSION;
+		const unsigned char* data = (const unsigned char*)mesh.mapping;
+		input.contents.assign(data, data + mesh.mappingLength);
+		closeMeshCache(mesh);
+		return true;
+	}
+	if (pathLength > 4 && strcmp(path + pathLength - 4, ".tga") == 0) {
+		MappedTexture texture;
+		if (!loadCachedTGA(path, texture)) {
+			fprintf(stderr, "Could not build the texture cache for %s.\n", path);
+			return false;
+		}
+		input.name = std::string(path) + TEXTURE_CACHE_EXTENSION;
+		const unsigned char* data = (const unsigned char*)texture.header;
+		input.contents.assign(data, data + sizeof(TextureCacheHeader) + texture.dataSize);
+		closeTextureCache(texture);
+		return true;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open file %s.\n", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	input.name = path;
+	input.contents.resize(length);
+	bool ok = length >= 0 && fread(input.contents.data(), 1, length, file) == (size_t)length;
+	fclose(file);
+	if (!ok) fprintf(stderr, "Could not read file %s.\n", path);
+	return ok;
+}
+
+static bool byName(const PackInput* a, const PackInput* b) {
+	return strcmp(a->name.c_str(), b->name.c_str()) < 0;
+}
+
+static size_t aligned(size_t offset) {
+	return (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+/** Writes a pack holding the given inputs, which must be sorted by name.
+ * @return the size of the pack, or 0 if it couldn't be written. */
+static size_t writePack(const char* path, const std::vector<PackInput*> &inputs) {
+	PackHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_MAGIC, 4);
+	header.version = PACK_VERSION;
+	header.numEntries = inputs.size();
+
+	std::vector<PackEntry> toc(inputs.size());
+	size_t offset = aligned(sizeof(PackHeader) + inputs.size() * sizeof(PackEntry));
+	for (size_t i = 0; i < inputs.size(); i++) {
+		memset(&toc[i], 0, sizeof(PackEntry));
+		strcpy(toc[i].name, inputs[i]->name.c_str());
+		toc[i].offset     = offset;
+		toc[i].storedSize = inputs[i]->stored.size();
+		toc[i].size       = inputs[i]->contents.size();
+		toc[i].flags      = inputs[i]->compress ? PACK_COMPRESSED : 0;
+		offset = aligned(offset + toc[i].storedSize);
+	}
+
+	std::string tempPath = std::string(path) + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Could not write asset pack %s.\n", path);
+		return 0;
+	}
+
+	static const unsigned char padding[PACK_ALIGNMENT] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(toc.data(), sizeof(PackEntry), toc.size(), file) == toc.size();
+	size_t written = sizeof(PackHeader) + toc.size() * sizeof(PackEntry);
+	for (size_t i = 0; ok && i < inputs.size(); i++) {
+		ok = fwrite(padding, 1, toc[i].offset - written, file) == toc[i].offset - written;
+		ok = ok && fwrite(inputs[i]->stored.data(), 1, toc[i].storedSize, file) == toc[i].storedSize;
+		written = toc[i].offset + toc[i].storedSize;
+	}
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tempPath.c_str(), path) != 0) {
+		fprintf(stderr, "Could not write asset pack %s.\n", path);
+		remove(tempPath.c_str());
+		return 0;
+	}
+	return written;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <archive> [-c | -s] files...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!glfwInit()) {
+		fprintf(stderr, "Could not initialise GLFW. Terminating.\n");
+		return EXIT_FAILURE;
+	}
+	startWorkers();
+
+	std::vector<PackInput> inputs;
+	inputs.reserve(argc - 2);
+	bool compress = false;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-s") == 0) {
+			compress = argv[i][1] == 'c';
+			continue;
+		}
+
+		inputs.push_back(PackInput());
+		PackInput &input = inputs.back();
+		input.compress = compress;
+		if (!readInput(argv[i], input)) return EXIT_FAILURE;
+		if (input.name.size() >= PACK_NAME_LENGTH) {
+			fprintf(stderr, "The name %s is too long to pack.\n", input.name.c_str());
+			return EXIT_FAILURE;
+		}
+		storeInput(input);
+	}
+
+	std::vector<PackInput*> sorted(inputs.size());
+	for (size_t i = 0; i < inputs.size(); i++) sorted[i] = &inputs[i];
+	std::sort(sorted.begin(), sorted.end(), byName);
+	for (size_t i = 1; i < sorted.size(); i++) {
+		if (sorted[i]->name == sorted[i - 1]->name) {
+			fprintf(stderr, "%s is given more than once.\n", sorted[i]->name.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t size = writePack(argv[1], sorted);
+	if (!size) return EXIT_FAILURE;
+
+	size_t totalSize = 0;
+	for (size_t i = 0; i < inputs.size(); i++) totalSize += inputs[i].contents.size();
+	printf("Packed %lu files into %s: %.2f MB, from %.2f MB.\n", (unsigned long)inputs.size(), argv[1],
+	       size / 1048576.0, totalSize / 1048576.0);
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}
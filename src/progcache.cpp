@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "progcache.h"
+
+static_assert(sizeof(ProgramCacheHeader) == 24, "ProgramCacheHeader must not contain padding");
+
+static std::string cachePathFor(const char* fragmentPath) {
+	return std::string(fragmentPath) + PROGRAM_CACHE_EXTENSION;
+}
+
+/** @return whether the driver can hand out program binaries, and take them
+ * back. */
+bool programCacheSupported(void) {
+	if (!GLEW_ARB_get_program_binary) return false;
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	return numFormats > 0;
+}
+
+/** Hashes the given strings (FNV-1a), each with its terminator, and then the
+ * GL vendor, renderer and version, into the key of a program's cache.
+ * @param strings Whatever the program is built from, in a fixed order. NULL
+ *                strings are hashed as empty ones. */
+uint64_t programCacheKey(const char* const strings[], int numStrings) {
+	const char* driver[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER),
+	                          (const char*)glGetString(GL_VERSION) };
+	uint64_t key = 14695981039346656037ull;
+	for (int i = 0; i < numStrings + 3; i++) {
+		const char* s = i < numStrings ? strings[i] : driver[i - numStrings];
+		const unsigned char* bytes = (const unsigned char*)(s ? s : "");
+		do {
+			key = (key ^ *bytes) * 1099511628211ull;
+		} while (*bytes++);
+	}
+	return key;
+}
+
+/** @return whether the driver still takes binaries in the given format. */
+static bool isBinaryFormatSupported(GLenum format) {
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	std::vector<GLint> formats(numFormats);
+	if (numFormats > 0) glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+	for (GLint i = 0; i < numFormats; i++) {
+		if ((GLenum)formats[i] == format) return true;
+	}
+	return false;
+}
+
+/** Loads a program from its cache, if it exists and has the given key.
+ * @param program A program with nothing attached, which is left unlinked if
+ *                the cache can't be used, to be built from source instead.
+ * @return true if the program was linked from the cache. */
+bool loadProgramCache(const char* fragmentPath, uint64_t key, GLuint program) {
+	if (!programCacheSupported()) return false;
+
+	std::string path = cachePathFor(fragmentPath);
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file) return false;
+
+	ProgramCacheHeader header;
+	std::vector<unsigned char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, PROGRAM_CACHE_MAGIC, 4) == 0
+	       && header.version == PROGRAM_CACHE_VERSION && header.key == key;
+	if (ok) {
+		binary.resize(header.binaryLength);
+		ok = fread(binary.data(), 1, binary.size(), file) == binary.size() && fgetc(file) == EOF;
+	}
+	fclose(file);
+	if (!ok || !isBinaryFormatSupported(header.binaryFormat)) return false;
+
+	glProgramBinary(program, header.binaryFormat, binary.data(), binary.size());
+	GLint linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked == GL_FALSE) {
+		fprintf(stderr, "The driver rejected the program cache %s, so it will be rebuilt.\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Writes the cache for a linked program. The file is written under a
+ * temporary name and renamed into place, so a partially written cache is never
+ * picked up.
+ * @return true if the cache was written. */
+bool writeProgramCache(const char* fragmentPath, uint64_t key, GLuint program) {
+	if (!programCacheSupported()) return false;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return false;
+	std::vector<unsigned char> binary(length);
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	ProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, 4);
+	header.version      = PROGRAM_CACHE_VERSION;
+	header.key          = key;
+	header.binaryFormat = format;
+	header.binaryLength = length;
+
+	std::string path = cachePathFor(fragmentPath);
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Could not write program cache %s.\n", path.c_str());
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(binary.data(), 1, length, file) == (size_t)length;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Could not write program cache %s.\n", path.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "generators.h"
+#include "quantize.h"
+
+#define PI 3.14159265
+
+/** Converts a float to an IEEE 754 half float, rounding to nearest even. */
+GLhalf floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude >= 0x7f800000) {
+		// Infinity stays infinity, NaN stays NaN
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+	}
+	if (magnitude >= 0x477ff000) {
+		return sign | 0x7c00;  // too big, so infinity
+	}
+	if (magnitude < 0x38800000) {
+		// Denormal (or zero) as a half: shift the mantissa, with its implicit 1, down
+		if (magnitude < 0x33000000) return sign;
+		uint32_t exponent = magnitude >> 23;
+		uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+		return sign | half;
+	}
+
+	// Normal: rebias the exponent and round off 13 bits of mantissa
+	uint32_t half = (magnitude - 0x38000000) >> 13;
+	uint32_t remainder = magnitude & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++;
+	return sign | half;
+}
+
+float halfToFloat(GLhalf value) {
+	uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa != 0) {
+		// Denormal half: normalise it
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	} else {
+		bits = sign;
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static float signNotZero(float value) {
+	return value >= 0 ? 1.0f : -1.0f;
+}
+
+/** Decodes an octahedral-encoded normal, as the vertex shader does. */
+glm::vec3 decodeOctahedral(const EncodedNormalComponent encoded[2]) {
+	float x = encoded[0] / (float)ENCODED_NORMAL_MAX;
+	float y = encoded[1] / (float)ENCODED_NORMAL_MAX;
+	glm::vec3 n(x, y, 1 - fabsf(x) - fabsf(y));
+	if (n.z < 0) {
+		n.x = (1 - fabsf(y)) * signNotZero(x);
+		n.y = (1 - fabsf(x)) * signNotZero(y);
+	}
+	return glm::normalize(n);
+}
+
+/** Encodes a unit normal by projecting it onto an octahedron and unfolding that
+ * onto a square. Of the four nearest points on the integer grid, the one which
+ * decodes closest to the normal is chosen. */
+void encodeOctahedral(const glm::vec3 &normal, EncodedNormalComponent encoded[2]) {
+	float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	if (sum == 0) {
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+	float x = normal.x / sum, y = normal.y / sum;
+	if (normal.z < 0) {
+		float foldedX = (1 - fabsf(y)) * signNotZero(x);
+		float foldedY = (1 - fabsf(x)) * signNotZero(y);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	glm::vec3 unit = normal / glm::length(normal);
+	float bestError = -1;
+	for (int i = 0; i < 4; i++) {
+		EncodedNormalComponent candidate[2] = {
+			(EncodedNormalComponent)((i & 1 ? ceilf : floorf)(x * ENCODED_NORMAL_MAX)),
+			(EncodedNormalComponent)((i & 2 ? ceilf : floorf)(y * ENCODED_NORMAL_MAX))
+		};
+		float error = 1 - glm::dot(decodeOctahedral(candidate), unit);
+		if (bestError < 0 || error < bestError) {
+			bestError = error;
+			encoded[0] = candidate[0];
+			encoded[1] = candidate[1];
+		}
+	}
+}
+
+/** Compresses the attributes (and if possible the indices) of a mesh, and
+ * measures the largest error introduced in each attribute. */
+void quantizeMesh(const MeshView &mesh, QuantizedMesh &quantized) {
+	GLuint n = mesh.numVertices;
+
+	glm::vec3 boundsMin(0, 0, 0), boundsMax(0, 0, 0);
+	if (n > 0) boundsMin = boundsMax = mesh.vertices[0];
+	for (GLuint v = 1; v < n; v++) {
+		boundsMin = glm::min(boundsMin, mesh.vertices[v]);
+		boundsMax = glm::max(boundsMax, mesh.vertices[v]);
+	}
+	glm::vec3 extent = boundsMax - boundsMin;
+	for (int i = 0; i < 3; i++) {
+		if (extent[i] <= 0) extent[i] = 1;  // flat along this axis; any scale will do
+	}
+	quantized.dequantize = glm::scale(glm::translate(glm::mat4(1.), boundsMin), extent);
+
+	quantized.positions.resize(3 * n);
+	quantized.normals.resize(2 * n);
+	quantized.texCoords.resize(2 * n);
+	quantized.maxPositionError = quantized.maxNormalError = quantized.maxTexCoordError = 0;
+	float minNormalCos = 1;
+	for (GLuint v = 0; v < n; v++) {
+		glm::vec3 decoded;
+		for (int i = 0; i < 3; i++) {
+			float t = (mesh.vertices[v][i] - boundsMin[i]) / extent[i];
+			GLushort q = (GLushort)floorf(fminf(fmaxf(t, 0), 1) * 65535 + 0.5f);
+			quantized.positions[3 * v + i] = q;
+			decoded[i] = boundsMin[i] + (q / 65535.0f) * extent[i];
+		}
+		quantized.maxPositionError = fmaxf(quantized.maxPositionError, glm::length(decoded - mesh.vertices[v]));
+
+		const glm::vec3 &normal = mesh.normals[v];
+		encodeOctahedral(normal, &quantized.normals[2 * v]);
+		float length = glm::length(normal);
+		if (length > 0) {
+			float cosine = glm::dot(decodeOctahedral(&quantized.normals[2 * v]), normal / length);
+			minNormalCos = fminf(minNormalCos, cosine);
+		}
+
+		for (int i = 0; i < 2; i++) {
+			GLhalf h = floatToHalf(mesh.texCoords[v][i]);
+			quantized.texCoords[2 * v + i] = h;
+			quantized.maxTexCoordError = fmaxf(quantized.maxTexCoordError, fabsf(halfToFloat(h) - mesh.texCoords[v][i]));
+		}
+	}
+	quantized.maxNormalError = acosf(fmaxf(minNormalCos, -1)) * 180 / PI;
+
+	quantized.shortIndices.clear();
+	if (n <= 65536) {
+		quantized.shortIndices.assign(mesh.indices, mesh.indices + mesh.numIndices);
+	}
+}
+
+void printQuantizationReport(const char* name, const MeshView &mesh, const QuantizedMesh &quantized) {
+	size_t before = mesh.numVertices * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)) + mesh.numIndices * sizeof(GLuint);
+	size_t after  = quantized.positions.size() * sizeof(GLushort)
+	              + quantized.normals.size()   * sizeof(EncodedNormalComponent)
+	              + quantized.texCoords.size() * sizeof(GLhalf)
+	              + mesh.numIndices * (quantized.shortIndices.empty() ? sizeof(GLuint) : sizeof(GLushort));
+	printf("Quantised %s: %lu -> %lu bytes; max error %g (position), %.3f degrees (normal), %g (UV).\n",
+	       name, (unsigned long)before, (unsigned long)after,
+	       quantized.maxPositionError, quantized.maxNormalError, quantized.maxTexCoordError);
+}
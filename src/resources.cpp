@@ -0,0 +1,1040 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "paths.h"
+#include "utils.h"
+#include "workers.h"
+#include "pack.h"
+#include "generators.h"
+#include "meshcache.h"
+#include "quantize.h"
+#include "tga.h"
+#include "texcache.h"
+#include "texarrays.h"
+#include "resources.h"
+
+/** How an asset is kept on the GPU within the memory budget (see
+ * `updateResidency`). */
+struct Residency {
+	const std::string* path;
+	bool isTexture;
+	void* entry;                ///< the MeshEntry or TextureEntry
+
+	bool loading;               ///< on its way to the GPU
+	bool evicted;               ///< showing the placeholder to stay within the budget (or not loaded yet)
+	unsigned lastUsedFrame;     ///< the last frame an object using it was drawn
+	unsigned lastVisibleFrame;  ///< the last frame an object using it was in view
+	float distance;             ///< from the camera to the nearest object using it, in the last frame it was used
+	size_t numBytes;            ///< GPU memory it takes once loaded, or 0 if it hasn't been yet
+};
+
+struct MeshEntry {
+	GPUMesh mesh;
+	int references;
+	std::vector<std::string> texturePaths;  ///< the textures acquired for the mesh's materials
+	VertexLayout layout;
+	Residency residency;
+};
+
+struct TextureEntry {
+	GPUTexture texture;
+	int references;
+	Residency residency;
+};
+
+static std::unordered_map<std::string, MeshEntry>    meshes;
+static std::unordered_map<std::string, TextureEntry> textures;
+
+/** The residency of each mesh and texture in the registry, by the address of
+ * its GPUMesh or GPUTexture. */
+static std::unordered_map<const void*, Residency*> residencyOf;
+
+/** The most GPU memory the registry's assets may take, or 0 for no limit. */
+static size_t residencyBudget = 0;
+static float residencyLoadDistance;
+static unsigned residencyFrame = 1;
+
+/** The most assets `updateResidency` has on their way to the GPU at once. */
+#define RESIDENCY_MAX_LOADS 4
+
+/** How much closer an asset must be than one on the GPU for that one to be
+ * evicted to make room for it, so that assets at about the same distance
+ * don't keep swapping places. */
+#define RESIDENCY_HYSTERESIS 1.25f
+
+static GPUMesh    placeholderMesh;
+static GPUTexture placeholderTexture;
+static const GLint rgbaSwizzle[4]      = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+static const GLint greyscaleSwizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+static bool placeholdersCreated = false;
+
+static bool compressVertices = true;
+static bool compressTextures = true;
+static bool textureCompressionSupported = false;  ///< for the formats texture caches hold (see texcache.h)
+
+static int numLoading = 0;
+static double loadingStartTime;
+
+/** One vertex attribute, as it is laid out on the CPU (tightly packed). */
+struct VertexAttribute {
+	GLuint index;          ///< the index of the generic vertex attribute
+	GLint numComponents;
+	GLenum type;           ///< the type of each component
+	GLboolean normalized;  ///< whether integer components are mapped to [0, 1] or [-1, 1]
+	size_t size;           ///< bytes per vertex
+	const void* data;
+};
+
+/** A buffer object mapped on the GL thread, so that its contents can be
+ * written on any thread: the given attributes interleaved (each starting on a
+ * 4-byte boundary), or a single attribute tightly packed. */
+struct StagedBuffer {
+	GLuint vbo;
+	void* mapped;  ///< NULL once unmapped, or if mapping failed
+	VertexAttribute attributes[3];
+	int numAttributes;
+	size_t offsets[3];
+	size_t stride;
+	GLuint count;  ///< the number of vertices (or indices)
+};
+
+/** How far an asset has got on its way to the GPU. */
+enum UploadStage {
+	STAGE_READ,    ///< read on a worker thread, and waiting for buffers to be mapped for it
+	STAGE_FILLED,  ///< copied into its buffers on a worker thread, and waiting for them to be unmapped
+	STAGE_FENCED   ///< waiting for the GPU to finish with it before it replaces its placeholder
+};
+
+/** An asset on its way from its file to the GPU. It is read on a worker
+ * thread; its buffers are created and mapped on the GL thread; it is copied
+ * into them on a worker thread; and then the GL thread unmaps them, issues
+ * the upload, and fences it. Only once the fence has signalled is it swapped
+ * in for its placeholder, so that the copying never stalls a frame. */
+struct LoadedAsset {
+	LoadedAsset* next;
+	std::string path;
+	UploadStage stage;
+
+	bool isTexture;
+	MappedMesh mesh;
+	bool compress;
+	VertexLayout layout;
+	QuantizedMesh quantized;
+	GPUMesh uploaded;
+	std::vector<StagedBuffer> staged;
+
+	TGAImage image;        ///< opened on a worker thread, and decoded into the PBO on another
+	MappedTexture cooked;  ///< used instead of `image` if the texture is compressed
+	bool imageRead;
+	GLuint pbo;           ///< the pixel buffer object the image is decoded or copied into
+	void* mappedPixels;   ///< NULL once unmapped, or if mapping failed
+	GPUTexture texture;
+
+	GLsync fence;
+};
+
+/** Assets coming back from the worker threads, as a lock-free stack (newest
+ * first). The workers push onto it, and the GL thread takes the whole stack
+ * at once. */
+static std::atomic<LoadedAsset*> loadedAssets(NULL);
+
+/** Assets whose uploads have been issued, oldest first. Only used on the GL
+ * thread. */
+static std::vector<LoadedAsset*> fencedAssets;
+
+static void pushLoadedAsset(LoadedAsset* asset) {
+	asset->next = loadedAssets.load(std::memory_order_relaxed);
+	while (!loadedAssets.compare_exchange_weak(asset->next, asset,
+	                                           std::memory_order_release, std::memory_order_relaxed));
+}
+
+static void loadMeshJob(void* data) {
+	LoadedAsset* asset = (LoadedAsset*)data;
+	loadCachedOBJ(asset->path.c_str(), asset->mesh);
+	if (asset->compress) {
+		quantizeMesh(asset->mesh.view, asset->quantized);
+		printQuantizationReport(asset->path.c_str(), asset->mesh.view, asset->quantized);
+	}
+	pushLoadedAsset(asset);
+}
+
+static void loadTextureJob(void* data) {
+	LoadedAsset* asset = (LoadedAsset*)data;
+	if (asset->compress) {
+		asset->imageRead = loadCachedTGA(asset->path.c_str(), asset->cooked);
+	} else {
+		asset->imageRead = openTGA(asset->path.c_str(), asset->image);
+	}
+	if (!asset->imageRead) fprintf(stderr, "Could not read texture %s.\n", asset->path.c_str());
+	pushLoadedAsset(asset);
+}
+
+static void startLoading(const std::string &path, bool isTexture, VertexLayout layout) {
+	if (numLoading++ == 0) loadingStartTime = glfwGetTime();
+
+	LoadedAsset* asset = new LoadedAsset;
+	asset->path = path;
+	asset->stage = STAGE_READ;
+	asset->isTexture = isTexture;
+	asset->compress = isTexture ? compressTextures && textureCompressionSupported : compressVertices;
+	asset->layout = layout;
+	submitJob(isTexture ? loadTextureJob : loadMeshJob, asset);
+}
+
+/** Writes the contents of a staged buffer. Safe to call on any thread. */
+static void fillStagedBuffer(const StagedBuffer &staged, void* out) {
+	unsigned char* to = (unsigned char*)out;
+	if (staged.numAttributes == 1) {
+		memcpy(to, staged.attributes[0].data, staged.attributes[0].size * staged.count);
+		return;
+	}
+
+	memset(to, 0, staged.stride * staged.count);  // the padding
+	for (int i = 0; i < staged.numAttributes; i++) {
+		const VertexAttribute &attribute = staged.attributes[i];
+		const unsigned char* from = (const unsigned char*)attribute.data;
+		for (GLuint v = 0; v < staged.count; v++) {
+			memcpy(to + v * staged.stride + staged.offsets[i], from + v * attribute.size, attribute.size);
+		}
+	}
+}
+
+/** Creates a buffer object of the size `staged` needs, bound to `target`, and
+ * maps it to be filled in. */
+static void createStagedBuffer(GLenum target, StagedBuffer &staged, size_t &numBytes) {
+	size_t size = staged.stride * staged.count;
+	glGenBuffers(1, &staged.vbo);
+	glBindBuffer(target, staged.vbo);
+	glBufferData(target, size, NULL, GL_STATIC_DRAW);
+	numBytes += size;
+
+	staged.mapped = NULL;
+	if (size > 0) staged.mapped = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+/** Unmaps a staged buffer once it has been filled in. Bound to
+ * `GL_COPY_WRITE_BUFFER`, which isn't part of any VAO's state. */
+static void unmapStagedBuffer(StagedBuffer &staged) {
+	size_t size = staged.stride * staged.count;
+	if (size == 0) return;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, staged.vbo);
+	if (!staged.mapped || glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE) {
+		// The mapping failed, or its contents were lost, so copy them in instead
+		std::vector<unsigned char> contents(size);
+		fillStagedBuffer(staged, contents.data());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, 0, size, contents.data());
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	staged.mapped = NULL;
+}
+
+/** Fills in and unmaps staged buffers straight away, for uploads which can't
+ * wait for a worker thread. */
+static void finishStagedBuffers(std::vector<StagedBuffer> &staged) {
+	for (size_t i = 0; i < staged.size(); i++) {
+		if (staged[i].mapped) fillStagedBuffer(staged[i], staged[i].mapped);
+		unmapStagedBuffer(staged[i]);
+	}
+	staged.clear();
+}
+
+/** Creates a Vertex Buffer Object for the given attributes, interleaved
+ * (each starting on a 4-byte boundary), and binds them as Vertex Attribute
+ * Arrays. The buffer is left mapped, and added to `staged` to be filled in.
+ * @return the index of the Vertex Buffer Object (prefix `vbo`). */
+static GLuint createVertexAttribVBO(const VertexAttribute* attributes, int numAttributes, GLuint numVertices,
+                                    std::vector<StagedBuffer> &staged, size_t &numBytes) {
+	StagedBuffer buffer;
+	buffer.numAttributes = numAttributes;
+	buffer.count = numVertices;
+
+	// A single attribute is left tightly packed
+	buffer.stride = 0;
+	for (int i = 0; i < numAttributes; i++) {
+		buffer.attributes[i] = attributes[i];
+		buffer.offsets[i] = buffer.stride;
+		buffer.stride += (numAttributes == 1) ? attributes[i].size : (attributes[i].size + 3) & ~(size_t)3;
+	}
+	createStagedBuffer(GL_ARRAY_BUFFER, buffer, numBytes);
+
+	// Bind as vertex attribute arrays
+	for (int i = 0; i < numAttributes; i++) {
+		const VertexAttribute &attribute = attributes[i];
+		glEnableVertexAttribArray(attribute.index);
+		glVertexAttribPointer(attribute.index, attribute.numComponents, attribute.type, attribute.normalized,
+		                      numAttributes == 1 ? 0 : buffer.stride, (const void*)buffer.offsets[i]);
+	}
+
+	staged.push_back(buffer);
+	return buffer.vbo;
+}
+
+/** Creates the index buffer of the bound VAO, left mapped, and adds it to
+ * `staged` to be filled in.
+ * @param indexSize The bytes per index. */
+static GLuint createIndexVBO(const void* indices, size_t indexSize, GLuint numIndices,
+                             std::vector<StagedBuffer> &staged, size_t &numBytes) {
+	StagedBuffer buffer;
+	VertexAttribute attribute = { 0, 1, 0, GL_FALSE, indexSize, indices };
+	buffer.attributes[0] = attribute;
+	buffer.numAttributes = 1;
+	buffer.offsets[0] = 0;
+	buffer.stride = indexSize;
+	buffer.count = numIndices;
+	createStagedBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer, numBytes);
+
+	staged.push_back(buffer);
+	return buffer.vbo;
+}
+
+/** Creates a VAO with the given position, normal and texture coordinate
+ * attributes, split between VBOs according to the layout. */
+static void uploadAttributes(GPUMesh &mesh, const VertexAttribute attributes[3], GLuint numVertices, VertexLayout layout,
+                             std::vector<StagedBuffer> &staged) {
+	glGenVertexArrays(1, &mesh.vao);
+	glBindVertexArray(mesh.vao);
+	checkForError("after VAO creation");
+
+	mesh.vboAttributes[0] = mesh.vboAttributes[1] = mesh.vboAttributes[2] = 0;
+	switch (layout) {
+	case LAYOUT_SEPARATE:
+		for (int i = 0; i < 3; i++) {
+			mesh.vboAttributes[i] = createVertexAttribVBO(&attributes[i], 1, numVertices, staged, mesh.numBytes);
+		}
+		break;
+	case LAYOUT_INTERLEAVED:
+		mesh.vboAttributes[0] = createVertexAttribVBO(attributes, 3, numVertices, staged, mesh.numBytes);
+		break;
+	case LAYOUT_SPLIT_POSITIONS:
+		mesh.vboAttributes[0] = createVertexAttribVBO(&attributes[0], 1, numVertices, staged, mesh.numBytes);
+		mesh.vboAttributes[1] = createVertexAttribVBO(&attributes[1], 2, numVertices, staged, mesh.numBytes);
+		break;
+	}
+	mesh.layout = layout;
+	mesh.numVertices = numVertices;
+}
+
+/** Copies the levels of detail of a mesh, their subsets and its meshlets, or
+ * makes one level of all its indices if it doesn't have any. Levels without
+ * subsets get one of all their indices, so that every level is drawn the same
+ * way. */
+static void setLODs(GPUMesh &mesh, const MeshView &view) {
+	if (view.numLODs == 0) {
+		MeshLOD all = { 0, view.numIndices, 0, 0, view.numSubsets };
+		mesh.lods[0] = all;
+		mesh.numLODs = 1;
+	} else {
+		mesh.numLODs = view.numLODs < MAX_LODS ? view.numLODs : MAX_LODS;
+		for (GLuint i = 0; i < mesh.numLODs; i++) mesh.lods[i] = view.lods[i];
+	}
+
+	mesh.subsets.clear();
+	for (GLuint i = 0; i < mesh.numLODs; i++) {
+		MeshLOD &lod = mesh.lods[i];
+		GLuint firstSubset = mesh.subsets.size();
+		if (lod.numSubsets == 0) {
+			// Without subsets, any meshlets cover the full-detail level
+			GLuint numMeshlets = i == 0 ? view.numMeshlets : 0;
+			MeshSubset all = { NO_MATERIAL, lod.firstIndex, lod.numIndices, 0, numMeshlets };
+			mesh.subsets.push_back(all);
+			lod.numSubsets = 1;
+		} else {
+			mesh.subsets.insert(mesh.subsets.end(), view.subsets + lod.firstSubset,
+			                    view.subsets + lod.firstSubset + lod.numSubsets);
+		}
+		lod.firstSubset = firstSubset;
+	}
+	mesh.meshlets.assign(view.meshlets, view.meshlets + view.numMeshlets);
+}
+
+/** @return the radius of a sphere around the origin which bounds a mesh, from
+ * its meshlets if it has any. */
+static GLfloat boundingRadius(const MeshView &view) {
+	GLfloat radius = 0;
+	if (view.numMeshlets > 0) {
+		for (GLuint i = 0; i < view.numMeshlets; i++) {
+			const Meshlet &meshlet = view.meshlets[i];
+			glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+			radius = fmaxf(radius, glm::length(center) + meshlet.radius);
+		}
+	} else {
+		for (GLuint i = 0; i < view.numVertices; i++) radius = fmaxf(radius, glm::length(view.vertices[i]));
+	}
+	return radius;
+}
+
+/** Creates the VAO and buffers of a mesh, leaving the buffers mapped and
+ * added to `staged`, to be filled in from `view` (which must stay valid until
+ * they are). */
+static GPUMesh uploadMesh(const MeshView &view, VertexLayout layout, std::vector<StagedBuffer> &staged) {
+	GPUMesh mesh;
+	mesh.numBytes = 0;
+
+	VertexAttribute attributes[3] = {
+		{ 0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), view.vertices },
+		{ 1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), view.normals },
+		{ 2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), view.texCoords }
+	};
+	uploadAttributes(mesh, attributes, view.numVertices, layout, staged);
+
+	// Indices VBO
+	mesh.vboIndices = createIndexVBO(view.indices, sizeof(GLuint), view.numIndices, staged, mesh.numBytes);
+	glBindVertexArray(0);
+
+	mesh.numIndices  = view.numIndices;
+	mesh.indexType   = GL_UNSIGNED_INT;
+	setLODs(mesh, view);
+	mesh.radius      = boundingRadius(view);
+	mesh.dequantize  = glm::mat4(1.);
+	mesh.octahedralScale = 0;
+	mesh.loaded = true;
+	return mesh;
+}
+
+/** As `uploadMesh`, for a mesh compressed by `quantizeMesh`. `view` is the
+ * uncompressed mesh, for its indices if they don't fit in 16 bits. */
+static GPUMesh uploadQuantizedMesh(const QuantizedMesh &quantized, const MeshView &view, VertexLayout layout,
+                                   std::vector<StagedBuffer> &staged) {
+	GPUMesh mesh;
+	mesh.numBytes = 0;
+
+	// Normals aren't normalised here, as GL 3.3 maps signed integers to floats
+	// asymmetrically; the shader divides them by ENCODED_NORMAL_MAX instead
+	VertexAttribute attributes[3] = {
+		{ 0, 3, GL_UNSIGNED_SHORT,    GL_TRUE,  3 * sizeof(GLushort),               quantized.positions.data() },
+		{ 1, 2, ENCODED_NORMAL_TYPE, GL_FALSE, 2 * sizeof(EncodedNormalComponent), quantized.normals.data() },
+		{ 2, 2, GL_HALF_FLOAT,        GL_FALSE, 2 * sizeof(GLhalf),                 quantized.texCoords.data() }
+	};
+	uploadAttributes(mesh, attributes, view.numVertices, layout, staged);
+
+	if (!quantized.shortIndices.empty()) {
+		mesh.vboIndices = createIndexVBO(quantized.shortIndices.data(), sizeof(GLushort), view.numIndices,
+		                                 staged, mesh.numBytes);
+		mesh.indexType  = GL_UNSIGNED_SHORT;
+	} else {
+		mesh.vboIndices = createIndexVBO(view.indices, sizeof(GLuint), view.numIndices, staged, mesh.numBytes);
+		mesh.indexType  = GL_UNSIGNED_INT;
+	}
+	glBindVertexArray(0);
+
+	mesh.numIndices  = view.numIndices;
+	setLODs(mesh, view);
+	mesh.radius      = boundingRadius(view);
+	mesh.dequantize  = quantized.dequantize;
+	mesh.octahedralScale = 1.0f / ENCODED_NORMAL_MAX;
+	mesh.loaded = true;
+	return mesh;
+}
+
+/** Uploads a mesh directly, outside the registry (e.g. to compare layouts).
+ * @param compress Whether to compress the vertex attributes (see quantize.h).
+ * @return the mesh, which must later be passed to `deleteGPUMesh`. */
+GPUMesh createGPUMesh(const MeshView &view, VertexLayout layout, bool compress) {
+	std::vector<StagedBuffer> staged;
+	GPUMesh mesh;
+	QuantizedMesh quantized;
+	if (compress) {
+		quantizeMesh(view, quantized);
+		mesh = uploadQuantizedMesh(quantized, view, layout, staged);
+	} else {
+		mesh = uploadMesh(view, layout, staged);
+	}
+	finishStagedBuffers(staged);
+	return mesh;
+}
+
+/** Frees the layer of a texture, unless it is the placeholder. */
+static void deleteGPUTexture(GPUTexture &texture) {
+	if (texture.array == placeholderTexture.array && texture.layer == placeholderTexture.layer) return;
+	freeTextureLayer(texture.array, texture.layer);
+}
+
+void deleteGPUMesh(GPUMesh &mesh) {
+	glDeleteBuffers(3, mesh.vboAttributes);  // unused ones are 0, which is ignored
+	glDeleteBuffers(1, &mesh.vboIndices);
+	glDeleteVertexArrays(1, &mesh.vao);
+}
+
+/** Creates the stand-ins for assets which haven't loaded yet: a unit
+ * icosahedron, and a 1x1 grey texture. */
+static void createPlaceholders(void) {
+	Mesh sphere = generateIcosahedron();
+	sphere.normals = sphere.vertices;
+	sphere.texCoords.resize(sphere.vertices.size(), glm::vec2(0, 0));
+	std::vector<StagedBuffer> staged;
+	placeholderMesh = uploadMesh(viewOf(sphere), LAYOUT_INTERLEAVED, staged);
+	finishStagedBuffers(staged);
+	placeholderMesh.numBytes = 0;
+	placeholderMesh.loaded = false;
+
+	const GLubyte grey[4] = { 128, 128, 128, 255 };
+	placeholderTexture.array = allocateTextureLayer(1, 1, GL_RGBA8, 1, rgbaSwizzle, placeholderTexture.layer);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, placeholderTexture.layer, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	placeholderTexture.numBytes = 0;
+	placeholderTexture.loaded = false;
+
+	textureCompressionSupported = GLEW_EXT_texture_compression_s3tc;
+
+	placeholdersCreated = true;
+}
+
+/** Sets up the residency of an entry just added to the registry, and starts
+ * loading it unless there is a budget, in which case `updateResidency` loads
+ * it once it is wanted. */
+static void addResidency(Residency &residency, const void* resource, const std::string &path, bool isTexture,
+                         void* entry, VertexLayout layout) {
+	residency.path = &path;
+	residency.isTexture = isTexture;
+	residency.entry = entry;
+	residency.loading = residencyBudget == 0;
+	residency.evicted = !residency.loading;
+	residency.lastUsedFrame = 0;
+	residency.lastVisibleFrame = 0;
+	residency.distance = INFINITY;
+	residency.numBytes = 0;
+	residencyOf[resource] = &residency;
+	if (residency.loading) startLoading(path, isTexture, layout);
+}
+
+/** Returns the mesh for the given OBJ file, starting to load it if no other
+ * object is using it. Each call must be matched by a call to `releaseMesh`
+ * with the same path. Must be called on the GL thread.
+ * @param layout How to arrange the vertex attributes in buffers, if the mesh
+ *               isn't already loaded.
+ * @return the mesh, which is the placeholder until the OBJ has loaded (or
+ *         while it is evicted), and stays valid until it is released. */
+const GPUMesh* acquireMesh(const char* objPath, VertexLayout layout) {
+	if (!placeholdersCreated) createPlaceholders();
+
+	std::unordered_map<std::string, MeshEntry>::iterator it = meshes.find(objPath);
+	if (it == meshes.end()) {
+		MeshEntry entry = { placeholderMesh, 0 };
+		entry.layout = layout;
+		it = meshes.insert(std::make_pair(std::string(objPath), entry)).first;
+		addResidency(it->second.residency, &it->second.mesh, it->first, false, &it->second, layout);
+	}
+
+	it->second.references++;
+	return &it->second.mesh;
+}
+
+/** Acquires the diffuse maps named by the materials of a mesh which has just
+ * loaded, in place of any it had before it was evicted. Maps which can't be
+ * found are left to the object's own texture. */
+static void acquireMaterialTextures(MeshEntry &entry, const MeshView &view) {
+	std::vector<std::string> previous;
+	previous.swap(entry.texturePaths);
+
+	entry.mesh.materialTextures.assign(view.numMaterials, NULL);
+	for (GLuint i = 0; i < view.numMaterials; i++) {
+		if (view.materials[i].texture[0] == '\0') continue;
+
+		std::string path = std::string(TEXTURE_PREFIX) + view.materials[i].texture;
+		if (!isInPack(path.c_str()) && access(path.c_str(), R_OK) != 0) continue;
+		entry.mesh.materialTextures[i] = acquireTexture(path.c_str());
+		entry.texturePaths.push_back(path);
+	}
+
+	// Released after acquiring, so that textures still in use aren't reloaded
+	for (size_t i = 0; i < previous.size(); i++) releaseTexture(previous[i].c_str());
+}
+
+static void releaseMaterialTextures(MeshEntry &entry) {
+	for (size_t i = 0; i < entry.texturePaths.size(); i++) releaseTexture(entry.texturePaths[i].c_str());
+	entry.texturePaths.clear();
+	entry.mesh.materialTextures.clear();
+}
+
+void releaseMesh(const char* objPath) {
+	std::unordered_map<std::string, MeshEntry>::iterator it = meshes.find(objPath);
+	if (it == meshes.end() || --it->second.references > 0) return;
+
+	// If it is still loading, it is deleted when it arrives instead
+	if (it->second.residency.loading) return;
+	releaseMaterialTextures(it->second);
+	if (!it->second.residency.evicted) deleteGPUMesh(it->second.mesh);
+	residencyOf.erase(&it->second.mesh);
+	meshes.erase(it);
+}
+
+/** Returns the texture stored in the given TGA file, starting to load it if no
+ * other object is using it. Each call must be matched by a call to
+ * `releaseTexture` with the same path. Must be called on the GL thread.
+ * @return the texture, which is the placeholder until the TGA has loaded (or
+ *         while it is evicted), and stays valid until it is released. */
+const GPUTexture* acquireTexture(const char* tgaPath) {
+	if (!placeholdersCreated) createPlaceholders();
+
+	std::unordered_map<std::string, TextureEntry>::iterator it = textures.find(tgaPath);
+	if (it == textures.end()) {
+		TextureEntry entry = { placeholderTexture, 0 };
+		it = textures.insert(std::make_pair(std::string(tgaPath), entry)).first;
+		addResidency(it->second.residency, &it->second.texture, it->first, true, &it->second, LAYOUT_INTERLEAVED);
+	}
+
+	it->second.references++;
+	return &it->second.texture;
+}
+
+void releaseTexture(const char* tgaPath) {
+	std::unordered_map<std::string, TextureEntry>::iterator it = textures.find(tgaPath);
+	if (it == textures.end() || --it->second.references > 0) return;
+
+	if (it->second.residency.loading) return;
+	deleteGPUTexture(it->second.texture);
+	residencyOf.erase(&it->second.texture);
+	textures.erase(it);
+}
+
+/** Copies an asset into the buffers mapped for it, on a worker thread. */
+static void fillBuffersJob(void* data) {
+	LoadedAsset* asset = (LoadedAsset*)data;
+	for (size_t i = 0; i < asset->staged.size(); i++) {
+		if (asset->staged[i].mapped) fillStagedBuffer(asset->staged[i], asset->staged[i].mapped);
+	}
+	if (asset->isTexture && asset->mappedPixels) {
+		if (asset->compress) {
+			memcpy(asset->mappedPixels, asset->cooked.levels[0], asset->cooked.dataSize);
+		} else if (!decodeTGA(asset->image, (unsigned char*)asset->mappedPixels)) {
+			fprintf(stderr, "Could not decode texture %s.\n", asset->path.c_str());
+			asset->imageRead = false;
+		}
+	}
+	asset->stage = STAGE_FILLED;
+	pushLoadedAsset(asset);
+}
+
+/** Fences the uploads issued for an asset, so that it can be swapped in once
+ * the GPU has finished with them. */
+static void fenceAsset(LoadedAsset* asset) {
+	asset->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	asset->stage = STAGE_FENCED;
+	fencedAssets.push_back(asset);
+}
+
+/** Creates and maps the buffers for an asset which has been read, and hands
+ * it back to a worker thread to fill them in. */
+static void mapBuffers(LoadedAsset* asset) {
+	if (!asset->isTexture) {
+		if (asset->compress) {
+			asset->uploaded = uploadQuantizedMesh(asset->quantized, asset->mesh.view, asset->layout, asset->staged);
+		} else {
+			asset->uploaded = uploadMesh(asset->mesh.view, asset->layout, asset->staged);
+		}
+	} else if (asset->imageRead) {
+		// The image goes through a Pixel Buffer Object, so that the driver
+		// can copy it into the texture without blocking
+		size_t size = asset->compress ? asset->cooked.dataSize : decodedTGASize(asset->image);
+		glGenBuffers(1, &asset->pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		asset->mappedPixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+		                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else {
+		// Nothing to upload
+		fenceAsset(asset);
+		return;
+	}
+	submitJob(fillBuffersJob, asset);
+}
+
+/** Issues the upload of an image decoded into its PBO, builds its mipmaps,
+ * and copies them into a layer of a texture array. */
+static void uploadImage(LoadedAsset* asset) {
+	TGAImage &image = asset->image;
+	size_t size = decodedTGASize(image);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->pbo);
+	if (!asset->mappedPixels || glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+		// The mapping failed, or its contents were lost, so decode it again here
+		std::vector<unsigned char> pixels(size);
+		if (asset->imageRead) asset->imageRead = decodeTGA(image, pixels.data());
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, pixels.data());
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	closeTGA(image);
+	if (!asset->imageRead) return;
+
+	// Copy the image in from the PBO, which the driver can do without
+	// blocking, into a texture of its own, as the mipmaps of a layer can't
+	// be generated without those of the rest of the array
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	GLint internalFormat = image.format == GL_RGBA ? GL_RGBA8 : GL_R8;
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->pbo);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, image.format, GL_UNSIGNED_BYTE, NULL);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	GLuint numLevels = 1;
+	while ((image.width >> numLevels) || (image.height >> numLevels)) numLevels++;
+	GPUTexture &texture = asset->texture;
+	texture.array = allocateTextureLayer(image.width, image.height, internalFormat, numLevels,
+	                                     image.format == GL_RED ? greyscaleSwizzle : rgbaSwizzle, texture.layer);
+	copyTextureToLayer(tex, texture.array, texture.layer);
+	glDeleteTextures(1, &tex);  // freed once the copy is done
+
+	texture.numBytes = texture.array->layerBytes;
+}
+
+/** Issues the upload of every mip level of a cooked texture from its PBO, into
+ * a layer of a texture array. */
+static void uploadCookedTexture(LoadedAsset* asset) {
+	MappedTexture &cooked = asset->cooked;
+	const TextureCacheHeader &header = *cooked.header;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->pbo);
+	if (!asset->mappedPixels || glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, cooked.dataSize, cooked.levels[0]);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// Allocated before binding the PBO, as the array may have to grow
+	GPUTexture &texture = asset->texture;
+	texture.array = allocateTextureLayer(header.width, header.height, header.internalFormat, header.numLevels,
+	                                     (const GLint*)header.swizzle, texture.layer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, asset->pbo);
+	for (GLuint i = 0; i < header.numLevels; i++) {
+		GLsizei width = header.width >> i ? header.width >> i : 1, height = header.height >> i ? header.height >> i : 1;
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, texture.layer, width, height, 1, header.internalFormat,
+		                          cooked.levelSizes[i], (const void*)(cooked.levels[i] - cooked.levels[0]));
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	texture.numBytes = cooked.dataSize;
+	closeTextureCache(cooked);
+}
+
+/** Unmaps the buffers of an asset once they have been filled in, issues the
+ * upload of its texture, and fences it. */
+static void unmapBuffers(LoadedAsset* asset) {
+	for (size_t i = 0; i < asset->staged.size(); i++) unmapStagedBuffer(asset->staged[i]);
+	asset->staged.clear();
+
+	if (asset->isTexture) {
+		if (asset->compress) {
+			uploadCookedTexture(asset);
+		} else {
+			uploadImage(asset);
+		}
+		glDeleteBuffers(1, &asset->pbo);  // freed once the copy is done
+		asset->texture.loaded = true;
+	}
+	fenceAsset(asset);
+}
+
+/** Swaps a mesh which the GPU has finished uploading in for its placeholder. */
+static void swapInMesh(LoadedAsset* asset) {
+	std::unordered_map<std::string, MeshEntry>::iterator it = meshes.find(asset->path);
+	MeshEntry &entry = it->second;
+	entry.mesh = asset->uploaded;
+	entry.residency.loading = false;
+	entry.residency.numBytes = entry.mesh.numBytes;
+
+	if (entry.references == 0) {
+		releaseMaterialTextures(entry);
+		deleteGPUMesh(entry.mesh);
+		residencyOf.erase(&entry.mesh);
+		meshes.erase(it);
+	} else {
+		acquireMaterialTextures(entry, asset->mesh.view);
+	}
+	closeMeshCache(asset->mesh);
+}
+
+/** Swaps a texture which the GPU has finished uploading in for its
+ * placeholder. */
+static void swapInTexture(LoadedAsset* asset) {
+	std::unordered_map<std::string, TextureEntry>::iterator it = textures.find(asset->path);
+	TextureEntry &entry = it->second;
+	entry.residency.loading = false;
+	if (!asset->imageRead) {
+		// Keep showing the placeholder, but don't try again
+		entry.texture.loaded = true;
+		entry.residency.numBytes = 0;
+	} else {
+		entry.texture = asset->texture;
+		entry.residency.numBytes = entry.texture.numBytes;
+	}
+
+	if (entry.references == 0) {
+		deleteGPUTexture(entry.texture);
+		residencyOf.erase(&entry.texture);
+		textures.erase(it);
+	}
+}
+
+/** Moves the assets coming back from the worker threads on to their next
+ * stage, and swaps in those the GPU has finished uploading. None of this waits
+ * for the GPU, or copies any assets. Call once per frame on the GL thread.
+ * @return the number of assets swapped in. */
+int processLoadedResources(void) {
+	LoadedAsset* stack = loadedAssets.exchange(NULL, std::memory_order_acquire);
+
+	// Reverse the stack, to upload in the order the assets finished
+	LoadedAsset* assets = NULL;
+	while (stack) {
+		LoadedAsset* next = stack->next;
+		stack->next = assets;
+		assets = stack;
+		stack = next;
+	}
+
+	while (assets) {
+		LoadedAsset* next = assets->next;
+		if (assets->stage == STAGE_READ) {
+			mapBuffers(assets);
+		} else {
+			unmapBuffers(assets);
+		}
+		assets = next;
+	}
+
+	int numUploaded = 0;
+	size_t numWaiting = 0;
+	for (size_t i = 0; i < fencedAssets.size(); i++) {
+		LoadedAsset* asset = fencedAssets[i];
+		if (glClientWaitSync(asset->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+			fencedAssets[numWaiting++] = asset;
+			continue;
+		}
+
+		glDeleteSync(asset->fence);
+		if (asset->isTexture) {
+			swapInTexture(asset);
+		} else {
+			swapInMesh(asset);
+		}
+		delete asset;
+		numUploaded++;
+	}
+	fencedAssets.resize(numWaiting);
+	checkForError("after uploading loaded resources");
+
+	if (numUploaded > 0) {
+		numLoading -= numUploaded;
+		if (numLoading == 0) {
+			printf("Finished loading resources in %.2f seconds.\n", glfwGetTime() - loadingStartTime);
+			printResourceUsage();
+		}
+	}
+	return numUploaded;
+}
+
+/** Limits the GPU memory taken by the meshes and textures in the registry.
+ * Assets are then only loaded once an object using them comes within
+ * `loadDistance` of the camera or into view, and those of objects which
+ * haven't been seen for the longest, and then the furthest away, are evicted
+ * to make room (see `updateResidency`).
+ * @param budget The most bytes to use, or 0 (the default) to keep every
+ *               asset acquired on the GPU. */
+void setResidencyBudget(size_t budget, float loadDistance) {
+	residencyBudget = budget;
+	residencyLoadDistance = loadDistance;
+}
+
+static void markUsed(const void* resource, float distance, bool visible) {
+	std::unordered_map<const void*, Residency*>::iterator it = residencyOf.find(resource);
+	if (it == residencyOf.end()) return;
+
+	Residency &residency = *it->second;
+	if (residency.lastUsedFrame != residencyFrame || distance < residency.distance) residency.distance = distance;
+	residency.lastUsedFrame = residencyFrame;
+	if (visible) residency.lastVisibleFrame = residencyFrame;
+}
+
+/** Records that an object using a mesh and texture from the registry is being
+ * drawn this frame, for `updateResidency` to decide what to keep.
+ * @param distance From the camera to the object.
+ * @param visible  Whether any of the object may be in view. */
+void useResources(const GPUMesh* mesh, const GPUTexture* texture, float distance, bool visible) {
+	markUsed(mesh, distance, visible);
+	markUsed(texture, distance, visible);
+	for (size_t i = 0; i < mesh->materialTextures.size(); i++) {
+		if (mesh->materialTextures[i]) markUsed(mesh->materialTextures[i], distance, visible);
+	}
+}
+
+/** Replaces an asset on the GPU with its placeholder, freeing its memory. */
+static void evict(Residency &residency) {
+	if (residency.isTexture) {
+		TextureEntry &entry = *(TextureEntry*)residency.entry;
+		deleteGPUTexture(entry.texture);
+		entry.texture = placeholderTexture;
+	} else {
+		// The material textures are left to be evicted on their own, as
+		// nothing draws them now
+		MeshEntry &entry = *(MeshEntry*)residency.entry;
+		GLfloat radius = entry.mesh.radius;
+		deleteGPUMesh(entry.mesh);
+		entry.mesh = placeholderMesh;
+		entry.mesh.radius = radius;  // so that it is still seen coming into view
+	}
+	residency.evicted = true;
+}
+
+static void reload(Residency &residency) {
+	residency.evicted = false;
+	residency.loading = true;
+	VertexLayout layout = residency.isTexture ? LAYOUT_INTERLEAVED : ((MeshEntry*)residency.entry)->layout;
+	startLoading(*residency.path, residency.isTexture, layout);
+}
+
+/** @return whether an asset is used by an object which is in view, or near
+ * enough to load it. */
+static bool isWanted(const Residency* residency) {
+	return residency->lastVisibleFrame == residencyFrame
+	    || (residency->lastUsedFrame == residencyFrame && residency->distance < residencyLoadDistance);
+}
+
+/** @return the distance of the nearest object using an asset this frame, or
+ * infinity if none are. */
+static float currentDistance(const Residency* residency) {
+	return residency->lastUsedFrame == residencyFrame ? residency->distance : INFINITY;
+}
+
+/** Orders assets to load: those in view, and then the nearest, first. */
+static bool byLoadPriority(const Residency* a, const Residency* b) {
+	bool aVisible = a->lastVisibleFrame == residencyFrame, bVisible = b->lastVisibleFrame == residencyFrame;
+	if (aVisible != bVisible) return aVisible;
+	return currentDistance(a) < currentDistance(b);
+}
+
+/** Orders assets to evict: those seen least recently, and then the furthest
+ * away, first. */
+static bool byEvictionPriority(const Residency* a, const Residency* b) {
+	if (a->lastVisibleFrame != b->lastVisibleFrame) return a->lastVisibleFrame < b->lastVisibleFrame;
+	return currentDistance(a) > currentDistance(b);
+}
+
+/** @return whether loading `wanted` is worth evicting `resident` for. */
+static bool outranks(const Residency* wanted, const Residency* resident) {
+	if (wanted->lastVisibleFrame == residencyFrame) return true;  // residents which may be evicted aren't in view
+	return currentDistance(wanted) * RESIDENCY_HYSTERESIS < currentDistance(resident);
+}
+
+/** Keeps the assets in the registry within the budget set by
+ * `setResidencyBudget`, given the objects marked by `useResources` this
+ * frame. Assets which are wanted are loaded in the background, nearest
+ * first, a few at a time; to make room, assets not in view are evicted, least
+ * recently seen first. Assets in view are never evicted, and are loaded even
+ * if they don't fit, so the budget may be overrun by what is in view. Nothing
+ * here waits for the GPU or the disk. Call once per frame on the GL thread,
+ * after marking the objects to be drawn. */
+void updateResidency(void) {
+	if (residencyBudget == 0) {
+		residencyFrame++;
+		return;
+	}
+
+	static std::vector<Residency*> wanted, evictable;
+	wanted.clear();
+	evictable.clear();
+	size_t used = 0;
+	int numInFlight = 0;
+	for (std::unordered_map<const void*, Residency*>::iterator it = residencyOf.begin(); it != residencyOf.end(); ++it) {
+		Residency* residency = it->second;
+		if (residency->loading) {
+			used += residency->numBytes;  // as much as it took last time, if it has been loaded before
+			numInFlight++;
+		} else if (residency->evicted) {
+			if (isWanted(residency)) wanted.push_back(residency);
+		} else {
+			used += residency->numBytes;
+			if (residency->numBytes > 0 && residency->lastVisibleFrame != residencyFrame) evictable.push_back(residency);
+		}
+	}
+
+	std::sort(evictable.begin(), evictable.end(), byEvictionPriority);
+	size_t next = 0;  // the next asset to evict
+	if (!wanted.empty()) {
+		std::sort(wanted.begin(), wanted.end(), byLoadPriority);
+		for (size_t i = 0; i < wanted.size() && numInFlight < RESIDENCY_MAX_LOADS; i++) {
+			Residency* residency = wanted[i];
+			while (used + residency->numBytes > residencyBudget && next < evictable.size()
+			       && outranks(residency, evictable[next])) {
+				evict(*evictable[next]);
+				used -= evictable[next]->numBytes;
+				next++;
+			}
+			// Assets in view are loaded anyway, as they would be drawn as
+			// placeholders otherwise; the rest wait for room
+			if (used + residency->numBytes > residencyBudget && residency->lastVisibleFrame != residencyFrame) break;
+
+			reload(*residency);
+			used += residency->numBytes;
+			numInFlight++;
+		}
+	}
+
+	// Assets may turn out larger than there was room for, so shed any which
+	// aren't wanted until back within the budget
+	for (; used > residencyBudget && next < evictable.size() && !isWanted(evictable[next]); next++) {
+		evict(*evictable[next]);
+		used -= evictable[next]->numBytes;
+	}
+	residencyFrame++;
+}
+
+/** Sets whether meshes loaded from now on have their vertex attributes
+ * compressed (see quantize.h). On by default. */
+void setVertexCompression(bool compress) {
+	compressVertices = compress;
+}
+
+/** Sets whether textures loaded from now on are cooked into compressed mip
+ * chains (see texcache.h), if the GPU supports the formats. On by default. */
+void setTextureCompression(bool compress) {
+	compressTextures = compress;
+}
+
+/** @return the number of assets still being loaded. */
+int numLoadingResources(void) {
+	return numLoading;
+}
+
+/** Prints the number of meshes and textures loaded, how many objects are
+ * using them, and roughly how much GPU memory they take up. */
+void printResourceUsage(void) {
+	size_t meshBytes = 0, textureBytes = 0;
+	int meshReferences = 0, textureReferences = 0;
+	for (std::unordered_map<std::string, MeshEntry>::iterator it = meshes.begin(); it != meshes.end(); ++it) {
+		meshBytes += it->second.mesh.numBytes;
+		meshReferences += it->second.references;
+	}
+	for (std::unordered_map<std::string, TextureEntry>::iterator it = textures.begin(); it != textures.end(); ++it) {
+		textureBytes += it->second.texture.numBytes;
+		textureReferences += it->second.references;
+	}
+
+	printf("Resources: %lu meshes (%d uses, %.1f MB), %lu textures (%d uses, %.1f MB)",
+	       (unsigned long)meshes.size(), meshReferences, meshBytes / 1048576.0,
+	       (unsigned long)textures.size(), textureReferences, textureBytes / 1048576.0);
+	if (residencyBudget > 0) {
+		int numEvicted = 0;
+		for (std::unordered_map<const void*, Residency*>::iterator it = residencyOf.begin(); it != residencyOf.end(); ++it) {
+			numEvicted += it->second->evicted;
+		}
+		printf(", %d evicted to stay within %.1f MB", numEvicted, residencyBudget / 1048576.0);
+	}
+	int numArrays, numLayers;
+	size_t arrayBytes;
+	textureArrayUsage(numArrays, numLayers, arrayBytes);
+	printf(", in %d texture arrays (%d layers, %.1f MB).\n", numArrays, numLayers, arrayBytes / 1048576.0);
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <unistd.h>
 #include <vector>
 #include <GL/glew.h>
 #include <GL/glfw.h>
@@ -10,6 +11,8 @@
 #include "paths.h"
 #include "utils.h"
 #include "generators.h"
+#include "resources.h"
+#include "pack.h"
 
 #include "scene.hpp"
 
@@ -17,6 +20,11 @@
 
 #define NUM_MUSIC_TREES 6
 
+/** The landscape's virtual texture, and the pages across its cache: 32 holds
+ * 1024 pages, which is 8 MB with the pages compressed. */
+#define LANDSCAPE_VIRTUAL_TEXTURE   TEXTURE("landscape.vt")
+#define LANDSCAPE_VIRTUAL_CACHE     32
+
 #define CAMERA_START_POSITION glm::vec3(115, 30, 11.6)
 #define CAMERA_START_YAW 23.1
 #define CAMERA_START_PITCH -0.157394
@@ -25,6 +33,11 @@
 #define SCREENSHOT_YAW      CAMERA_START_YAW
 #define SCREENSHOT_PITCH    CAMERA_START_PITCH
 
+/** The most a level of detail may differ from the full mesh on screen, in
+ * pixels, and how far either side of that to wait before switching. */
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS  0.25f
+
 #define GROUND_SHAKE_MAGNITUDE 0.5
 #define GROUND_SHAKE_DURATION 0.05
 #define NUM_GROUND_SHAKES 3
@@ -40,52 +53,46 @@ void updateModelMatrix(DisplayObject &object) {
 	object.modelMatrix = matrix;
 }
 
-/** Creates a Vertex Buffer Object, fills it with the given items, and binds it
- * as a Vertex Attribute Array.
- * @param index         The index of the generic vertex attribute to be modified.
- * @param numComponents The number of components per generic vertex attribute.
- * @param items         A std::vector containing the data.
- * @tparam T The type of the items in the data.
- * @return the index of the Vertex Buffer Object (prefix `vbo`).
+/** @return the least detailed level of the object's mesh whose error, as seen
+ * from the given distance, is within `maxPixels`. */
+static GLuint coarsestLODWithin(const DisplayObject &object, float pixelsPerModelUnit, float maxPixels) {
+	GLuint lod = 0;
+	while (lod + 1 < object.mesh->numLODs && object.mesh->lods[lod + 1].error * pixelsPerModelUnit <= maxPixels) {
+		lod++;
+	}
+	return lod;
+}
+
+/** Chooses the level of detail to draw an object at, by how large the error of
+ * each level would appear on screen. To avoid flickering between two levels,
+ * an object only gets coarser once the next level is comfortably within the
+ * error allowed, and only gets finer once its current level is comfortably
+ * outside it.
+ * @param pixelsPerUnit The size on screen of one unit at a distance of one unit.
  */
-template <class T>
-static GLuint createVertexAttribVBO(GLuint index, GLint numComponents, const std::vector<T> &items) {
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(T) * items.size(), items.data(), GL_STATIC_DRAW);
-
-	// Bind as vertex attribute array
-	glEnableVertexAttribArray(index);
-	glVertexAttribPointer(index, numComponents, GL_FLOAT, GL_FALSE, 0, 0);
-
-	return vbo;
+void updateLOD(DisplayObject &object, const glm::vec3 &cameraLocation, float pixelsPerUnit) {
+	float distance = glm::length(object.location - cameraLocation);
+	if (distance < 1) distance = 1;
+	float pixelsPerModelUnit = object.scale * pixelsPerUnit / distance;
+
+	if (object.lod >= object.mesh->numLODs) object.lod = object.mesh->numLODs - 1;
+	GLuint coarser = coarsestLODWithin(object, pixelsPerModelUnit, LOD_PIXEL_ERROR * (1 - LOD_HYSTERESIS));
+	if (coarser > object.lod) {
+		object.lod = coarser;
+	} else if (object.mesh->lods[object.lod].error * pixelsPerModelUnit > LOD_PIXEL_ERROR * (1 + LOD_HYSTERESIS)) {
+		object.lod = coarsestLODWithin(object, pixelsPerModelUnit, LOD_PIXEL_ERROR);
+	}
 }
 
-static DisplayObject createDisplayObject(const Mesh &mesh, const char *texturePath) {
-	// Create a VAO
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	checkForError("after VAO creation");
-
-	// Create vertex attribute VBOs
-	createVertexAttribVBO<glm::vec3>(0, 3, mesh.vertices);
-	createVertexAttribVBO<glm::vec3>(1, 3, mesh.normals);
-	createVertexAttribVBO<glm::vec2>(2, 2, mesh.texCoords);
-
-	// Indices VBO
-	GLuint vboIndices;
-	glGenBuffers(1, &vboIndices);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndices);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.indices.size(), mesh.indices.data(), GL_STATIC_DRAW);
-
-	// DisplayObject
+/** Creates a DisplayObject at the origin from the given model and texture.
+ * The mesh and texture are shared with any other objects using the same files,
+ * and are loaded in the background. */
+static DisplayObject createDisplayObject(const char *modelPath, const char *texturePath) {
 	DisplayObject obj;
-	obj.vao = vao;
-	obj.numVertices = mesh.vertices.size();
-	obj.numIndices  = mesh.indices.size();
-	obj.tex = loadTGA(texturePath);  // TODO: prevent textures being loaded twice
+	obj.mesh    = acquireMesh(modelPath);
+	obj.texture = acquireTexture(texturePath);
+	obj.virtualTexture = NULL;
+	obj.lod = 0;
 	obj.location = glm::vec3(0., 0., 0.);
 	obj.rotation = glm::vec3(0., 0., 0.);
 	obj.scale = 1;
@@ -252,31 +259,31 @@ void setupScene(std::vector<DisplayObject*> &objects, DisplayObject &cameraObjec
 
 	// Static part //
 	objects.clear();
-	Mesh landscapeMesh = loadOBJ(MODEL("landscape.obj"));
-	landscape = createDisplayObject(landscapeMesh, TEXTURE("landscape.tga"));
+	landscape = createDisplayObject(MODEL("landscape.obj"), TEXTURE("landscape.tga"));
 	landscape.scale = 33;
 	updateModelMatrix(landscape);
+	// Paged in as it is seen, if its page file has been built (see vtex.h)
+	if (isInPack(LANDSCAPE_VIRTUAL_TEXTURE) || access(LANDSCAPE_VIRTUAL_TEXTURE, R_OK) == 0) {
+		landscape.virtualTexture = openVirtualTexture(LANDSCAPE_VIRTUAL_TEXTURE, LANDSCAPE_VIRTUAL_CACHE);
+	}
 	objects.push_back(&landscape);
 
-	Mesh spaceshipMesh = loadOBJ(MODEL("spaceship.obj"));
-	spaceship = createDisplayObject(spaceshipMesh, TEXTURE("spaceship.tga"));
+	spaceship = createDisplayObject(MODEL("spaceship.obj"), TEXTURE("spaceship.tga"));
 	spaceship.location = spaceshipEndLocation;
 	spaceship.rotation = spaceshipEndRotation;
 	spaceship.scale = 3;
 	updateModelMatrix(spaceship);
 	objects.push_back(&spaceship);
 
-	Mesh clangerMesh = loadOBJ(MODEL("clanger.obj"));
-	clanger = createDisplayObject(clangerMesh, TEXTURE("clanger.tga"));
+	clanger = createDisplayObject(MODEL("clanger.obj"), TEXTURE("clanger.tga"));
 	clanger.location = clangerLocation;
 	clanger.rotation = glm::vec3(0, 0, 0);
 	updateModelMatrix(clanger);
 	objects.push_back(&clanger);
 
-	Mesh musicTreeMesh = loadOBJ(MODEL("music-tree.obj"));
 	GLfloat musicTreeLocations[] = { -0.97,0,-2, -0.7,0,-1.74, -0.45,0,-1.48, -0.32,0,-2.25, 0.7,0.08,-2.38, 1,0.08,-2.5 };
 	for (unsigned int i = 0, j = 0; i < NUM_MUSIC_TREES; i++, j = i * 3) {
-		DisplayObject tree = createDisplayObject(musicTreeMesh, TEXTURE("music-tree.tga"));
+		DisplayObject tree = createDisplayObject(MODEL("music-tree.obj"), TEXTURE("music-tree.tga"));
 		tree.location = 33.0f * glm::vec3(musicTreeLocations[j], musicTreeLocations[j+1], musicTreeLocations[j+2]);
 		tree.rotation = glm::vec3(0, rand() % 90, 0);
 		tree.scale = rand() / float(RAND_MAX) + 2.5;
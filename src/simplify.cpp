@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "generators.h"
+#include "meshopt.h"
+#include "simplify.h"
+
+/** How much more the planes through borders and seams count than the planes of
+ * the triangles themselves. */
+#define CONSTRAINT_WEIGHT 4.0
+
+/** The largest error allowed in any level, as a fraction of the diagonal of
+ * the mesh's bounding box. */
+#define MAX_LOD_ERROR 0.1f
+
+/** A level is only kept if it has at most this fraction of the indices of the
+ * level before. */
+#define MIN_LOD_REDUCTION 0.75f
+
+/** The symmetric 4x4 matrix of a quadric, as its upper triangle:
+ * xx xy xz xw yy yz yw zz zw ww. */
+struct Quadric {
+	double q[10];
+};
+
+static void addPlane(Quadric &quadric, const glm::vec3 &normal, float d, double weight) {
+	double a = normal.x, b = normal.y, c = normal.z;
+	double* q = quadric.q;
+	q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+	q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+	q[7] += weight * c * c; q[8] += weight * c * d;
+	q[9] += weight * d * d;
+}
+
+static void addQuadric(Quadric &to, const Quadric &from) {
+	for (int i = 0; i < 10; i++) to.q[i] += from.q[i];
+}
+
+/** @return the sum of the squared distances from the point to the planes. */
+static double evaluate(const Quadric &quadric, const glm::vec3 &point) {
+	double x = point.x, y = point.y, z = point.z;
+	const double* q = quadric.q;
+	double result = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+	              + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+	              + q[7] * z * z + 2 * q[8] * z
+	              + q[9];
+	return result > 0 ? result : 0;
+}
+
+static uint64_t edgeKey(GLuint from, GLuint to) {
+	return ((uint64_t)from << 32) | to;
+}
+
+/** The corners of a directed edge: which vertices (as opposed to positions)
+ * it goes between, and how many triangles have it. */
+struct DirectedEdge {
+	GLuint from, to;
+	int count;
+};
+
+struct Collapse {
+	GLuint from, to;  ///< positions
+	double cost;
+};
+
+static bool cheapestFirst(const Collapse &a, const Collapse &b) {
+	return a.cost < b.cost;
+}
+
+/** Everything known about the mesh being simplified. Vertices with the same
+ * position are "welded" for the purposes of topology: `positionOf` maps each
+ * vertex to the first vertex with its position. */
+struct Simplifier {
+	const Mesh* mesh;
+	std::vector<GLuint> positionOf;
+	std::vector<Quadric> quadrics;  ///< by position
+
+	std::vector<GLuint> indices;
+
+	// Rebuilt on each pass
+	std::unordered_map<uint64_t, DirectedEdge> edges;  ///< by positions
+	std::vector<GLuint> start, adjacent;  ///< triangles around each position (CSR)
+	std::vector<char> isBorder, isSeam, isLocked;
+};
+
+static GLuint positionAt(const Simplifier &s, size_t corner) {
+	return s.positionOf[s.indices[corner]];
+}
+
+static const glm::vec3 &pointOf(const Simplifier &s, GLuint position) {
+	return s.mesh->vertices[position];
+}
+
+static bool isBorderEdge(const Simplifier &s, GLuint a, GLuint b) {
+	return !s.edges.count(edgeKey(a, b)) || !s.edges.count(edgeKey(b, a));
+}
+
+/** @return whether the vertices either side of an edge differ. */
+static bool isSeamEdge(const Simplifier &s, GLuint a, GLuint b) {
+	std::unordered_map<uint64_t, DirectedEdge>::const_iterator forward = s.edges.find(edgeKey(a, b));
+	std::unordered_map<uint64_t, DirectedEdge>::const_iterator back    = s.edges.find(edgeKey(b, a));
+	if (forward == s.edges.end() || back == s.edges.end()) return false;
+	return forward->second.from != back->second.to || forward->second.to != back->second.from;
+}
+
+/** Finds the edges and the triangles around each position, and so which
+ * positions are on borders or seams, or are too complicated to move. */
+static void analyse(Simplifier &s) {
+	GLuint numVertices = s.positionOf.size();
+	size_t numTriangles = s.indices.size() / 3;
+
+	s.edges.clear();
+	for (size_t t = 0; t < numTriangles; t++) {
+		for (int k = 0; k < 3; k++) {
+			size_t from = 3 * t + k, to = 3 * t + (k + 1) % 3;
+			DirectedEdge edge = { s.indices[from], s.indices[to], 0 };
+			s.edges.insert(std::make_pair(edgeKey(positionAt(s, from), positionAt(s, to)), edge)).first->second.count++;
+		}
+	}
+
+	s.start.assign(numVertices + 1, 0);
+	for (size_t c = 0; c < s.indices.size(); c++) s.start[positionAt(s, c) + 1]++;
+	for (GLuint p = 0; p < numVertices; p++) s.start[p + 1] += s.start[p];
+	s.adjacent.resize(s.indices.size());
+	std::vector<GLuint> filled(s.start.begin(), s.start.end() - 1);
+	for (size_t c = 0; c < s.indices.size(); c++) s.adjacent[filled[positionAt(s, c)]++] = c / 3;
+
+	// A vertex is on a seam if another vertex shares its position
+	std::vector<GLuint> vertexAt(numVertices, (GLuint)-1);
+	s.isBorder.assign(numVertices, 0);
+	s.isSeam.assign(numVertices, 0);
+	s.isLocked.assign(numVertices, 0);
+	std::vector<int> borderEdges(numVertices, 0);
+	for (size_t c = 0; c < s.indices.size(); c++) {
+		GLuint p = positionAt(s, c);
+		if (vertexAt[p] == (GLuint)-1) vertexAt[p] = s.indices[c];
+		else if (vertexAt[p] != s.indices[c]) s.isSeam[p] = 1;
+	}
+	for (std::unordered_map<uint64_t, DirectedEdge>::iterator it = s.edges.begin(); it != s.edges.end(); ++it) {
+		GLuint a = it->first >> 32, b = (GLuint)it->first;
+		std::unordered_map<uint64_t, DirectedEdge>::iterator back = s.edges.find(edgeKey(b, a));
+		if (it->second.count > 1 || (back != s.edges.end() && back->second.count > 1)) {
+			s.isLocked[a] = s.isLocked[b] = 1;  // non-manifold
+		} else if (back == s.edges.end()) {
+			s.isBorder[a] = s.isBorder[b] = 1;
+			borderEdges[a]++;
+			borderEdges[b]++;
+		}
+	}
+	for (GLuint p = 0; p < numVertices; p++) {
+		if (borderEdges[p] > 2) s.isLocked[p] = 1;  // where borders meet
+	}
+}
+
+/** @return whether position `a` may be collapsed onto its neighbour `b`. */
+static bool mayCollapse(const Simplifier &s, GLuint a, GLuint b) {
+	if (s.isLocked[a]) return false;
+	if (s.isBorder[a]) return isBorderEdge(s, a, b);
+	if (s.isSeam[a])   return isSeamEdge(s, a, b);
+	return true;
+}
+
+/** Tries to collapse position `a` onto position `b`. Each vertex at `a` must
+ * move to the vertex at `b` it shares an edge with (so seams stay intact), and
+ * no remaining triangle may flip over.
+ * @param vertexTo Updated with where the vertices at `a` move to.
+ * @return the number of triangles removed, or 0 if the collapse isn't possible. */
+static int tryCollapse(const Simplifier &s, GLuint a, GLuint b, std::vector<GLuint> &vertexTo) {
+	GLuint moves[8][2];
+	int numMoves = 0;
+	int removed = 0;
+
+	for (GLuint i = s.start[a]; i < s.start[a + 1]; i++) {
+		size_t t = s.adjacent[i];
+		int cornerA = -1, cornerB = -1;
+		for (int k = 0; k < 3; k++) {
+			GLuint p = positionAt(s, 3 * t + k);
+			if (p == a) cornerA = k;
+			if (p == b) cornerB = k;
+		}
+		if (cornerB < 0) continue;
+
+		GLuint from = s.indices[3 * t + cornerA], to = s.indices[3 * t + cornerB];
+		int m = 0;
+		while (m < numMoves && moves[m][0] != from) m++;
+		if (m < numMoves) {
+			if (moves[m][1] != to) return 0;  // inconsistent
+		} else {
+			if (numMoves == 8) return 0;
+			moves[numMoves][0] = from;
+			moves[numMoves][1] = to;
+			numMoves++;
+		}
+		removed++;
+	}
+
+	const glm::vec3 &target = pointOf(s, b);
+	for (GLuint i = s.start[a]; i < s.start[a + 1]; i++) {
+		size_t t = s.adjacent[i];
+		glm::vec3 before[3], after[3];
+		bool hasB = false;
+		int cornerA = 0;
+		for (int k = 0; k < 3; k++) {
+			GLuint p = positionAt(s, 3 * t + k);
+			if (p == b) hasB = true;
+			if (p == a) cornerA = k;
+			before[k] = after[k] = pointOf(s, p);
+		}
+		if (hasB) continue;
+
+		// Every vertex at `a` must have somewhere to go
+		GLuint from = s.indices[3 * t + cornerA];
+		int m = 0;
+		while (m < numMoves && moves[m][0] != from) m++;
+		if (m == numMoves) return 0;
+
+		after[cornerA] = target;
+		glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normalAfter  = glm::cross(after[1]  - after[0],  after[2]  - after[0]);
+		if (glm::dot(normalBefore, normalAfter) <= 0) return 0;
+	}
+
+	for (int m = 0; m < numMoves; m++) vertexTo[moves[m][0]] = moves[m][1];
+	return removed;
+}
+
+/** Simplifies some of the triangles of a mesh (e.g. its full-detail level) by
+ * collapsing edges, until there are at most `targetIndexCount` indices left or
+ * no more collapses can be made within `maxError`.
+ * @param result Set to the simplified indices, which refer to the same
+ *               vertices as `indices`.
+ * @param sources If not NULL, set to the triangle of `indices` that each
+ *                triangle of the result came from.
+ * @return the estimated error of the result, in model space units. */
+float simplifyIndices(const Mesh &mesh, const std::vector<GLuint> &indices, size_t targetIndexCount,
+                      float maxError, std::vector<GLuint> &result, std::vector<GLuint>* sources) {
+	Simplifier s;
+	s.mesh = &mesh;
+	s.indices = indices;
+	GLuint numVertices = mesh.vertices.size();
+	if (sources) {
+		sources->resize(indices.size() / 3);
+		for (size_t t = 0; t < sources->size(); t++) (*sources)[t] = t;
+	}
+
+	// Weld vertices by position
+	weldPositions(mesh.vertices, s.positionOf);
+
+	// Each position starts with the planes of its triangles, and of any borders
+	// or seams through it
+	analyse(s);
+	Quadric zero;
+	memset(&zero, 0, sizeof(zero));
+	s.quadrics.assign(numVertices, zero);
+	for (size_t t = 0; t < s.indices.size() / 3; t++) {
+		GLuint p[3] = { positionAt(s, 3*t), positionAt(s, 3*t+1), positionAt(s, 3*t+2) };
+		glm::vec3 normal = glm::cross(pointOf(s, p[1]) - pointOf(s, p[0]), pointOf(s, p[2]) - pointOf(s, p[0]));
+		float length = glm::length(normal);
+		if (length == 0) continue;
+		normal /= length;
+		for (int k = 0; k < 3; k++) {
+			addPlane(s.quadrics[p[k]], normal, -glm::dot(normal, pointOf(s, p[0])), 1);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			GLuint a = p[k], b = p[(k + 1) % 3];
+			if (!isBorderEdge(s, a, b) && !isSeamEdge(s, a, b)) continue;
+			glm::vec3 edge = pointOf(s, b) - pointOf(s, a);
+			glm::vec3 across = glm::cross(edge, normal);
+			float acrossLength = glm::length(across);
+			if (acrossLength == 0) continue;
+			across /= acrossLength;
+			float d = -glm::dot(across, pointOf(s, a));
+			addPlane(s.quadrics[a], across, d, CONSTRAINT_WEIGHT);
+			addPlane(s.quadrics[b], across, d, CONSTRAINT_WEIGHT);
+		}
+	}
+
+	double maxCost = (double)maxError * maxError;
+	double resultCost = 0;
+	std::vector<GLuint> vertexTo(numVertices);
+	std::vector<char> touched(numVertices);
+	std::vector<Collapse> collapses;
+	bool first = true;
+	while (s.indices.size() > targetIndexCount) {
+		if (!first) analyse(s);
+		first = false;
+
+		// Find the cheapest allowed direction to collapse each edge
+		collapses.clear();
+		for (std::unordered_map<uint64_t, DirectedEdge>::iterator it = s.edges.begin(); it != s.edges.end(); ++it) {
+			GLuint a = it->first >> 32, b = (GLuint)it->first;
+			if (a > b && s.edges.count(edgeKey(b, a))) continue;  // seen from the other side
+
+			Collapse collapse = { 0, 0, -1 };
+			if (mayCollapse(s, a, b)) {
+				Collapse ab = { a, b, evaluate(s.quadrics[a], pointOf(s, b)) };
+				collapse = ab;
+			}
+			if (mayCollapse(s, b, a)) {
+				double cost = evaluate(s.quadrics[b], pointOf(s, a));
+				if (collapse.cost < 0 || cost < collapse.cost) {
+					Collapse ba = { b, a, cost };
+					collapse = ba;
+				}
+			}
+			if (collapse.cost >= 0 && collapse.cost <= maxCost) collapses.push_back(collapse);
+		}
+		std::sort(collapses.begin(), collapses.end(), cheapestFirst);
+
+		// Make as many as possible without two touching the same triangles
+		for (GLuint v = 0; v < numVertices; v++) vertexTo[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t numIndices = s.indices.size();
+		int numCollapsed = 0;
+		for (size_t i = 0; i < collapses.size() && numIndices > targetIndexCount; i++) {
+			const Collapse &c = collapses[i];
+			if (touched[c.from] || touched[c.to]) continue;
+
+			int removed = tryCollapse(s, c.from, c.to, vertexTo);
+			if (removed == 0) continue;
+
+			for (GLuint j = s.start[c.from]; j < s.start[c.from + 1]; j++) {
+				size_t t = s.adjacent[j];
+				for (int k = 0; k < 3; k++) touched[positionAt(s, 3 * t + k)] = 1;
+			}
+			addQuadric(s.quadrics[c.to], s.quadrics[c.from]);
+			resultCost = std::max(resultCost, c.cost);
+			numIndices -= 3 * removed;
+			numCollapsed++;
+		}
+		if (numCollapsed == 0) break;
+
+		// Move the collapsed vertices, and drop the triangles which have collapsed
+		size_t kept = 0;
+		for (size_t t = 0; t < s.indices.size() / 3; t++) {
+			GLuint v[3];
+			for (int k = 0; k < 3; k++) v[k] = vertexTo[s.indices[3 * t + k]];
+			GLuint p0 = s.positionOf[v[0]], p1 = s.positionOf[v[1]], p2 = s.positionOf[v[2]];
+			if (p0 == p1 || p1 == p2 || p2 == p0) continue;
+			if (sources) (*sources)[kept / 3] = (*sources)[t];
+			for (int k = 0; k < 3; k++) s.indices[kept++] = v[k];
+		}
+		s.indices.resize(kept);
+		if (sources) sources->resize(kept / 3);
+	}
+
+	result.swap(s.indices);
+	return sqrt(resultCost);
+}
+
+/** Groups the triangles of a level by the subset of the full-detail level
+ * they came from, appends them to the mesh's indices with one subset per
+ * material, and optimises each subset for the vertex cache. */
+static void appendLevel(Mesh &mesh, const std::vector<GLuint> &level, const std::vector<GLuint> &sources,
+                        size_t numFullSubsets, MeshLOD &lod) {
+	lod.firstIndex  = mesh.indices.size();
+	lod.numIndices  = level.size();
+	lod.firstSubset = mesh.subsets.size();
+	lod.numSubsets  = 0;
+
+	std::vector<GLuint> indices, clusters;
+	for (size_t i = 0; i < std::max(numFullSubsets, (size_t)1); i++) {
+		indices.clear();
+		for (size_t t = 0; t < level.size() / 3; t++) {
+			if (numFullSubsets > 0) {
+				const MeshSubset &from = mesh.subsets[i];
+				GLuint index = 3 * sources[t];
+				if (index < from.firstIndex || index >= from.firstIndex + from.numIndices) continue;
+			}
+			indices.insert(indices.end(), &level[3 * t], &level[3 * t] + 3);
+		}
+		if (indices.empty()) continue;
+
+		optimizeVertexCache(indices, mesh.vertices.size(), clusters);
+		if (numFullSubsets > 0) {
+			MeshSubset subset = { mesh.subsets[i].material, (GLuint)mesh.indices.size(), (GLuint)indices.size(), 0, 0 };
+			mesh.subsets.push_back(subset);
+			lod.numSubsets++;
+		}
+		mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+	}
+}
+
+/** Builds up to MAX_LODS levels of detail for a mesh, each with about half the
+ * triangles of the one before, and appends their indices to the mesh's. Each
+ * level is simplified from the full-detail one, so its error is measured
+ * against the original surface. The whole mesh is simplified at once, so that
+ * the edges between materials can't crack open, and each level is then split
+ * into subsets by material like the full-detail one. */
+void buildLODs(Mesh &mesh, const char* name) {
+	std::vector<GLuint> full(mesh.indices);
+	size_t numFullSubsets = mesh.subsets.size();
+	mesh.lods.clear();
+	MeshLOD fullDetail = { 0, (GLuint)full.size(), 0, 0, (GLuint)numFullSubsets };
+	mesh.lods.push_back(fullDetail);
+	if (full.empty()) return;
+
+	glm::vec3 boundsMin = mesh.vertices[0], boundsMax = mesh.vertices[0];
+	for (size_t v = 1; v < mesh.vertices.size(); v++) {
+		boundsMin = glm::min(boundsMin, mesh.vertices[v]);
+		boundsMax = glm::max(boundsMax, mesh.vertices[v]);
+	}
+	float maxError = MAX_LOD_ERROR * glm::length(boundsMax - boundsMin);
+
+	std::vector<GLuint> level, sources;
+	while (mesh.lods.size() < MAX_LODS) {
+		const MeshLOD &previous = mesh.lods.back();
+		size_t target = (previous.numIndices / 2) / 3 * 3;
+		float error = simplifyIndices(mesh, full, target, maxError, level, &sources);
+		if (level.empty() || level.size() > previous.numIndices * MIN_LOD_REDUCTION) break;
+
+		MeshLOD lod;
+		lod.error = std::max(error, previous.error);
+		appendLevel(mesh, level, sources, numFullSubsets, lod);
+		mesh.lods.push_back(lod);
+	}
+
+	if (name) {
+		printf("Built %lu levels of detail for %s:", (unsigned long)mesh.lods.size(), name);
+		for (size_t i = 0; i < mesh.lods.size(); i++) {
+			printf(" %u (%g)", mesh.lods[i].numIndices / 3, mesh.lods[i].error);
+		}
+		printf(" triangles (error).\n");
+	}
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "tga.h"
+#include "texcache.h"
+#include "texarrays.h"
+
+/** Every texture array, one for each size and format of texture loaded. */
+static std::vector<TextureArray*> arrays;
+
+/** A framebuffer to attach the levels of textures to, to copy them into
+ * arrays. */
+static GLuint copyFramebuffer = 0;
+
+static GLuint levelDimension(GLuint size, GLuint level) {
+	return (size >> level) ? (size >> level) : 1;
+}
+
+/** Finds how pixels of an uncompressed format are read and written.
+ * @return the bytes per pixel, or 0 if the format is compressed. */
+static int pixelTransferFormat(GLenum internalFormat, GLenum &format, GLenum &type) {
+	type = GL_UNSIGNED_BYTE;
+	switch (internalFormat) {
+	case GL_RGBA8: format = GL_RGBA; return 4;
+	case GL_R8:    format = GL_RED;  return 1;
+	default:       format = GL_RGBA; return 0;
+	}
+}
+
+/** @return the bytes taken by one layer of one mip level of an array. */
+static size_t levelBytes(const TextureArray &array, GLuint level) {
+	GLenum format, type;
+	GLuint width = levelDimension(array.width, level), height = levelDimension(array.height, level);
+	int bytesPerPixel = pixelTransferFormat(array.internalFormat, format, type);
+	if (bytesPerPixel == 0) return compressedLevelSize(array.internalFormat, width, height);
+	return (size_t)width * height * bytesPerPixel;
+}
+
+/** Creates the texture for an array, with room for the given number of layers,
+ * and leaves it bound. */
+static GLuint createArrayTexture(const TextureArray &array, GLuint numLayers) {
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+	GLenum format, type;
+	bool compressed = pixelTransferFormat(array.internalFormat, format, type) == 0;
+	for (GLuint i = 0; i < array.numLevels; i++) {
+		GLsizei width = levelDimension(array.width, i), height = levelDimension(array.height, i);
+		if (compressed) {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, array.internalFormat, width, height, numLayers, 0,
+			                       levelBytes(array, i) * numLayers, NULL);
+		} else {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, i, array.internalFormat, width, height, numLayers, 0, format, type, NULL);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, array.numLevels - 1);
+	glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, array.swizzle);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	return tex;
+}
+
+/** Doubles the number of layers in an array. The layers it has are copied
+ * into the new texture through a buffer object, so the copy stays on the GPU,
+ * and nothing waits for it. */
+static void growTextureArray(TextureArray* array) {
+	GLuint numLayers = array->numLayers * 2;
+	GLuint tex = createArrayTexture(*array, numLayers);
+
+	GLenum format, type;
+	bool compressed = pixelTransferFormat(array->internalFormat, format, type) == 0;
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (GLuint i = 0; i < array->numLevels; i++) {
+		GLsizei width = levelDimension(array->width, i), height = levelDimension(array->height, i);
+		size_t size = levelBytes(*array, i) * array->numLayers;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_COPY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array->tex);
+		if (compressed) {
+			glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, i, NULL);
+		} else {
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, i, format, type, NULL);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+		if (compressed) {
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, 0, width, height, array->numLayers,
+			                          array->internalFormat, size, NULL);
+		} else {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, 0, width, height, array->numLayers, format, type, NULL);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glDeleteBuffers(1, &buffer);
+	glDeleteTextures(1, &array->tex);
+
+	// Handed out from the lowest
+	for (GLuint layer = numLayers; layer-- > array->numLayers;) array->freeLayers.push_back(layer);
+	array->tex = tex;
+	array->numLayers = numLayers;
+}
+
+/** Finds a free layer for a texture, in the array for textures of its size
+ * and format, which is created or grown if need be. Its contents are
+ * undefined until they are uploaded, for instance with
+ * `glCompressedTexSubImage3D`, or `copyTextureToLayer`. Must be called on the
+ * GL thread, and leaves the array bound to `GL_TEXTURE_2D_ARRAY`.
+ * @param swizzle Where the shader's RGBA come from (GL_RED...GL_ONE).
+ * @param layer   Set to the layer, which must later be passed to
+ *                `freeTextureLayer`.
+ * @return the array, which stays valid while it has any layers in use. */
+TextureArray* allocateTextureLayer(GLuint width, GLuint height, GLenum internalFormat, GLuint numLevels,
+                                   const GLint swizzle[4], GLint &layer) {
+	TextureArray* array = NULL;
+	for (size_t i = 0; i < arrays.size() && !array; i++) {
+		TextureArray* candidate = arrays[i];
+		if (candidate->width == width && candidate->height == height && candidate->internalFormat == internalFormat
+		    && candidate->numLevels == numLevels && memcmp(candidate->swizzle, swizzle, sizeof(candidate->swizzle)) == 0) {
+			array = candidate;
+		}
+	}
+
+	if (!array) {
+		array = new TextureArray;
+		array->width = width;
+		array->height = height;
+		array->internalFormat = internalFormat;
+		array->numLevels = numLevels;
+		memcpy(array->swizzle, swizzle, sizeof(array->swizzle));
+		array->layerBytes = 0;
+		for (GLuint i = 0; i < numLevels; i++) array->layerBytes += levelBytes(*array, i);
+		array->numLayers = 1;
+		array->freeLayers.push_back(0);
+		array->tex = createArrayTexture(*array, 1);
+		arrays.push_back(array);
+	} else if (array->freeLayers.empty()) {
+		growTextureArray(array);
+	} else {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array->tex);
+	}
+
+	layer = array->freeLayers.back();
+	array->freeLayers.pop_back();
+	return array;
+}
+
+/** Frees a layer allocated by `allocateTextureLayer`, and deletes its array
+ * if no layers of it are in use. */
+void freeTextureLayer(TextureArray* array, GLint layer) {
+	array->freeLayers.push_back(layer);
+	if (array->freeLayers.size() < array->numLayers) return;
+
+	glDeleteTextures(1, &array->tex);
+	for (size_t i = 0; i < arrays.size(); i++) {
+		if (arrays[i] == array) {
+			arrays.erase(arrays.begin() + i);
+			break;
+		}
+	}
+	delete array;
+}
+
+/** Copies every mip level of a 2D texture into a layer of an array, on the
+ * GPU. The texture must be the size of the array's layers, with as many
+ * levels, and in a format which can be rendered to (GL_RGBA8 or GL_R8). */
+void copyTextureToLayer(GLuint source, const TextureArray* array, GLint layer) {
+	if (!copyFramebuffer) glGenFramebuffers(1, &copyFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffer);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array->tex);
+	for (GLuint i = 0; i < array->numLevels; i++) {
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, i);
+		glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, 0, 0,
+		                    levelDimension(array->width, i), levelDimension(array->height, i));
+	}
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+/** Counts the texture arrays, the layers in use in them, and the GPU memory
+ * they take, including that of their free layers. */
+void textureArrayUsage(int &numArrays, int &numLayers, size_t &numBytes) {
+	numArrays = arrays.size();
+	numLayers = 0;
+	numBytes = 0;
+	for (size_t i = 0; i < arrays.size(); i++) {
+		numLayers += arrays[i]->numLayers - arrays[i]->freeLayers.size();
+		numBytes += arrays[i]->layerBytes * arrays[i]->numLayers;
+	}
+}
@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+
+#include "generators.h"
+#include "meshcache.h"
+#include "tga.h"
+#include "texcache.h"
+#include "workers.h"
+#include "pack.h"
+
+static_assert(sizeof(TextureCacheHeader) == 48, "TextureCacheHeader must not contain padding");
+
+static std::string cachePathFor(const char* tgaPath) {
+	return std::string(tgaPath) + TEXTURE_CACHE_EXTENSION;
+}
+
+static size_t blockSize(GLenum internalFormat) {
+	switch (internalFormat) {
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:  return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return 16;
+	case GL_COMPRESSED_RED_RGTC1:          return 8;
+	default:                               return 0;
+	}
+}
+
+/** @return the bytes taken by one mip level of a compressed texture, or 0 if
+ * the format isn't one a texture cache holds. */
+size_t compressedLevelSize(GLenum internalFormat, GLuint width, GLuint height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(internalFormat);
+}
+
+static GLuint levelDimension(GLuint size, GLuint level) {
+	return (size >> level) ? (size >> level) : 1;
+}
+
+/** @return the number of levels in a full mip chain, down to 1x1. */
+static GLuint numMipLevels(GLuint width, GLuint height) {
+	GLuint levels = 1;
+	while ((width >> levels) || (height >> levels)) levels++;
+	return levels;
+}
+
+/** Checks that a cache's levels add up to its length, and points
+ * `texture.levels` at them.
+ * @return false if the cache isn't in the current format. */
+static bool viewTextureCache(const void* data, size_t length, MappedTexture &texture) {
+	const TextureCacheHeader* header = (const TextureCacheHeader*)data;
+	if (length < sizeof(TextureCacheHeader) || memcmp(header->magic, TEXTURE_CACHE_MAGIC, 4) != 0
+			|| header->version != TEXTURE_CACHE_VERSION || blockSize(header->internalFormat) == 0
+			|| header->width == 0 || header->height == 0 || header->width > 65536 || header->height > 65536
+			|| header->numLevels != numMipLevels(header->width, header->height)) {
+		return false;
+	}
+
+	const unsigned char* level = (const unsigned char*)(header + 1);
+	size_t dataSize = 0;
+	for (GLuint i = 0; i < header->numLevels; i++) {
+		texture.levels[i] = level + dataSize;
+		texture.levelSizes[i] = compressedLevelSize(header->internalFormat, levelDimension(header->width, i),
+		                                            levelDimension(header->height, i));
+		dataSize += texture.levelSizes[i];
+	}
+	if (sizeof(TextureCacheHeader) + dataSize != length) return false;
+
+	texture.header = header;
+	texture.dataSize = dataSize;
+	return true;
+}
+
+/** Maps the cache for the given TGA file into memory, if it exists and is up
+ * to date.
+ * @return true on success, in which case `texture` must later be passed to
+ *         `closeTextureCache`. */
+bool openTextureCache(const char* tgaPath, MappedTexture &texture) {
+	uint64_t key;
+	if (!isLittleEndian() || !sourceKeyOf(tgaPath, key)) return false;
+
+	std::string path = cachePathFor(tgaPath);
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TextureCacheHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+
+	if (((const TextureCacheHeader*)mapping)->sourceKey != key || !viewTextureCache(mapping, st.st_size, texture)) {
+		fprintf(stderr, "Texture cache %s is stale, ignoring it.\n", path.c_str());
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	texture.mapping       = mapping;
+	texture.mappingLength = st.st_size;
+	texture.packBuffer    = NULL;
+	texture.cooked        = NULL;
+	return true;
+}
+
+/** Finds the cache for the given TGA file in the asset pack (see pack.h). The
+ * pack is built from up-to-date caches, so the TGA itself isn't checked, and
+ * needn't exist.
+ * @return true on success, in which case `texture` must later be passed to
+ *         `closeTextureCache`. */
+static bool openPackedTextureCache(const char* tgaPath, MappedTexture &texture) {
+	PackView packed;
+	std::string name = cachePathFor(tgaPath);
+	if (!isLittleEndian() || !readFromPack(name.c_str(), packed)) return false;
+
+	if (!viewTextureCache(packed.data, packed.size, texture)) {
+		fprintf(stderr, "Texture cache %s in the asset pack is stale, ignoring it.\n", name.c_str());
+		releasePackView(packed);
+		return false;
+	}
+
+	texture.mapping       = NULL;
+	texture.mappingLength = 0;
+	texture.packBuffer    = packed.buffer;
+	texture.cooked        = NULL;
+	return true;
+}
+
+void closeTextureCache(MappedTexture &texture) {
+	if (texture.mapping) munmap(texture.mapping, texture.mappingLength);
+	free(texture.packBuffer);
+	delete texture.cooked;
+	texture.mapping    = NULL;
+	texture.header     = NULL;
+	texture.packBuffer = NULL;
+	texture.cooked     = NULL;
+}
+
+// Cooking //
+
+/** Halves an RGBA image with a box filter, as `glGenerateMipmap` would. The
+ * last row or column of an odd-sized image is folded into the one before.
+ * @param out Room for the image at the next mip level down. */
+void downsampleImage(const unsigned char* in, GLuint width, GLuint height, unsigned char* out) {
+	GLuint outWidth = levelDimension(width, 1), outHeight = levelDimension(height, 1);
+	for (GLuint y = 0; y < outHeight; y++) {
+		GLuint y0 = 2 * y, y1 = (2 * y + 1 < height) ? 2 * y + 1 : 2 * y;
+		for (GLuint x = 0; x < outWidth; x++) {
+			GLuint x0 = 2 * x, x1 = (2 * x + 1 < width) ? 2 * x + 1 : 2 * x;
+			for (int c = 0; c < 4; c++) {
+				unsigned sum = in[4 * (y0 * width + x0) + c] + in[4 * (y0 * width + x1) + c]
+				             + in[4 * (y1 * width + x0) + c] + in[4 * (y1 * width + x1) + c];
+				out[4 * (y * outWidth + x) + c] = (sum + 2) / 4;
+			}
+		}
+	}
+}
+
+static unsigned to565(const glm::vec3 &color) {
+	glm::vec3 c = glm::clamp(color, 0.0f, 255.0f);
+	return ((unsigned)(c.x * 31 / 255 + 0.5f) << 11) | ((unsigned)(c.y * 63 / 255 + 0.5f) << 5)
+	     | (unsigned)(c.z * 31 / 255 + 0.5f);
+}
+
+static glm::vec3 from565(unsigned color) {
+	unsigned r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+	return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+/** Chooses the nearest of the four colours between two BC1 endpoints for
+ * each pixel of a block, with the endpoints in the four-colour order.
+ * @return the total squared error. */
+static float chooseColorIndices(const glm::vec3 pixels[16], unsigned &c0, unsigned &c1, uint32_t &indices) {
+	if (c0 < c1) {
+		unsigned swap = c0;
+		c0 = c1;
+		c1 = swap;
+	}
+
+	glm::vec3 palette[4];
+	palette[0] = from565(c0);
+	palette[1] = from565(c1);
+	palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+	int numColors = (c0 == c1) ? 1 : 4;  // equal endpoints would be the three-colour order
+
+	indices = 0;
+	float total = 0;
+	for (int i = 0; i < 16; i++) {
+		uint32_t best = 0;
+		float bestError = INFINITY;
+		for (int k = 0; k < numColors; k++) {
+			glm::vec3 d = pixels[i] - palette[k];
+			float error = glm::dot(d, d);
+			if (error < bestError) {
+				bestError = error;
+				best = k;
+			}
+		}
+		indices |= best << (2 * i);
+		total += bestError;
+	}
+	return total;
+}
+
+/** Compresses a block of 16 RGB colours into BC1: two endpoints at either end
+ * of the line through the colours along their principal axis (found by power
+ * iteration on their covariance), pulled in slightly since the extremes are
+ * rarely hit, and a 2-bit index per pixel into the four colours between them.
+ * The endpoints are then refitted to the indices by least squares, which pulls
+ * them towards colours off the axis, and kept if that does better. */
+static void encodeColorBlock(const glm::vec3 pixels[16], unsigned char out[8]) {
+	glm::vec3 mean(0);
+	for (int i = 0; i < 16; i++) mean += pixels[i];
+	mean /= 16.0f;
+
+	float cov[6] = { 0, 0, 0, 0, 0, 0 };  // xx, xy, xz, yy, yz, zz
+	for (int i = 0; i < 16; i++) {
+		glm::vec3 d = pixels[i] - mean;
+		cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z;
+		cov[3] += d.y * d.y; cov[4] += d.y * d.z; cov[5] += d.z * d.z;
+	}
+	// Start from the row of the covariance with the most variance, which is
+	// never orthogonal to the principal axis
+	glm::vec3 axis(cov[0], cov[1], cov[2]);
+	if (cov[3] >= cov[0] && cov[3] >= cov[5]) axis = glm::vec3(cov[1], cov[3], cov[4]);
+	else if (cov[5] >= cov[0]) axis = glm::vec3(cov[2], cov[4], cov[5]);
+	for (int iteration = 0; iteration < 8; iteration++) {
+		axis = glm::vec3(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+		                 cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+		                 cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+		float largest = fmaxf(fabsf(axis.x), fmaxf(fabsf(axis.y), fabsf(axis.z)));
+		if (largest == 0) break;
+		axis /= largest;
+	}
+
+	unsigned c0, c1;
+	float lengthSquared = glm::dot(axis, axis);
+	if (lengthSquared == 0) {
+		c0 = c1 = to565(mean);  // a flat block
+	} else {
+		float low = 0, high = 0;
+		for (int i = 0; i < 16; i++) {
+			float t = glm::dot(pixels[i] - mean, axis) / lengthSquared;
+			low = fminf(low, t);
+			high = fmaxf(high, t);
+		}
+		float inset = (high - low) / 16;
+		c0 = to565(mean + axis * (high - inset));
+		c1 = to565(mean + axis * (low + inset));
+	}
+	uint32_t indices;
+	float error = chooseColorIndices(pixels, c0, c1, indices);
+
+	if (error > 0 && c0 != c1) {
+		// Each pixel is w * c0 + (1 - w) * c1, so solve the normal equations
+		// for the endpoints which best fit the indices chosen
+		static const float weights[4] = { 1, 0, 2 / 3.0f, 1 / 3.0f };
+		float aa = 0, ab = 0, bb = 0;
+		glm::vec3 ap(0), bp(0);
+		for (int i = 0; i < 16; i++) {
+			float a = weights[(indices >> (2 * i)) & 3], b = 1 - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			ap += a * pixels[i];
+			bp += b * pixels[i];
+		}
+		float determinant = aa * bb - ab * ab;
+		if (determinant != 0) {
+			unsigned r0 = to565((ap * bb - bp * ab) / determinant);
+			unsigned r1 = to565((bp * aa - ap * ab) / determinant);
+			uint32_t refitted;
+			float refittedError = chooseColorIndices(pixels, r0, r1, refitted);
+			if (refittedError < error) {
+				c0 = r0;
+				c1 = r1;
+				indices = refitted;
+			}
+		}
+	}
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	memcpy(out + 4, &indices, 4);
+}
+
+/** Compresses a block of 16 values into BC4 (which is also the alpha of BC3):
+ * the largest and smallest values as endpoints, in the eight-value order, and
+ * a 3-bit index per pixel into the values between them. */
+static void encodeValueBlock(const unsigned char values[16], unsigned char out[8]) {
+	unsigned char a0 = values[0], a1 = values[0];
+	for (int i = 1; i < 16; i++) {
+		if (values[i] > a0) a0 = values[i];
+		if (values[i] < a1) a1 = values[i];
+	}
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		float palette[8] = { (float)a0, (float)a1 };
+		for (int k = 2; k < 8; k++) palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7.0f;
+		for (int i = 0; i < 16; i++) {
+			uint64_t best = 0;
+			float bestError = INFINITY;
+			for (uint64_t k = 0; k < 8; k++) {
+				float error = fabsf(values[i] - palette[k]);
+				if (error < bestError) {
+					bestError = error;
+					best = k;
+				}
+			}
+			indices |= best << (3 * i);
+		}
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+	for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+/** One mip level being compressed by `runParallel`, a row of blocks per task. */
+struct LevelCompression {
+	const unsigned char* rgba;
+	GLuint width, height;
+	GLenum internalFormat;
+	unsigned char* out;
+};
+
+static void compressBlockRowTask(void* data, int row) {
+	const LevelCompression* c = (const LevelCompression*)data;
+	GLuint blocksWide = (c->width + 3) / 4;
+	size_t size = blockSize(c->internalFormat);
+	unsigned char* out = c->out + (size_t)row * blocksWide * size;
+	for (GLuint bx = 0; bx < blocksWide; bx++, out += size) {
+		// Blocks past the edge of the image repeat its last row and column
+		glm::vec3 colors[16];
+		unsigned char reds[16], alphas[16];
+		for (int i = 0; i < 16; i++) {
+			GLuint x = bx * 4 + i % 4, y = row * 4 + i / 4;
+			if (x >= c->width) x = c->width - 1;
+			if (y >= c->height) y = c->height - 1;
+			const unsigned char* pixel = c->rgba + 4 * ((size_t)y * c->width + x);
+			colors[i] = glm::vec3(pixel[0], pixel[1], pixel[2]);
+			reds[i] = pixel[0];
+			alphas[i] = pixel[3];
+		}
+
+		if (c->internalFormat == GL_COMPRESSED_RED_RGTC1) {
+			encodeValueBlock(reds, out);
+		} else if (c->internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+			encodeValueBlock(alphas, out);
+			encodeColorBlock(colors, out + 8);
+		} else {
+			encodeColorBlock(colors, out);
+		}
+	}
+}
+
+/** Compresses an RGBA image into blocks of the given format, in rows as
+ * `glCompressedTexImage2D` takes them, sharing the rows between the worker
+ * threads.
+ * @param out Room for `compressedLevelSize(internalFormat, width, height)`
+ *            bytes. */
+void compressImage(const unsigned char* rgba, GLuint width, GLuint height, GLenum internalFormat, unsigned char* out) {
+	LevelCompression c = { rgba, width, height, internalFormat, out };
+	runParallel(compressBlockRowTask, &c, (height + 3) / 4);
+}
+
+/** Cooks an image into the contents of a texture cache: builds its mip chain,
+ * and compresses each level, sharing the rows of blocks between the worker
+ * threads.
+ * @param pixels The image, as `decodeTGA` decodes it. */
+void cookTexture(const TGAImage &image, const unsigned char* pixels, uint64_t sourceKey,
+                 std::vector<unsigned char> &cooked) {
+	GLuint width = image.width, height = image.height;
+	size_t numPixels = (size_t)width * height;
+
+	// Expand a greyscale image to RGBA, with the grey in red
+	std::vector<unsigned char> rgba;
+	bool opaque = true;
+	if (image.bytesPerPixel == 4) {
+		rgba.assign(pixels, pixels + 4 * numPixels);
+		for (size_t i = 0; i < numPixels && opaque; i++) opaque = pixels[4 * i + 3] == 255;
+	} else {
+		rgba.assign(4 * numPixels, 255);
+		for (size_t i = 0; i < numPixels; i++) rgba[4 * i] = pixels[i];
+	}
+
+	TextureCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TEXTURE_CACHE_MAGIC, 4);
+	header.version   = TEXTURE_CACHE_VERSION;
+	header.sourceKey = sourceKey;
+	header.width     = width;
+	header.height    = height;
+	header.numLevels = numMipLevels(width, height);
+	header.swizzle[0] = GL_RED;
+	header.swizzle[1] = GL_GREEN;
+	header.swizzle[2] = GL_BLUE;
+	header.swizzle[3] = GL_ALPHA;
+	if (image.bytesPerPixel == 1) {
+		// Sample as greyscale
+		header.internalFormat = GL_COMPRESSED_RED_RGTC1;
+		header.swizzle[0] = header.swizzle[1] = header.swizzle[2] = GL_RED;
+		header.swizzle[3] = GL_ONE;
+	} else {
+		header.internalFormat = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+
+	size_t dataSize = 0;
+	for (GLuint i = 0; i < header.numLevels; i++) {
+		dataSize += compressedLevelSize(header.internalFormat, levelDimension(width, i), levelDimension(height, i));
+	}
+	cooked.resize(sizeof(TextureCacheHeader) + dataSize);
+	memcpy(cooked.data(), &header, sizeof(header));
+
+	std::vector<unsigned char> smaller;
+	unsigned char* out = cooked.data() + sizeof(TextureCacheHeader);
+	for (GLuint i = 0; i < header.numLevels; i++) {
+		GLuint levelWidth = levelDimension(width, i), levelHeight = levelDimension(height, i);
+		compressImage(rgba.data(), levelWidth, levelHeight, header.internalFormat, out);
+		out += compressedLevelSize(header.internalFormat, levelWidth, levelHeight);
+
+		if (i + 1 < header.numLevels) {
+			smaller.resize(4 * (size_t)levelDimension(width, i + 1) * levelDimension(height, i + 1));
+			downsampleImage(rgba.data(), levelWidth, levelHeight, smaller.data());
+			rgba.swap(smaller);
+		}
+	}
+}
+
+/** Writes the cache for the given TGA file. The file is written under a
+ * temporary name and renamed into place, so a partially written cache is never
+ * picked up.
+ * @return true if the cache was written. */
+bool writeTextureCache(const char* tgaPath, const std::vector<unsigned char> &cooked) {
+	if (!isLittleEndian()) return false;
+
+	std::string path = cachePathFor(tgaPath);
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Could not write texture cache %s.\n", path.c_str());
+		return false;
+	}
+
+	bool ok = fwrite(cooked.data(), 1, cooked.size(), file) == cooked.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "Could not write texture cache %s.\n", path.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Loads the cooked texture for a TGA file, from its cache if there is an
+ * up-to-date one, or otherwise by decoding and cooking the TGA, and writing
+ * the cache for next time.
+ * @return false if the TGA couldn't be read; if not, the texture must later be
+ *         passed to `closeTextureCache`. */
+bool loadCachedTGA(const char* tgaPath, MappedTexture &texture) {
+	if (openPackedTextureCache(tgaPath, texture) || openTextureCache(tgaPath, texture)) return true;
+
+	TGAImage image;
+	if (!openTGA(tgaPath, image)) return false;
+	std::vector<unsigned char> pixels(decodedTGASize(image));
+	if (!decodeTGA(image, pixels.data())) {
+		fprintf(stderr, "Could not decode texture %s.\n", tgaPath);
+		closeTGA(image);
+		return false;
+	}
+
+	double start = glfwGetTime();
+	uint64_t key = 0;
+	bool haveKey = sourceKeyOf(tgaPath, key);
+	std::vector<unsigned char>* cooked = new std::vector<unsigned char>();
+	cookTexture(image, pixels.data(), key, *cooked);
+	closeTGA(image);
+	printf("Cooked %s: %.2f MB in %.2f seconds.\n", tgaPath, cooked->size() / 1048576.0, glfwGetTime() - start);
+
+	if (haveKey && writeTextureCache(tgaPath, *cooked) && openTextureCache(tgaPath, texture)) {
+		delete cooked;
+		return true;
+	}
+
+	// Couldn't use the cache, so hold on to the cooked texture instead
+	viewTextureCache(cooked->data(), cooked->size(), texture);
+	texture.mapping       = NULL;
+	texture.mappingLength = 0;
+	texture.packBuffer    = NULL;
+	texture.cooked        = cooked;
+	return true;
+}
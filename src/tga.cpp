@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "pack.h"
+#include "tga.h"
+
+#define TGA_HEADER_SIZE 18
+
+/** Image types */
+#define TGA_TRUECOLOR     2
+#define TGA_GREYSCALE     3
+#define TGA_RLE_TRUECOLOR 10
+#define TGA_RLE_GREYSCALE 11
+
+/** Image descriptor bits */
+#define TGA_RIGHT_TO_LEFT 0x10
+#define TGA_TOP_TO_BOTTOM 0x20
+
+static uint16_t read16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+/** Reads the header of a TGA file held in memory.
+ * @param name For error messages.
+ * @return false if the file isn't a TGA image of a kind which can be read. */
+bool openTGAMemory(const void* data, size_t length, const char* name, TGAImage &image) {
+	const unsigned char* file = (const unsigned char*)data;
+	if (length < TGA_HEADER_SIZE) {
+		fprintf(stderr, "%s is too short to be a TGA file.\n", name);
+		return false;
+	}
+
+	int type = file[2], depth = file[16], descriptor = file[17];
+	bool colour = type == TGA_TRUECOLOR || type == TGA_RLE_TRUECOLOR;
+	bool grey   = type == TGA_GREYSCALE || type == TGA_RLE_GREYSCALE;
+	if (!(colour && (depth == 24 || depth == 32)) && !(grey && depth == 8)) {
+		fprintf(stderr, "%s is a kind of TGA image which can't be read (type %d, %d bits).\n", name, type, depth);
+		return false;
+	}
+	if (descriptor & TGA_RIGHT_TO_LEFT) {
+		fprintf(stderr, "%s stores its rows right to left, which isn't supported.\n", name);
+		return false;
+	}
+
+	// Skip the image ID, and the colour map, which true-colour images may
+	// still have
+	size_t colourMapLength = file[1] ? read16(file + 5) * (size_t)((file[7] + 7) / 8) : 0;
+
+	image.width  = read16(file + 12);
+	image.height = read16(file + 14);
+	image.bytesPerPixel = colour ? 4 : 1;
+	image.format = colour ? GL_RGBA : GL_RED;
+	image.file = file;
+	image.fileLength = length;
+	image.mapping = NULL;
+	image.packBuffer = NULL;
+	image.pixelsOffset = TGA_HEADER_SIZE + file[0] + colourMapLength;
+	image.fileBytesPerPixel = depth / 8;
+	image.rle = type == TGA_RLE_TRUECOLOR || type == TGA_RLE_GREYSCALE;
+	image.topToBottom = (descriptor & TGA_TOP_TO_BOTTOM) != 0;
+
+	size_t pixelsLength = (size_t)image.width * image.height * image.fileBytesPerPixel;
+	if (image.width == 0 || image.height == 0 || image.pixelsOffset > length
+			|| (!image.rle && pixelsLength > length - image.pixelsOffset)) {
+		fprintf(stderr, "%s is truncated.\n", name);
+		return false;
+	}
+	return true;
+}
+
+/** Opens the TGA file at the given path, from the asset pack if it is there,
+ * and reads its header.
+ * @return true on success, in which case `image` must later be passed to
+ *         `closeTGA`. */
+bool openTGA(const char* path, TGAImage &image) {
+	PackView packed;
+	if (readFromPack(path, packed)) {
+		if (!openTGAMemory(packed.data, packed.size, path, image)) {
+			releasePackView(packed);
+			return false;
+		}
+		image.packBuffer = packed.buffer;
+		return true;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open file %s.\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		fprintf(stderr, "Could not read file %s.\n", path);
+		return false;
+	}
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Could not read file %s.\n", path);
+		return false;
+	}
+
+	if (!openTGAMemory(mapping, st.st_size, path, image)) {
+		munmap(mapping, st.st_size);
+		return false;
+	}
+	image.mapping = mapping;
+	return true;
+}
+
+void closeTGA(TGAImage &image) {
+	if (image.mapping) munmap(image.mapping, image.fileLength);
+	free(image.packBuffer);
+	image.file = NULL;
+	image.mapping = NULL;
+	image.packBuffer = NULL;
+}
+
+/** @return the bytes `decodeTGA` writes. */
+size_t decodedTGASize(const TGAImage &image) {
+	return (size_t)image.width * image.height * image.bytesPerPixel;
+}
+
+// Swizzling //
+
+/** Converts runs of TGA pixels to RGBA: the BGR or BGRA pixels of a
+ * true-colour image, `n` at a time. */
+struct TGAKernels {
+	void (*bgrToRGBA)(const unsigned char* in, unsigned char* out, size_t n);
+	void (*bgraToRGBA)(const unsigned char* in, unsigned char* out, size_t n);
+};
+
+static void bgrToRGBAScalar(const unsigned char* in, unsigned char* out, size_t n) {
+	for (size_t i = 0; i < n; i++, in += 3, out += 4) {
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = 255;
+	}
+}
+
+static void bgraToRGBAScalar(const unsigned char* in, unsigned char* out, size_t n) {
+	for (size_t i = 0; i < n; i++, in += 4, out += 4) {
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = in[3];
+	}
+}
+
+static const TGAKernels scalarKernels = { bgrToRGBAScalar, bgraToRGBAScalar };
+
+/* The SIMD kernels swap bytes within each pixel with a byte shuffle, spreading
+ * 4 BGR pixels (12 bytes) over 16 for the alpha to be ORed in. The AVX2 ones
+ * do 8 pixels at a time, in two 4-pixel lanes. Loads never reach past the
+ * last pixel; the few pixels left over go to the scalar kernels. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TGA_X86 1
+#include <immintrin.h>
+#define TGA_SSSE3 __attribute__((target("ssse3")))
+#define TGA_AVX2  __attribute__((target("avx2")))
+
+TGA_SSSE3 static void bgrToRGBASSSE3(const unsigned char* in, unsigned char* out, size_t n) {
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+	size_t i = 0;
+	for (; i + 6 <= n; i += 4) {  // 16 bytes are loaded, and 12 used
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(in + 3 * i));
+		_mm_storeu_si128((__m128i*)(out + 4 * i), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	bgrToRGBAScalar(in + 3 * i, out + 4 * i, n - i);
+}
+
+TGA_SSSE3 static void bgraToRGBASSSE3(const unsigned char* in, unsigned char* out, size_t n) {
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+		_mm_storeu_si128((__m128i*)(out + 4 * i), _mm_shuffle_epi8(pixels, shuffle));
+	}
+	bgraToRGBAScalar(in + 4 * i, out + 4 * i, n - i);
+}
+
+static const TGAKernels ssse3Kernels = { bgrToRGBASSSE3, bgraToRGBASSSE3 };
+
+TGA_AVX2 static void bgrToRGBAAVX2(const unsigned char* in, unsigned char* out, size_t n) {
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+	                                         2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+	size_t i = 0;
+	for (; i + 10 <= n; i += 8) {  // the upper lane loads 16 bytes from the fifth pixel
+		__m128i low  = _mm_loadu_si128((const __m128i*)(in + 3 * i));
+		__m128i high = _mm_loadu_si128((const __m128i*)(in + 3 * i + 12));
+		__m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+		_mm256_storeu_si256((__m256i*)(out + 4 * i), _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	bgrToRGBAScalar(in + 3 * i, out + 4 * i, n - i);
+}
+
+TGA_AVX2 static void bgraToRGBAAVX2(const unsigned char* in, unsigned char* out, size_t n) {
+	const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+	                                         2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(in + 4 * i));
+		_mm256_storeu_si256((__m256i*)(out + 4 * i), _mm256_shuffle_epi8(pixels, shuffle));
+	}
+	bgraToRGBAScalar(in + 4 * i, out + 4 * i, n - i);
+}
+
+static const TGAKernels avx2Kernels = { bgrToRGBAAVX2, bgraToRGBAAVX2 };
+#endif
+
+static GLuint supportedSIMD(void) {
+#ifdef TGA_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return TGA_SIMD_AVX2;
+	if (__builtin_cpu_supports("ssse3")) return TGA_SIMD_SSSE3;
+#endif
+	return TGA_SIMD_NONE;
+}
+
+/** @return the kernels for a level which the CPU supports. */
+static const TGAKernels* kernelsFor(GLuint level) {
+	switch (level) {
+#ifdef TGA_X86
+	case TGA_SIMD_AVX2:  return &avx2Kernels;
+	case TGA_SIMD_SSSE3: return &ssse3Kernels;
+#endif
+	default:             return &scalarKernels;
+	}
+}
+
+/** The kernels in use. The best the CPU supports are picked during static
+ * initialisation, so that worker threads never have to. */
+static const TGAKernels* kernelsInUse = kernelsFor(supportedSIMD());
+
+/** Picks the kernels used to decode colour images: the scalar ones
+ * (TGA_SIMD_NONE), SSSE3, AVX2, or the best the CPU supports (TGA_SIMD_BEST).
+ * Every level decodes to exactly the same pixels. Not safe to call while
+ * images are being decoded.
+ * @return the level used, which is lower than the one asked for if the CPU
+ *         doesn't support it. */
+GLuint tgaSIMD(GLuint level) {
+	GLuint supported = supportedSIMD();
+	if (level > supported) level = supported;
+	kernelsInUse = kernelsFor(level);
+	return level;
+}
+
+// Decoding //
+
+/** Converts `n` pixels of the file to the decoded format. */
+static void convertPixels(const TGAImage &image, const unsigned char* in, unsigned char* out, size_t n) {
+	if (image.fileBytesPerPixel == 3) {
+		kernelsInUse->bgrToRGBA(in, out, n);
+	} else if (image.fileBytesPerPixel == 4) {
+		kernelsInUse->bgraToRGBA(in, out, n);
+	} else {
+		memcpy(out, in, n);
+	}
+}
+
+/** @return where the decoded row `row` of the file goes in the output. */
+static unsigned char* rowOut(const TGAImage &image, unsigned char* out, GLuint row) {
+	GLuint flipped = image.topToBottom ? image.height - 1 - row : row;
+	return out + (size_t)flipped * image.width * image.bytesPerPixel;
+}
+
+/** Decodes run-length encoded pixels. Packets may run on from one row into
+ * the next, so each is split at the ends of rows.
+ * @return false if the data runs out before the image is filled. */
+static bool decodeRLE(const TGAImage &image, unsigned char* out) {
+	const unsigned char* in = image.file + image.pixelsOffset;
+	const unsigned char* inEnd = image.file + image.fileLength;
+	int inSize = image.fileBytesPerPixel, outSize = image.bytesPerPixel;
+	GLuint row = 0, column = 0;
+	unsigned char* to = rowOut(image, out, 0);
+	while (row < image.height) {
+		if (in >= inEnd) return false;
+		unsigned packet = *in++;
+		size_t count = (packet & 0x7f) + 1;
+		bool run = (packet & 0x80) != 0;
+		size_t inLength = run ? inSize : count * inSize;
+		if (inLength > (size_t)(inEnd - in)) return false;
+
+		// Runs are filled a whole pixel at a time
+		unsigned char value[4];
+		uint32_t word = 0;
+		if (run) {
+			convertPixels(image, in, value, 1);
+			memcpy(&word, value, sizeof(word));
+			in += inSize;
+		}
+		while (count > 0 && row < image.height) {
+			size_t n = image.width - column < count ? image.width - column : count;
+			if (!run) {
+				convertPixels(image, in, to, n);
+				in += n * inSize;
+			} else if (outSize == 4) {
+				for (size_t i = 0; i < n; i++) memcpy(to + 4 * i, &word, 4);
+			} else {
+				memset(to, value[0], n);
+			}
+			to += n * outSize;
+			column += n;
+			count -= n;
+			if (column == image.width) {
+				column = 0;
+				if (++row < image.height) to = rowOut(image, out, row);
+			}
+		}
+	}
+	return true;
+}
+
+/** Decodes an image opened by `openTGA` into `out`, which must have room for
+ * `decodedTGASize(image)` bytes. Safe to call from any thread.
+ * @return false if the file is corrupt, in which case `out` may be partly
+ *         written. */
+bool decodeTGA(const TGAImage &image, unsigned char* out) {
+	if (image.rle) return decodeRLE(image, out);
+
+	const unsigned char* in = image.file + image.pixelsOffset;
+	size_t rowLength = (size_t)image.width * image.fileBytesPerPixel;
+	for (GLuint row = 0; row < image.height; row++, in += rowLength) {
+		convertPixels(image, in, rowOut(image, out, row), image.width);
+	}
+	return true;
+}
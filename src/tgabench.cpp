@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "workers.h"
+#include "tga.h"
+#include "paths.h"
+
+/** @file tgabench.cpp
+ * Times the TGA decoder (see tga.h) against GLFW's, at each SIMD level the CPU
+ * supports:
+ *
+ *     tgabench [image.tga...]
+ *
+ * The spaceship and clanger textures are used if no images are given. Each
+ * image is decoded as it is stored, and re-encoded in memory as uncompressed
+ * 32 and 24-bit images with their rows from the top down, so that every path
+ * through the decoder is timed. Before timing, checks that each level gives
+ * exactly the same pixels as GLFW.
+ */
+
+#define BENCH_CALLS  20
+#define BENCH_ROUNDS 5
+
+static const char* levelNames[] = { "scalar", "SSSE3", "AVX2" };
+
+/** Reads a whole file into memory. */
+static bool readWholeFile(const char* path, std::vector<unsigned char> &data) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open file %s.\n", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data.resize(length > 0 ? length : 0);
+	bool read = length > 0 && fread(data.data(), 1, length, file) == (size_t)length;
+	fclose(file);
+	if (!read) fprintf(stderr, "Could not read file %s.\n", path);
+	return read;
+}
+
+/** Writes decoded RGBA pixels as an uncompressed true-colour TGA file, with
+ * its rows from the top down. */
+static void encodeTGA(const TGAImage &image, const unsigned char* rgba, int depth,
+                      std::vector<unsigned char> &file) {
+	unsigned char header[18] = { 0, 0, 2 };
+	header[12] = image.width & 0xff;
+	header[13] = image.width >> 8;
+	header[14] = image.height & 0xff;
+	header[15] = image.height >> 8;
+	header[16] = depth;
+	header[17] = 0x20 | (depth == 32 ? 8 : 0);  // top to bottom, and the alpha bits
+	file.assign(header, header + sizeof(header));
+
+	int bytesPerPixel = depth / 8;
+	for (GLuint row = image.height; row-- > 0;) {
+		const unsigned char* pixel = rgba + (size_t)row * image.width * 4;
+		for (GLuint x = 0; x < image.width; x++, pixel += 4) {
+			unsigned char bgra[4] = { pixel[2], pixel[1], pixel[0], pixel[3] };
+			file.insert(file.end(), bgra, bgra + bytesPerPixel);
+		}
+	}
+}
+
+/** @return whether `pixels`, decoded by `decodeTGA`, match what GLFW decoded. */
+static bool sameAsGLFW(const TGAImage &image, const unsigned char* pixels, const GLFWimage &reference) {
+	if ((GLuint)reference.Width != image.width || (GLuint)reference.Height != image.height) return false;
+	size_t numPixels = (size_t)image.width * image.height;
+	int inSize = reference.BytesPerPixel, outSize = image.bytesPerPixel;
+	for (size_t p = 0; p < numPixels; p++) {
+		const unsigned char* in = reference.Data + p * inSize;
+		const unsigned char* out = pixels + p * outSize;
+		for (int c = 0; c < outSize; c++) {
+			unsigned char expected = c < inSize ? in[c] : 0xff;
+			if (out[c] != expected) return false;
+		}
+	}
+	return true;
+}
+
+/** @return the best time of BENCH_ROUNDS rounds of BENCH_CALLS decodes, in
+ *          seconds per decode. */
+static double timeDecoder(const TGAImage &image, unsigned char* pixels) {
+	decodeTGA(image, pixels);  // warm up
+	double best = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		double start = glfwGetTime();
+		for (int i = 0; i < BENCH_CALLS; i++) decodeTGA(image, pixels);
+		double elapsed = glfwGetTime() - start;
+		if (round == 0 || elapsed < best) best = elapsed;
+	}
+	return best / BENCH_CALLS;
+}
+
+/** As `timeDecoder`, for GLFW's decoder. */
+static double timeGLFW(const std::vector<unsigned char> &file) {
+	double best = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		double start = glfwGetTime();
+		for (int i = 0; i < BENCH_CALLS; i++) {
+			GLFWimage image;
+			if (glfwReadMemoryImage(file.data(), file.size(), &image, 0) == GL_TRUE) glfwFreeImage(&image);
+		}
+		double elapsed = glfwGetTime() - start;
+		if (round == 0 || elapsed < best) best = elapsed;
+	}
+	return best / BENCH_CALLS;
+}
+
+/** Checks and times one encoding of an image.
+ * @return false if any level decodes it differently from GLFW. */
+static bool benchmark(const char* name, const std::vector<unsigned char> &file, GLuint numLevels) {
+	TGAImage image;
+	if (!openTGAMemory(file.data(), file.size(), name, image)) return false;
+	GLFWimage reference;
+	if (glfwReadMemoryImage(file.data(), file.size(), &reference, 0) != GL_TRUE) {
+		fprintf(stderr, "GLFW could not read %s.\n", name);
+		return false;
+	}
+
+	std::vector<unsigned char> pixels(decodedTGASize(image));
+	for (GLuint level = 0; level < numLevels; level++) {
+		tgaSIMD(level);
+		memset(pixels.data(), 0, pixels.size());
+		if (!decodeTGA(image, pixels.data()) || !sameAsGLFW(image, pixels.data(), reference)) {
+			fprintf(stderr, "The %s decoder gives different pixels from GLFW for %s.\n", levelNames[level], name);
+			glfwFreeImage(&reference);
+			return false;
+		}
+	}
+	glfwFreeImage(&reference);
+
+	double megabytes = pixels.size() / 1e6;
+	double glfwTime = timeGLFW(file);
+	printf("  %-24s GLFW %.3f ms (%.0f MB/s)", name, glfwTime * 1e3, megabytes / glfwTime);
+	for (GLuint level = 0; level < numLevels; level++) {
+		tgaSIMD(level);
+		double time = timeDecoder(image, pixels.data());
+		printf(", %s %.3f ms (%.0f MB/s, %.1fx)", levelNames[level], time * 1e3, megabytes / time, glfwTime / time);
+	}
+	printf("\n");
+	return true;
+}
+
+int main(int argc, char** argv) {
+	static const char* defaultPaths[] = { TEXTURE("spaceship.tga"), TEXTURE("clanger.tga") };
+	const char** paths = argc > 1 ? (const char**)argv + 1 : defaultPaths;
+	int numPaths = argc > 1 ? argc - 1 : sizeof(defaultPaths) / sizeof(defaultPaths[0]);
+	if (!glfwInit()) {
+		fprintf(stderr, "Could not initialise GLFW. Terminating.\n");
+		return EXIT_FAILURE;
+	}
+	startWorkers();
+
+	GLuint numLevels = tgaSIMD(TGA_SIMD_BEST) + 1;
+	printf("Benchmarking TGA decoding, best of %d rounds of %d decodes:\n", BENCH_ROUNDS, BENCH_CALLS);
+	for (int i = 0; i < numPaths; i++) {
+		std::vector<unsigned char> file;
+		if (!readWholeFile(paths[i], file)) return EXIT_FAILURE;
+		TGAImage image;
+		if (!openTGAMemory(file.data(), file.size(), paths[i], image)) return EXIT_FAILURE;
+		printf("%s (%ux%u, %d-bit%s):\n", paths[i], image.width, image.height,
+		       image.fileBytesPerPixel * 8, image.rle ? ", run-length encoded" : "");
+		if (!benchmark("as stored", file, numLevels)) return EXIT_FAILURE;
+		if (image.format != GL_RGBA) continue;
+
+		std::vector<unsigned char> rgba(decodedTGASize(image)), encoded;
+		decodeTGA(image, rgba.data());
+		encodeTGA(image, rgba.data(), 32, encoded);
+		if (!benchmark("uncompressed, 32-bit", encoded, numLevels)) return EXIT_FAILURE;
+		encodeTGA(image, rgba.data(), 24, encoded);
+		if (!benchmark("uncompressed, 24-bit", encoded, numLevels)) return EXIT_FAILURE;
+	}
+
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}
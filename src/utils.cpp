@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 
 #include <GL/glew.h>
 #include <GL/glfw.h>
 
+#include "pack.h"
 #include "utils.h"
 
 void checkForError(const char* where) {
@@ -25,6 +27,16 @@ void checkForError(const char* where) {
 
 char* fileToBuffer(const char* path) {
     printf("Loading %s...", path);
+    PackView packed;
+    if (readFromPack(path, packed)) {
+        char* buffer = (char*)malloc(packed.size + 1);
+        memcpy(buffer, packed.data, packed.size);
+        releasePackView(packed);
+        buffer[packed.size] = 0;
+        printf(" done (from the asset pack).\n");
+        return buffer;
+    }
+
     FILE *file = fopen(path, "rb");
     if (!file) {
         fprintf(stderr, "Could not open file %s.\n", path);
@@ -44,24 +56,3 @@ char* fileToBuffer(const char* path) {
     printf(" done.\n");
     return buffer;
 }
-
-/** Loads and binds the texture stored in the TGA file at the given path.
- * @return the ID of the loaded texture (prefix `tex`). */
-GLuint loadTGA(const char *imagePath) {
-	// Method from http://opengl-tutorial.org/beginners-tutorials/tutorial-5-a-textured-cube/#How_to_load_texture_with_GLFW
-	GLuint tex;
-	glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    glfwLoadTexture2D(imagePath, 0);
-
-    // Nice trilinear filtering
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    return tex;
-}
-
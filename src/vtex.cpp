@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "workers.h"
+#include "pack.h"
+#include "vtex.h"
+
+static_assert(sizeof(VirtualTextureHeader) == 32, "VirtualTextureHeader must not contain padding");
+
+/** How many times smaller across than the viewport the feedback buffer is. */
+#define VIRTUAL_FEEDBACK_SCALE 8
+
+/** The most pages read on the worker threads at once. */
+#define VIRTUAL_MAX_LOADS 16
+
+/** In a cache slot holding no page. */
+#define NO_PAGE 0xffffffffu
+
+/** A page, as its level and position packed into 32 bits, which sort by
+ * level. */
+static uint32_t pageKey(GLuint level, GLuint x, GLuint y) {
+	return level << 24 | y << 12 | x;
+}
+
+static GLuint pageLevel(uint32_t page) { return page >> 24; }
+static GLuint pageX(uint32_t page)     { return page & 0xfff; }
+static GLuint pageY(uint32_t page)     { return (page >> 12) & 0xfff; }
+
+struct CacheSlot {
+	uint32_t page;           ///< the page in the slot, or NO_PAGE
+	unsigned lastUsedFrame;  ///< the last frame whose feedback asked for it
+};
+
+struct VirtualTexture;
+
+/** A page being read on a worker thread. */
+struct PageLoad {
+	PageLoad* next;
+	VirtualTexture* texture;
+	uint32_t page;
+	const unsigned char* source;
+	std::vector<unsigned char> data;
+};
+
+/** The part of a level of the page table changed since it was last
+ * uploaded. */
+struct DirtyRect {
+	bool dirty;
+	GLuint x0, y0, x1, y1;
+};
+
+struct VirtualTexture {
+	std::string path;
+	const unsigned char* file;
+	size_t fileLength;
+	void* mapping;     ///< if the file was memory-mapped
+	void* packBuffer;  ///< the decompressed copy, if the file came compressed from the asset pack
+	VirtualTextureHeader header;
+	size_t firstPageOfLevel[VIRTUAL_TEXTURE_MAX_LEVELS];  ///< in the page offsets
+
+	GLuint pageTable;
+	std::vector<unsigned char> pageTableLevels[VIRTUAL_TEXTURE_MAX_LEVELS];  ///< a copy of each level, 4 bytes a texel
+	DirtyRect dirty[VIRTUAL_TEXTURE_MAX_LEVELS];
+
+	GLuint cache;
+	GLuint cachePages;  ///< across the cache
+	std::vector<CacheSlot> slots;                  ///< the first holds the coarsest page, for good
+	std::unordered_map<uint32_t, GLuint> slotOf;   ///< of each page in the cache
+	std::unordered_set<uint32_t> loading;
+	std::atomic<PageLoad*> loadedPages;            ///< read, and waiting to be uploaded
+
+	GLuint feedbackFramebuffer;
+	GLuint feedbackRenderbuffers[2];  ///< colour and depth
+	GLsizei feedbackWidth, feedbackHeight;
+	GLuint feedbackBuffers[2];        ///< for reading back alternate frames
+	GLsync feedbackFences[2];
+	GLint framebuffer;                ///< restored after the feedback pass, with the viewport and clear colour
+	GLint viewport[4];
+	GLfloat clearColor[4];
+	std::vector<uint32_t> requests;
+
+	unsigned frame;
+	unsigned requestFrame;  ///< the last frame whose feedback was read
+};
+
+static GLuint pagesAcross(const VirtualTexture* texture, GLuint level) {
+	return 1u << (texture->header.numLevels - 1 - level);
+}
+
+/** @return where a page is in the file, or 0 if it is beyond the image. */
+static uint64_t pageOffset(const VirtualTexture* texture, uint32_t page) {
+	GLuint level = pageLevel(page);
+	size_t index = texture->firstPageOfLevel[level] + (size_t)pageY(page) * pagesAcross(texture, level) + pageX(page);
+	uint64_t offset;
+	memcpy(&offset, texture->file + sizeof(VirtualTextureHeader) + index * sizeof(uint64_t), sizeof(offset));
+	return offset;
+}
+
+/** Opens the page file, from the asset pack if it is there. */
+static bool mapPageFile(VirtualTexture* texture) {
+	const char* path = texture->path.c_str();
+	PackView packed;
+	if (readFromPack(path, packed)) {
+		texture->file = (const unsigned char*)packed.data;
+		texture->fileLength = packed.size;
+		texture->packBuffer = packed.buffer;
+		return true;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open file %s.\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		fprintf(stderr, "Could not read file %s.\n", path);
+		return false;
+	}
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Could not read file %s.\n", path);
+		return false;
+	}
+	texture->file = (const unsigned char*)mapping;
+	texture->fileLength = st.st_size;
+	texture->mapping = mapping;
+	return true;
+}
+
+/** Checks the header and page offsets of the page file.
+ * @return false if it can't be used. */
+static bool readPageFile(VirtualTexture* texture) {
+	const char* path = texture->path.c_str();
+	VirtualTextureHeader &header = texture->header;
+	if (texture->fileLength < sizeof(header)) {
+		fprintf(stderr, "%s is too short to be a virtual texture.\n", path);
+		return false;
+	}
+	memcpy(&header, texture->file, sizeof(header));
+	size_t compressedPageBytes = (VIRTUAL_PAGE_SIZE / 4) * (VIRTUAL_PAGE_SIZE / 4) * 8;
+	bool compressed = header.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (memcmp(header.magic, VIRTUAL_TEXTURE_MAGIC, 4) != 0 || header.version != VIRTUAL_TEXTURE_VERSION
+	    || header.numLevels == 0 || header.numLevels > VIRTUAL_TEXTURE_MAX_LEVELS
+	    || !(compressed || header.internalFormat == GL_RGBA8)
+	    || header.pageBytes != (compressed ? compressedPageBytes : 4 * VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE)) {
+		fprintf(stderr, "%s isn't a virtual texture of a kind which can be read.\n", path);
+		return false;
+	}
+	if (compressed && !GLEW_EXT_texture_compression_s3tc) {
+		fprintf(stderr, "The pages of %s are compressed in a format the GPU doesn't support.\n", path);
+		return false;
+	}
+
+	size_t numPages = 0;
+	for (GLuint level = 0; level < header.numLevels; level++) {
+		texture->firstPageOfLevel[level] = numPages;
+		numPages += (size_t)pagesAcross(texture, level) * pagesAcross(texture, level);
+	}
+	if (texture->fileLength < sizeof(header) + numPages * sizeof(uint64_t)) {
+		fprintf(stderr, "%s is truncated.\n", path);
+		return false;
+	}
+	for (size_t i = 0; i < numPages; i++) {
+		uint64_t offset;
+		memcpy(&offset, texture->file + sizeof(header) + i * sizeof(uint64_t), sizeof(offset));
+		if (offset != 0 && (offset > texture->fileLength || texture->fileLength - offset < header.pageBytes)) {
+			fprintf(stderr, "%s is truncated.\n", path);
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Records that part of a level of the page table has changed. */
+static void markDirty(VirtualTexture* texture, GLuint level, GLuint x, GLuint y, GLuint span) {
+	DirtyRect &rect = texture->dirty[level];
+	if (!rect.dirty) {
+		rect.dirty = true;
+		rect.x0 = x;
+		rect.y0 = y;
+		rect.x1 = x + span;
+		rect.y1 = y + span;
+	} else {
+		rect.x0 = std::min(rect.x0, x);
+		rect.y0 = std::min(rect.y0, y);
+		rect.x1 = std::max(rect.x1, x + span);
+		rect.y1 = std::max(rect.y1, y + span);
+	}
+}
+
+/** Updates the page table for a page which has come into or left the cache:
+ * its own entry, and those of the finer pages under it, which fall back to
+ * the nearest coarser page in the cache. */
+static void updatePageTable(VirtualTexture* texture, uint32_t page) {
+	GLuint level = pageLevel(page), x = pageX(page), y = pageY(page);
+	for (GLint l = level; l >= 0; l--) {
+		GLuint shift = level - l, span = 1u << shift, across = pagesAcross(texture, l);
+		GLuint x0 = x << shift, y0 = y << shift;
+		unsigned char* entries = texture->pageTableLevels[l].data();
+		const unsigned char* parents = (GLuint)l + 1 < texture->header.numLevels ? texture->pageTableLevels[l + 1].data() : NULL;
+		for (GLuint ey = y0; ey < y0 + span; ey++) {
+			for (GLuint ex = x0; ex < x0 + span; ex++) {
+				unsigned char* entry = entries + 4 * ((size_t)ey * across + ex);
+				std::unordered_map<uint32_t, GLuint>::const_iterator it = texture->slotOf.find(pageKey(l, ex, ey));
+				if (it != texture->slotOf.end()) {
+					entry[0] = it->second % texture->cachePages;
+					entry[1] = it->second / texture->cachePages;
+					entry[2] = l;
+					entry[3] = 255;
+				} else if (parents) {
+					memcpy(entry, parents + 4 * ((size_t)(ey / 2) * (across / 2) + ex / 2), 4);
+				} else {
+					memset(entry, 0, 4);
+				}
+			}
+		}
+		markDirty(texture, l, x0, y0, span);
+	}
+}
+
+/** Uploads the parts of the page table which have changed. */
+static void flushPageTable(VirtualTexture* texture) {
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, texture->pageTable);
+	for (GLuint level = 0; level < texture->header.numLevels; level++) {
+		DirtyRect &rect = texture->dirty[level];
+		if (!rect.dirty) continue;
+		GLuint across = pagesAcross(texture, level);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, across);
+		glTexSubImage2D(GL_TEXTURE_2D, level, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RGBA,
+		                GL_UNSIGNED_BYTE, texture->pageTableLevels[level].data() + 4 * ((size_t)rect.y0 * across + rect.x0));
+		rect.dirty = false;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/** Uploads a page into a slot of the cache. */
+static void uploadPage(VirtualTexture* texture, GLuint slot, const unsigned char* data) {
+	GLint x = (slot % texture->cachePages) * VIRTUAL_PAGE_SIZE, y = (slot / texture->cachePages) * VIRTUAL_PAGE_SIZE;
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_CACHE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, texture->cache);
+	if (texture->header.internalFormat == GL_RGBA8) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	} else {
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE,
+		                          texture->header.internalFormat, texture->header.pageBytes, data);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/** Puts a page which has been read into the cache, in place of the page used
+ * least recently, as long as that one wasn't asked for in the last feedback.
+ * @return false if every slot is in use, in which case the page is dropped,
+ *         to be asked for again. */
+static bool placePage(VirtualTexture* texture, uint32_t page, const unsigned char* data) {
+	GLuint slot = 0;
+	for (GLuint i = 1; i < texture->slots.size(); i++) {
+		const CacheSlot &candidate = texture->slots[i];
+		if (candidate.page == NO_PAGE) {
+			slot = i;
+			break;
+		}
+		if (candidate.lastUsedFrame < texture->requestFrame
+		    && (slot == 0 || candidate.lastUsedFrame < texture->slots[slot].lastUsedFrame)) {
+			slot = i;
+		}
+	}
+	if (slot == 0) return false;
+
+	CacheSlot &chosen = texture->slots[slot];
+	uint32_t evicted = chosen.page;
+	if (evicted != NO_PAGE) texture->slotOf.erase(evicted);
+	chosen.page = page;
+	chosen.lastUsedFrame = texture->requestFrame;
+	texture->slotOf[page] = slot;
+
+	uploadPage(texture, slot, data);
+	if (evicted != NO_PAGE) updatePageTable(texture, evicted);
+	updatePageTable(texture, page);
+	return true;
+}
+
+/** Copies a page out of the file on a worker thread, so that the GL thread
+ * never waits for the disk. */
+static void loadPageJob(void* data) {
+	PageLoad* load = (PageLoad*)data;
+	load->data.assign(load->source, load->source + load->texture->header.pageBytes);
+
+	std::atomic<PageLoad*> &loaded = load->texture->loadedPages;
+	load->next = loaded.load(std::memory_order_relaxed);
+	while (!loaded.compare_exchange_weak(load->next, load, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static void startLoading(VirtualTexture* texture, uint32_t page) {
+	PageLoad* load = new PageLoad;
+	load->texture = texture;
+	load->page = page;
+	load->source = texture->file + pageOffset(texture, page);
+	texture->loading.insert(page);
+	submitJob(loadPageJob, load);
+}
+
+/** Works out which pages the feedback buffer asked for, marks those in the
+ * cache as used, and starts loading the rest, coarsest first, as far as there
+ * is room for them. */
+static void requestPages(VirtualTexture* texture, const unsigned char* pixels, size_t numPixels) {
+	std::vector<uint32_t> &requests = texture->requests;
+	requests.clear();
+	for (size_t i = 0; i < numPixels; i++) {
+		const unsigned char* pixel = pixels + 4 * i;
+		if (pixel[3] == 0 || pixel[3] > texture->header.numLevels) continue;
+		GLuint level = pixel[3] - 1, x = pixel[0] | (pixel[2] & 0xf) << 8, y = pixel[1] | (pixel[2] >> 4) << 8;
+		if (x < pagesAcross(texture, level) && y < pagesAcross(texture, level)) requests.push_back(pageKey(level, x, y));
+	}
+	std::sort(requests.begin(), requests.end());
+	requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+	// The coarser pages over them stand in until they arrive
+	size_t numAsked = requests.size();
+	for (size_t i = 0; i < numAsked; i++) {
+		uint32_t page = requests[i];
+		for (GLuint level = pageLevel(page) + 1; level < texture->header.numLevels; level++) {
+			GLuint shift = level - pageLevel(page);
+			requests.push_back(pageKey(level, pageX(page) >> shift, pageY(page) >> shift));
+		}
+	}
+	std::sort(requests.begin(), requests.end(), std::greater<uint32_t>());
+	requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+	texture->requestFrame = texture->frame;
+	size_t numFree = 0;
+	for (size_t i = 0; i < requests.size(); i++) {
+		std::unordered_map<uint32_t, GLuint>::const_iterator it = texture->slotOf.find(requests[i]);
+		if (it != texture->slotOf.end()) texture->slots[it->second].lastUsedFrame = texture->frame;
+	}
+	for (size_t i = 1; i < texture->slots.size(); i++) {
+		numFree += texture->slots[i].lastUsedFrame < texture->frame || texture->slots[i].page == NO_PAGE;
+	}
+
+	// Loading pages which won't fit would only read them again next frame
+	for (size_t i = 0; i < requests.size() && texture->loading.size() < std::min(numFree, (size_t)VIRTUAL_MAX_LOADS); i++) {
+		uint32_t page = requests[i];
+		if (texture->slotOf.count(page) || texture->loading.count(page) || pageOffset(texture, page) == 0) continue;
+		startLoading(texture, page);
+	}
+}
+
+/** Opens a virtual texture, and creates its page table and its cache, into
+ * which the coarsest page is read straight away. Must be called on the GL
+ * thread.
+ * @param cachePages The number of pages across the cache texture, which holds
+ *                   the square of that many.
+ * @return the texture, which must later be passed to `closeVirtualTexture`,
+ *         or NULL if it couldn't be read. */
+VirtualTexture* openVirtualTexture(const char* path, GLuint cachePages) {
+	VirtualTexture* texture = new VirtualTexture();
+	texture->path = path;
+	texture->loadedPages = NULL;
+	if (!mapPageFile(texture) || !readPageFile(texture)) {
+		closeVirtualTexture(texture);
+		return NULL;
+	}
+	const VirtualTextureHeader &header = texture->header;
+	uint32_t coarsest = pageKey(header.numLevels - 1, 0, 0);
+	if (pageOffset(texture, coarsest) == 0) {
+		fprintf(stderr, "%s has no coarsest page.\n", path);
+		closeVirtualTexture(texture);
+		return NULL;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_TABLE_UNIT);
+	glGenTextures(1, &texture->pageTable);
+	glBindTexture(GL_TEXTURE_2D, texture->pageTable);
+	for (GLuint level = 0; level < header.numLevels; level++) {
+		GLuint across = pagesAcross(texture, level);
+		texture->pageTableLevels[level].assign(4 * (size_t)across * across, 0);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, across, across, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.numLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	GLsizei cacheSize = cachePages * VIRTUAL_PAGE_SIZE;
+	texture->cachePages = cachePages;
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_CACHE_UNIT);
+	glGenTextures(1, &texture->cache);
+	glBindTexture(GL_TEXTURE_2D, texture->cache);
+	if (header.internalFormat == GL_RGBA8) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize, cacheSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	} else {
+		glCompressedTexImage2D(GL_TEXTURE_2D, 0, header.internalFormat, cacheSize, cacheSize, 0,
+		                       (size_t)header.pageBytes * cachePages * cachePages, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	CacheSlot empty = { NO_PAGE, 0 };
+	texture->slots.assign((size_t)cachePages * cachePages, empty);
+	texture->slots[0].page = coarsest;
+	texture->slotOf[coarsest] = 0;
+	uploadPage(texture, 0, texture->file + pageOffset(texture, coarsest));
+	updatePageTable(texture, coarsest);
+	flushPageTable(texture);
+	return texture;
+}
+
+/** Deletes a virtual texture, once the pages being read for it have
+ * arrived. */
+void closeVirtualTexture(VirtualTexture* texture) {
+	while (!texture->loading.empty()) {
+		PageLoad* load = texture->loadedPages.exchange(NULL, std::memory_order_acquire);
+		while (load) {
+			PageLoad* next = load->next;
+			texture->loading.erase(load->page);
+			delete load;
+			load = next;
+		}
+		if (!texture->loading.empty()) usleep(1000);
+	}
+
+	glDeleteTextures(1, &texture->pageTable);
+	glDeleteTextures(1, &texture->cache);
+	glDeleteFramebuffers(1, &texture->feedbackFramebuffer);
+	glDeleteRenderbuffers(2, texture->feedbackRenderbuffers);
+	glDeleteBuffers(2, texture->feedbackBuffers);
+	for (int i = 0; i < 2; i++) {
+		if (texture->feedbackFences[i]) glDeleteSync(texture->feedbackFences[i]);
+	}
+	if (texture->mapping) munmap(texture->mapping, texture->fileLength);
+	free(texture->packBuffer);
+	delete texture;
+}
+
+/** Binds the page table and cache of a virtual texture to their texture units,
+ * and sets the uniforms the shader samples it with.
+ * @param texture The texture, or NULL to sample the ordinary texture. */
+void bindVirtualTexture(const VirtualTexture* texture, GLuint program) {
+	glProgramUniform1i(program, glGetUniformLocation(program, "virtualTextured"), texture != NULL);
+	if (!texture) return;
+
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, texture->pageTable);
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_PAGE_CACHE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, texture->cache);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLfloat size = (GLfloat)VIRTUAL_PAGE_PAYLOAD * pagesAcross(texture, 0);
+	glProgramUniform4f(program, glGetUniformLocation(program, "virtualTexture"),
+	                   texture->header.width / size, texture->header.height / size, size, texture->header.numLevels - 1);
+	glProgramUniform3f(program, glGetUniformLocation(program, "pageCacheLayout"), texture->cachePages,
+	                   (GLfloat)VIRTUAL_PAGE_BORDER / VIRTUAL_PAGE_SIZE, (GLfloat)VIRTUAL_PAGE_PAYLOAD / VIRTUAL_PAGE_SIZE);
+}
+
+static void createFeedbackBuffer(VirtualTexture* texture, GLsizei width, GLsizei height) {
+	if (texture->feedbackFramebuffer) {
+		glDeleteFramebuffers(1, &texture->feedbackFramebuffer);
+		glDeleteRenderbuffers(2, texture->feedbackRenderbuffers);
+		glDeleteBuffers(2, texture->feedbackBuffers);
+		for (int i = 0; i < 2; i++) {
+			if (texture->feedbackFences[i]) glDeleteSync(texture->feedbackFences[i]);
+			texture->feedbackFences[i] = 0;
+		}
+	}
+	texture->feedbackWidth = width;
+	texture->feedbackHeight = height;
+
+	glGenRenderbuffers(2, texture->feedbackRenderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, texture->feedbackRenderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, texture->feedbackRenderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &texture->feedbackFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, texture->feedbackFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, texture->feedbackRenderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, texture->feedbackRenderbuffers[1]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Could not create the feedback buffer for %s.\n", texture->path.c_str());
+	}
+
+	glGenBuffers(2, texture->feedbackBuffers);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->feedbackBuffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, 4 * (size_t)width * height, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+/** Starts drawing into the feedback buffer of a virtual texture, with the
+ * shader writing the page each pixel needs rather than its colour. Draw the
+ * objects using the texture, and then call `endVirtualTextureFeedback`. */
+void beginVirtualTextureFeedback(VirtualTexture* texture, GLuint program) {
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &texture->framebuffer);
+	glGetIntegerv(GL_VIEWPORT, texture->viewport);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, texture->clearColor);
+	GLsizei width = std::max(1, texture->viewport[2] / VIRTUAL_FEEDBACK_SCALE);
+	GLsizei height = std::max(1, texture->viewport[3] / VIRTUAL_FEEDBACK_SCALE);
+	if (width != texture->feedbackWidth || height != texture->feedbackHeight) createFeedbackBuffer(texture, width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, texture->feedbackFramebuffer);
+	glViewport(0, 0, width, height);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// The texture is seen from further away in the smaller buffer, so the mip
+	// levels are brought back to what they are on screen
+	bindVirtualTexture(texture, program);
+	glProgramUniform1i(program, glGetUniformLocation(program, "virtualFeedback"), 1);
+	glProgramUniform1f(program, glGetUniformLocation(program, "virtualBias"), -log2f((GLfloat)texture->viewport[2] / width));
+}
+
+/** Finishes drawing into the feedback buffer, and starts reading it back,
+ * which `updateVirtualTexture` picks up a frame later. */
+void endVirtualTextureFeedback(VirtualTexture* texture, GLuint program) {
+	glProgramUniform1i(program, glGetUniformLocation(program, "virtualFeedback"), 0);
+	glProgramUniform1f(program, glGetUniformLocation(program, "virtualBias"), 0);
+
+	int buffer = texture->frame % 2;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->feedbackBuffers[buffer]);
+	glReadPixels(0, 0, texture->feedbackWidth, texture->feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (texture->feedbackFences[buffer]) glDeleteSync(texture->feedbackFences[buffer]);
+	texture->feedbackFences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, texture->framebuffer);
+	glViewport(texture->viewport[0], texture->viewport[1], texture->viewport[2], texture->viewport[3]);
+	glClearColor(texture->clearColor[0], texture->clearColor[1], texture->clearColor[2], texture->clearColor[3]);
+}
+
+/** Uploads the pages which have been read into the cache, reads the feedback
+ * of the frame before if the GPU has finished with it, and starts loading the
+ * pages it asks for. None of this waits for the GPU or the disk. Call once per
+ * frame on the GL thread, after `endVirtualTextureFeedback`. */
+void updateVirtualTexture(VirtualTexture* texture) {
+	PageLoad* load = texture->loadedPages.exchange(NULL, std::memory_order_acquire);
+	while (load) {
+		PageLoad* next = load->next;
+		placePage(texture, load->page, load->data.data());
+		texture->loading.erase(load->page);
+		delete load;
+		load = next;
+	}
+
+	int buffer = (texture->frame + 1) % 2;
+	GLsync fence = texture->feedbackFences[buffer];
+	if (fence && glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+		glDeleteSync(fence);
+		texture->feedbackFences[buffer] = 0;
+		size_t numPixels = (size_t)texture->feedbackWidth * texture->feedbackHeight;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, texture->feedbackBuffers[buffer]);
+		const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * numPixels, GL_MAP_READ_BIT);
+		if (pixels) {
+			requestPages(texture, pixels, numPixels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	flushPageTable(texture);
+	texture->frame++;
+}
+
+/** Prints how full the cache of a virtual texture is. */
+void printVirtualTextureUsage(const VirtualTexture* texture) {
+	size_t numSlots = texture->slots.size();
+	printf("Virtual texture %s: %lu of %lu cache pages in use (%.1f MB), %lu loading.\n", texture->path.c_str(),
+	       (unsigned long)texture->slotOf.size(), (unsigned long)numSlots,
+	       numSlots * texture->header.pageBytes / 1048576.0, (unsigned long)texture->loading.size());
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <GL/glfw.h>
+
+#include "workers.h"
+#include "tga.h"
+#include "texcache.h"
+#include "vtex.h"
+
+/** @file vtextool.cpp
+ * Builds a virtual texture's page file (see vtex.h) from a TGA image:
+ *
+ *     vtex [-u] <image.tga> <output.vt>
+ *
+ * The pages are compressed with BC1, as opaque textures are cooked (see
+ * texcache.h), or left uncompressed with `-u`. Each mip level is made by
+ * downsampling the one before, so the whole image, as RGBA, must fit in
+ * memory.
+ */
+
+/** The most pages across, which the feedback buffer can still name. */
+#define MAX_PAGES_ACROSS (1u << (VIRTUAL_TEXTURE_MAX_LEVELS - 1))
+
+static GLuint levelDimension(GLuint size, GLuint level) {
+	return (size >> level) ? (size >> level) : 1;
+}
+
+/** Copies a page, with its border, out of a level of the image, repeating
+ * the edge texels of the image beyond it. */
+static void extractPage(const unsigned char* rgba, GLuint width, GLuint height, GLuint pageX, GLuint pageY,
+                        unsigned char* out) {
+	for (int y = 0; y < VIRTUAL_PAGE_SIZE; y++) {
+		int sourceY = (int)(pageY * VIRTUAL_PAGE_PAYLOAD) - VIRTUAL_PAGE_BORDER + y;
+		sourceY = std::min(std::max(sourceY, 0), (int)height - 1);
+		for (int x = 0; x < VIRTUAL_PAGE_SIZE; x++) {
+			int sourceX = (int)(pageX * VIRTUAL_PAGE_PAYLOAD) - VIRTUAL_PAGE_BORDER + x;
+			sourceX = std::min(std::max(sourceX, 0), (int)width - 1);
+			memcpy(out + 4 * (y * VIRTUAL_PAGE_SIZE + x), rgba + 4 * ((size_t)sourceY * width + sourceX), 4);
+		}
+	}
+}
+
+/** @return how many pages of a level of the image there are along one side,
+ *          starting from the origin. */
+static GLuint pagesUsed(GLuint size) {
+	return (size + VIRTUAL_PAGE_PAYLOAD - 1) / VIRTUAL_PAGE_PAYLOAD;
+}
+
+int main(int argc, char** argv) {
+	bool uncompressed = argc > 1 && strcmp(argv[1], "-u") == 0;
+	if (argc != 3 + uncompressed) {
+		fprintf(stderr, "Usage: %s [-u] <image.tga> <output.vt>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char* imagePath = argv[1 + uncompressed];
+	const char* outputPath = argv[2 + uncompressed];
+	if (!glfwInit()) {
+		fprintf(stderr, "Could not initialise GLFW. Terminating.\n");
+		return EXIT_FAILURE;
+	}
+	startWorkers();
+
+	TGAImage image;
+	if (!openTGA(imagePath, image)) return EXIT_FAILURE;
+	size_t numPixels = (size_t)image.width * image.height;
+	std::vector<unsigned char> pixels(decodedTGASize(image));
+	if (!decodeTGA(image, pixels.data())) return EXIT_FAILURE;
+	closeTGA(image);
+
+	// Expand a greyscale image to RGBA, as the pages are
+	std::vector<unsigned char> rgba;
+	if (image.bytesPerPixel == 4) {
+		rgba.swap(pixels);
+	} else {
+		rgba.assign(4 * numPixels, 255);
+		for (size_t i = 0; i < numPixels; i++) rgba[4 * i] = rgba[4 * i + 1] = rgba[4 * i + 2] = pixels[i];
+		std::vector<unsigned char>().swap(pixels);
+	}
+
+	GLuint pagesAcross = 1, numLevels = 1;
+	while (pagesAcross * VIRTUAL_PAGE_PAYLOAD < std::max(image.width, image.height)) {
+		pagesAcross *= 2;
+		numLevels++;
+	}
+	if (pagesAcross > MAX_PAGES_ACROSS) {
+		fprintf(stderr, "%s is too large for a virtual texture.\n", imagePath);
+		return EXIT_FAILURE;
+	}
+
+	VirtualTextureHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, VIRTUAL_TEXTURE_MAGIC, 4);
+	header.version        = VIRTUAL_TEXTURE_VERSION;
+	header.width          = image.width;
+	header.height         = image.height;
+	header.numLevels      = numLevels;
+	header.internalFormat = uncompressed ? GL_RGBA8 : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	header.pageBytes      = uncompressed ? 4 * VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE
+	                                     : compressedLevelSize(header.internalFormat, VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE);
+
+	// The pages follow the offsets in the same order, so where each one goes
+	// is known before any are made
+	std::vector<uint64_t> pageOffsets;
+	for (GLuint level = 0; level < numLevels; level++) {
+		GLuint across = pagesAcross >> level;
+		pageOffsets.resize(pageOffsets.size() + (size_t)across * across, 0);
+	}
+	uint64_t offset = sizeof(header) + pageOffsets.size() * sizeof(uint64_t);
+	size_t numPages = 0, index = 0;
+	for (GLuint level = 0; level < numLevels; level++) {
+		GLuint across = pagesAcross >> level;
+		GLuint usedX = pagesUsed(levelDimension(image.width, level));
+		GLuint usedY = pagesUsed(levelDimension(image.height, level));
+		for (GLuint y = 0; y < across; y++) {
+			for (GLuint x = 0; x < across; x++, index++) {
+				if (x >= usedX || y >= usedY) continue;
+				pageOffsets[index] = offset;
+				offset += header.pageBytes;
+				numPages++;
+			}
+		}
+	}
+
+	FILE* file = fopen(outputPath, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open file %s.\n", outputPath);
+		return EXIT_FAILURE;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1
+	            && fwrite(pageOffsets.data(), sizeof(uint64_t), pageOffsets.size(), file) == pageOffsets.size();
+
+	// A row of pages is stacked into one column, so that each compresses into
+	// a contiguous run of blocks
+	std::vector<unsigned char> column, compressed, smaller;
+	GLuint width = image.width, height = image.height;
+	for (GLuint level = 0; level < numLevels && written; level++) {
+		GLuint usedX = pagesUsed(width), usedY = pagesUsed(height);
+		column.resize(4 * (size_t)VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE * usedX);
+		compressed.resize((size_t)header.pageBytes * usedX);
+		for (GLuint y = 0; y < usedY && written; y++) {
+			for (GLuint x = 0; x < usedX; x++) {
+				extractPage(rgba.data(), width, height, x, y, column.data() + 4 * (size_t)VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE * x);
+			}
+			const unsigned char* pages = column.data();
+			if (!uncompressed) {
+				compressImage(column.data(), VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE * usedX, header.internalFormat,
+				              compressed.data());
+				pages = compressed.data();
+			}
+			written = fwrite(pages, header.pageBytes, usedX, file) == usedX;
+		}
+
+		if (level + 1 < numLevels) {
+			smaller.resize(4 * (size_t)levelDimension(width, 1) * levelDimension(height, 1));
+			downsampleImage(rgba.data(), width, height, smaller.data());
+			rgba.swap(smaller);
+			width = levelDimension(width, 1);
+			height = levelDimension(height, 1);
+		}
+	}
+	if (fclose(file) != 0 || !written) {
+		fprintf(stderr, "Could not write file %s.\n", outputPath);
+		remove(outputPath);
+		return EXIT_FAILURE;
+	}
+
+	printf("Built %s: %ux%u in %u levels of %lu pages, %.2f MB.\n", outputPath, image.width, image.height,
+	       numLevels, (unsigned long)numPages, offset / 1048576.0);
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <deque>
+#include <vector>
+
+#include <GL/glfw.h>
+
+#include "workers.h"
+
+struct Job {
+	WorkerJob function;
+	void* data;
+};
+
+static GLFWmutex queueMutex;
+static GLFWcond queueCond;
+static std::deque<Job> queue;
+static std::vector<GLFWthread> threads;
+
+static void workerMain(void*) {
+	for (;;) {
+		glfwLockMutex(queueMutex);
+		while (queue.empty()) {
+			glfwWaitCond(queueCond, queueMutex, GLFW_INFINITY);
+		}
+		Job job = queue.front();
+		queue.pop_front();
+		glfwUnlockMutex(queueMutex);
+
+		job.function(job.data);
+	}
+}
+
+/** Starts one worker thread per processor, less one for the main thread. Must
+ * be called from the main thread, after glfwInit. */
+void startWorkers(void) {
+	if (!threads.empty()) return;
+
+	queueMutex = glfwCreateMutex();
+	queueCond  = glfwCreateCond();
+
+	int count = glfwGetNumberOfProcessors() - 1;
+	if (count < 1) count = 1;
+	for (int i = 0; i < count; i++) {
+		GLFWthread thread = glfwCreateThread(workerMain, NULL);
+		if (thread < 0) {
+			fprintf(stderr, "Could not start worker thread %d.\n", i);
+			break;
+		}
+		threads.push_back(thread);
+	}
+}
+
+/** @return the number of threads that work is shared between by `runParallel`
+ * (the workers plus the calling thread). */
+int numWorkers(void) {
+	return threads.size() + 1;
+}
+
+/** Queues a job to be run on one of the worker threads. If the workers haven't
+ * been started, the job is run immediately on the calling thread. */
+void submitJob(WorkerJob job, void* data) {
+	if (threads.empty()) {
+		job(data);
+		return;
+	}
+
+	Job j = { job, data };
+	glfwLockMutex(queueMutex);
+	queue.push_back(j);
+	glfwUnlockMutex(queueMutex);
+	glfwSignalCond(queueCond);
+}
+
+/** The state of one call to `runParallel`, shared with the worker jobs helping
+ * it. It is freed by whoever releases it last, since helpers may only get to
+ * run after all of the tasks are complete. */
+struct ParallelRun {
+	ParallelTask task;
+	void* data;
+	int count;
+	int next;
+	int completed;
+	int references;
+
+	GLFWmutex mutex;
+	GLFWcond done;
+};
+
+static void runTasks(ParallelRun* run) {
+	for (;;) {
+		glfwLockMutex(run->mutex);
+		int index = run->next++;
+		glfwUnlockMutex(run->mutex);
+		if (index >= run->count) break;
+
+		run->task(run->data, index);
+
+		glfwLockMutex(run->mutex);
+		bool finished = ++run->completed == run->count;
+		glfwUnlockMutex(run->mutex);
+		if (finished) glfwSignalCond(run->done);
+	}
+}
+
+static void releaseRun(ParallelRun* run) {
+	glfwLockMutex(run->mutex);
+	bool last = --run->references == 0;
+	glfwUnlockMutex(run->mutex);
+
+	if (last) {
+		glfwDestroyCond(run->done);
+		glfwDestroyMutex(run->mutex);
+		delete run;
+	}
+}
+
+static void helpWithRun(void* data) {
+	ParallelRun* run = (ParallelRun*)data;
+	runTasks(run);
+	releaseRun(run);
+}
+
+/** Calls `task(data, i)` for each i in [0, count), sharing the calls between
+ * the worker threads and the calling thread, and returns once they have all
+ * finished. The calling thread also takes tasks, so it is safe to call this
+ * from within a job. */
+void runParallel(ParallelTask task, void* data, int count) {
+	int numHelpers = count - 1 < (int)threads.size() ? count - 1 : threads.size();
+	if (numHelpers <= 0) {
+		for (int i = 0; i < count; i++) task(data, i);
+		return;
+	}
+
+	ParallelRun* run = new ParallelRun;
+	run->task = task;
+	run->data = data;
+	run->count = count;
+	run->next = 0;
+	run->completed = 0;
+	run->references = numHelpers + 1;
+	run->mutex = glfwCreateMutex();
+	run->done  = glfwCreateCond();
+
+	for (int i = 0; i < numHelpers; i++) {
+		submitJob(helpWithRun, run);
+	}
+	runTasks(run);
+
+	glfwLockMutex(run->mutex);
+	while (run->completed < run->count) {
+		glfwWaitCond(run->done, run->mutex, GLFW_INFINITY);
+	}
+	glfwUnlockMutex(run->mutex);
+	releaseRun(run);
+}